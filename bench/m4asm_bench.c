@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "lib/getopt/getopt.h"
+#include "label.h"
+#include "stats.h"
+#include "m4asm.h"
+#include "insns.h"
+
+// Microbenchmarks for the hot assembler functions. Each benchmark is run
+// with a doubling iteration count until it takes at least -t seconds, then
+// reported as ns/op and allocations/op.
+
+typedef void (*bench_fn)(void* arg, long iters);
+
+static double min_time = 0.2;
+static char* filter = NULL;
+static volatile unsigned long sink;
+
+static void run(const char* name, bench_fn fn, void* arg) {
+    if (filter != NULL && strstr(name, filter) == NULL) return;
+
+    long iters = 1;
+    double t;
+    unsigned long allocs;
+    for (;;) {
+        unsigned long m0 = st_ctx.mallocs;
+        double t0 = st_wall_time();
+        fn(arg, iters);
+        t = st_wall_time() - t0;
+        allocs = st_ctx.mallocs - m0;
+        if (t >= min_time || iters >= (1L << 40)) break;
+        iters *= t > 0 ? (t * 10 < min_time ? 10 : 2) : 10;
+    }
+
+    printf("%-40s %12ld %14.1f %12.2f\n", name, iters, t * 1e9 / iters, (double)allocs / iters);
+}
+
+// collapse_spaces
+
+static void b_collapse_spaces(void* arg, long iters) {
+    for (long i=0;i<iters;i++) {
+        char* r = collapse_spaces((char*)arg);
+        sink += r[0];
+        free(r);
+    }
+}
+
+// getintval
+
+static void b_getintval(void* arg, long iters) {
+    for (long i=0;i<iters;i++) {
+        sink += getintval((char*)arg).value;
+    }
+}
+
+// parse_param
+
+static struct le_context bench_lctx;
+
+static void b_parse_param(void* arg, long iters) {
+    for (long i=0;i<iters;i++) {
+        sink += parse_param((char*)arg, &bench_lctx).value;
+    }
+}
+
+// handle_special_cases
+
+static void b_special(void* arg, long iters) {
+    for (long i=0;i<iters;i++) {
+        sink += handle_special_cases((char*)arg).length;
+    }
+}
+
+// instruction selection
+
+struct sel_arg {
+    char* mnemonic;
+    char* ptypes;
+};
+
+static void b_find_insn(void* arg, long iters) {
+    struct sel_arg *a = (struct sel_arg*)arg;
+    for (long i=0;i<iters;i++) {
+        sink += find_insn(a->mnemonic, a->ptypes);
+    }
+}
+
+// assemble_insn
+
+static void b_assemble(void* arg, long iters) {
+    int opcode = *(int*)arg;
+    for (long i=0;i<iters;i++) {
+        sink += assemble_insn(opcode, 3, 0x1234, 0, 0).length;
+    }
+}
+
+// le_get_label_addr
+
+struct label_arg {
+    struct le_context ctx;
+    char name[33];
+};
+
+static void b_label(void* arg, long iters) {
+    struct label_arg *a = (struct label_arg*)arg;
+    for (long i=0;i<iters;i++) {
+        sink += le_get_label_addr(a->name, &a->ctx);
+    }
+}
+
+static void label_setup(struct label_arg *a, int n) {
+    a->ctx = le_init_context();
+    a->ctx.nlabels = n;
+    le_allocate_labels(&a->ctx);
+    for (int i=0;i<n;i++) {
+        snprintf(a->ctx.labels[i].name, 33, "label_%d", i);
+        a->ctx.labels[i].address = i * 2;
+    }
+    a->ctx.idx = n;
+    // Average case for a linear table: a label in the middle.
+    snprintf(a->name, 33, "label_%d", n / 2);
+}
+
+void usage(char** argv) {
+    fprintf(stderr, "Usage: %s [-t min_seconds] [-f filter]\n", argv[0]);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:f:")) != -1) {
+        switch (opt) {
+        case 't':
+            min_time = atof(optarg);
+            break;
+        case 'f':
+            filter = strdup(optarg);
+            break;
+        default:
+            usage(argv);
+        }
+    }
+
+    st_init(1);
+    printf("%-40s %12s %14s %12s\n", "benchmark", "iterations", "ns/op", "allocs/op");
+
+    run("collapse_spaces/short", b_collapse_spaces, "mov r1, r2");
+    run("collapse_spaces/runs", b_collapse_spaces, "mov    r1,      r2     ; trailing     comment");
+    char* longrun = (char*)malloc(1026);
+    memset(longrun, ' ', 1024);
+    longrun[0] = 'x';
+    longrun[1024] = 'y';
+    longrun[1025] = 0;
+    run("collapse_spaces/run1024", b_collapse_spaces, longrun);
+
+    run("getintval/dec", b_getintval, "12345");
+    run("getintval/hex", b_getintval, "0xDEADBEEF");
+    run("getintval/bin", b_getintval, "0b1011001110001111");
+
+    bench_lctx = le_init_context();
+    bench_lctx.nlabels = 1;
+    le_allocate_labels(&bench_lctx);
+    strcpy(bench_lctx.labels[0].name, "target");
+    bench_lctx.labels[0].address = 0x1234;
+    bench_lctx.idx = 1;
+
+    run("parse_param/register", b_parse_param, "r12,");
+    run("parse_param/word", b_parse_param, "0x1234");
+    run("parse_param/dword", b_parse_param, "d0x12345678");
+    run("parse_param/near", b_parse_param, "(0x100)");
+    run("parse_param/far", b_parse_param, "[0x12345]");
+    run("parse_param/regpair", b_parse_param, "[r2:r3]");
+    run("parse_param/char", b_parse_param, "'a'");
+    run("parse_param/label", b_parse_param, "target");
+    run("parse_param/label_near", b_parse_param, "@target");
+
+    run("handle_special_cases/ds", b_special, "ds \"Hello World\"");
+    run("handle_special_cases/miss", b_special, "mov r1, r2");
+
+    struct sel_arg sel_first = {"nop", ""};
+    struct sel_arg sel_mid = {"push", "R"};
+    struct sel_arg sel_last = {"ds", "s"};
+    struct sel_arg sel_miss = {"bogus", "RR"};
+    run("find_insn/first", b_find_insn, &sel_first);
+    run("find_insn/middle", b_find_insn, &sel_mid);
+    run("find_insn/last", b_find_insn, &sel_last);
+    run("find_insn/miss", b_find_insn, &sel_miss);
+
+    for (int c=0;insns[c].mnemonic != NULL;c++) {
+        if (insns[c].opcode == OPC_DS) continue; // emitted by handle_special_cases
+        char name[64];
+        int opcode = insns[c].opcode;
+        snprintf(name, 64, "assemble_insn/%s_0x%02X", insns[c].mnemonic, opcode);
+        run(name, b_assemble, &opcode);
+    }
+
+    int sizes[] = {1000, 100000, 1000000};
+    for (int i=0;i<3;i++) {
+        struct label_arg la;
+        char name[64];
+        label_setup(&la, sizes[i]);
+        snprintf(name, 64, "le_get_label_addr/%d", sizes[i]);
+        run(name, b_label, &la);
+        le_free_labels(&la.ctx);
+    }
+
+    free(longrun);
+    le_free_labels(&bench_lctx);
+    if (filter != NULL) free(filter);
+    return 0;
+}
@@ -0,0 +1,116 @@
+#!/bin/sh
+# End-to-end benchmark runner and regression gate.
+#
+# Generates synthetic corpora with m4asm_gen, assembles each one with
+# m4asm --stats=json and records throughput and peak RSS per corpus/size.
+# Exits non-zero when:
+#   - a result is more than THRESHOLD times worse than the baseline (-b), or
+#   - a pathological corpus (long space runs, very long lines) assembles more
+#     than PATHO times slower per line than the plain corpus of the same size.
+# A baseline given with -b that does not exist is an error too, reported
+# with exit status 77 so CTest shows the gate as not run rather than passed.
+
+usage() {
+    echo "Usage: $0 -a m4asm -g m4asm_gen [-s \"sizes\"] [-b baseline] [-r record] [-t threshold] [-p patho_ratio] [-k workdir]" >&2
+    exit 1
+}
+
+M4ASM=
+M4GEN=
+SIZES="1000 10000 100000"
+BASELINE=
+RECORD=
+THRESHOLD=1.25
+PATHO=3
+WORKDIR=
+
+while getopts "a:g:s:b:r:t:p:k:" opt; do
+    case $opt in
+    a) M4ASM=$OPTARG ;;
+    g) M4GEN=$OPTARG ;;
+    s) SIZES=$OPTARG ;;
+    b) BASELINE=$OPTARG ;;
+    r) RECORD=$OPTARG ;;
+    t) THRESHOLD=$OPTARG ;;
+    p) PATHO=$OPTARG ;;
+    k) WORKDIR=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+
+[ -n "$M4ASM" ] && [ -n "$M4GEN" ] || usage
+
+if [ -n "$BASELINE" ] && [ ! -f "$BASELINE" ]; then
+    echo "FAIL: no baseline at $BASELINE; record one with the bench_e2e target (or -r) first" >&2
+    exit 77
+fi
+
+if [ -z "$WORKDIR" ]; then
+    WORKDIR=$(mktemp -d)
+    trap 'rm -rf "$WORKDIR"' EXIT
+fi
+mkdir -p "$WORKDIR"
+
+# name:generator options
+CORPORA="mixed:-w_4 spaces:-w_512 longlines:-w_4_-L_16000"
+
+json_field() {
+    sed -n "s/.*\"$1\":\([0-9.]*\).*/\1/p" "$2"
+}
+
+RESULTS="$WORKDIR/results.txt"
+: > "$RESULTS"
+FAIL=0
+
+printf "%-10s %10s %14s %14s %12s\n" corpus lines "lines/s" "insns/s" "rss (KiB)"
+for size in $SIZES; do
+    for c in $CORPORA; do
+        name=${c%%:*}
+        opts=$(echo "${c#*:}" | tr '_' ' ')
+        src="$WORKDIR/$name-$size.asm"
+        "$M4GEN" -n "$size" $opts -o "$src" || exit 1
+        if ! "$M4ASM" -i "$src" -o "$WORKDIR/out.bin" --stats="json:$WORKDIR/stats.json" > /dev/null; then
+            echo "FAIL: m4asm failed on $name/$size" >&2
+            exit 1
+        fi
+        lps=$(json_field lines_per_sec "$WORKDIR/stats.json")
+        ips=$(json_field insns_per_sec "$WORKDIR/stats.json")
+        rss=$(json_field peak_rss_kb "$WORKDIR/stats.json")
+        printf "%-10s %10s %14s %14s %12s\n" "$name" "$size" "$lps" "$ips" "$rss"
+        echo "$name $size $lps $rss" >> "$RESULTS"
+    done
+done
+
+# Pathological inputs must scale like the plain corpus.
+for size in $SIZES; do
+    base=$(awk -v s="$size" '$1=="mixed" && $2==s {print $3}' "$RESULTS")
+    for name in spaces longlines; do
+        lps=$(awk -v n="$name" -v s="$size" '$1==n && $2==s {print $3}' "$RESULTS")
+        if awk -v b="$base" -v l="$lps" -v p="$PATHO" 'BEGIN {exit !(l * p < b)}'; then
+            echo "FAIL: $name/$size runs at $lps lines/s, more than ${PATHO}x slower than mixed ($base lines/s)" >&2
+            FAIL=1
+        fi
+    done
+done
+
+if [ -n "$BASELINE" ]; then
+    while read -r name size blps brss; do
+        lps=$(awk -v n="$name" -v s="$size" '$1==n && $2==s {print $3}' "$RESULTS")
+        rss=$(awk -v n="$name" -v s="$size" '$1==n && $2==s {print $4}' "$RESULTS")
+        [ -n "$lps" ] || continue
+        if awk -v b="$blps" -v l="$lps" -v t="$THRESHOLD" 'BEGIN {exit !(l * t < b)}'; then
+            echo "FAIL: $name/$size throughput $lps lines/s regressed from $blps" >&2
+            FAIL=1
+        fi
+        if awk -v b="$brss" -v r="$rss" -v t="$THRESHOLD" 'BEGIN {exit !(r > b * t)}'; then
+            echo "FAIL: $name/$size peak RSS $rss KiB regressed from $brss" >&2
+            FAIL=1
+        fi
+    done < "$BASELINE"
+fi
+
+if [ -n "$RECORD" ]; then
+    cp "$RESULTS" "$RECORD"
+fi
+
+exit $FAIL
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "lib/getopt/getopt.h"
+#include "m4asm.h"
+#include "insns.h"
+
+// Deterministic generator for synthetic M4 sources. The same options and
+// seed always produce the same file, so corpora never need to be checked in.
+
+static unsigned long long rng_state;
+
+static unsigned long rng() {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (unsigned long)((rng_state * 2685821657736338717ULL) >> 32);
+}
+
+static int nlabels = 0;
+static int maxspaces = 1;
+
+static void put_spaces(FILE* fp) {
+    int n = maxspaces > 1 ? 1 + rng() % maxspaces : 1;
+    for (int i=0;i<n;i++) fputc(' ', fp);
+}
+
+static void put_label(FILE* fp, const char* fmt) {
+    char name[24];
+    snprintf(name, sizeof(name), "L%lu", rng() % nlabels);
+    fprintf(fp, fmt, name);
+}
+
+static void put_param(FILE* fp, char ptype, const char* mnemonic, int idx) {
+    int branch = idx == 0 && (strcmp(mnemonic, "jmp") == 0 || strcmp(mnemonic, "call") == 0
+              || strcmp(mnemonic, "brchf") == 0 || strcmp(mnemonic, "brchi") == 0);
+    int r;
+
+    switch (ptype) {
+    case PTYPE_REGISTER:
+        fprintf(fp, "r%lu", rng() % 16);
+        break;
+    case PTYPE_WORD_IMM:
+        if (strcmp(mnemonic, "shl") == 0 || strcmp(mnemonic, "shr") == 0
+         || strcmp(mnemonic, "rol") == 0 || strcmp(mnemonic, "ror") == 0) {
+            fprintf(fp, "%lu", rng() % 16);
+        } else if (branch && nlabels > 0) {
+            put_label(fp, "@%s");
+        } else if ((r = rng() % 4) == 0) {
+            fprintf(fp, "'%c'", (int)('a' + rng() % 26));
+        } else if (r == 1) {
+            fprintf(fp, "%lu", rng() % 1000);
+        } else {
+            fprintf(fp, "0x%lX", rng() % 0x10000);
+        }
+        break;
+    case PTYPE_DWORD_IMM:
+        if (branch && nlabels > 0) {
+            put_label(fp, "%s");
+        } else {
+            fprintf(fp, "d0x%lX", 0x10000 + rng() % 0x100000);
+        }
+        break;
+    case PTYPE_NEAR_PTR:
+        if (nlabels > 0 && rng() % 2) {
+            put_label(fp, "(%s)");
+        } else {
+            fprintf(fp, "(0x%lX)", rng() % 0x10000);
+        }
+        break;
+    case PTYPE_FAR_PTR:
+        if (nlabels > 0 && rng() % 2) {
+            put_label(fp, "[%s]");
+        } else {
+            fprintf(fp, "[0x%lX]", 0x10000 + rng() % 0x100000);
+        }
+        break;
+    case PTYPE_REGPAIR_PTR:
+        r = rng() % 15;
+        fprintf(fp, "[r%d:r%d]", r, r+1);
+        break;
+    case PTYPE_RELATIVE_POS:
+        fprintf(fp, "+%lu", 2 + rng() % 64);
+        break;
+    case PTYPE_RELATIVE_NEG:
+        fprintf(fp, "-%lu", rng() % 64);
+        break;
+    }
+}
+
+static void put_ds(FILE* fp) {
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!$%^&*()";
+    int len = 1 + rng() % 48;
+    fputs("ds", fp);
+    put_spaces(fp);
+    fputc('"', fp);
+    char prev = 0;
+    for (int i=0;i<len;i++) {
+        // A space run inside a string would be collapsed, so never emit two.
+        char c = (rng() % 6 == 0 && prev != ' ' && i != 0 && i != len-1) ? ' ' : chars[rng() % (sizeof(chars) - 1)];
+        fputc(c, fp);
+        prev = c;
+    }
+    fputs("\"\n", fp);
+}
+
+static void put_insn(FILE* fp, struct insn_def_t *d) {
+    if (d->opcode == OPC_DS) {
+        put_ds(fp);
+        return;
+    }
+    fputs(d->mnemonic, fp);
+    for (int i=0;d->params[i];i++) {
+        if (i > 0) fputc(',', fp);
+        put_spaces(fp);
+        put_param(fp, d->params[i], d->mnemonic, i);
+    }
+    fputc('\n', fp);
+}
+
+void usage(char** argv) {
+    fprintf(stderr, "Usage: %s [-n lines] [-d labels_per_1000] [-w max_space_run] [-L long_line_len] [-s seed] [-o file]\n", argv[0]);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+    long lines = 10000;
+    int density = 20;
+    int longlen = 0;
+    unsigned long long seed = 1;
+    char* outfile = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:d:w:L:s:o:")) != -1) {
+        switch (opt) {
+        case 'n':
+            lines = atol(optarg);
+            break;
+        case 'd':
+            density = atoi(optarg);
+            break;
+        case 'w':
+            maxspaces = atoi(optarg);
+            break;
+        case 'L':
+            longlen = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+            outfile = strdup(optarg);
+            break;
+        default:
+            usage(argv);
+        }
+    }
+
+    if (lines <= 0 || density < 0 || density > 1000 || maxspaces < 1 || longlen < 0 || longlen > 32000) {
+        usage(argv);
+    }
+
+    FILE* fp = stdout;
+    if (outfile != NULL) {
+        fp = fopen(outfile, "w");
+        if (fp == NULL) {
+            perror("fopen()");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    nlabels = (int)(lines * density / 1000);
+
+    // Weight register-only forms up; they dominate real code.
+    int ndefs = 0;
+    while (insns[ndefs].mnemonic != NULL) ndefs++;
+    int* weights = (int*)malloc(sizeof(int) * ndefs);
+    int total = 0;
+    for (int i=0;i<ndefs;i++) {
+        int regonly = strspn(insns[i].params, "R") == strlen(insns[i].params);
+        weights[i] = regonly ? 8 : 2;
+        total += weights[i];
+    }
+
+    char* longline = NULL;
+    if (longlen > 0) {
+        longline = (char*)malloc(longlen + 1);
+        for (int i=0;i<longlen;i++) longline[i] = (i % 8 == 0) ? ' ' : 'a' + (i % 26);
+        longline[0] = ';';
+        longline[longlen] = 0;
+    }
+
+    int nextlabel = 0;
+    long labelspacing = nlabels > 0 ? lines / nlabels : 0;
+    uint32_t org = 0;
+    for (long l=0;l<lines;l++) {
+        if (nextlabel < nlabels && l == nextlabel * labelspacing) {
+            fprintf(fp, "L%d:\n", nextlabel++);
+            continue;
+        }
+        if (l % 4096 == 4095) {
+            org += 0x20000;
+            fprintf(fp, "$org 0x%X\n", org);
+            continue;
+        }
+        if (longline != NULL && l % 256 == 255) {
+            fprintf(fp, "%s\n", longline);
+            continue;
+        }
+
+        int w = rng() % total;
+        int i = 0;
+        while (w >= weights[i]) w -= weights[i++];
+        put_insn(fp, &insns[i]);
+    }
+
+    if (fp != stdout) fclose(fp);
+    free(weights);
+    if (longline != NULL) free(longline);
+    if (outfile != NULL) free(outfile);
+    return 0;
+}
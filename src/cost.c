@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m4asm.h"
+#include "cost.h"
+#include "insns.h"
+#include "lib/strsep/strsep.h"
+
+#define COST_MAXDEFS 256
+
+static int cost_ready = 0;
+static int cost_model = COST_CYCLES;
+static int cost_ndefs = 0;
+static int cost_cyc[COST_MAXDEFS];
+static int cost_len[COST_MAXDEFS];
+
+// Cycles come from insns[]. Lengths come from the encoder, which is what
+// actually ends up in the image (insns[] disagrees for pop (n) and popad).
+static void cost_defaults() {
+    cost_ndefs = 0;
+    for (int c=0;insns[c].mnemonic != NULL && c < COST_MAXDEFS;c++) {
+        cost_cyc[c] = insns[c].cycles;
+        cost_len[c] = insns[c].opcode == OPC_DS ? insns[c].length : assemble_insn(insns[c].opcode, 0, 0, 0, 0).length;
+        cost_ndefs++;
+    }
+    cost_ready = 1;
+}
+
+int cost_init(int mode) {
+    cost_defaults();
+    cost_model = mode;
+    return 0;
+}
+
+int cost_mode() {
+    return cost_model;
+}
+
+int cost_parse_mode(const char* name) {
+    if (strcmp(name, "cycles") == 0) return COST_CYCLES;
+    if (strcmp(name, "size") == 0) return COST_SIZE;
+    if (strcmp(name, "balanced") == 0) return COST_BALANCED;
+    return -1;
+}
+
+// Profile format, one entry per line:
+//   <opcode> <cycles> [<length>]
+// e.g. "0x31 7" or "0x3C 4 2". Blank lines and lines starting with ';' or
+// '#' are ignored. Entries replace the built-in cycles for that opcode; a
+// length, if given, has to match the encoder's.
+int cost_load_profile(const char* path) {
+    if (!cost_ready) cost_defaults();
+
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror("Opening cost profile");
+        return 1;
+    }
+
+    char buf[256];
+    int lineno = 0;
+    while (fgets(buf, sizeof(buf), fp)) {
+        lineno++;
+        buf[strcspn(buf, "\r\n")] = 0;
+        char* line = collapse_spaces(buf);
+        char* s = line;
+        while (*s == ' ') s++;
+        if (*s == 0 || *s == ';' || *s == '#') {
+            free(line);
+            continue;
+        }
+
+        char* f[3] = {NULL, NULL, NULL};
+        int nf = 0;
+        char* tok;
+        while ((tok = strsep(&s, " ")) != NULL) {
+            if (!*tok) continue;
+            if (nf < 3) f[nf] = tok;
+            nf++;
+        }
+
+        struct parsed_int_t op = nf >= 2 ? getintval(f[0]) : (struct parsed_int_t){1, 0, 0};
+        struct parsed_int_t cy = nf >= 2 ? getintval(f[1]) : (struct parsed_int_t){1, 0, 0};
+        struct parsed_int_t ln = nf == 3 ? getintval(f[2]) : (struct parsed_int_t){0, 0, 0};
+        if (nf > 3 || op.code != 0 || cy.code != 0 || ln.code != 0) {
+            fprintf(stderr, "Error: %s:%d: expected '<opcode> <cycles> [<length>]'\n", path, lineno);
+            free(line);
+            fclose(fp);
+            return 1;
+        }
+
+        // The length is what the encoder emits; it is accepted only as a
+        // check, since layout cannot make the image match anything else.
+        int found = 0;
+        for (int c=0;c<cost_ndefs;c++) {
+            if (insns[c].opcode != op.value) continue;
+            if (nf == 3 && ln.value != (unsigned long)cost_len[c]) {
+                fprintf(stderr, "Error: %s:%d: opcode 0x%02lX encodes to %d words, not %lu\n", path, lineno, op.value, cost_len[c], ln.value);
+                free(line);
+                fclose(fp);
+                return 1;
+            }
+            cost_cyc[c] = (int)cy.value;
+            found = 1;
+        }
+        if (!found) {
+            fprintf(stderr, "Error: %s:%d: unknown opcode 0x%02lX\n", path, lineno, op.value);
+            free(line);
+            fclose(fp);
+            return 1;
+        }
+        free(line);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+int cost_cycles(int def) {
+    if (!cost_ready) cost_defaults();
+    return cost_cyc[def];
+}
+
+int cost_length(int def) {
+    if (!cost_ready) cost_defaults();
+    return cost_len[def];
+}
+
+// Scalar cost, lower is better. The secondary criterion is folded in with
+// a large weight on the primary one so values can be summed over sequences.
+long cost_value(int cycles, int words) {
+    switch (cost_model) {
+    case COST_SIZE:
+        return (long)words * 65536 + cycles;
+    case COST_BALANCED:
+        return ((long)cycles + words) * 65536 + cycles;
+    default:
+        return (long)cycles * 65536 + words;
+    }
+}
+
+long cost_insn(int def) {
+    return cost_value(cost_cycles(def), cost_length(def));
+}
+
+// Orders two insns[] variants, falling back to table order on a tie.
+int cost_less(int a, int b) {
+    long ca = cost_insn(a);
+    long cb = cost_insn(b);
+    if (ca != cb) return ca < cb;
+    return a < b;
+}
@@ -0,0 +1,22 @@
+#ifndef COST_H
+#define COST_H
+
+// Instruction cost model. Every selection and optimization decision goes
+// through cost_value()/cost_less() so that switching the model (or loading
+// a profile for another CPU revision) changes them all consistently.
+
+#define COST_CYCLES 0     // fewest cycles, then fewest words
+#define COST_SIZE 1       // fewest words, then fewest cycles
+#define COST_BALANCED 2   // cycles + words, then fewest cycles
+
+int cost_init(int mode);
+int cost_mode();
+int cost_parse_mode(const char* name);
+int cost_load_profile(const char* path);
+int cost_cycles(int def);
+int cost_length(int def);
+long cost_value(int cycles, int words);
+long cost_insn(int def);
+int cost_less(int a, int b);
+
+#endif
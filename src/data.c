@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "m4asm.h"
+#include "label.h"
+#include "stmt.h"
+#include "cost.h"
+#include "pgo.h"
+#include "data.h"
+
+// Near-window data placement. A data block is a run of labels, $align and
+// dw/ds statements that follows a jmp, a ret or another block, so nothing
+// falls into it. Blocks in the first $org segment are moved, one at a time
+// and best first, to just after the entry code's first jmp or ret, and a
+// move is kept only if the program gets cheaper under the cost model once
+// the relaxation has picked (near) and word-immediate forms for the
+// references.
+// Data placed with $org or behind a $fill is left where it is.
+
+struct data_block {
+    int start;          // statement range in the original order
+    int end;            // exclusive, just after the last data statement
+    int words;
+    unsigned long refs; // references that can relax, weighted by count
+    int moved;
+};
+
+struct data_label {
+    char name[33];
+    int block;
+};
+
+static int data_label_cmp(const void* a, const void* b) {
+    return strcmp(((const struct data_label*)a)->name, ((const struct data_label*)b)->name);
+}
+
+static int data_is(struct stmt_t *st, const char* mnemonic) {
+    char m[16];
+    if (st->kind != STMT_INSN || st->special) return 0;
+    stmt_mnemonic(st, m);
+    return strcmp(m, mnemonic) == 0;
+}
+
+static int data_stmt(struct stmt_t *st) {
+    return st->kind == STMT_INSN && (st->special || data_is(st, "dw"));
+}
+
+// Lays out v in the given order and returns its cost: cycles weighted by
+// the statement counts, plus static words.
+static long data_cost(struct stmt_list *sl, struct le_context *lctx, struct stmt_t *orig, int *order, unsigned long *w) {
+    for (int k=0;k<sl->n;k++) {
+        sl->v[k] = orig[order[k]];
+        sl->v[k].rank = 0;
+    }
+    stmt_layout(sl, lctx);
+
+    long cycles = 0, words = 0;
+    for (int k=0;k<sl->n;k++) {
+        struct stmt_t *st = &sl->v[k];
+        if (st->kind != STMT_INSN) continue;
+        words += st->length;
+        if (!st->special && !data_stmt(st)) cycles += (long)w[order[k]] * cost_cycles(st->cand[st->rank]);
+    }
+    if (cycles > INT_MAX) cycles = INT_MAX;
+    if (words > INT_MAX) words = INT_MAX;
+    return cost_value((int)cycles, (int)words);
+}
+
+// Builds order[]: everything up to ins, the moved blocks in the order
+// given by rank[], then the rest without the moved blocks.
+static void data_order(struct data_block *blocks, int *rank, int nrank, int ins, int n, int *order) {
+    int k = 0;
+    for (int i=0;i<ins;i++) order[k++] = i;
+    for (int r=0;r<nrank;r++) {
+        struct data_block *b = &blocks[rank[r]];
+        if (!b->moved) continue;
+        for (int i=b->start;i<b->end;i++) order[k++] = i;
+    }
+    int b = 0;
+    for (int i=ins;i<n;i++) {
+        while (b < nrank && blocks[b].end <= i) b++;
+        if (b < nrank && blocks[b].moved && i >= blocks[b].start) continue;
+        order[k++] = i;
+    }
+}
+
+static struct data_block *data_sort_base;
+
+static int data_score_cmp(const void* a, const void* b) {
+    struct data_block *x = &data_sort_base[*(const int*)a];
+    struct data_block *y = &data_sort_base[*(const int*)b];
+    // refs per word, highest first
+    unsigned long long l = (unsigned long long)x->refs * y->words;
+    unsigned long long r = (unsigned long long)y->refs * x->words;
+    if (l != r) return l < r ? 1 : -1;
+    return *(const int*)a - *(const int*)b;
+}
+
+int opt_place_data(struct stmt_list *sl, struct le_context *lctx, const char* profile, FILE* log) {
+    stmt_compact(sl);
+    if (!sl->relax || sl->n == 0) return 0;
+    // Moving data shifts the code after the entry point.
+    if (!stmt_branches_all_labels(sl)) {
+        if (log != NULL) fprintf(log, "place-data: skipped, program branches to non-label addresses\n");
+        return 0;
+    }
+
+    // The first segment ends at the first $org; data is moved in front of
+    // the code that follows the entry point's first jmp or ret.
+    int segend = 0;
+    while (segend < sl->n && sl->v[segend].kind != STMT_ORG && sl->v[segend].kind != STMT_FILL) segend++;
+    int ins = -1;
+    for (int i=0;i<segend && ins < 0;i++) {
+        if (data_is(&sl->v[i], "jmp") || data_is(&sl->v[i], "ret")) ins = i + 1;
+    }
+    if (ins < 0) return 0;
+
+    struct data_block *blocks = (struct data_block*)calloc(sl->n + 1, sizeof(struct data_block));
+    int nblocks = 0;
+    int closed = 1;
+    for (int i=ins;i<segend;) {
+        struct stmt_t *st = &sl->v[i];
+        if ((st->kind == STMT_LABEL || st->kind == STMT_ALIGN) && closed) {
+            int last = -1;
+            int j = i;
+            for (;j<segend && (sl->v[j].kind == STMT_LABEL || sl->v[j].kind == STMT_ALIGN || data_stmt(&sl->v[j]));j++) {
+                if (data_stmt(&sl->v[j])) last = j;
+            }
+            if (last >= 0) {
+                struct data_block *b = &blocks[nblocks++];
+                b->start = i;
+                b->end = last + 1;
+                i = last + 1;
+                continue;
+            }
+            i = j;
+            continue;
+        }
+        if (st->kind == STMT_INSN) closed = data_stmt(st) || data_is(st, "jmp") || data_is(st, "ret");
+        i++;
+    }
+    if (nblocks == 0) {
+        free(blocks);
+        return 0;
+    }
+
+    // Label -> block, then count the relaxable references to each block.
+    struct data_label *labels = (struct data_label*)malloc(sizeof(struct data_label) * (sl->n + 1));
+    int nlabels = 0;
+    for (int b=0;b<nblocks;b++) {
+        for (int i=blocks[b].start;i<blocks[b].end;i++) {
+            if (sl->v[i].kind != STMT_LABEL) continue;
+            strncpy(labels[nlabels].name, sl->v[i].text, 32);
+            labels[nlabels].name[32] = 0;
+            labels[nlabels].name[strlen(labels[nlabels].name)-1] = 0;
+            labels[nlabels++].block = b;
+        }
+    }
+    qsort(labels, nlabels, sizeof(struct data_label), data_label_cmp);
+
+    unsigned long *w = profile != NULL ? pgo_stmt_counts(sl, profile) : NULL;
+    if (w == NULL) {
+        w = (unsigned long*)malloc(sizeof(unsigned long) * (sl->n + 1));
+        for (int i=0;i<sl->n;i++) w[i] = 1;
+    }
+    for (int i=0;i<sl->n;i++) {
+        struct stmt_t *st = &sl->v[i];
+        if (st->kind != STMT_INSN || st->symidx < 0 || st->ncand < 2) continue;
+        struct data_label key;
+        strcpy(key.name, st->sym);
+        struct data_label *l = (struct data_label*)bsearch(&key, labels, nlabels, sizeof(struct data_label), data_label_cmp);
+        if (l != NULL) blocks[l->block].refs += w[i];
+    }
+
+    struct stmt_t *orig = (struct stmt_t*)malloc(sizeof(struct stmt_t) * (sl->n + 1));
+    memcpy(orig, sl->v, sizeof(struct stmt_t) * sl->n);
+    int *order = (int*)malloc(sizeof(int) * (sl->n + 1));
+    int *rank = (int*)malloc(sizeof(int) * (nblocks + 1));
+    for (int b=0;b<nblocks;b++) rank[b] = b;
+
+    data_order(blocks, rank, nblocks, ins, sl->n, order);
+    long best = data_cost(sl, lctx, orig, order, w);
+
+    // Nothing to gain if every referenced block is already near.
+    int far = 0;
+    for (int b=0;b<nblocks;b++) {
+        struct data_block *bl = &blocks[b];
+        for (int i=bl->start;i<bl->end;i++) {
+            if (sl->v[i].kind == STMT_INSN) bl->words += sl->v[i].length;
+        }
+        if (bl->refs > 0 && sl->v[bl->end-1].addr + sl->v[bl->end-1].length*2 > 0x10000) far = 1;
+    }
+
+    int moved = 0;
+    if (far) {
+        data_sort_base = blocks;
+        qsort(rank, nblocks, sizeof(int), data_score_cmp);
+        for (int r=0;r<nblocks;r++) {
+            struct data_block *bl = &blocks[rank[r]];
+            if (bl->refs == 0) break;
+            bl->moved = 1;
+            data_order(blocks, rank, nblocks, ins, sl->n, order);
+            long c = data_cost(sl, lctx, orig, order, w);
+            if (c < best) {
+                best = c;
+                moved++;
+                if (log != NULL) fprintf(log, "line %d: place-data: %.*s (%lu refs, %d words) moved near\n", orig[bl->start].lineno, (int)strlen(orig[bl->start].text) - 1, orig[bl->start].text, bl->refs, bl->words);
+            } else {
+                bl->moved = 0;
+            }
+        }
+    }
+
+    data_order(blocks, rank, nblocks, ins, sl->n, order);
+    data_cost(sl, lctx, orig, order, w);
+
+    free(orig);
+    free(order);
+    free(rank);
+    free(labels);
+    free(blocks);
+    free(w);
+    return moved;
+}
@@ -0,0 +1,14 @@
+#ifndef DATA_H
+#define DATA_H
+
+#include <stdio.h>
+#include "label.h"
+#include "stmt.h"
+
+// Moves labelled dw/ds blocks into the near window (below 0x10000), most
+// referenced per word first, so their references can take the (near) and
+// word-immediate forms. Counts from profile weight the references when it
+// is not NULL. Returns the number of blocks moved.
+int opt_place_data(struct stmt_list *sl, struct le_context *lctx, const char* profile, FILE* log);
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "m4asm.h"
+#include "label.h"
+#include "source.h"
+#include "stmt.h"
+#include "opt.h"
+#include "inline.h"
+#include "live.h"
+#include "data.h"
+#include "image.h"
+
+static void img_push(struct img *img, uint16_t w) {
+    if (img->n == img->cap) {
+        img->cap = img->cap ? img->cap * 2 : 256;
+        img->words = (uint16_t*)realloc(img->words, sizeof(uint16_t) * img->cap);
+        if (img->words == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    img->words[img->n++] = w;
+}
+
+int img_assemble(FILE* fp, int relax, struct img *out) {
+    struct img_opts opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.relax = relax;
+    return img_assemble_opts(fp, &opts, out);
+}
+
+int img_assemble_opts(FILE* fp, const struct img_opts *opts, struct img *out) {
+    memset(out, 0, sizeof(*out));
+    struct src_context sctx = src_init_context();
+    if (src_read(fp, &sctx) != 0) return -1;
+
+    struct le_context lctx = le_init_context();
+    struct stmt_list sl = stmt_init_list(opts->relax);
+    stmt_build(&sctx, &sl, &lctx);
+    if (opts->inlinelimit) opt_inline(&sl, &lctx, opts->inlinelimit, NULL);
+    if (opts->optimize) {
+        int saves;
+        opt_peephole(&sl, &lctx, NULL);
+        opt_liveness(&sl, &lctx, &saves, NULL);
+    }
+    if (opts->placedata) opt_place_data(&sl, &lctx, NULL, NULL);
+    stmt_layout(&sl, &lctx);
+    lctx.stage = 1;
+
+    for (int i=0;i<sl.n;i++) {
+        struct stmt_t *st = &sl.v[i];
+        if (st->kind == STMT_ALIGN || st->kind == STMT_FILL) {
+            for (int k=0;k<st->length;k++) img_push(out, st->fill);
+            continue;
+        }
+        if (st->kind != STMT_INSN) continue;
+        uint16_t w[STMT_MAXWORDS];
+        int n = stmt_encode(st, &lctx, w);
+        for (int k=0;k<n;k++) img_push(out, w[k]);
+    }
+
+    src_free(&sctx);
+    stmt_free(&sl);
+    le_free_labels(&lctx);
+    return 0;
+}
+
+#define IMG_LOGISIM_HDR "v3.0 hex words addressed"
+
+int img_load(const char* path, struct img *out) {
+    memset(out, 0, sizeof(*out));
+    FILE* fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (fp == NULL) return -1;
+    size_t n = 0, cap = 65536;
+    unsigned char* buf = (unsigned char*)malloc(cap + 1);
+    for (;;) {
+        n += fread(buf + n, 1, cap - n, fp);
+        if (n < cap) break;
+        cap *= 2;
+        buf = (unsigned char*)realloc(buf, cap + 1);
+    }
+    if (fp != stdin) fclose(fp);
+    buf[n] = 0;
+
+    if (n >= strlen(IMG_LOGISIM_HDR) && strncmp((char*)buf, IMG_LOGISIM_HDR, strlen(IMG_LOGISIM_HDR)) == 0) {
+        // "AAAAAAAA: wwww wwww ..." lines, AAAAAAAA a word address.
+        char* line = strchr((char*)buf, '\n');
+        while (line != NULL) {
+            line++;
+            char* end;
+            unsigned long a = strtoul(line, &end, 16);
+            if (isxdigit((unsigned char)*line) && *end == ':') {
+                char* p = end + 1;
+                for (;;) {
+                    while (*p == ' ' || *p == '\t') p++;
+                    if (!isxdigit((unsigned char)*p)) break;
+                    unsigned long v = strtoul(p, &end, 16);
+                    while (out->n < (long)a) img_push(out, 0);
+                    if ((long)a < out->n) out->words[a] = v;
+                    else img_push(out, v);
+                    a++;
+                    p = end;
+                }
+            }
+            line = strchr(line, '\n');
+        }
+    } else {
+        out->cap = (n + 1) / 2;
+        out->words = (uint16_t*)malloc(sizeof(uint16_t) * (out->cap ? out->cap : 1));
+        if (out->words == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i=0;i<n;i+=2) out->words[i/2] = buf[i] << 8 | buf[i+1];
+        out->n = out->cap;
+    }
+    free(buf);
+    return 0;
+}
+
+void img_free(struct img *img) {
+    free(img->words);
+    memset(img, 0, sizeof(*img));
+}
@@ -0,0 +1,35 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h>
+#include "m4asm.h"
+
+// In-memory assembly: the read, label, layout and encode passes of m4asm
+// with the words collected in an array instead of written to a file. The
+// words are the same as in m4asm's binary output for the same source and
+// options (img_assemble: none). Assembly errors exit, as they do in m4asm.
+
+struct img {
+    uint16_t *words;    // host order
+    long n;
+    long cap;
+};
+
+// The optimization passes img_assemble_opts() runs, as m4asm's options of
+// the same names, in m4asm's order and without logs.
+struct img_opts {
+    int relax;          // 0 for --no-relax
+    int optimize;       // -O
+    int inlinelimit;    // --inline=N, 0 for none
+    int placedata;      // --place-data
+};
+
+// Returns 0, or -1 with errno set if fp cannot be read.
+int img_assemble(FILE* fp, int relax, struct img *out);
+int img_assemble_opts(FILE* fp, const struct img_opts *opts, struct img *out);
+// Reads an m4asm binary or -f logisim image ("-" for stdin), as m4sim
+// does. Returns 0, or -1 with errno set.
+int img_load(const char* path, struct img *out);
+void img_free(struct img *img);
+
+#endif
@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m4asm.h"
+#include "label.h"
+#include "stmt.h"
+#include "cost.h"
+#include "inline.h"
+#include "insns.h"
+
+// Body instructions that would behave differently without the call frame
+// (or that transfer control) disqualify a routine.
+static const char* inl_barriers[] = {
+    "jmp", "call", "ret", "brchf", "brchi", "push", "pushb", "pop", "popad", "ssp", "sint", "dw", NULL
+};
+
+struct inl_routine {
+    int label;      // index of the label statement
+    int first;      // first body statement
+    int ret;        // index of the closing ret
+    int sites;      // call sites
+    int call;       // first call site
+    int other;      // references other than call
+    int cycles;     // body cost
+    int words;
+    int inlined;
+    int dropped;
+};
+
+static int inl_is(struct stmt_t *st, const char* mnemonic) {
+    char m[16];
+    if (st->kind != STMT_INSN || st->special) return 0;
+    stmt_mnemonic(st, m);
+    return strcmp(m, mnemonic) == 0;
+}
+
+static int inl_barrier(struct stmt_t *st) {
+    if (st->special) return 1;
+    for (int i=0;inl_barriers[i] != NULL;i++) {
+        if (inl_is(st, inl_barriers[i])) return 1;
+    }
+    return 0;
+}
+
+// Matches "label:" followed by straight-line code and a ret, with no other
+// label inside. Returns 1 and fills r if the routine starting at i qualifies.
+static int inl_scan(struct stmt_list *sl, int i, struct inl_routine *r) {
+    memset(r, 0, sizeof(*r));
+    r->label = i;
+    r->first = i+1;
+    for (int j=i+1;j<sl->n;j++) {
+        struct stmt_t *st = &sl->v[j];
+        if (st->kind == STMT_NONE) continue;
+        if (st->kind != STMT_INSN) return 0;
+        if (inl_is(st, "ret")) {
+            r->ret = j;
+            return 1;
+        }
+        if (inl_barrier(st)) return 0;
+        r->cycles += cost_cycles(st->cand[0]);
+        r->words += cost_length(st->cand[0]);
+    }
+    return 0;
+}
+
+// Returns 1 if execution can fall into the statement at i from above.
+static int inl_fallthrough(struct stmt_list *sl, int i) {
+    for (int j=i-1;j>=0;j--) {
+        struct stmt_t *st = &sl->v[j];
+        if (st->kind == STMT_NONE || st->kind == STMT_ORG || st->kind == STMT_ALIGN) continue;
+        if (st->kind == STMT_LABEL) return 1;
+        return !(inl_is(st, "jmp") || inl_is(st, "ret"));
+    }
+    return 1;
+}
+
+static char* inl_name(struct stmt_t *label, char* out) {
+    strncpy(out, label->text, 33);
+    out[32] = 0;
+    out[strlen(out)-1] = 0;
+    return out;
+}
+
+// The routine a call statement calls, -1 if none. byname maps positions
+// in names to routine indices.
+static int inl_callee(struct stmt_t *st, struct stmt_names *names, int *byname) {
+    char op[33];
+    if (!inl_is(st, "call") || stmt_operand(st, 0, op) != 0) return -1;
+    int p = stmt_names_find(names, op);
+    return p < 0 ? -1 : byname[p];
+}
+
+// Inlines qualifying leaf routines at their call sites. A routine is a label
+// followed by straight-line code ending in ret; it is inlined when its body
+// costs fewer than limit cycles and the result is cheaper under the cost
+// model. Routines left without references and not reachable by falling
+// through are dropped. Returns the number of call sites rewritten.
+int opt_inline(struct stmt_list *sl, struct le_context *lctx, int limit, FILE* log) {
+    int nr = 0, cap = 0;
+    struct inl_routine *rs = NULL;
+    char name[33];
+
+    // Inserting and removing code would move hand-computed branch targets.
+    if (!stmt_branches_all_labels(sl)) {
+        fprintf(stderr, "Warning: inlining skipped, program branches to non-label addresses\n");
+        return 0;
+    }
+
+    for (int i=0;i<sl->n;i++) {
+        struct inl_routine r;
+        if (sl->v[i].kind != STMT_LABEL || !inl_scan(sl, i, &r)) continue;
+        if (r.cycles >= limit) continue;
+        if (nr == cap) {
+            cap = cap ? cap * 2 : 16;
+            rs = (struct inl_routine*)realloc(rs, sizeof(struct inl_routine) * cap);
+        }
+        rs[nr++] = r;
+    }
+
+    // Call graph edges into the candidates, from one pass over the
+    // statements. A routine calling itself is ruled out by inl_scan already
+    // (call is a barrier).
+    struct stmt_names names;
+    memset(&names, 0, sizeof(names));
+    for (int k=0;k<nr;k++) stmt_names_add(&names, inl_name(&sl->v[rs[k].label], name));
+    stmt_names_sort(&names);
+    int *byname = (int*)malloc(sizeof(int) * (nr + 1));
+    for (int k=0;k<nr;k++) byname[stmt_names_find(&names, inl_name(&sl->v[rs[k].label], name))] = k;
+    for (int i=0;i<sl->n;i++) {
+        char op[33];
+        int last = -1;
+        int call = inl_is(&sl->v[i], "call");
+        for (int o=0;stmt_operand(&sl->v[i], o, op) == 0;o++) {
+            int p = stmt_names_find(&names, op);
+            if (p < 0 || byname[p] == last) continue;
+            struct inl_routine *r = &rs[byname[p]];
+            last = byname[p];
+            if (call) {
+                if (r->sites++ == 0) r->call = i;
+            } else {
+                r->other++;
+            }
+        }
+    }
+
+    int total = 0;
+    for (int k=0;k<nr;k++) {
+        struct inl_routine *r = &rs[k];
+        if (r->sites == 0) continue;
+
+        struct stmt_t *ret = &sl->v[r->ret];
+        int call = r->call;
+        inl_name(&sl->v[r->label], name);
+        int ccycles = cost_cycles(sl->v[call].cand[0]);
+        int cwords = cost_length(sl->v[call].cand[0]);
+        int rcycles = cost_cycles(ret->cand[0]);
+        int rwords = cost_length(ret->cand[0]);
+
+        // Cycles are per executed call, words are static.
+        int drop = r->other == 0 && !inl_fallthrough(sl, r->label);
+        int ocycles = r->sites * (ccycles + r->cycles + rcycles);
+        int owords = r->sites * cwords + r->words + rwords;
+        int ncycles = r->sites * r->cycles;
+        int nwords = r->sites * r->words + (drop ? 0 : r->words + rwords);
+        if (cost_value(ncycles, nwords) >= cost_value(ocycles, owords)) continue;
+
+        r->inlined = 1;
+        r->dropped = drop;
+        total += r->sites;
+        if (log != NULL) {
+            fprintf(log, "line %d: inline: %s into %d call site%s%s (cycles %+d, words %+d)\n",
+                sl->v[r->label].lineno, name, r->sites, r->sites == 1 ? "" : "s",
+                drop ? ", original dropped" : "", ncycles - ocycles, nwords - owords);
+        }
+    }
+
+    if (total == 0) {
+        stmt_names_free(&names);
+        free(byname);
+        free(rs);
+        return 0;
+    }
+
+    // Statements of dropped routines, by the routine.
+    int *dropped = (int*)malloc(sizeof(int) * (sl->n + 1));
+    for (int i=0;i<sl->n;i++) dropped[i] = -1;
+    for (int k=0;k<nr;k++) {
+        if (!rs[k].dropped) continue;
+        for (int i=rs[k].label;i<=rs[k].ret;i++) dropped[i] = k;
+    }
+
+    // Rebuild the list with every call to an inlined routine replaced by a
+    // copy of its body.
+    struct stmt_list out = stmt_init_list(sl->relax);
+    out.cap = sl->n + total * 4;
+    out.v = (struct stmt_t*)malloc(sizeof(struct stmt_t) * out.cap);
+    for (int i=0;i<sl->n;i++) {
+        struct stmt_t *st = &sl->v[i];
+
+        if (dropped[i] >= 0) {
+            // Freed below: later call sites still copy the body text.
+            if (i == rs[dropped[i]].label) lctx->nlabels--;
+            continue;
+        }
+
+        int site = inl_callee(st, &names, byname);
+        if (site >= 0 && !rs[site].inlined) site = -1;
+        if (site < 0) {
+            if (out.n == out.cap) {
+                out.cap *= 2;
+                out.v = (struct stmt_t*)realloc(out.v, sizeof(struct stmt_t) * out.cap);
+            }
+            out.v[out.n++] = *st;
+            continue;
+        }
+
+        for (int j=rs[site].first;j<rs[site].ret;j++) {
+            if (sl->v[j].kind == STMT_NONE) continue;
+            if (out.n == out.cap) {
+                out.cap *= 2;
+                out.v = (struct stmt_t*)realloc(out.v, sizeof(struct stmt_t) * out.cap);
+            }
+            struct stmt_t *cp = &out.v[out.n++];
+            *cp = sl->v[j];
+            cp->lineno = st->lineno;
+            cp->text = strdup(sl->v[j].text);
+        }
+        free(st->text);
+    }
+
+    for (int k=0;k<nr;k++) {
+        if (!rs[k].dropped) continue;
+        for (int i=rs[k].label;i<=rs[k].ret;i++) free(sl->v[i].text);
+    }
+    free(sl->v);
+    sl->v = out.v;
+    sl->n = out.n;
+    sl->cap = out.cap;
+    stmt_names_free(&names);
+    free(byname);
+    free(dropped);
+    free(rs);
+    return total;
+}
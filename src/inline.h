@@ -0,0 +1,12 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include <stdio.h>
+#include "label.h"
+#include "stmt.h"
+
+#define INLINE_DEFAULT_LIMIT 16   // body cycles
+
+int opt_inline(struct stmt_list *sl, struct le_context *lctx, int limit, FILE* log);
+
+#endif
@@ -0,0 +1,736 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "m4asm.h"
+#include "sim.h"
+#include "jit.h"
+#include "insns.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE (16u << 20)
+#define JIT_BLOCK_ROOM 16384    // code bytes one block can need
+#define JIT_MAXBLOCKS 65536
+#define JIT_HASH 131072         // power of two, above JIT_MAXBLOCKS
+#define JIT_MAXEXITS (2 * JIT_MAXBLOCKS)
+#define JIT_BLOCK_INSNS 64
+#define JIT_MAXSTUBS (2 * JIT_BLOCK_INSNS + 4)
+
+// Host registers while in translated code:
+//   rbx = struct sim*, r12 = jit_flagmap, r13 = struct jit_regs*,
+//   r14 = instructions left in the budget, r15 = cycle count.
+// Guest registers, sp, flags etc. stay in struct sim, so helpers and the
+// interpreter see the same state.
+
+struct jit_regs {
+    long long budget;
+    unsigned long long cycles;
+};
+
+struct jit_block {
+    uint32_t pc;
+    int n;                  // instructions
+    unsigned char *code;
+};
+
+// An exit to a fixed pc that can be patched into a direct jump. patch is
+// the "mov [pc], target" the jump replaces.
+struct jit_exit {
+    unsigned char *patch;
+    uint32_t target;
+};
+
+// Exit to emit after the block body. rel is the rel32 to point at it.
+struct jit_stub {
+    unsigned char *rel;
+    int k;                  // instructions executed when taken
+    int cycles;
+    uint32_t pc;
+    int stop;
+    int chain;
+};
+
+typedef int (*jit_entry_fn)(struct sim *s, struct jit_regs *regs, void* code);
+
+static unsigned char *jit_buf = NULL;
+static unsigned char *jit_cur;
+static unsigned char *jit_start;        // first byte after the trampoline
+static unsigned char *jit_epilogue;
+static jit_entry_fn jit_entry;
+static unsigned char jit_flagmap[256];
+static struct jit_block *jit_blocks;
+static int jit_nblocks;
+static int *jit_hash;
+static struct jit_exit *jit_exits;
+static int jit_nexits;
+static int jit_failed = 0;
+static unsigned long jit_ntranslated, jit_nchained, jit_nflushes;
+
+// x86-64 encoding
+
+#define JIT_EAX 0
+#define JIT_ECX 1
+#define JIT_EDX 2
+#define JIT_ESI 6
+#define JIT_EDI 7
+
+#define JIT_ADD 0
+#define JIT_OR 1
+#define JIT_ADC 2
+#define JIT_SBB 3
+#define JIT_AND 4
+#define JIT_SUB 5
+#define JIT_XOR 6
+#define JIT_CMP 7
+
+#define JIT_OFF(f) ((uint32_t)offsetof(struct sim, f))
+#define JIT_REG(i) (JIT_OFF(r) + 2 * (i))
+
+static void e8(int b) {
+    *jit_cur++ = (unsigned char)b;
+}
+
+static void e16(uint32_t v) {
+    e8(v & 0xFF);
+    e8(v >> 8 & 0xFF);
+}
+
+static void e32(uint32_t v) {
+    e16(v & 0xFFFF);
+    e16(v >> 16);
+}
+
+static void e64(unsigned long long v) {
+    e32((uint32_t)v);
+    e32((uint32_t)(v >> 32));
+}
+
+static void e_patch32(unsigned char *at, unsigned char *target) {
+    uint32_t d = (uint32_t)(target - (at + 4));
+    at[0] = d & 0xFF;
+    at[1] = d >> 8 & 0xFF;
+    at[2] = d >> 16 & 0xFF;
+    at[3] = d >> 24;
+}
+
+// ModRM for [rbx + disp32] with reg in the reg field.
+static void e_mrbx(int reg, uint32_t disp) {
+    e8(0x80 | reg << 3 | 3);
+    e32(disp);
+}
+
+// movzx reg32, word [rbx + off]
+static void e_load16(int reg, uint32_t off) {
+    e8(0x0F); e8(0xB7); e_mrbx(reg, off);
+}
+
+// mov word [rbx + off], reg16
+static void e_store16(int reg, uint32_t off) {
+    e8(0x66); e8(0x89); e_mrbx(reg, off);
+}
+
+static void e_store_imm16(uint32_t off, uint16_t v) {
+    e8(0x66); e8(0xC7); e_mrbx(0, off); e16(v);
+}
+
+static void e_store_imm32(uint32_t off, uint32_t v) {
+    e8(0xC7); e_mrbx(0, off); e32(v);
+}
+
+// op ax, cx / op ax, imm16
+static void e_alu_rr(int op) {
+    e8(0x66); e8(op * 8 + 1); e8(0xC0 | JIT_ECX << 3 | JIT_EAX);
+}
+
+static void e_alu_ri(int op, uint16_t v) {
+    e8(0x66); e8(0x81); e8(0xC0 | op << 3 | JIT_EAX); e16(v);
+}
+
+static void e_test_ax() {
+    e8(0x66); e8(0x85); e8(0xC0);
+}
+
+static void e_not_ax() {
+    e8(0x66); e8(0xF7); e8(0xD0);
+}
+
+// Host ZF/CF/SF/OF to SIM_F_*, into s->flags.
+static void e_flags() {
+    e8(0x9F);                                           // lahf
+    e8(0x0F); e8(0x90); e8(0xC0);                       // seto al
+    e8(0x0F); e8(0xB6); e8(0xCC);                       // movzx ecx, ah
+    e8(0x41); e8(0x0F); e8(0xB6); e8(0x0C); e8(0x0C);   // movzx ecx, byte [r12 + rcx]
+    e8(0xC0); e8(0xE0); e8(0x03);                       // shl al, 3
+    e8(0x08); e8(0xC1);                                 // or cl, al
+    e8(0x88); e_mrbx(JIT_ECX, JIT_OFF(flags));          // mov [flags], cl
+}
+
+static void e_call(void* fn) {
+    e8(0x48); e8(0xB8); e64((unsigned long long)(size_t)fn);   // mov rax, fn
+    e8(0xFF); e8(0xD0);                                         // call rax
+}
+
+static void e_rdi_sim() {
+    e8(0x48); e8(0x89); e8(0xDF);                       // mov rdi, rbx
+}
+
+static void e_mov_imm32(int reg, uint32_t v) {
+    e8(0xB8 + reg); e32(v);
+}
+
+static unsigned char* e_jcc(int cc) {
+    e8(0x0F); e8(0x80 + cc); e32(0);
+    return jit_cur - 4;
+}
+
+#define JIT_CC_E 0x4
+#define JIT_CC_NE 0x5
+#define JIT_CC_L 0xC
+
+static void e_charge(int k, int cycles) {
+    if (k > 0) {
+        e8(0x49); e8(0x81); e8(0xEE); e32(k);           // sub r14, k
+    }
+    if (cycles > 0) {
+        e8(0x49); e8(0x81); e8(0xC7); e32(cycles);      // add r15, cycles
+    }
+}
+
+static void e_jmp(unsigned char *target) {
+    e8(0xE9); e32(0);
+    e_patch32(jit_cur - 4, target);
+}
+
+// Helpers called from translated code.
+
+static int jit_h_store(struct sim *s, uint32_t addr, uint32_t v) {
+    sim_store16(s, addr, v);
+    return s->watch_hit;
+}
+
+static uint32_t jit_h_load(struct sim *s, uint32_t addr) {
+    return sim_read16(&s->mem, addr);
+}
+
+static int jit_h_push(struct sim *s, uint32_t v) {
+    s->sp -= 2;
+    sim_store16(s, s->sp, v);
+    return s->watch_hit;
+}
+
+static uint32_t jit_h_pop(struct sim *s) {
+    uint16_t v = sim_read16(&s->mem, s->sp);
+    s->sp += 2;
+    return v;
+}
+
+static int jit_h_call(struct sim *s, uint32_t next) {
+    jit_h_push(s, next >> 16);
+    jit_h_push(s, next & 0xFFFF);
+    s->depth++;
+    return s->watch_hit;
+}
+
+static uint32_t jit_h_ret(struct sim *s) {
+    uint32_t pc = jit_h_pop(s);
+    pc |= jit_h_pop(s) << 16;
+    s->depth--;
+    return pc;
+}
+
+// Everything without a translation runs through the interpreter.
+static int jit_h_step(struct sim *s, uint32_t pc) {
+    unsigned long long insns = s->insns;
+    unsigned long long cycles = s->cycles;
+    s->pc = pc;
+    sim_run(s, 1);
+    s->insns = insns;
+    s->cycles = cycles;
+    s->stop = SIM_RUNNING;
+    return s->watch_hit;
+}
+
+static void jit_flush(struct sim *s) {
+    jit_cur = jit_start;
+    jit_nblocks = 0;
+    jit_nexits = 0;
+    memset(jit_hash, 0, JIT_HASH * sizeof(int));
+    for (unsigned long p=0;p<SIM_NPAGES;p++) {
+        if (s->watch[p] != NULL) memset(s->watch[p], 0, SIM_PAGE_SIZE / 16);
+    }
+    s->watch_hit = 0;
+    jit_nflushes++;
+}
+
+static int jit_init(struct sim *s) {
+    if (jit_failed) return 0;
+    if (jit_buf == NULL) {
+        void* m = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED) {
+            jit_failed = 1;
+            return 0;
+        }
+        jit_buf = (unsigned char*)m;
+        jit_blocks = (struct jit_block*)malloc(JIT_MAXBLOCKS * sizeof(struct jit_block));
+        jit_hash = (int*)calloc(JIT_HASH, sizeof(int));
+        jit_exits = (struct jit_exit*)malloc(JIT_MAXEXITS * sizeof(struct jit_exit));
+        for (int h=0;h<256;h++) {
+            jit_flagmap[h] = (h & 0x40 ? SIM_F_Z : 0) | (h & 0x01 ? SIM_F_C : 0) | (h & 0x80 ? SIM_F_N : 0);
+        }
+
+        jit_cur = jit_buf;
+        jit_entry = (jit_entry_fn)(void*)jit_cur;
+        e8(0x53); e8(0x55);                                 // push rbx, rbp
+        e8(0x41); e8(0x54); e8(0x41); e8(0x55);             // push r12, r13
+        e8(0x41); e8(0x56); e8(0x41); e8(0x57);             // push r14, r15
+        e8(0x48); e8(0x83); e8(0xEC); e8(0x08);             // sub rsp, 8
+        e8(0x48); e8(0x89); e8(0xFB);                       // mov rbx, rdi
+        e8(0x49); e8(0x89); e8(0xF5);                       // mov r13, rsi
+        e8(0x4D); e8(0x8B); e8(0x75); e8(0x00);             // mov r14, [r13]
+        e8(0x4D); e8(0x8B); e8(0x7D); e8(0x08);             // mov r15, [r13 + 8]
+        e8(0x49); e8(0xBC); e64((unsigned long long)(size_t)jit_flagmap);  // mov r12, jit_flagmap
+        e8(0xFF); e8(0xE2);                                 // jmp rdx
+        jit_epilogue = jit_cur;
+        e8(0x4D); e8(0x89); e8(0x75); e8(0x00);             // mov [r13], r14
+        e8(0x4D); e8(0x89); e8(0x7D); e8(0x08);             // mov [r13 + 8], r15
+        e8(0x48); e8(0x83); e8(0xC4); e8(0x08);             // add rsp, 8
+        e8(0x41); e8(0x5F); e8(0x41); e8(0x5E);             // pop r15, r14
+        e8(0x41); e8(0x5D); e8(0x41); e8(0x5C);             // pop r13, r12
+        e8(0x5D); e8(0x5B);                                 // pop rbp, rbx
+        e8(0xC3);                                           // ret
+        jit_start = jit_cur;
+    }
+    if (s->watch == NULL) {
+        s->watch = (unsigned char**)calloc(SIM_NPAGES, sizeof(unsigned char*));
+    }
+    return jit_blocks != NULL && jit_hash != NULL && jit_exits != NULL && s->watch != NULL;
+}
+
+static struct jit_block* jit_lookup(uint32_t pc) {
+    for (uint32_t h=(pc >> 1) & (JIT_HASH - 1);jit_hash[h];h=(h + 1) & (JIT_HASH - 1)) {
+        if (jit_blocks[jit_hash[h] - 1].pc == pc) return &jit_blocks[jit_hash[h] - 1];
+    }
+    return NULL;
+}
+
+static void jit_watch(struct sim *s, uint32_t addr, int words) {
+    for (int i=0;i<words;i++, addr+=2) {
+        unsigned char **pp = &s->watch[addr >> SIM_PAGE_BITS];
+        if (*pp == NULL) {
+            *pp = (unsigned char*)calloc(SIM_PAGE_SIZE / 16, 1);
+            if (*pp == NULL) {
+                fprintf(stderr, "Error: out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        uint32_t w = (addr & (SIM_PAGE_SIZE - 1)) >> 1;
+        (*pp)[w >> 3] |= 1 << (w & 7);
+    }
+}
+
+// Exit to the dispatcher: charge, set pc (and stop), return the exit id
+// (0 = not patchable).
+static void e_exit(int k, int cycles, uint32_t pc, int stop, int chain) {
+    e_charge(k, cycles);
+    if (stop != SIM_RUNNING) e_store_imm32(JIT_OFF(stop), stop);
+    int id = 0;
+    if (chain && jit_nexits < JIT_MAXEXITS) {
+        jit_exits[jit_nexits].patch = jit_cur;
+        jit_exits[jit_nexits].target = pc;
+        id = ++jit_nexits;
+    }
+    e_store_imm32(JIT_OFF(pc), pc);
+    e_mov_imm32(JIT_EAX, id);
+    e_jmp(jit_epilogue);
+}
+
+static int jit_sets_flags(int opc) {
+    switch (opc) {
+    case OPC_ADD_RR: case OPC_ADD_RI: case OPC_ADC_RR:
+    case OPC_SUB_RR: case OPC_SUB_RI: case OPC_SUC_RR: case OPC_CMP_RR:
+    case OPC_SHR_RI: case OPC_SHL_RI: case OPC_ROR_RI: case OPC_ROL_RI:
+    case OPC_NOT_R: case OPC_INC_R: case OPC_DEC_R: case OPC_INC2_R: case OPC_DEC2_R:
+    case OPC_AND_RR: case OPC_OR_RR: case OPC_NOR_RR: case OPC_XOR_RR: case OPC_NAND_RR: case OPC_XNOR_RR:
+    case OPC_AND_RI: case OPC_OR_RI: case OPC_NOR_RI: case OPC_XOR_RI: case OPC_NAND_RI: case OPC_XNOR_RI:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Instructions with their own translation; the rest go through
+// jit_h_step().
+static int jit_native(int opc) {
+    if (jit_sets_flags(opc)) return 1;
+    switch (opc) {
+    case OPC_NOP:
+    case OPC_JMP_FAR: case OPC_JMP_NEAR: case OPC_JMP_REL_POS: case OPC_JMP_REL_NEG:
+    case OPC_MOV_I2R_NEAR: case OPC_MOV_I2R_FAR: case OPC_MOV_R2M_FAR: case OPC_MOV_R2M_NEAR:
+    case OPC_MOV_R2R: case OPC_MOV_R2A: case OPC_MOV_V2R: case OPC_MOV_V2A:
+    case OPC_PUSH_REG: case OPC_POP_REG: case OPC_SSP:
+    case OPC_CALL_FAR: case OPC_CALL_NEAR: case OPC_RET:
+    case OPC_IEN: case OPC_SINT:
+    case OPC_BRCH_FLG_FAR: case OPC_BRCH_FLG_NEAR: case OPC_BRCH_IV_FAR: case OPC_BRCH_IV_NEAR:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int jit_ends_block(int opc) {
+    switch (opc) {
+    case OPC_JMP_FAR: case OPC_JMP_NEAR: case OPC_JMP_REL_POS: case OPC_JMP_REL_NEG:
+    case OPC_CALL_FAR: case OPC_CALL_NEAR: case OPC_RET: case OPC_SINT:
+    case OPC_BRCH_FLG_FAR: case OPC_BRCH_FLG_NEAR: case OPC_BRCH_IV_FAR: case OPC_BRCH_IV_NEAR:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Reads s->flags.
+static int jit_uses_flags(int opc) {
+    return opc == OPC_ADC_RR || opc == OPC_SUC_RR || opc == OPC_BRCH_FLG_FAR || opc == OPC_BRCH_FLG_NEAR || !jit_native(opc);
+}
+
+// May leave the block before the next instruction.
+static int jit_may_exit(int opc) {
+    return opc == OPC_MOV_R2M_FAR || opc == OPC_MOV_R2M_NEAR || opc == OPC_PUSH_REG || jit_ends_block(opc) || !jit_native(opc);
+}
+
+// ALU op of the translated instructions: x86 op, second operand from a
+// register (cx) or the immediate, invert the result afterwards.
+static void e_alu(struct sim_op *op) {
+    int x86 = -1, inv = 0, imm = 0, carry = 0, store = 1;
+    uint32_t v = op->p1;
+    switch (op->opcode) {
+    case OPC_ADD_RR: x86 = JIT_ADD; break;
+    case OPC_ADD_RI: x86 = JIT_ADD; imm = 1; break;
+    case OPC_ADC_RR: x86 = JIT_ADC; carry = 1; break;
+    case OPC_SUB_RR: x86 = JIT_SUB; break;
+    case OPC_SUB_RI: x86 = JIT_SUB; imm = 1; break;
+    case OPC_SUC_RR: x86 = JIT_SBB; carry = 1; break;
+    case OPC_CMP_RR: x86 = JIT_CMP; store = 0; break;
+    case OPC_INC_R: x86 = JIT_ADD; imm = 1; v = 1; break;
+    case OPC_DEC_R: x86 = JIT_SUB; imm = 1; v = 1; break;
+    case OPC_INC2_R: x86 = JIT_ADD; imm = 1; v = 2; break;
+    case OPC_DEC2_R: x86 = JIT_SUB; imm = 1; v = 2; break;
+    case OPC_AND_RR: x86 = JIT_AND; break;
+    case OPC_OR_RR: x86 = JIT_OR; break;
+    case OPC_XOR_RR: x86 = JIT_XOR; break;
+    case OPC_NOR_RR: x86 = JIT_OR; inv = 1; break;
+    case OPC_NAND_RR: x86 = JIT_AND; inv = 1; break;
+    case OPC_XNOR_RR: x86 = JIT_XOR; inv = 1; break;
+    case OPC_AND_RI: x86 = JIT_AND; imm = 1; break;
+    case OPC_OR_RI: x86 = JIT_OR; imm = 1; break;
+    case OPC_XOR_RI: x86 = JIT_XOR; imm = 1; break;
+    case OPC_NOR_RI: x86 = JIT_OR; imm = 1; inv = 1; break;
+    case OPC_NAND_RI: x86 = JIT_AND; imm = 1; inv = 1; break;
+    case OPC_XNOR_RI: x86 = JIT_XOR; imm = 1; inv = 1; break;
+    case OPC_NOT_R: inv = 1; break;
+    }
+    e_load16(JIT_EAX, JIT_REG(op->p0));
+    if (x86 >= 0 && !imm) e_load16(JIT_ECX, JIT_REG(op->p1));
+    if (carry) {
+        e8(0x0F); e8(0xBA); e_mrbx(4, JIT_OFF(flags)); e8(1);   // bt [flags], 1
+    }
+    if (x86 >= 0) {
+        if (imm) e_alu_ri(x86, v);
+        else e_alu_rr(x86);
+    }
+    if (inv) {
+        e_not_ax();
+        e_test_ax();
+    }
+    if (store) e_store16(JIT_EAX, JIT_REG(op->p0));
+}
+
+// Shifts and rotates: C is the last bit out, V is cleared.
+static void e_shift(struct sim_op *op, int flags) {
+    e_load16(JIT_EAX, JIT_REG(op->p0));
+    unsigned n = op->p1 & 15;
+    if (n != 0) {
+        int ext = op->opcode == OPC_SHL_RI ? 4 : op->opcode == OPC_SHR_RI ? 5 : op->opcode == OPC_ROL_RI ? 0 : 1;
+        e8(0x66); e8(0xC1); e8(0xC0 | ext << 3 | JIT_EAX); e8(n);   // shl/shr/rol/ror ax, n
+        e_store16(JIT_EAX, JIT_REG(op->p0));
+    }
+    if (!flags) return;
+    if (n != 0) {
+        e8(0x0F); e8(0x92); e8(0xC2);                   // setc dl
+    } else {
+        e8(0x31); e8(0xD2);                             // xor edx, edx
+    }
+    e_test_ax();
+    e8(0x9F);                                           // lahf
+    e8(0x0F); e8(0xB6); e8(0xCC);                       // movzx ecx, ah
+    e8(0x41); e8(0x0F); e8(0xB6); e8(0x0C); e8(0x0C);   // movzx ecx, byte [r12 + rcx]
+    e8(0xD0); e8(0xE2);                                 // shl dl, 1
+    e8(0x08); e8(0xD1);                                 // or cl, dl
+    e8(0x88); e_mrbx(JIT_ECX, JIT_OFF(flags));          // mov [flags], cl
+}
+
+static struct jit_block* jit_translate(struct sim *s, uint32_t pc) {
+    struct sim_op ops[JIT_BLOCK_INSNS];
+    uint32_t addrs[JIT_BLOCK_INSNS];
+    int need[JIT_BLOCK_INSNS];
+    int cum[JIT_BLOCK_INSNS];
+    int n = 0;
+
+    if (pc & 1) return NULL;
+    uint32_t a = pc;
+    while (n < JIT_BLOCK_INSNS) {
+        if (sim_decode(s, a, &ops[n])) break;
+        addrs[n] = a;
+        cum[n] = (n ? cum[n-1] : 0) + ops[n].cycles;
+        a += ops[n].length * 2;
+        n++;
+        if (jit_ends_block(ops[n-1].opcode)) break;
+    }
+    if (n == 0) return NULL;
+
+    // Flags only need writing back if something reads them before the
+    // next write, or the block may be left in between.
+    int live = 1;
+    for (int k=n-1;k>=0;k--) {
+        need[k] = live;
+        if (jit_sets_flags(ops[k].opcode)) live = jit_uses_flags(ops[k].opcode);
+        else live = live || jit_uses_flags(ops[k].opcode) || jit_may_exit(ops[k].opcode);
+    }
+
+    if (jit_nblocks == JIT_MAXBLOCKS || jit_cur + JIT_BLOCK_ROOM > jit_buf + JIT_CODE_SIZE) jit_flush(s);
+
+    struct jit_block *b = &jit_blocks[jit_nblocks++];
+    struct jit_stub stubs[JIT_MAXSTUBS];
+    int nstubs = 0;
+    b->pc = pc;
+    b->n = n;
+    b->code = jit_cur;
+    jit_ntranslated++;
+
+    // Prologue: bail out if the budget does not cover the whole block.
+    e8(0x49); e8(0x81); e8(0xFE); e32(n);               // cmp r14, n
+    stubs[nstubs++] = (struct jit_stub){e_jcc(JIT_CC_L), 0, 0, pc, SIM_RUNNING, 0};
+
+    int k;
+    for (k=0;k<n;k++) {
+        struct sim_op *op = &ops[k];
+        uint32_t next = addrs[k] + op->length * 2;
+
+        if (jit_sets_flags(op->opcode)) {
+            if (op->opcode == OPC_SHL_RI || op->opcode == OPC_SHR_RI || op->opcode == OPC_ROL_RI || op->opcode == OPC_ROR_RI) {
+                e_shift(op, need[k]);
+            } else {
+                e_alu(op);
+                if (need[k]) e_flags();
+            }
+            continue;
+        }
+
+        switch (op->opcode) {
+        case OPC_NOP:
+            break;
+        case OPC_MOV_R2R:
+            e_load16(JIT_EAX, JIT_REG(op->p1));
+            e_store16(JIT_EAX, JIT_REG(op->p0));
+            break;
+        case OPC_MOV_V2R:
+            e_store_imm16(JIT_REG(op->p0), op->p1);
+            break;
+        case OPC_MOV_R2A:
+            e_load16(JIT_EAX, JIT_REG(op->p0));
+            e_store16(JIT_EAX, JIT_OFF(a));
+            break;
+        case OPC_MOV_V2A:
+            e_store_imm16(JIT_OFF(a), op->p0);
+            break;
+        case OPC_SSP:
+            e_store_imm32(JIT_OFF(sp), op->p0);
+            break;
+        case OPC_IEN:
+            e8(0xC6); e_mrbx(0, JIT_OFF(ien)); e8(1);
+            break;
+        case OPC_MOV_I2R_NEAR:
+        case OPC_MOV_I2R_FAR:
+            e_rdi_sim();
+            e_mov_imm32(JIT_ESI, op->p1);
+            e_call((void*)jit_h_load);
+            e_store16(JIT_EAX, JIT_REG(op->p0));
+            break;
+        case OPC_POP_REG:
+            e_rdi_sim();
+            e_call((void*)jit_h_pop);
+            e_store16(JIT_EAX, JIT_REG(op->p0));
+            break;
+        case OPC_MOV_R2M_FAR:
+        case OPC_MOV_R2M_NEAR:
+        case OPC_PUSH_REG:
+            e_rdi_sim();
+            if (op->opcode == OPC_PUSH_REG) {
+                e_load16(JIT_ESI, JIT_REG(op->p0));
+                e_call((void*)jit_h_push);
+            } else {
+                e_mov_imm32(JIT_ESI, op->p0);
+                e_load16(JIT_EDX, JIT_REG(op->p1));
+                e_call((void*)jit_h_store);
+            }
+            e8(0x85); e8(0xC0);                         // test eax, eax
+            stubs[nstubs++] = (struct jit_stub){e_jcc(JIT_CC_NE), k + 1, cum[k], next, SIM_RUNNING, 0};
+            break;
+
+        case OPC_JMP_FAR:
+        case OPC_JMP_NEAR:
+        case OPC_JMP_REL_POS:
+        case OPC_JMP_REL_NEG:
+            if (op->p0 == addrs[k]) e_exit(k + 1, cum[k], addrs[k], SIM_STOP_HALT, 0);
+            else e_exit(k + 1, cum[k], op->p0, SIM_RUNNING, 1);
+            break;
+        case OPC_BRCH_FLG_FAR:
+        case OPC_BRCH_FLG_NEAR:
+            if (op->p1 & 0xFF) {
+                e8(0xF6); e_mrbx(0, JIT_OFF(flags)); e8(op->p1 & 0xFF);   // test byte [flags], mask
+                stubs[nstubs++] = (struct jit_stub){e_jcc(JIT_CC_NE), k + 1, cum[k], op->p0, SIM_RUNNING, 1};
+            }
+            e_exit(k + 1, cum[k], next, SIM_RUNNING, 1);
+            break;
+        case OPC_BRCH_IV_FAR:
+        case OPC_BRCH_IV_NEAR:
+            e8(0x80); e_mrbx(7, JIT_OFF(iv)); e8(op->p1 & 0xFF);         // cmp byte [iv], value
+            stubs[nstubs++] = (struct jit_stub){e_jcc(JIT_CC_E), k + 1, cum[k], op->p0, SIM_RUNNING, 1};
+            e_exit(k + 1, cum[k], next, SIM_RUNNING, 1);
+            break;
+        case OPC_CALL_FAR:
+        case OPC_CALL_NEAR:
+            e_rdi_sim();
+            e_mov_imm32(JIT_ESI, next);
+            e_call((void*)jit_h_call);
+            e8(0x85); e8(0xC0);                         // test eax, eax
+            stubs[nstubs++] = (struct jit_stub){e_jcc(JIT_CC_NE), k + 1, cum[k], op->p0, SIM_RUNNING, 0};
+            e_exit(k + 1, cum[k], op->p0, SIM_RUNNING, 1);
+            break;
+        case OPC_RET:
+            e8(0x83); e_mrbx(7, JIT_OFF(depth)); e8(0);                   // cmp dword [depth], 0
+            stubs[nstubs++] = (struct jit_stub){e_jcc(JIT_CC_E), k + 1, cum[k], addrs[k], SIM_STOP_RET, 0};
+            e_rdi_sim();
+            e_call((void*)jit_h_ret);
+            e8(0x89); e_mrbx(JIT_EAX, JIT_OFF(pc));     // mov [pc], eax
+            e_charge(k + 1, cum[k]);
+            e_mov_imm32(JIT_EAX, 0);
+            e_jmp(jit_epilogue);
+            break;
+        case OPC_SINT:
+            e_exit(k + 1, cum[k], next, SIM_STOP_SINT, 0);
+            break;
+
+        default:
+            e_rdi_sim();
+            e_mov_imm32(JIT_ESI, addrs[k]);
+            e_call((void*)jit_h_step);
+            e8(0x85); e8(0xC0);                         // test eax, eax
+            stubs[nstubs++] = (struct jit_stub){e_jcc(JIT_CC_NE), k + 1, cum[k], next, SIM_RUNNING, 0};
+            break;
+        }
+    }
+    if (!jit_ends_block(ops[n-1].opcode)) e_exit(n, cum[n-1], addrs[n-1] + ops[n-1].length * 2, SIM_RUNNING, 1);
+
+    for (int i=0;i<nstubs;i++) {
+        e_patch32(stubs[i].rel, jit_cur);
+        e_exit(stubs[i].k, stubs[i].cycles, stubs[i].pc, stubs[i].stop, stubs[i].chain);
+    }
+
+    for (k=0;k<n;k++) jit_watch(s, addrs[k], ops[k].length);
+    uint32_t h;
+    for (h=(pc >> 1) & (JIT_HASH - 1);jit_hash[h];h=(h + 1) & (JIT_HASH - 1));
+    jit_hash[h] = jit_nblocks;
+    return b;
+}
+
+// Turns exit id into a direct jump to b.
+static void jit_chain(int id, struct jit_block *b) {
+    struct jit_exit *x = &jit_exits[id - 1];
+    if (x->target != b->pc) return;
+    unsigned char *save = jit_cur;
+    jit_cur = x->patch;
+    e_jmp(b->code);
+    jit_cur = save;
+    jit_nchained++;
+}
+
+int jit_available() {
+    return 1;
+}
+
+int jit_run(struct sim *s, unsigned long long maxinsns) {
+    if (!jit_init(s)) return sim_run(s, maxinsns);
+    unsigned long long limit = maxinsns ? s->insns + maxinsns : ~0ULL;
+    struct jit_regs regs;
+    int last = 0;
+    s->stop = SIM_RUNNING;
+    while (s->stop == SIM_RUNNING) {
+        if (s->watch_hit) {
+            jit_flush(s);
+            last = 0;
+        }
+        if (s->insns >= limit) {
+            s->stop = SIM_STOP_LIMIT;
+            break;
+        }
+        unsigned long long left = limit - s->insns;
+        struct jit_block *b = jit_lookup(s->pc);
+        if (b == NULL) {
+            unsigned long flushes = jit_nflushes;
+            b = jit_translate(s, s->pc);
+            if (jit_nflushes != flushes) last = 0;
+        }
+        if (b == NULL || (unsigned long long)b->n > left) {
+            sim_run(s, 1);
+            if (s->stop == SIM_STOP_LIMIT) s->stop = SIM_RUNNING;
+            last = 0;
+            continue;
+        }
+        if (last) jit_chain(last, b);
+        regs.budget = left > 0x7FFFFFFFFFFFFFFFULL ? 0x7FFFFFFFFFFFFFFFLL : (long long)left;
+        regs.cycles = s->cycles;
+        long long budget = regs.budget;
+        last = jit_entry(s, &regs, b->code);
+        s->insns += budget - regs.budget;
+        s->cycles = regs.cycles;
+    }
+    return s->stop;
+}
+
+void jit_report(FILE* fp) {
+    fprintf(fp, "jit: %lu blocks translated, %lu exits chained, %lu flushes, %ld bytes of code\n",
+        jit_ntranslated, jit_nchained, jit_nflushes, jit_buf ? (long)(jit_cur - jit_buf) : 0L);
+}
+
+void jit_free() {
+    if (jit_buf != NULL) munmap(jit_buf, JIT_CODE_SIZE);
+    free(jit_blocks);
+    free(jit_hash);
+    free(jit_exits);
+    jit_buf = NULL;
+    jit_blocks = NULL;
+    jit_hash = NULL;
+    jit_exits = NULL;
+}
+
+#else
+
+int jit_available() {
+    return 0;
+}
+
+int jit_run(struct sim *s, unsigned long long maxinsns) {
+    return sim_run(s, maxinsns);
+}
+
+void jit_report(FILE* fp) {
+    fprintf(fp, "jit: not available on this host\n");
+}
+
+void jit_free() {
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdio.h>
+#include "sim.h"
+
+// Block translator for the simulator (m4sim -j), Linux x86-64 only.
+// Basic blocks end at jmp, call, brchf/brchi, ret and sint. Each block is
+// translated on first use and entered through a trampoline; exits to a
+// known target are patched to jump straight into the target's block.
+// Cycles and instruction counts are charged per exit, so they match the
+// interpreter exactly, and a block only starts if the instruction budget
+// covers all of it (the interpreter finishes the tail).
+//
+// Translated words are watched through sim.watch; a store to one, from
+// either a block or the interpreter, ends the current block and drops
+// every translation.
+
+// 1 if the translator is built for this host.
+int jit_available();
+// sim_run() with translated blocks. Falls back to sim_run() if the code
+// buffer cannot be mapped.
+int jit_run(struct sim *s, unsigned long long maxinsns);
+void jit_report(FILE* fp);
+void jit_free();
+
+#endif
@@ -10,6 +10,8 @@ struct le_context le_init_context() {
     ret.labels = NULL;
     ret.nlabels = 0;
     ret.stage = 0;
+    ret.lookups = 0;
+    ret.probes = 0;
     return ret;
 }
 
@@ -20,7 +22,7 @@ void le_initial_count(char* str, struct le_context *ctx) {
 }
 
 void le_allocate_labels(struct le_context *ctx) {
-    ctx->labels = (struct label*)malloc(sizeof(struct label) * ctx->nlabels);
+    ctx->labels = (struct label*)calloc(ctx->nlabels, sizeof(struct label));
 }
 
 void le_free_labels(struct le_context *ctx) {
@@ -50,7 +52,9 @@ int le_valid_label(char* line) {
 }
 
 uint32_t le_get_label_addr(char* labelname, struct le_context *ctx) {
+    ctx->lookups++;
     for (int i=0;i<ctx->nlabels;i++) {
+        ctx->probes++;
         if (strcmp(ctx->labels[i].name, labelname) != 0) continue;
 
         return ctx->labels[i].address;
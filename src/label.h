@@ -14,6 +14,8 @@ struct le_context {
     int idx;
     struct label *labels;
     int stage;
+    unsigned long lookups;
+    unsigned long probes;
 };
 
 struct le_context le_init_context();
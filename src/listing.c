@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m4asm.h"
+#include "stmt.h"
+#include "listing.h"
+#include "cost.h"
+#include "insns.h"
+
+#define LST_WORDS 4   // encoded words per listing line
+
+static FILE* lst_fp = NULL;
+static uint32_t lst_addr = 0;
+static long lst_block = 0;      // cycles since the last label
+static long lst_total = 0;
+static long lst_words = 0;
+
+int lst_open(const char* path, const char* source) {
+    lst_fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (lst_fp == NULL) return 1;
+    lst_addr = 0;
+    lst_block = lst_total = lst_words = 0;
+    fprintf(lst_fp, "; m4asm listing of %s\n", source);
+    fprintf(lst_fp, "; %5s  %-8s  %-19s  %-18s %3s %4s  %s\n", "line", "address", "words", "variant", "len", "cyc", "source");
+    return 0;
+}
+
+void lst_close() {
+    if (lst_fp == NULL) return;
+    fprintf(lst_fp, "; %ld cycles with every instruction run once, %ld words\n", lst_total, lst_words);
+    if (lst_fp != stdout) fclose(lst_fp);
+    lst_fp = NULL;
+}
+
+int lst_enabled() {
+    return lst_fp != NULL;
+}
+
+// Words [from, from+LST_WORDS) of data as hex.
+static void lst_hex(char* out, uint16_t *data, int n, int from) {
+    out[0] = 0;
+    for (int k=from;k<n && k<from+LST_WORDS;k++) {
+        sprintf(out + strlen(out), "%s%04x", k > from ? " " : "", hton16(data[k]));
+    }
+}
+
+void lst_stmt(struct stmt_t *st, struct assembled_insn_t *asi) {
+    if (lst_fp == NULL) return;
+    char hex[LST_WORDS*5 + 1];
+    char variant[40];
+
+    switch (st->kind) {
+    case STMT_ORG:
+        lst_addr = st->value;
+        fprintf(lst_fp, "%7d  %08X  %-19s  %-18s %3s %4s  %s\n", st->lineno, lst_addr, "", "", "", "", st->text);
+        break;
+    case STMT_LABEL:
+        fprintf(lst_fp, "%7d  %08X  %-19s  %-18s %3s %4s  %s", st->lineno, lst_addr, "", "", "", "", st->text);
+        fprintf(lst_fp, "    ; %ld cycles since the last label, %ld so far\n", lst_block, lst_total);
+        lst_block = 0;
+        break;
+    case STMT_ALIGN:
+    case STMT_FILL:
+        snprintf(variant, sizeof(variant), "%d x %04x", st->length, st->fill);
+        fprintf(lst_fp, "%7d  %08X  %-19s  %-18s %3d %4s  %s\n", st->lineno, st->addr, variant, "", st->length, "", st->text);
+        lst_addr = st->addr + st->length*2;
+        lst_words += st->length;
+        break;
+    case STMT_INSN:
+        if (asi == NULL) break;
+        lst_hex(hex, asi->data, asi->length, 0);
+        if (st->special) {
+            snprintf(variant, sizeof(variant), "%s", "ds");
+            fprintf(lst_fp, "%7d  %08X  %-19s  %-18s %3d %4s  %s\n", st->lineno, st->addr, hex, variant, asi->length, "", st->text);
+        } else {
+            // Length as encoded, cycles as the layout costed them: the
+            // table's length is wrong for some forms (popad).
+            struct insn_def_t *d = &insns[st->cand[st->rank]];
+            int cycles = cost_cycles(st->cand[st->rank]);
+            snprintf(variant, sizeof(variant), "%s %s (0x%02X)", d->mnemonic, d->params[0] ? d->params : "-", d->opcode);
+            fprintf(lst_fp, "%7d  %08X  %-19s  %-18s %3d %4d  %s\n", st->lineno, st->addr, hex, variant, asi->length, cycles, st->text);
+            lst_block += cycles;
+            lst_total += cycles;
+        }
+        for (int k=LST_WORDS;k<asi->length;k+=LST_WORDS) {
+            lst_hex(hex, asi->data, asi->length, k);
+            fprintf(lst_fp, "%7s  %08X  %s\n", "", st->addr + k*2, hex);
+        }
+        lst_addr = st->addr + asi->length*2;
+        lst_words += asi->length;
+        break;
+    case STMT_NONE:
+        break;
+    default:
+        fprintf(lst_fp, "%7d  %08X  %-19s  %-18s %3s %4s  %s\n", st->lineno, lst_addr, "", "", "", "", st->text);
+        break;
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef LISTING_H
+#define LISTING_H
+
+#include "stmt.h"
+
+// Assembly listing (-l): one line per statement with its address, encoded
+// words, the insns[] variant picked and its length and cycles, and cycle
+// subtotals at every label. Written from the encode loop as it goes.
+// Every call is a no-op unless lst_open() succeeded.
+
+int lst_open(const char* path, const char* source);
+void lst_close();
+int lst_enabled();
+// asi is the encoding of an instruction statement, NULL for the others.
+void lst_stmt(struct stmt_t *st, struct assembled_insn_t *asi);
+
+#endif
@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m4asm.h"
+#include "label.h"
+#include "stmt.h"
+#include "cost.h"
+#include "live.h"
+#include "insns.h"
+
+// Operand roles, one character per entry of insns[].params:
+//   u = register read, d = register written, b = read and written,
+//   p = register pair [rX:rX+1] read, - = not a register.
+// LIVE_PURE instructions have no effect besides their register and flag
+// writes and may be deleted when those are dead.
+#define LIVE_SETF 1     // writes the flags
+#define LIVE_USEF 2     // reads the flags
+#define LIVE_PURE 4
+#define LIVE_ALL 8      // may read every register (leaves the block)
+
+struct live_role {
+    unsigned short opcode;
+    const char* roles;
+    int flags;
+};
+
+static struct live_role live_roles[] = {
+    {OPC_NOP,           "",   0},
+    {OPC_JMP_FAR,       "-",  0},
+    {OPC_JMP_NEAR,      "-",  0},
+    {OPC_JMP_REL_POS,   "-",  0},
+    {OPC_JMP_REL_NEG,   "-",  0},
+    {OPC_MOV_I2R_NEAR,  "d-", 0},
+    {OPC_MOV_I2R_FAR,   "d-", 0},
+    {OPC_MOV_R2M_FAR,   "-u", 0},
+    {OPC_MOV_R2M_NEAR,  "-u", 0},
+    {OPC_MOV_R2R,       "du", LIVE_PURE},
+    {OPC_MOV_R2A,       "u",  0},
+    {OPC_MOV_V2R,       "d-", LIVE_PURE},
+    {OPC_MOV_V2A,       "-",  0},
+    {OPC_MOV_D2R,       "d",  0},
+    {OPC_MOV_R2D,       "u",  0},
+    {OPC_ADD_RR,        "bu", LIVE_SETF | LIVE_PURE},
+    {OPC_ADD_RI,        "b-", LIVE_SETF | LIVE_PURE},
+    {OPC_ADC_RR,        "bu", LIVE_SETF | LIVE_USEF | LIVE_PURE},
+    {OPC_SUB_RR,        "bu", LIVE_SETF | LIVE_PURE},
+    {OPC_SUB_RI,        "b-", LIVE_SETF | LIVE_PURE},
+    {OPC_SUC_RR,        "bu", LIVE_SETF | LIVE_USEF | LIVE_PURE},
+    {OPC_SHR_RI,        "b-", LIVE_SETF | LIVE_PURE},
+    {OPC_SHL_RI,        "b-", LIVE_SETF | LIVE_PURE},
+    {OPC_ROR_RI,        "b-", LIVE_SETF | LIVE_PURE},
+    {OPC_ROL_RI,        "b-", LIVE_SETF | LIVE_PURE},
+    {OPC_NOT_R,         "b",  LIVE_SETF | LIVE_PURE},
+    {OPC_INC_R,         "b",  LIVE_SETF | LIVE_PURE},
+    {OPC_DEC_R,         "b",  LIVE_SETF | LIVE_PURE},
+    {OPC_DEC2_R,        "b",  LIVE_SETF | LIVE_PURE},
+    {OPC_INC2_R,        "b",  LIVE_SETF | LIVE_PURE},
+    {OPC_AND_RR,        "bu", LIVE_SETF | LIVE_PURE},
+    {OPC_OR_RR,         "bu", LIVE_SETF | LIVE_PURE},
+    {OPC_NOR_RR,        "bu", LIVE_SETF | LIVE_PURE},
+    {OPC_XOR_RR,        "bu", LIVE_SETF | LIVE_PURE},
+    {OPC_NAND_RR,       "bu", LIVE_SETF | LIVE_PURE},
+    {OPC_XNOR_RR,       "bu", LIVE_SETF | LIVE_PURE},
+    {OPC_CMP_RR,        "uu", LIVE_SETF | LIVE_PURE},
+    {OPC_AND_RI,        "b-", LIVE_SETF | LIVE_PURE},
+    {OPC_OR_RI,         "b-", LIVE_SETF | LIVE_PURE},
+    {OPC_NOR_RI,        "b-", LIVE_SETF | LIVE_PURE},
+    {OPC_XOR_RI,        "b-", LIVE_SETF | LIVE_PURE},
+    {OPC_NAND_RI,       "b-", LIVE_SETF | LIVE_PURE},
+    {OPC_XNOR_RI,       "b-", LIVE_SETF | LIVE_PURE},
+    {OPC_PUSHB_FAR,     "-",  0},
+    {OPC_PUSHW_FAR,     "-",  0},
+    {OPC_PUSHW_NEAR,    "-",  0},
+    {OPC_PUSH_REG,      "u",  0},
+    {OPC_SSP,           "-",  LIVE_ALL},
+    {OPC_POP_REG,       "d",  0},
+    {OPC_POP_FAR,       "-",  0},
+    {OPC_POP_AD,        "",   0},
+    {OPC_POP_NEAR,      "-",  0},
+    {OPC_CALL_FAR,      "-",  LIVE_ALL},
+    {OPC_CALL_NEAR,     "-",  LIVE_ALL},
+    {OPC_RET,           "",   LIVE_ALL},
+    {OPC_IEN,           "",   0},
+    {OPC_SINT,          "",   LIVE_ALL},
+    {OPC_MMOV_ST,       "-u", 0},
+    {OPC_MMOV_LD,       "d-", 0},
+    {OPC_IMOV_LD,       "d-", 0},
+    {OPC_IMOV_ST,       "-u", 0},
+    {OPC_IMOV_ST_IMM,   "--", 0},
+    {OPC_BRCH_FLG_FAR,  "--", LIVE_USEF},
+    {OPC_BRCH_FLG_NEAR, "--", LIVE_USEF},
+    {OPC_BRCH_IV_FAR,   "--", LIVE_USEF},
+    {OPC_BRCH_IV_NEAR,  "--", LIVE_USEF},
+    {OPC_MOV_RSA,       "pu", 0},
+    {OPC_IMOV_RSA,      "pu", 0},
+    {OPC_MMOV_RSA,      "pu", 0},
+    {OPC_MOV_RSA_LOAD,  "dp", 0},
+    {OPC_MMOV_RSA_LOAD, "dp", 0},
+    {0, NULL, 0}
+};
+
+#define LIVE_FLAGS (1u << 16)
+#define LIVE_EVERY 0x1FFFFu
+
+#define LIVE_K_OTHER 0
+#define LIVE_K_JMP 1
+#define LIVE_K_BRCH 2
+#define LIVE_K_CALL 3
+#define LIVE_K_RET 4
+#define LIVE_K_PUSH 5
+#define LIVE_K_POP 6
+#define LIVE_K_OPAQUE 7 // other stack manipulation, sint
+#define LIVE_K_DATA 8
+
+struct live_insn {
+    uint32_t use;
+    uint32_t def;
+    int pure;
+    int kind;
+    int reg;            // LIVE_K_PUSH/POP: the register
+    int target;         // jmp/brch/call: statement index of the label, -1 if unknown
+};
+
+struct live_label {
+    const char* name;
+    int len;
+    int idx;
+};
+
+struct live_ctx {
+    struct stmt_list *sl;
+    struct live_insn *in;
+    struct live_label *labels;
+    int nlabels;
+    int *blk;           // block of each statement
+    int nblk;
+    int *first;         // first statement of each block
+    uint32_t *live_in;
+    uint32_t *live_out;
+    uint32_t *clobber;  // per statement index of a routine label, 0 = not computed
+    int *visiting;
+};
+
+static struct live_role *live_role(unsigned short opcode) {
+    for (int i=0;live_roles[i].roles != NULL;i++) {
+        if (live_roles[i].opcode == opcode) return &live_roles[i];
+    }
+    return NULL;
+}
+
+static int live_label_cmp(const void* a, const void* b) {
+    const struct live_label *x = (const struct live_label*)a;
+    const struct live_label *y = (const struct live_label*)b;
+    int n = x->len < y->len ? x->len : y->len;
+    int c = strncmp(x->name, y->name, n);
+    return c != 0 ? c : x->len - y->len;
+}
+
+// Statement index of the label named by the first operand of st, -1 if the
+// operand is not a label of this program.
+static int live_target(struct live_ctx *lc, struct stmt_t *st) {
+    const char* s = strchr(st->text, ' ');
+    if (s == NULL) return -1;
+    s++;
+    if (*s == '@') s++;
+    struct live_label key;
+    key.name = s;
+    key.len = strcspn(s, ", ");
+    struct live_label *l = (struct live_label*)bsearch(&key, lc->labels, lc->nlabels, sizeof(struct live_label), live_label_cmp);
+    return l != NULL ? l->idx : -1;
+}
+
+static void live_describe(struct live_ctx *lc, int i, struct le_context *lctx) {
+    struct stmt_t *st = &lc->sl->v[i];
+    struct live_insn *li = &lc->in[i];
+    memset(li, 0, sizeof(*li));
+    li->target = -1;
+    if (st->kind != STMT_INSN) return;
+
+    int def = st->special ? -1 : st->cand[0];
+    if (def < 0 || insns[def].opcode == OPC_DW) {
+        li->kind = LIVE_K_DATA;
+        li->use = LIVE_EVERY;
+        return;
+    }
+
+    struct live_role *r = live_role(insns[def].opcode);
+    if (r == NULL) {
+        li->use = LIVE_EVERY;
+        return;
+    }
+
+    struct parsed_insn_t pi;
+    parse_insn(st->text, lctx, &pi);
+    for (int k=0;r->roles[k];k++) {
+        uint32_t bit = 1u << (pi.pvs[k].value & 0xF);
+        switch (r->roles[k]) {
+        case 'u': li->use |= bit; break;
+        case 'd': li->def |= bit; break;
+        case 'b': li->use |= bit; li->def |= bit; break;
+        case 'p': li->use |= bit | (bit << 1); break;
+        }
+    }
+    if (r->flags & LIVE_SETF) li->def |= LIVE_FLAGS;
+    if (r->flags & LIVE_USEF) li->use |= LIVE_FLAGS;
+    if (r->flags & LIVE_ALL) li->use = LIVE_EVERY;
+    li->pure = (r->flags & LIVE_PURE) != 0;
+
+    switch (insns[def].opcode) {
+    case OPC_JMP_FAR: case OPC_JMP_NEAR: case OPC_JMP_REL_POS: case OPC_JMP_REL_NEG:
+        li->kind = LIVE_K_JMP;
+        break;
+    case OPC_BRCH_FLG_FAR: case OPC_BRCH_FLG_NEAR: case OPC_BRCH_IV_FAR: case OPC_BRCH_IV_NEAR:
+        li->kind = LIVE_K_BRCH;
+        break;
+    case OPC_CALL_FAR: case OPC_CALL_NEAR:
+        li->kind = LIVE_K_CALL;
+        break;
+    case OPC_RET:
+        li->kind = LIVE_K_RET;
+        break;
+    case OPC_PUSH_REG:
+        li->kind = LIVE_K_PUSH;
+        li->reg = pi.pvs[0].value & 0xF;
+        break;
+    case OPC_POP_REG:
+        li->kind = LIVE_K_POP;
+        li->reg = pi.pvs[0].value & 0xF;
+        break;
+    case OPC_PUSHB_FAR: case OPC_PUSHW_FAR: case OPC_PUSHW_NEAR:
+    case OPC_POP_FAR: case OPC_POP_NEAR: case OPC_POP_AD: case OPC_SSP: case OPC_SINT:
+        li->kind = LIVE_K_OPAQUE;
+        break;
+    }
+    if (li->kind == LIVE_K_JMP || li->kind == LIVE_K_BRCH || li->kind == LIVE_K_CALL) {
+        li->target = live_target(lc, st);
+    }
+}
+
+// Splits the statement list into basic blocks: a block starts at a label
+// and after every jmp, brch, call, ret and data statement.
+static void live_blocks(struct live_ctx *lc) {
+    struct stmt_list *sl = lc->sl;
+    lc->nblk = 0;
+    int start = 1;
+    for (int i=0;i<sl->n;i++) {
+        if (sl->v[i].kind == STMT_LABEL) start = 1;
+        if (start) lc->first[lc->nblk++] = i;
+        lc->blk[i] = lc->nblk - 1;
+        start = 0;
+        if (sl->v[i].kind == STMT_INSN && lc->in[i].kind != LIVE_K_OTHER && lc->in[i].kind != LIVE_K_PUSH && lc->in[i].kind != LIVE_K_POP) start = 1;
+    }
+}
+
+static int live_last(struct live_ctx *lc, int b) {
+    return (b + 1 < lc->nblk ? lc->first[b+1] : lc->sl->n) - 1;
+}
+
+static uint32_t live_block_out(struct live_ctx *lc, int b) {
+    int last = live_last(lc, b);
+    for (;last >= lc->first[b] && lc->sl->v[last].kind != STMT_INSN;last--);
+    uint32_t next = b + 1 < lc->nblk ? lc->live_in[b+1] : LIVE_EVERY;
+    if (last < lc->first[b]) return next;
+
+    struct live_insn *li = &lc->in[last];
+    uint32_t tgt = li->target >= 0 ? lc->live_in[lc->blk[li->target]] : LIVE_EVERY;
+    switch (li->kind) {
+    case LIVE_K_JMP: return tgt;
+    case LIVE_K_BRCH: return tgt | next;
+    case LIVE_K_RET: return LIVE_EVERY;
+    case LIVE_K_DATA: return LIVE_EVERY;
+    default: return next;
+    }
+}
+
+static uint32_t live_transfer(struct live_ctx *lc, int b, uint32_t live) {
+    for (int i=live_last(lc, b);i>=lc->first[b];i--) {
+        if (lc->sl->v[i].kind != STMT_INSN) continue;
+        live = (live & ~lc->in[i].def) | lc->in[i].use;
+    }
+    return live;
+}
+
+static void live_solve(struct live_ctx *lc) {
+    for (int b=0;b<lc->nblk;b++) lc->live_in[b] = lc->live_out[b] = 0;
+    int changed;
+    do {
+        changed = 0;
+        for (int b=lc->nblk-1;b>=0;b--) {
+            lc->live_out[b] = live_block_out(lc, b);
+            uint32_t in = live_transfer(lc, b, lc->live_out[b]);
+            if (in != lc->live_in[b]) {
+                lc->live_in[b] = in;
+                changed = 1;
+            }
+        }
+    } while (changed);
+}
+
+// Registers (and flags) a routine may modify, found by walking from its
+// label to the first ret. Anything that leaves the straight line or moves
+// the stack in a way we cannot pair up counts as clobbering everything.
+static uint32_t live_clobber(struct live_ctx *lc, int label) {
+    if (label < 0) return LIVE_EVERY;
+    if (lc->clobber[label]) return lc->clobber[label];
+    if (lc->visiting[label]) return LIVE_EVERY;
+    lc->visiting[label] = 1;
+
+    uint32_t set = 0;
+    int depth = 0;
+    int i;
+    for (i=label+1;i<lc->sl->n;i++) {
+        if (lc->sl->v[i].kind != STMT_INSN) continue;
+        struct live_insn *li = &lc->in[i];
+        if (li->kind == LIVE_K_RET) break;
+        if (li->kind == LIVE_K_CALL) {
+            set |= live_clobber(lc, li->target);
+        } else if (li->kind == LIVE_K_PUSH) {
+            depth++;
+        } else if (li->kind == LIVE_K_POP) {
+            // Popping what the caller pushed means the pushed values are arguments.
+            if (--depth < 0) set = LIVE_EVERY;
+        } else if (li->kind != LIVE_K_OTHER) {
+            set = LIVE_EVERY;
+        }
+        if (set == LIVE_EVERY) break;
+        set |= li->def;
+    }
+    if (i == lc->sl->n || depth != 0) set = LIVE_EVERY;
+
+    lc->visiting[label] = 0;
+    lc->clobber[label] = set | LIVE_FLAGS;
+    return lc->clobber[label];
+}
+
+static int live_prev(struct stmt_list *sl, int i) {
+    for (i--;i>=0 && sl->v[i].kind == STMT_NONE;i--);
+    return i;
+}
+
+static int live_next(struct stmt_list *sl, int i) {
+    for (i++;i<sl->n && sl->v[i].kind == STMT_NONE;i++);
+    return i;
+}
+
+static void live_remove(struct stmt_list *sl, int i, int *cycles, int *words) {
+    *cycles += cost_cycles(sl->v[i].cand[0]);
+    *words += cost_length(sl->v[i].cand[0]);
+    sl->v[i].kind = STMT_NONE;
+}
+
+// Drops push rX / pop rX pairs wrapped directly around a call whose target
+// does not modify rX. Pairs are matched inside out.
+static int live_saves(struct live_ctx *lc, FILE* log) {
+    struct stmt_list *sl = lc->sl;
+    int total = 0;
+    for (int c=0;c<sl->n;c++) {
+        if (sl->v[c].kind != STMT_INSN || lc->in[c].kind != LIVE_K_CALL) continue;
+        uint32_t clob = live_clobber(lc, lc->in[c].target);
+        if (clob == LIVE_EVERY) continue;
+
+        int p = live_prev(sl, c);
+        int q = live_next(sl, c);
+        while (p >= 0 && q < sl->n
+            && sl->v[p].kind == STMT_INSN && lc->in[p].kind == LIVE_K_PUSH
+            && sl->v[q].kind == STMT_INSN && lc->in[q].kind == LIVE_K_POP
+            && lc->in[p].reg == lc->in[q].reg && !(clob & (1u << lc->in[p].reg))) {
+            int cycles = 0, words = 0;
+            if (log != NULL) {
+                fprintf(log, "line %d: save-restore: %s; %s around %s", sl->v[p].lineno, sl->v[p].text, sl->v[q].text, sl->v[c].text);
+            }
+            live_remove(sl, p, &cycles, &words);
+            live_remove(sl, q, &cycles, &words);
+            if (log != NULL) fprintf(log, " (cycles %+d, words %+d)\n", -cycles, -words);
+            total++;
+            p = live_prev(sl, p);
+            q = live_next(sl, q);
+        }
+    }
+    return total;
+}
+
+// Deletes pure instructions whose results are never read, scanning each
+// block backwards from its live-out set.
+static int live_dead(struct live_ctx *lc, FILE* log) {
+    struct stmt_list *sl = lc->sl;
+    int total = 0;
+    for (int b=0;b<lc->nblk;b++) {
+        uint32_t live = lc->live_out[b];
+        for (int i=live_last(lc, b);i>=lc->first[b];i--) {
+            if (sl->v[i].kind != STMT_INSN) continue;
+            struct live_insn *li = &lc->in[i];
+            if (li->pure && li->def && !(li->def & live)) {
+                int cycles = 0, words = 0;
+                live_remove(sl, i, &cycles, &words);
+                if (log != NULL) fprintf(log, "line %d: dead-store: %s (cycles %+d, words %+d)\n", sl->v[i].lineno, sl->v[i].text, -cycles, -words);
+                total++;
+                continue;
+            }
+            live = (live & ~li->def) | li->use;
+        }
+    }
+    return total;
+}
+
+int opt_liveness(struct stmt_list *sl, struct le_context *lctx, int *saves, FILE* log) {
+    struct live_ctx lc;
+    memset(&lc, 0, sizeof(lc));
+    lc.sl = sl;
+    *saves = 0;
+
+    for (int i=0;i<sl->n;i++) {
+        if (sl->v[i].kind == STMT_LABEL) lc.nlabels++;
+    }
+    lc.labels = (struct live_label*)malloc(sizeof(struct live_label) * (lc.nlabels + 1));
+    lc.nlabels = 0;
+    for (int i=0;i<sl->n;i++) {
+        if (sl->v[i].kind != STMT_LABEL) continue;
+        lc.labels[lc.nlabels].name = sl->v[i].text;
+        lc.labels[lc.nlabels].len = strlen(sl->v[i].text) - 1;
+        lc.labels[lc.nlabels].idx = i;
+        lc.nlabels++;
+    }
+    qsort(lc.labels, lc.nlabels, sizeof(struct live_label), live_label_cmp);
+
+    lc.in = (struct live_insn*)calloc(sl->n + 1, sizeof(struct live_insn));
+    lc.blk = (int*)calloc(sl->n + 1, sizeof(int));
+    lc.first = (int*)calloc(sl->n + 1, sizeof(int));
+    lc.live_in = (uint32_t*)calloc(sl->n + 1, sizeof(uint32_t));
+    lc.live_out = (uint32_t*)calloc(sl->n + 1, sizeof(uint32_t));
+    lc.clobber = (uint32_t*)calloc(sl->n + 1, sizeof(uint32_t));
+    lc.visiting = (int*)calloc(sl->n + 1, sizeof(int));
+
+    for (int i=0;i<sl->n;i++) live_describe(&lc, i, lctx);
+
+    int total = 0;
+    // Deleting code would move hand-computed branch targets.
+    if (stmt_branches_all_labels(sl)) {
+        *saves = live_saves(&lc, log);
+        live_blocks(&lc);
+        int n;
+        do {
+            live_solve(&lc);
+            n = live_dead(&lc, log);
+            total += n;
+        } while (n > 0);
+    } else if (log != NULL) {
+        fprintf(log, "liveness: skipped, program branches to non-label addresses\n");
+    }
+
+    free(lc.labels);
+    free(lc.in);
+    free(lc.blk);
+    free(lc.first);
+    free(lc.live_in);
+    free(lc.live_out);
+    free(lc.clobber);
+    free(lc.visiting);
+
+    stmt_compact(sl);
+    return total;
+}
@@ -0,0 +1,13 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <stdio.h>
+#include "label.h"
+#include "stmt.h"
+
+// Register liveness over basic blocks. Removes dead register writes and
+// push/pop pairs around calls that leave the saved register alone.
+// Returns the number of dead stores removed; *saves gets the pair count.
+int opt_liveness(struct stmt_list *sl, struct le_context *lctx, int *saves, FILE* log);
+
+#endif
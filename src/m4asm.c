@@ -4,179 +4,52 @@
 #include <errno.h>
 #include <pcre.h>
 #include "lib/endianness/endianness.h"
-#include "lib/getopt/getopt.h"
 #include "lib/strsep/strsep.h"
 #include "label.h"
+#include "stats.h"
+#include "cost.h"
 #include "m4asm.h"
 #include "insns.h"
 
-void usage(char** argv) {
-    fprintf(stderr, "Usage: %s [-i file] [-o file] [-f binary/logisim]\n", argv[0]);
-    exit(EXIT_FAILURE);
-}
-
-int main(int argc, char** argv) {
-    printf("m4asm (C) Charlie Camilleri 2023\n");
-    printf("Version 0.9\n\n");
-
-    char *infile = NULL;
-    char *outfile = NULL;
-    int opt;
-    int outformat = OUTFMT_BINARY;
-
-    while ((opt = getopt(argc, argv, "i:o:f:")) != -1) {
-        switch (opt) {
-        case 'i': 
-            infile = strdup(optarg);
-            break;
-        case 'o': 
-            outfile = strdup(optarg);
-            break;
-        case 'f':
-            if (strcmp(optarg,"logisim") == 0) {
-                outformat = OUTFMT_LOGISIM;
-            } else if (strcmp(optarg, "binary") == 0) {
-                outformat = OUTFMT_BINARY;
-            } else {
-                usage(argv);
-            }
-            break;
-        default:
-            usage(argv);
-        }
-    }
-
-    if (infile == NULL || outfile == NULL) {
-        usage(argv);
-    }
-
-    printf("Reading %s\n", infile);
-    FILE* fp = fopen(infile, "r");
-    if (fp == NULL) {
-        perror("fopen()");
-        exit(-errno);
-    }
-    char *line_ = (char*)malloc(32768);
-
-    struct le_context lctx = le_init_context();
-
-    fseek(fp, 0, SEEK_SET);
-    while (fgets(line_, 32768, fp)) {
-        if (ferror(fp)) {
-            fclose(fp);
-            perror("Reading file");
-            exit(-errno);
-        }
-        char* line = collapse_spaces(line_);
-        line[strcspn(line, "\r\n")] = 0;
-        le_initial_count(line, &lctx);
-        free(line);
-    }
-    le_allocate_labels(&lctx);
-
-    fseek(fp, 0, SEEK_SET);
-    int insns = 0;
-    uint32_t addr = 0;
-    while (fgets(line_, 32768, fp)) {
-        if (ferror(fp)) {
-            fclose(fp);
-            perror("Reading file");
+void write_insn(FILE* fp, int outformat, struct assembled_insn_t *in, uint32_t *a) {
+    if (outformat == OUTFMT_BINARY) {
+        if (fwrite(in->data, 2, in->length, fp) != in->length) {
+            perror("fwrite");
             exit(-errno);
         }
-        char* line = collapse_spaces(line_);
-        line[strcspn(line, "\r\n")] = 0;
-        if ((memcmp(line, "$ORG ", 5) == 0 || memcmp(line, "$org ", 5) == 0) && strlen(line)>5) {
-            struct parsed_int_t pp = getintval(line + 5);
-            if (pp.code != 0) {
-                fprintf(stderr, "Error: Invalid origin specified: %s\n", line);
-                exit(EXIT_FAILURE);
-            }
-            addr = pp.value&0xFFFFFFFF;
-        } else {
-            if (strlen(line) > 2 && le_parse_label(line, addr, &lctx, 1) && line[0] != ';') {
-                struct assembled_insn_t asi = parse_and_assemble_insn(line, &lctx);
-                if (asi.length > 0) insns ++;
-                addr += asi.length*2;
-            }
-        }
-        free(line);
-    }
-
-    fseek(fp, 0, SEEK_SET);
-    lctx.stage = 1;
-
-    struct assembled_insn_t *assembled = (struct assembled_insn_t*)malloc(sizeof(struct assembled_insn_t) * insns);
-    int c = 0;
-    while (fgets(line_, 32768, fp)) {
         if (ferror(fp)) {
-            fclose(fp);
-            perror("Reading file");
             exit(-errno);
         }
-        char* line = collapse_spaces(line_);
-        line[strcspn(line, "\r\n")] = 0;
-        if (strlen(line) > 2 && !le_valid_label(line) && memcmp(line, "$org ",5)!=0 && memcmp(line, "$org ",5)!=0 && line[0] != ';') { 
-            struct assembled_insn_t asi = parse_and_assemble_insn(line, &lctx);
-            if (asi.length > 0) {
-                assembled[c] = asi;
-                c++;
-            }
-        }
-        free(line);
-    }
-
-    fclose(fp);
-
-    fp = fopen(outfile, "wb");
-    if (fp == NULL) {
-        perror("Opening output file");
-        exit(-errno);
-    }
-
-    if (outformat == OUTFMT_BINARY) {
-        for (int i=0;i<insns;i++) {
-            if (fwrite(assembled[i].data, 2, assembled[i].length, fp) != assembled[i].length) {
-                perror("fwrite");
-                exit(-errno);
-            }
-            if (ferror(fp)) {
-                exit(-errno);
-            }
-        }
     } else if (outformat == OUTFMT_LOGISIM) {
-        char* hdr = "v3.0 hex words addressed\n";
-        if (fwrite(hdr, 1, strlen(hdr), fp) != (strlen(hdr))) {
+        // 01234567: abcd dead f00d
+        char* outline = (char*)malloc(10 + (5 * in->length) + 2);
+        memset(outline, 0, 10 + (5 * in->length) + 2);
+        snprintf(outline, 10 + (5 * in->length) + 1, "%08X: ", *a);
+        for (int j=0;j<in->length;j++) {
+            char buf[6];
+            snprintf(buf, 6, "%04x ",hton16(in->data[j]));
+            memcpy(outline + 10 + (5*j), buf, 5);
+        }
+        outline[strlen(outline)-1] = '\n';
+        if (fwrite(outline, 1, strlen(outline), fp) != (strlen(outline))) {
             perror("fwrite");
             exit(-errno);
         }
 
-        uint32_t a = 0;
-        for (int i=0;i<insns;i++) {
-            // 01234567: abcd dead f00d
-            char* outline = (char*)malloc(10 + (5 * assembled[i].length) + 2);
-            memset(outline, 0, 10 + (5 * assembled[i].length) + 2);
-            snprintf(outline, 10 + (5 * assembled[i].length) + 1, "%08X: ", a);
-            for (int j=0;j<assembled[i].length;j++) {
-                char buf[6];
-                snprintf(buf, 6, "%04x ",hton16(assembled[i].data[j]));
-                memcpy(outline + 10 + (5*j), buf, 5);
-            }
-            outline[strlen(outline)-1] = '\n';
-            if (fwrite(outline, 1, strlen(outline), fp) != (strlen(outline))) {
-                perror("fwrite");
-                exit(-errno);
-            }
-
-            free(outline);
-            a += assembled[i].length;
-        }
+        free(outline);
     }
+    *a += in->length;
+}
 
-    fclose(fp);
-    free(assembled);
-    free(infile);
-    free(outfile);
-    le_free_labels(&lctx);
+// Writes count copies of word, as $align and $fill padding.
+void write_fill(FILE* fp, int outformat, uint16_t word, int count, uint32_t *a) {
+    struct assembled_insn_t pad;
+    while (count > 0) {
+        pad.length = count < 64 ? count : 64;
+        for (int i=0;i<pad.length;i++) pad.data[i] = hton16(word);
+        write_insn(fp, outformat, &pad, a);
+        count -= pad.length;
+    }
 }
 
 void print_assembled_insn(struct assembled_insn_t in) {
@@ -186,6 +59,40 @@ void print_assembled_insn(struct assembled_insn_t in) {
     }
 } 
 
+// Splits an instruction line into its mnemonic and parsed operands. The
+// first operand that is a bare label is remembered in sym/symidx so that
+// layout can pick a shorter form for it once addresses are known.
+void parse_insn(char* data, struct le_context *lctx, struct parsed_insn_t *pi) {
+    memset(pi, 0, sizeof(struct parsed_insn_t));
+    pi->symidx = -1;
+
+    char* token, *mustfree, *dup;
+    mustfree = dup = strdup(data);
+    int numflds = 0;
+    while ((token = strsep(&dup, " ")) && numflds < 16) {
+        if (numflds == 0) {
+            strncpy(pi->mnemonic, token, 15);
+            STRTOLOWER(pi->mnemonic);
+        } else {
+            struct parsed_param_t pp = parse_param(token, lctx);
+            if (pp.code != 0) {
+                fprintf(stderr, "Error parsing parameter: %s\n", token);
+                exit(EXIT_FAILURE);
+            }
+            pi->ptypes[numflds-1] = pp.type;
+            pi->pvs[numflds-1] = pp;
+            if (pp.sym && pi->symidx < 0) {
+                pi->symidx = numflds-1;
+                strncpy(pi->sym, token[0] == '[' ? token+1 : token, 32);
+                pi->sym[strcspn(pi->sym, ",]")] = 0;
+            }
+        }
+        numflds++;
+    }
+    pi->nparams = numflds > 0 ? numflds-1 : 0;
+    free(mustfree);
+}
+
 struct assembled_insn_t parse_and_assemble_insn(char* data, struct le_context *lctx) {
     struct assembled_insn_t ret;
     memset(&ret, 0, sizeof(ret));
@@ -193,59 +100,30 @@ struct assembled_insn_t parse_and_assemble_insn(char* data, struct le_context *l
     if ((ret = handle_special_cases(data)).length > 0) {
         return ret;
     } else {
+        struct parsed_insn_t pi;
+        parse_insn(data, lctx, &pi);
 
-        char* token, *mustfree, *dup;
-        mustfree = dup = strdup(data);
-        int numflds = 0;
-        char* values[16];
-        while ((token = strsep(&dup, " ")) && numflds < 16) {
-            values[numflds] = (char*)malloc(strlen(token) +1);
-            strcpy(values[numflds], token);
-            numflds++;
-        }
-
-        char ptypes[17];
-        struct parsed_param_t pvs[16];
-        memset(ptypes,0,17);
-        memset(pvs, 0, sizeof(struct parsed_param_t) * 16);
-
-        for (int i=1;i<numflds;i++) {
-            struct parsed_param_t pp = parse_param(values[i], lctx);
-            if (pp.code != 0) {
-                fprintf(stderr, "Error parsing parameter: %s\n", values[i]);
-                exit(EXIT_FAILURE);
-            }
-            ptypes[i-1] = pp.type;
-            pvs[i-1] = pp;
-        }
-
-        STRTOLOWER(values[0]);
-    
-        int c = 0;
-        struct insn_def_t cd, best;
-        best.cycles = 999;
-        while ((cd = insns[c]).mnemonic != NULL) {
-            c++;
-            if (strcmp(values[0], cd.mnemonic)!=0) continue;
-            if (strcmp(ptypes, cd.params)) continue;
-
-            if (cd.cycles < best.cycles) best = cd;
-        }
-
-        if (best.cycles == 999) {
-            fprintf(stderr, "Error: Cannot find instruction with mnemonic %s and ptypes [%s]\n", values[0], ptypes);
+        int best = find_insn(pi.mnemonic, pi.ptypes);
+        if (best < 0) {
+            fprintf(stderr, "Error: Cannot find instruction with mnemonic %s and ptypes [%s]\n", pi.mnemonic, pi.ptypes);
             exit(EXIT_FAILURE);
         }
 
-        int p0 = pvs[0].value;
-        int p1 = pvs[1].value;
-        int p2 = pvs[2].value;
-        int p3 = pvs[3].value;
+        return assemble_insn(insns[best].opcode, pi.pvs[0].value, pi.pvs[1].value, pi.pvs[2].value, pi.pvs[3].value);
+    }
+}
+
+// Returns the index in insns[] of the cheapest variant (under the current
+// cost model) of mnemonic taking exactly the given ptypes, or -1 if none.
+int find_insn(char* mnemonic, char* ptypes) {
+    int best = -1;
+    for (int c=0;insns[c].mnemonic != NULL;c++) {
+        if (strcmp(mnemonic, insns[c].mnemonic)!=0) continue;
+        if (strcmp(ptypes, insns[c].params)) continue;
 
-        for (int i=0;i<numflds;i++) free(values[i]);
-        free(mustfree);
-        return assemble_insn(best.opcode, p0, p1, p2, p3);
+        if (best < 0 || cost_less(c, best)) best = c;
     }
+    return best;
 }
 
 struct assembled_insn_t assemble_insn(int opcode, uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3) {
@@ -526,7 +404,7 @@ struct assembled_insn_t assemble_insn(int opcode, uint32_t p0, uint32_t p1, uint
             break;
         case OPC_BRCH_FLG_NEAR: // p0: addr, p1: flags to test
             ret.length = 2;
-            ret.data[0] = hton16(OPC_BRCH_FLG_FAR) | hton16((p1&0xFF)<<8);
+            ret.data[0] = hton16(OPC_BRCH_FLG_NEAR) | hton16((p1&0xFF)<<8);
             ret.data[1] = l16(p0);
             break;
         case OPC_BRCH_IV_FAR: // p0: addr, p1: IV to test
@@ -537,7 +415,7 @@ struct assembled_insn_t assemble_insn(int opcode, uint32_t p0, uint32_t p1, uint
             break;
         case OPC_BRCH_IV_NEAR: // p0: addr, p1: IV to test
             ret.length = 2;
-            ret.data[0] = hton16(OPC_BRCH_IV_FAR) | hton16((p1&0xFF)<<8);
+            ret.data[0] = hton16(OPC_BRCH_IV_NEAR) | hton16((p1&0xFF)<<8);
             ret.data[1] = l16(p0);
             break;
 
@@ -582,16 +460,20 @@ struct parsed_int_t getintval(char* f) {
 }
 
 struct parsed_param_t parse_param(char* p, struct le_context *lctx) {
-    pcre *pp_regex;
+    // Compiled once; compiling per call leaked a pattern for every operand.
+    static pcre *pp_regex = NULL;
 
     const char *error;
     int erroffset;
 
-    pp_regex = pcre_compile(REGEX_PTYPE_REGPAIR, 0, &error, &erroffset, NULL);
-    //int rc = pcre_exec(re, NULL, subject, strlen(subject), 0, 0, ovector, 30);
     if (pp_regex == NULL) {
-        printf("Error compiling regex: [%s] - %s\n",REGEX_PTYPE_REGPAIR,error);
-        exit(EXIT_FAILURE);
+        pp_regex = pcre_compile(REGEX_PTYPE_REGPAIR, 0, &error, &erroffset, NULL);
+        st_ctx.regex_compiles++;
+        //int rc = pcre_exec(re, NULL, subject, strlen(subject), 0, 0, ovector, 30);
+        if (pp_regex == NULL) {
+            fprintf(stderr, "Error compiling regex: [%s] - %s\n",REGEX_PTYPE_REGPAIR,error);
+            exit(EXIT_FAILURE);
+        }
     }
 
     char* cpy = strdup(p);
@@ -599,6 +481,7 @@ struct parsed_param_t parse_param(char* p, struct le_context *lctx) {
     struct parsed_param_t ret;
     ret.type = 'X';
     ret.code = 1;
+    ret.sym = 0;
     if (cpy[0] == '+' || cpy[0] == '-') {
         struct parsed_int_t iv = getintval(cpy+1);
         if (iv.code != 0 || iv.value > 0xFFFF) {
@@ -630,11 +513,11 @@ struct parsed_param_t parse_param(char* p, struct le_context *lctx) {
             if (rc == 3) {
                 const char *rX, *rY;
                 if ((rc= pcre_get_substring(p, ovector, 3, 1, &rX))<0) {
-                    printf("Error getting regex substring 1: %d\n", rc);
+                    fprintf(stderr, "Error getting regex substring 1: %d\n", rc);
                     exit(EXIT_FAILURE);
                 }
                 if ((rc= pcre_get_substring(p, ovector, 3, 2, &rY))<0) {
-                    printf("Error getting regex substring 2: %d\n", rc);
+                    fprintf(stderr, "Error getting regex substring 2: %d\n", rc);
                     exit(EXIT_FAILURE);
                 }
 
@@ -644,7 +527,7 @@ struct parsed_param_t parse_param(char* p, struct le_context *lctx) {
                 pcre_free_substring(rY);
 
                 if (Y != (X+1) || Y>15 || X >15 || Y < 0 || X < 0) {
-                    printf("Error: Invalid register pairing %s\n", p);
+                    fprintf(stderr, "Error: Invalid register pairing %s\n", p);
                     exit(EXIT_FAILURE);
                 }
 
@@ -652,10 +535,11 @@ struct parsed_param_t parse_param(char* p, struct le_context *lctx) {
                 ret.type = PTYPE_REGPAIR_PTR;
             } else {
                 if (rc<-1) {
-                    printf("Warning: REGEX_PTYPE_REGPAIR had unknown error while testing parameter %s. [rc=%d]\n",cpy,rc);
+                    fprintf(stderr, "Warning: REGEX_PTYPE_REGPAIR had unknown error while testing parameter %s. [rc=%d]\n",cpy,rc);
                 }
                 ret.value = le_get_label_addr(cpy+1, lctx);
                 ret.type = PTYPE_FAR_PTR;
+                ret.sym = 1;
             }
         } else {
             ret.value = iv.value&0xFFFFFFFF;
@@ -708,6 +592,7 @@ struct parsed_param_t parse_param(char* p, struct le_context *lctx) {
             } else {
                 ret.value = le_get_label_addr(cpy, lctx);
                 ret.type = PTYPE_DWORD_IMM;
+                ret.sym = 1;
             }
         } else {
             if (iv.value > 0xFFFF) {
@@ -724,49 +609,34 @@ struct parsed_param_t parse_param(char* p, struct le_context *lctx) {
     return ret;
 }
 
-char* collapse_spaces_part(char* str){
-    if (strlen(str) < 2) return strdup(str);
-    char prev = str[0];
-    for (int i=1;i<strlen(str);i++) {
-        char cur = str[i];
-        if (prev == cur && cur == ' ') {
-            char* ns = (char*)malloc(strlen(str));
-            memset(ns, 0, strlen(str));
-            memcpy(ns, str, i);
-            strcpy(ns+i, str+i+1);
-            return ns;
-        } 
-        prev = cur;
-    }
-    return str;
-}
-
+// Collapses every run of spaces to a single space, in one pass.
 char* collapse_spaces(char* str){
-    char* dup = strdup(str);
-    char* r = NULL;
-    int k = 0;
-    while (strcmp(r = collapse_spaces_part(dup), dup) != 0) {
-        free(dup);
-        dup = strdup(r);
-        free(r);
+    char* ret = (char*)malloc(strlen(str) + 1);
+    char* o = ret;
+    for (char* c = str; *c; c++) {
+        if (*c == ' ' && c != str && c[-1] == ' ') continue;
+        *o++ = *c;
     }
-    //free(dup);
-    return dup;
+    *o = 0;
+    return ret;
 }
 
 struct assembled_insn_t handle_special_cases(char* data) {
     struct assembled_insn_t ret;
     ret.length = 0;
 
-    pcre *re;
+    static pcre *re = NULL;
 
     const char *error;
     int erroffset;
 
-    re = pcre_compile(REGEX_DS, 0, &error, &erroffset, NULL);
     if (re == NULL) {
-        printf("Error compiling regex: [%s] - %s\n",REGEX_DS,error);
-        exit(EXIT_FAILURE);
+        re = pcre_compile(REGEX_DS, 0, &error, &erroffset, NULL);
+        st_ctx.regex_compiles++;
+        if (re == NULL) {
+            fprintf(stderr, "Error compiling regex: [%s] - %s\n",REGEX_DS,error);
+            exit(EXIT_FAILURE);
+        }
     }
 
     int ovector[30];
@@ -774,12 +644,12 @@ struct assembled_insn_t handle_special_cases(char* data) {
     if (rc == 3) {
         const char *val;
         if ((rc= pcre_get_substring(data, ovector, 3, 1, &val))<0) {
-            printf("Error getting regex substring 1: %d\n", rc);
+            fprintf(stderr, "Error getting regex substring 1: %d\n", rc);
             exit(EXIT_FAILURE);
         }
 
         if (strlen(val) > 64) {
-            printf("Error: string value too long! [value=%s]\n",val);
+            fprintf(stderr, "Error: string value too long! [value=%s]\n",val);
             exit(EXIT_FAILURE);
         }
 
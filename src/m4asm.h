@@ -7,24 +7,41 @@ typedef unsigned short uint16_t;
 #include "label.h"
 #include "lib/endianness/endianness.h"
 #include <ctype.h>
+#include <stdio.h>
 #include <pcre.h>
 #define STRTOLOWER(v) for (int i=0;i<strlen(v);i++) v[i]=tolower(v[i]);
 
 #define l16(x) (hton32(x)&0xFFFF0000)>>16
 #define u16(x) (hton32(x)&0xFFFF)
 
+struct parsed_insn_t;
+
 struct assembled_insn_t assemble_insn(int opcode, uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3);
+void parse_insn(char* data, struct le_context *lctx, struct parsed_insn_t *pi);
 struct assembled_insn_t parse_and_assemble_insn(char* data, struct le_context *lctx);
+int find_insn(char* mnemonic, char* ptypes);
 void print_assembled_insn(struct assembled_insn_t in);
 struct parsed_int_t getintval(char* f);
 struct parsed_param_t parse_param(char* p, struct le_context *lctx);
 char* collapse_spaces(char* str);
 struct assembled_insn_t handle_special_cases(char* data);
+void write_insn(FILE* fp, int outformat, struct assembled_insn_t *in, uint32_t *a);
+void write_fill(FILE* fp, int outformat, uint16_t word, int count, uint32_t *a);
 
 struct parsed_param_t {
     int code; // 0 = no error
     char type; // R = register, N = word, F = dword, n = [near address], f = [far address]
     uint32_t value;
+    char sym; // 1 if value is the address of a bare or [far] label (relaxable)
+};
+
+struct parsed_insn_t {
+    char mnemonic[16];
+    int nparams;
+    char ptypes[17];
+    struct parsed_param_t pvs[16];
+    int symidx;     // index of the first bare or [far] label operand, -1 if none
+    char sym[33];   // its label name
 };
 
 #define OUTFMT_BINARY 0
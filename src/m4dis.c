@@ -0,0 +1,328 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "lib/getopt/getopt.h"
+#include "m4asm.h"
+#include "sim.h"
+#include "image.h"
+#include "srcmap.h"
+#include "insns.h"
+
+// Disassembles an m4asm image (binary or -f logisim output) back to
+// source that m4asm --no-relax assembles to the same words. Words that do
+// not decode to an instruction the assembler would write the same way
+// (undefined opcodes, stray bits outside the operand fields, operands the
+// syntax cannot express, an instruction cut off by the end of the image)
+// come out as dw.
+//
+// Given the image's listing (-l), the listing's data lines come out as
+// dw, labels are defined where they fall on an instruction, and operands
+// that hit one are written with it: (label) and [label] for memory
+// operands, @label and label for jump, call and branch targets.
+// Relaxation would turn those far forms near again, hence --no-relax.
+//
+// -a prefixes every line with its address and words, which is for
+// reading, not reassembling.
+
+#define DIS_OUT (1 << 16)
+#define DIS_LINE 256            // longest line written
+
+// The opcode byte dispatch table, from insns[] and the encoder's field
+// layout.
+struct dis_op {
+    const char* mnemonic;
+    const char* params;
+    int length;                 // 0 = not an opcode
+    int target;                 // operand 0 is a code address
+    uint16_t fixed;
+    uint16_t fixedmask;
+    struct sim_field f[2];
+};
+
+struct dis {
+    struct img img;
+    uint32_t base;
+    struct srcmap map;
+    unsigned char *len;         // per word: words of what starts there, 0 inside one
+    unsigned char *placed;      // per label: defined in the output
+    int addrs;
+    char* out;
+    char* o;
+};
+
+static struct dis_op dis_ops[256];
+
+#define DIS_DW 0x80             // len flag: dw
+
+void usage(char** argv) {
+    fprintf(stderr, "Usage: %s [-b base] [-l listing] [-a] [-o file] image\n", argv[0]);
+    exit(EXIT_FAILURE);
+}
+
+static void dis_tables() {
+    for (int o=0;o<256;o++) {
+        const struct sim_form *fm = sim_form(o);
+        struct dis_op *op = &dis_ops[o];
+        if (fm->def < 0) continue;
+        op->mnemonic = insns[fm->def].mnemonic;
+        op->params = insns[fm->def].params;
+        op->length = fm->length;
+        op->fixed = fm->fixed;
+        op->fixedmask = fm->fixedmask;
+        memcpy(op->f, fm->f, sizeof(op->f));
+        op->target = o == OPC_JMP_FAR || o == OPC_JMP_NEAR || o == OPC_CALL_FAR || o == OPC_CALL_NEAR ||
+            o == OPC_BRCH_FLG_FAR || o == OPC_BRCH_FLG_NEAR || o == OPC_BRCH_IV_FAR || o == OPC_BRCH_IV_NEAR;
+    }
+}
+
+// Operand values of the instruction at word i, as assemble_insn() takes
+// them. Returns its length, or 0 if it has to be written as dw.
+static int dis_decode(struct dis *d, long i, uint32_t p[2]) {
+    const uint16_t *w = d->img.words + i;
+    struct dis_op *op = &dis_ops[w[0] & 0xFF];
+    if (op->length == 0 || (w[0] & op->fixedmask) != op->fixed || i + op->length > d->img.n) return 0;
+    for (int k=0;op->params[k];k++) {
+        const struct sim_field *f = &op->f[k];
+        if (f->word == 0) p[k] = (w[0] >> f->shift) & f->mask;
+        else p[k] = f->word > 0 ? w[f->word] : 0;
+        if (f->hi > 0) p[k] |= (uint32_t)w[f->hi] << 16;
+
+        switch (op->params[k]) {
+        case PTYPE_REGPAIR_PTR:
+            if (p[k] == 15) return 0;           // [r15:r16]
+            break;
+        case PTYPE_RELATIVE_POS:
+            if (p[k] > 0xFFFD) return 0;        // written as +(p+2)
+            break;
+        case PTYPE_RELATIVE_NEG:
+            if (p[k] < 2) return 0;             // written as -(p-2)
+            break;
+        }
+    }
+    return op->length;
+}
+
+static char* dis_hex(char* o, uint32_t v, int digits) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (int k=digits-1;k>=0;k--) o[digits-1-k] = hex[(v >> (4*k)) & 0xF];
+    return o + digits;
+}
+
+static char* dis_dec(char* o, uint32_t v) {
+    char t[10];
+    int n = 0;
+    do {
+        t[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) *o++ = t[--n];
+    return o;
+}
+
+static char* dis_str(char* o, const char* s) {
+    while (*s) *o++ = *s++;
+    return o;
+}
+
+static void dis_flush(struct dis *d, FILE* fp, int force) {
+    if (!force && d->o - d->out < DIS_OUT - DIS_LINE) return;
+    if (fwrite(d->out, 1, d->o - d->out, fp) != (size_t)(d->o - d->out)) {
+        perror("fwrite");
+        exit(-errno);
+    }
+    d->o = d->out;
+}
+
+// The label to write for an operand value, NULL if none.
+static const char* dis_label(struct dis *d, uint32_t v) {
+    int k = srcmap_label_at(&d->map, v);
+    if (k < 0) return NULL;
+    for (;k < d->map.nlabels && d->map.labels[k].addr == v;k++) {
+        if (d->placed[k]) return d->map.labels[k].name;
+    }
+    return NULL;
+}
+
+static char* dis_operand(struct dis *d, char* o, char type, uint32_t v, int target) {
+    const char* l = NULL;
+    switch (type) {
+    case PTYPE_REGISTER:
+        *o++ = 'r';
+        return dis_dec(o, v);
+    case PTYPE_WORD_IMM:
+        if (target && (l = dis_label(d, v)) != NULL) {
+            *o++ = '@';
+            return dis_str(o, l);
+        }
+        return dis_hex(dis_str(o, "0x"), v, 4);
+    case PTYPE_DWORD_IMM:
+        // A bare r... or d... would parse as a register or a dword.
+        if (target && (l = dis_label(d, v)) != NULL && l[0] != 'r' && l[0] != 'd') return dis_str(o, l);
+        return dis_hex(dis_str(o, "d0x"), v, 8);
+    case PTYPE_NEAR_PTR:
+        *o++ = '(';
+        if ((l = dis_label(d, v)) != NULL) o = dis_str(o, l);
+        else o = dis_hex(dis_str(o, "0x"), v, 4);
+        *o++ = ')';
+        return o;
+    case PTYPE_FAR_PTR:
+        *o++ = '[';
+        if ((l = dis_label(d, v)) != NULL) o = dis_str(o, l);
+        else o = dis_hex(dis_str(o, "0x"), v, 8);
+        *o++ = ']';
+        return o;
+    case PTYPE_REGPAIR_PTR:
+        o = dis_dec(dis_str(o, "[r"), v);
+        o = dis_dec(dis_str(o, ":r"), v + 1);
+        *o++ = ']';
+        return o;
+    case PTYPE_RELATIVE_POS:
+        *o++ = '+';
+        return dis_dec(o, v + 2);
+    case PTYPE_RELATIVE_NEG:
+        *o++ = '-';
+        return dis_dec(o, v - 2);
+    }
+    return o;
+}
+
+// First pass: where every instruction and dw starts, and which labels
+// can be defined.
+static void dis_layout(struct dis *d) {
+    long n = d->img.n;
+    d->len = (unsigned char*)calloc(n ? n : 1, 1);
+    d->placed = (unsigned char*)calloc(d->map.nlabels ? d->map.nlabels : 1, 1);
+    if (d->len == NULL || d->placed == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int ln = -1;
+    uint32_t p[2];
+    for (long i=0;i<n;) {
+        uint32_t a = d->base + 2*i;
+        while (ln + 1 < d->map.nlines && d->map.lines[ln+1].addr <= a) ln++;
+        int len = ln >= 0 && !d->map.lines[ln].insn ? 0 : dis_decode(d, i, p);
+        d->len[i] = len ? len : DIS_DW | 1;
+        i += len ? len : 1;
+    }
+
+    uint32_t end = d->base + 2*n;
+    for (int k=0;k<d->map.nlabels;k++) {
+        uint32_t a = d->map.labels[k].addr;
+        if (a < d->base || a > end || (a - d->base) % 2) continue;
+        d->placed[k] = a == end || d->len[(a - d->base) / 2] != 0;
+    }
+}
+
+static void dis_print(struct dis *d, FILE* fp, const char* path) {
+    d->out = (char*)malloc(DIS_OUT);
+    d->o = d->out;
+    fprintf(fp, "; m4dis %s: assemble with m4asm --no-relax\n", path);
+    if (d->base) fprintf(fp, "$org 0x%X\n", d->base);
+
+    int lb = 0;
+    uint32_t p[2];
+    for (long i=0;i<=d->img.n;i++) {
+        if (i < d->img.n && d->len[i] == 0) continue;
+        uint32_t a = d->base + 2*i;
+        for (;lb < d->map.nlabels && d->map.labels[lb].addr <= a;lb++) {
+            struct srcmap_label *l = &d->map.labels[lb];
+            if (l->addr < d->base) continue;
+            if (d->placed[lb]) {
+                d->o = dis_str(dis_str(d->o, l->name), ":\n");
+            } else {
+                d->o = dis_hex(dis_str(dis_str(dis_str(d->o, "; "), l->name), " = 0x"), l->addr, 8);
+                *d->o++ = '\n';
+            }
+            dis_flush(d, fp, 0);
+        }
+        if (i == d->img.n) break;
+
+        int len = d->len[i] & ~DIS_DW;
+        if (d->addrs) {
+            d->o = dis_str(dis_hex(d->o, a, 8), "  ");
+            for (int k=0;k<4;k++) {
+                if (k < len) d->o = dis_hex(d->o, d->img.words[i+k], 4);
+                else d->o = dis_str(d->o, "    ");
+                *d->o++ = ' ';
+            }
+            *d->o++ = ' ';
+        }
+        if (d->len[i] & DIS_DW) {
+            d->o = dis_hex(dis_str(d->o, "dw 0x"), d->img.words[i], 4);
+        } else {
+            struct dis_op *op = &dis_ops[d->img.words[i] & 0xFF];
+            dis_decode(d, i, p);
+            d->o = dis_str(d->o, op->mnemonic);
+            for (int k=0;op->params[k];k++) {
+                d->o = dis_str(d->o, k ? ", " : " ");
+                d->o = dis_operand(d, d->o, op->params[k], p[k], op->target && k == 0);
+            }
+        }
+        *d->o++ = '\n';
+        dis_flush(d, fp, 0);
+    }
+    dis_flush(d, fp, 1);
+    free(d->out);
+}
+
+int main(int argc, char** argv) {
+    struct dis d;
+    memset(&d, 0, sizeof(d));
+    const char* listing = NULL;
+    const char* output = "-";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:l:ao:")) != -1) {
+        switch (opt) {
+        case 'b': {
+            struct parsed_int_t iv = getintval(optarg);
+            if (iv.code != 0 || iv.value > 0xFFFFFFFFul || iv.value % 2) usage(argv);
+            d.base = iv.value;
+            break;
+        }
+        case 'l':
+            listing = optarg;
+            break;
+        case 'a':
+            d.addrs = 1;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage(argv);
+        }
+    }
+    if (optind != argc - 1) usage(argv);
+
+    if (img_load(argv[optind], &d.img) != 0) {
+        perror("Loading image");
+        exit(-errno);
+    }
+    if (listing != NULL && srcmap_load(&d.map, listing) != 0) {
+        perror("Loading listing");
+        exit(-errno);
+    }
+    FILE* fp = strcmp(output, "-") == 0 ? stdout : fopen(output, "w");
+    if (fp == NULL) {
+        perror(output);
+        exit(-errno);
+    }
+
+    dis_tables();
+    dis_layout(&d);
+    dis_print(&d, fp, argv[optind]);
+    if (fp != stdout && fclose(fp) != 0) {
+        perror(output);
+        exit(-errno);
+    }
+
+    free(d.len);
+    free(d.placed);
+    srcmap_free(&d.map);
+    img_free(&d.img);
+    return 0;
+}
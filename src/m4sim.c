@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "lib/getopt/getopt.h"
+#include "m4asm.h"
+#include "stats.h"
+#include "sim.h"
+#include "jit.h"
+#include "prof.h"
+#include "simtrace.h"
+#include "insns.h"
+
+// Runs an m4asm image (binary or -f logisim output) and prints the final
+// machine state. Exit status: 0 when the program stops by itself (sint,
+// outermost ret, jmp to itself), 2 when -n runs out, 1 otherwise. -T
+// records every instruction for m4trace; it steps the interpreter, so -j
+// has no effect with it.
+
+#define M4SIM_MAXDUMPS 16
+
+void usage(char** argv) {
+    fprintf(stderr, "Usage: %s [-b base] [-e entry] [-s sp] [-n max-insns] [-d addr,words] [-j] [-v]\n       [-l listing] [-p report] [-F collapsed] [-G profile] [-S period]\n       [-r snapshot] [-w snapshot] [-T trace] [image]\n", argv[0]);
+    exit(EXIT_FAILURE);
+}
+
+static uint32_t num(char** argv, char* s) {
+    struct parsed_int_t iv = getintval(s);
+    if (iv.code != 0 || iv.value > 0xFFFFFFFFul) usage(argv);
+    return (uint32_t)iv.value;
+}
+
+static void print_state(FILE* fp, struct sim *s) {
+    fprintf(fp, "stop %s at %08X\n", sim_stop_name(s->stop), s->pc);
+    fprintf(fp, "insns %llu\ncycles %llu\n", s->insns, s->cycles);
+    fprintf(fp, "pc %08X sp %08X a %04X d %04X flags %02X depth %d\n", s->pc, s->sp, s->a, s->d, s->flags, s->depth);
+    for (int i=0;i<16;i++) {
+        fprintf(fp, "r%-2d %04X%s", i, s->r[i], i % 8 == 7 ? "\n" : "  ");
+    }
+}
+
+static void prof_write(struct prof *prof, const char* path, void (*out)(struct prof*, FILE*)) {
+    if (path == NULL) return;
+    FILE* fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (fp == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    out(prof, fp);
+    if (fp != stdout) fclose(fp);
+}
+
+int main(int argc, char** argv) {
+    uint32_t base = 0;
+    uint32_t entry = 0;
+    int hasentry = 0;
+    uint32_t sp = 0;
+    int hassp = 0;
+    unsigned long long maxinsns = 0;
+    int verbose = 0;
+    int jit = 0;
+    uint32_t dumps[M4SIM_MAXDUMPS][2];
+    int ndumps = 0;
+    const char* listing = NULL;
+    const char* report = NULL;
+    const char* collapsed = NULL;
+    const char* profile = NULL;
+    unsigned long long period = 0;
+    const char* restore = NULL;
+    const char* save = NULL;
+    const char* trace = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:e:s:n:d:jvl:p:F:G:S:r:w:T:")) != -1) {
+        switch (opt) {
+        case 'b':
+            base = num(argv, optarg);
+            break;
+        case 'e':
+            entry = num(argv, optarg);
+            hasentry = 1;
+            break;
+        case 's':
+            sp = num(argv, optarg);
+            hassp = 1;
+            break;
+        case 'n': {
+            struct parsed_int_t iv = getintval(optarg);
+            if (iv.code != 0) usage(argv);
+            maxinsns = iv.value;
+            break;
+        }
+        case 'd': {
+            char* comma = strchr(optarg, ',');
+            if (comma == NULL || ndumps == M4SIM_MAXDUMPS) usage(argv);
+            *comma = 0;
+            dumps[ndumps][0] = num(argv, optarg);
+            dumps[ndumps][1] = num(argv, comma + 1);
+            ndumps++;
+            break;
+        }
+        case 'j':
+            jit = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'l':
+            listing = optarg;
+            break;
+        case 'p':
+            report = optarg;
+            break;
+        case 'F':
+            collapsed = optarg;
+            break;
+        case 'G':
+            profile = optarg;
+            break;
+        case 'r':
+            restore = optarg;
+            break;
+        case 'w':
+            save = optarg;
+            break;
+        case 'T':
+            trace = optarg;
+            break;
+        case 'S': {
+            struct parsed_int_t iv = getintval(optarg);
+            if (iv.code != 0 || iv.value == 0) usage(argv);
+            period = iv.value;
+            break;
+        }
+        default:
+            usage(argv);
+        }
+    }
+    if (optind != argc - 1 && !(restore != NULL && optind == argc)) usage(argv);
+    if (collapsed != NULL && period) {
+        fprintf(stderr, "Error: -F needs exact profiling, drop -S\n");
+        exit(EXIT_FAILURE);
+    }
+    if (profile != NULL && listing == NULL) {
+        fprintf(stderr, "Error: -G needs the image's listing (-l)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (trace != NULL && (report != NULL || collapsed != NULL || profile != NULL)) {
+        fprintf(stderr, "Error: -T cannot be combined with profiling\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct prof *prof = NULL;
+    if (report != NULL || collapsed != NULL || profile != NULL) {
+        prof = prof_new(period);
+        if (listing != NULL && prof_listing(prof, listing) != 0) {
+            perror("Loading listing");
+            exit(-errno);
+        }
+    }
+
+    struct sim s;
+    sim_init(&s);
+    if (restore != NULL && sim_restore(&s, restore) < 0) {
+        perror("Loading snapshot");
+        exit(-errno);
+    }
+    if (optind < argc && sim_load(&s, argv[optind], base) < 0) {
+        perror("Loading image");
+        exit(-errno);
+    }
+    if (restore == NULL || hasentry) s.pc = hasentry ? entry : base;
+    if (restore == NULL || hassp) s.sp = sp;
+
+    struct trc_writer *trc = NULL;
+    if (trace != NULL && (trc = trc_create(trace)) == NULL) {
+        perror(trace);
+        exit(-errno);
+    }
+
+    double t0 = st_wall_time();
+    if (trc != NULL) trc_run(trc, &s, maxinsns);
+    else if (prof != NULL) prof_run(prof, &s, maxinsns, jit ? jit_run : sim_run);
+    else if (jit) jit_run(&s, maxinsns);
+    else sim_run(&s, maxinsns);
+    double t = st_wall_time() - t0;
+
+    print_state(stdout, &s);
+    for (int k=0;k<ndumps;k++) {
+        for (uint32_t w=0;w<dumps[k][1];w++) {
+            if (w % 8 == 0) printf("%s%08X:", w ? "\n" : "", dumps[k][0] + w*2);
+            printf(" %04X", sim_read16(&s.mem, dumps[k][0] + w*2));
+        }
+        if (dumps[k][1]) printf("\n");
+    }
+    if (verbose) {
+        fprintf(stderr, "%llu instructions, %llu cycles in %.3f s (%.1f M instructions/s), %lu pages\n",
+            s.insns, s.cycles, t, t > 0 ? s.insns / t / 1e6 : 0.0, s.mem.npages);
+        if (jit) jit_report(stderr);
+    }
+
+    if (trc != NULL && trc_finish(trc, &s) < 0) {
+        perror("Writing trace");
+        exit(-errno);
+    }
+    if (save != NULL && sim_save(&s, save) < 0) {
+        perror("Saving snapshot");
+        exit(-errno);
+    }
+    if (prof != NULL) {
+        prof_write(prof, report, prof_report);
+        prof_write(prof, collapsed, prof_collapsed);
+        prof_write(prof, profile, prof_pgo);
+        prof_free(prof);
+    }
+
+    int status = s.stop == SIM_STOP_LIMIT ? 2 : (s.stop == SIM_STOP_SINT || s.stop == SIM_STOP_RET || s.stop == SIM_STOP_HALT) ? 0 : 1;
+    sim_free(&s);
+    jit_free();
+    return status;
+}
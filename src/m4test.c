@@ -0,0 +1,654 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "lib/getopt/getopt.h"
+#include "m4asm.h"
+#include "stats.h"
+#include "sim.h"
+#include "image.h"
+#include "inline.h"
+#include "jit.h"
+#include "insns.h"
+
+#ifdef _WIN32
+#include <windows.h>
+static CRITICAL_SECTION mt_lock;
+#define MT_LOCK() EnterCriticalSection(&mt_lock)
+#define MT_UNLOCK() LeaveCriticalSection(&mt_lock)
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+static pthread_mutex_t mt_lock = PTHREAD_MUTEX_INITIALIZER;
+#define MT_LOCK() pthread_mutex_lock(&mt_lock)
+#define MT_UNLOCK() pthread_mutex_unlock(&mt_lock)
+#endif
+
+// Regression runner: assembles every test in-process, runs each one in its
+// own simulator on a pool of threads and checks the final state against
+// the test's expectations. Exit status is 0 if every test passed.
+//
+// Expectations are comments in the test source, one per line (other
+// comments are ignored):
+//   ; expect r3 = 0x10         also a, d, pc, sp, flags, depth
+//   ; expect [0x200] = 5       main-memory word
+//   ; expect stop = sint       sint, ret, halt, limit, illegal, align
+//   ; expect cycles = 120      also insns
+//   ; limit 5000               instruction limit for this test
+//   ; options -O --inline=20   m4asm passes: -O, --inline[=N],
+//                              --place-data, --no-relax
+// Instructions and cycles are counted from the start of the test.
+// Without a stop expectation the program has to stop by itself (sint,
+// outermost ret or jmp to itself) within the limit.
+//
+// Assembly is done up front (the assembler keeps some state in globals and
+// exits on the first error). Outside Windows it runs in a child process
+// that sends the images back over a pipe; a test the assembler gives up on
+// ends the child, is reported as an error with the assembler's message,
+// and a new child carries on with the next test. On Windows an assembly
+// error stops the runner, as in m4asm. Tests that cannot be read or have
+// malformed expectations are errors too.
+//
+// -j runs every test with the block translator instead of the
+// interpreter, one at a time since it keeps its translations in globals.
+// With -r every test starts from a copy-on-write clone of the snapshot,
+// with its image loaded over it.
+
+#define MT_DEFAULT_LIMIT 1000000
+#define MT_MSG 256
+
+#define EX_REG 0
+#define EX_A 1
+#define EX_D 2
+#define EX_PC 3
+#define EX_SP 4
+#define EX_FLAGS 5
+#define EX_DEPTH 6
+#define EX_MEM 7
+#define EX_STOP 8
+#define EX_CYCLES 9
+#define EX_INSNS 10
+
+struct expect {
+    int kind;
+    int lineno;
+    uint32_t arg;           // register number or address
+    unsigned long long value;
+};
+
+struct test {
+    char* path;
+    struct img img;
+    struct expect *ex;
+    int nex;
+    int capex;
+    unsigned long long limit;
+    struct img_opts opts;
+    // results
+    int error;              // not run: could not be read or assembled
+    int failed;
+    char msg[MT_MSG];
+    double time;
+    int stop;
+    unsigned long long insns;
+    unsigned long long cycles;
+};
+
+static struct test *tests = NULL;
+static int ntests = 0;
+static int captests = 0;
+static int next_test = 0;
+static const char* assembling = NULL;
+
+static struct sim boot;
+static int has_boot = 0;
+static uint32_t base = 0;
+static uint32_t sp = 0;
+static int hassp = 0;
+static unsigned long long limit = MT_DEFAULT_LIMIT;
+static int use_jit = 0;
+
+void usage(char** argv) {
+    fprintf(stderr, "Usage: %s [-t threads] [-x junit.xml] [-n max-insns] [-b base] [-s sp] [-r snapshot] [-f list] [-j] [-v] test.asm...\n", argv[0]);
+    exit(EXIT_FAILURE);
+}
+
+static void mt_atexit() {
+    if (assembling != NULL) fprintf(stderr, "m4test: stopped while assembling %s\n", assembling);
+}
+
+static uint32_t num(char** argv, char* s) {
+    struct parsed_int_t iv = getintval(s);
+    if (iv.code != 0 || iv.value > 0xFFFFFFFFul) usage(argv);
+    return (uint32_t)iv.value;
+}
+
+static void add_test(const char* path) {
+    if (ntests == captests) {
+        captests = captests ? captests * 2 : 256;
+        tests = (struct test*)realloc(tests, sizeof(struct test) * captests);
+        if (tests == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct test *t = &tests[ntests++];
+    memset(t, 0, sizeof(*t));
+    t->path = strdup(path);
+    t->limit = limit;
+    t->opts.relax = 1;
+}
+
+static void add_expect(struct test *t, int kind, uint32_t arg, unsigned long long value, int lineno) {
+    if (t->nex == t->capex) {
+        t->capex = t->capex ? t->capex * 2 : 8;
+        t->ex = (struct expect*)realloc(t->ex, sizeof(struct expect) * t->capex);
+    }
+    struct expect *e = &t->ex[t->nex++];
+    e->kind = kind;
+    e->arg = arg;
+    e->value = value;
+    e->lineno = lineno;
+}
+
+static int stop_code(const char* name) {
+    for (int k=SIM_STOP_SINT;k<=SIM_STOP_ALIGN;k++) {
+        if (strcmp(name, sim_stop_name(k)) == 0) return k;
+    }
+    return -1;
+}
+
+static void bad_line(struct test *t, int lineno) {
+    if (t->error) return;
+    t->error = 1;
+    snprintf(t->msg, MT_MSG, "line %d: expected '; expect <what> = <value>' or '; options <m4asm options>'", lineno);
+}
+
+// "; options ..." as m4asm takes them; 0 if one is not supported.
+static int parse_options(struct test *t, char* s) {
+    for (char* o=strtok(s, " \t");o != NULL;o=strtok(NULL, " \t")) {
+        if (strcmp(o, "-O") == 0) {
+            t->opts.optimize = 1;
+        } else if (strcmp(o, "--inline") == 0) {
+            t->opts.inlinelimit = INLINE_DEFAULT_LIMIT;
+        } else if (strncmp(o, "--inline=", 9) == 0) {
+            struct parsed_int_t iv = getintval(o + 9);
+            if (iv.code != 0 || iv.value == 0) return 0;
+            t->opts.inlinelimit = (int)iv.value;
+        } else if (strcmp(o, "--place-data") == 0) {
+            t->opts.placedata = 1;
+        } else if (strcmp(o, "--no-relax") == 0) {
+            t->opts.relax = 0;
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// "; expect what = value", "; limit n" and "; options ..." comment lines.
+static void parse_expectations(struct test *t, FILE* fp) {
+    char buf[512];
+    int lineno = 0;
+    while (fgets(buf, sizeof(buf), fp)) {
+        lineno++;
+        buf[strcspn(buf, "\r\n")] = 0;
+        char* s = buf;
+        while (*s == ' ' || *s == '\t') s++;
+        if (*s != ';') continue;
+        s++;
+        char what[64], value[64];
+        if (sscanf(s, " limit %63s", value) == 1) {
+            struct parsed_int_t iv = getintval(value);
+            if (iv.code == 0) t->limit = iv.value;
+            continue;
+        }
+        while (*s == ' ' || *s == '\t') s++;
+        if (strncmp(s, "options ", 8) == 0) {
+            if (!parse_options(t, s + 8)) bad_line(t, lineno);
+            continue;
+        }
+        if (sscanf(s, " expect %63[^= ] = %63s", what, value) != 2) continue;
+
+        if (strcmp(what, "stop") == 0) {
+            int k = stop_code(value);
+            if (k < 0) bad_line(t, lineno);
+            else add_expect(t, EX_STOP, 0, k, lineno);
+            continue;
+        }
+        struct parsed_int_t iv = getintval(value);
+        if (iv.code != 0) {
+            bad_line(t, lineno);
+            continue;
+        }
+        if (what[0] == 'r' && what[1] >= '0' && what[1] <= '9' && atoi(what + 1) < 16) add_expect(t, EX_REG, atoi(what + 1), iv.value, lineno);
+        else if (strcmp(what, "a") == 0) add_expect(t, EX_A, 0, iv.value, lineno);
+        else if (strcmp(what, "d") == 0) add_expect(t, EX_D, 0, iv.value, lineno);
+        else if (strcmp(what, "pc") == 0) add_expect(t, EX_PC, 0, iv.value, lineno);
+        else if (strcmp(what, "sp") == 0) add_expect(t, EX_SP, 0, iv.value, lineno);
+        else if (strcmp(what, "flags") == 0) add_expect(t, EX_FLAGS, 0, iv.value, lineno);
+        else if (strcmp(what, "depth") == 0) add_expect(t, EX_DEPTH, 0, iv.value, lineno);
+        else if (strcmp(what, "cycles") == 0) add_expect(t, EX_CYCLES, 0, iv.value, lineno);
+        else if (strcmp(what, "insns") == 0) add_expect(t, EX_INSNS, 0, iv.value, lineno);
+        else if (what[0] == '[' && what[strlen(what)-1] == ']') {
+            what[strlen(what)-1] = 0;
+            struct parsed_int_t addr = getintval(what + 1);
+            if (addr.code != 0) bad_line(t, lineno);
+            else add_expect(t, EX_MEM, (uint32_t)addr.value, iv.value, lineno);
+        } else {
+            bad_line(t, lineno);
+        }
+    }
+}
+
+static void test_error(struct test *t, const char* msg) {
+    t->error = 1;
+    snprintf(t->msg, MT_MSG, "%s", msg);
+}
+
+// Reads the expectations; returns the open source, or NULL on an error.
+static FILE* prepare(struct test *t) {
+    FILE* fp = fopen(t->path, "r");
+    if (fp == NULL) {
+        test_error(t, strerror(errno));
+        return NULL;
+    }
+    parse_expectations(t, fp);
+    if (t->error) {
+        fclose(fp);
+        return NULL;
+    }
+    rewind(fp);
+    return fp;
+}
+
+#ifdef _WIN32
+static void assemble_all() {
+    for (int k=0;k<ntests;k++) {
+        struct test *t = &tests[k];
+        FILE* fp = prepare(t);
+        if (fp == NULL) continue;
+        assembling = t->path;
+        if (img_assemble_opts(fp, &t->opts, &t->img) != 0) test_error(t, strerror(errno));
+        assembling = NULL;
+        fclose(fp);
+    }
+}
+#else
+// Child side: assembles tests [k, ntests) and writes each as its index,
+// word count (-1 if unreadable) and words. Whatever the assembler prints
+// for a test goes to errf, and on to the real stderr once it is done.
+static void assemble_child(int k, int out, FILE* errf) {
+    int errfd = dup(2);
+    dup2(fileno(errf), 2);
+    FILE* op = fdopen(out, "wb");
+    for (;k<ntests;k++) {
+        struct test *t = &tests[k];
+        if (t->error) continue;
+        if (ftruncate(fileno(errf), 0) != 0 || lseek(fileno(errf), 0, SEEK_SET) != 0) _exit(EXIT_FAILURE);
+        FILE* fp = fopen(t->path, "r");
+        struct img img;
+        long n = -1;
+        assembling = t->path;
+        if (fp != NULL && img_assemble_opts(fp, &t->opts, &img) == 0) n = img.n;
+        assembling = NULL;
+        if (fp != NULL) fclose(fp);
+        if (fwrite(&k, sizeof(k), 1, op) != 1 || fwrite(&n, sizeof(n), 1, op) != 1 ||
+            (n > 0 && fwrite(img.words, sizeof(uint16_t), n, op) != (size_t)n)) _exit(EXIT_FAILURE);
+        if (n >= 0) img_free(&img);
+        fflush(op);
+
+        char buf[4096];
+        ssize_t r;
+        lseek(fileno(errf), 0, SEEK_SET);
+        while ((r = read(fileno(errf), buf, sizeof(buf))) > 0) {
+            if (write(errfd, buf, r) != r) break;
+        }
+    }
+    fclose(op);
+    _exit(0);
+}
+
+// The first line the assembler printed for the test it gave up on, and
+// all of it to stderr.
+static void assemble_failed(struct test *t, FILE* errf) {
+    char line[MT_MSG];
+    int first = 1;
+    rewind(errf);
+    test_error(t, "assembly failed");
+    while (fgets(line, sizeof(line), errf)) {
+        fputs(line, stderr);
+        line[strcspn(line, "\r\n")] = 0;
+        if (first && line[0]) test_error(t, line);
+        first = first && !line[0];
+    }
+}
+
+static void assemble_all() {
+    for (int k=0;k<ntests;k++) {
+        FILE* fp = prepare(&tests[k]);
+        if (fp != NULL) fclose(fp);
+    }
+
+    int k = 0;
+    while (k < ntests) {
+        int fds[2];
+        FILE* errf = tmpfile();
+        if (errf == NULL || pipe(fds) != 0) {
+            perror("m4test");
+            exit(-errno);
+        }
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(-errno);
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            assemble_child(k, fds[1], errf);
+        }
+        close(fds[1]);
+
+        FILE* in = fdopen(fds[0], "rb");
+        int j;
+        long n;
+        while (fread(&j, sizeof(j), 1, in) == 1 && fread(&n, sizeof(n), 1, in) == 1) {
+            struct test *t = &tests[j];
+            k = j + 1;
+            if (n < 0) {
+                test_error(t, "cannot read the source");
+                continue;
+            }
+            t->img.n = t->img.cap = n;
+            t->img.words = (uint16_t*)malloc(sizeof(uint16_t) * (n ? n : 1));
+            if (t->img.words == NULL || (long)fread(t->img.words, sizeof(uint16_t), n, in) != n) {
+                fprintf(stderr, "Error: lost the assembler process\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        fclose(in);
+        waitpid(pid, NULL, 0);
+
+        while (k < ntests && tests[k].error) k++;
+        if (k < ntests) assemble_failed(&tests[k++], errf);
+        fclose(errf);
+    }
+}
+#endif
+
+static unsigned long long actual(struct sim *s, struct expect *e) {
+    switch (e->kind) {
+    case EX_REG: return s->r[e->arg];
+    case EX_A: return s->a;
+    case EX_D: return s->d;
+    case EX_PC: return s->pc;
+    case EX_SP: return s->sp;
+    case EX_FLAGS: return s->flags;
+    case EX_DEPTH: return s->depth;
+    case EX_MEM: return sim_read16(&s->mem, e->arg);
+    case EX_STOP: return s->stop;
+    case EX_CYCLES: return s->cycles;
+    default: return s->insns;
+    }
+}
+
+static void describe(struct expect *e, char* out) {
+    static const char* names[] = {"r", "a", "d", "pc", "sp", "flags", "depth", "", "stop", "cycles", "insns"};
+    if (e->kind == EX_REG) sprintf(out, "r%u", e->arg);
+    else if (e->kind == EX_MEM) sprintf(out, "[0x%X]", e->arg);
+    else strcpy(out, names[e->kind]);
+}
+
+// s is a reset machine, and is reset again for the next test.
+static void run_test(struct test *t, struct sim *s) {
+    if (t->error) return;
+    double t0 = st_wall_time();
+    if (has_boot) sim_clone(s, &boot);
+    for (long i=0;i<t->img.n;i++) sim_write16(&s->mem, base + i*2, t->img.words[i]);
+    s->pc = base;
+    if (hassp || !has_boot) s->sp = sp;
+    s->insns = s->cycles = 0;
+
+    if (use_jit) {
+        jit_run(s, t->limit);
+        jit_free();
+    } else {
+        sim_run(s, t->limit);
+    }
+
+    t->stop = s->stop;
+    t->insns = s->insns;
+    t->cycles = s->cycles;
+    int stopped = 0;
+    for (int k=0;k<t->nex && !t->failed;k++) {
+        struct expect *e = &t->ex[k];
+        unsigned long long v = actual(s, e);
+        if (e->kind == EX_STOP) stopped = 1;
+        if (v == e->value) continue;
+        char what[32];
+        describe(e, what);
+        t->failed = 1;
+        if (e->kind == EX_STOP) snprintf(t->msg, MT_MSG, "line %d: stop is %s, expected %s", e->lineno, sim_stop_name(v), sim_stop_name(e->value));
+        else snprintf(t->msg, MT_MSG, "line %d: %s is 0x%llX, expected 0x%llX", e->lineno, what, v, e->value);
+    }
+    if (!t->failed && !stopped && s->stop != SIM_STOP_SINT && s->stop != SIM_STOP_RET && s->stop != SIM_STOP_HALT) {
+        t->failed = 1;
+        snprintf(t->msg, MT_MSG, "stop %s at %08X after %llu instructions", sim_stop_name(s->stop), s->pc, s->insns);
+    }
+    sim_reset(s);
+    t->time = st_wall_time() - t0;
+}
+
+// One machine per thread, reset between tests.
+#ifdef _WIN32
+static DWORD WINAPI worker(LPVOID arg) {
+#else
+static void* worker(void* arg) {
+#endif
+    struct sim s;
+    (void)arg;
+    sim_init(&s);
+    for (;;) {
+        MT_LOCK();
+        int k = next_test++;
+        MT_UNLOCK();
+        if (k >= ntests) break;
+        run_test(&tests[k], &s);
+    }
+    sim_free(&s);
+    return 0;
+}
+
+static int ncpus() {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+#endif
+}
+
+static void run_all(int nthreads) {
+    sim_tables();
+#ifdef _WIN32
+    InitializeCriticalSection(&mt_lock);
+    HANDLE *th = (HANDLE*)malloc(sizeof(HANDLE) * nthreads);
+    for (int i=0;i<nthreads;i++) th[i] = CreateThread(NULL, 0, worker, NULL, 0, NULL);
+    WaitForMultipleObjects(nthreads, th, TRUE, INFINITE);
+    for (int i=0;i<nthreads;i++) CloseHandle(th[i]);
+#else
+    pthread_t *th = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+    for (int i=0;i<nthreads;i++) {
+        if (pthread_create(&th[i], NULL, worker, NULL) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i=0;i<nthreads;i++) pthread_join(th[i], NULL);
+#endif
+    free(th);
+}
+
+static void xml_escaped(FILE* fp, const char* s) {
+    for (;*s;s++) {
+        switch (*s) {
+        case '<': fputs("&lt;", fp); break;
+        case '>': fputs("&gt;", fp); break;
+        case '&': fputs("&amp;", fp); break;
+        case '"': fputs("&quot;", fp); break;
+        default: fputc(*s, fp);
+        }
+    }
+}
+
+static void write_junit(FILE* fp, int failures, int errors, double total) {
+    fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(fp, "<testsuites tests=\"%d\" failures=\"%d\" errors=\"%d\" time=\"%.6f\">\n", ntests, failures, errors, total);
+    fprintf(fp, "  <testsuite name=\"m4test\" tests=\"%d\" failures=\"%d\" errors=\"%d\" time=\"%.6f\">\n", ntests, failures, errors, total);
+    for (int k=0;k<ntests;k++) {
+        struct test *t = &tests[k];
+        const char* slash = strrchr(t->path, '/');
+        fprintf(fp, "    <testcase classname=\"");
+        if (slash != NULL) {
+            char* dir = strdup(t->path);
+            dir[slash - t->path] = 0;
+            xml_escaped(fp, dir);
+            free(dir);
+        } else {
+            fprintf(fp, "m4test");
+        }
+        fprintf(fp, "\" name=\"");
+        xml_escaped(fp, slash != NULL ? slash + 1 : t->path);
+        fprintf(fp, "\" time=\"%.6f\">", t->time);
+        if (t->error) {
+            fprintf(fp, "\n      <error message=\"");
+            xml_escaped(fp, t->msg);
+            fprintf(fp, "\"/>\n    ");
+        } else if (t->failed) {
+            fprintf(fp, "\n      <failure message=\"");
+            xml_escaped(fp, t->msg);
+            fprintf(fp, "\">stop %s, %llu instructions, %llu cycles</failure>\n    ", sim_stop_name(t->stop), t->insns, t->cycles);
+        }
+        fprintf(fp, "</testcase>\n");
+    }
+    fprintf(fp, "  </testsuite>\n</testsuites>\n");
+}
+
+int main(int argc, char** argv) {
+    int nthreads = 0;
+    const char* junit = NULL;
+    const char* restore = NULL;
+    int verbose = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:x:n:b:s:r:f:jv")) != -1) {
+        switch (opt) {
+        case 't':
+            nthreads = num(argv, optarg);
+            break;
+        case 'x':
+            junit = optarg;
+            break;
+        case 'n': {
+            struct parsed_int_t iv = getintval(optarg);
+            if (iv.code != 0) usage(argv);
+            limit = iv.value;
+            break;
+        }
+        case 'b':
+            base = num(argv, optarg);
+            break;
+        case 's':
+            sp = num(argv, optarg);
+            hassp = 1;
+            break;
+        case 'r':
+            restore = optarg;
+            break;
+        case 'f': {
+            FILE* fp = strcmp(optarg, "-") == 0 ? stdin : fopen(optarg, "r");
+            if (fp == NULL) {
+                perror("Opening test list");
+                exit(-errno);
+            }
+            char buf[1024];
+            while (fgets(buf, sizeof(buf), fp)) {
+                buf[strcspn(buf, "\r\n")] = 0;
+                if (buf[0] != 0 && buf[0] != '#') add_test(buf);
+            }
+            if (fp != stdin) fclose(fp);
+            break;
+        }
+        case 'j':
+            use_jit = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv);
+        }
+    }
+    for (int i=optind;i<argc;i++) add_test(argv[i]);
+    if (ntests == 0) usage(argv);
+    if (nthreads <= 0) nthreads = ncpus();
+    if (nthreads > ntests) nthreads = ntests;
+    if (use_jit) nthreads = 1;
+
+    st_init(0);
+    atexit(mt_atexit);
+    sim_init(&boot);
+    if (restore != NULL) {
+        if (sim_restore(&boot, restore) < 0) {
+            perror("Loading snapshot");
+            exit(-errno);
+        }
+        has_boot = 1;
+    }
+
+    double t0 = st_wall_time();
+    assemble_all();
+    double t1 = st_wall_time();
+    run_all(nthreads);
+    double t2 = st_wall_time();
+
+    int failures = 0, errors = 0;
+    for (int k=0;k<ntests;k++) {
+        struct test *t = &tests[k];
+        if (t->error) {
+            errors++;
+            printf("ERROR %s: %s\n", t->path, t->msg);
+        } else if (t->failed) {
+            failures++;
+            printf("FAIL %s: %s\n", t->path, t->msg);
+        } else if (verbose) {
+            printf("ok   %s: %llu instructions, %llu cycles\n", t->path, t->insns, t->cycles);
+        }
+    }
+    printf("%d tests, %d failed, %d errors; assembled in %.3f s, ran in %.3f s on %d threads (%.1f us/test)\n",
+        ntests, failures, errors, t1 - t0, t2 - t1, nthreads, (t2 - t0) * 1e6 / ntests);
+
+    if (junit != NULL) {
+        FILE* fp = strcmp(junit, "-") == 0 ? stdout : fopen(junit, "w");
+        if (fp == NULL) {
+            perror("Opening JUnit report");
+            exit(-errno);
+        }
+        write_junit(fp, failures, errors, t2 - t0);
+        if (fp != stdout) fclose(fp);
+    }
+
+    for (int k=0;k<ntests;k++) {
+        img_free(&tests[k].img);
+        free(tests[k].ex);
+        free(tests[k].path);
+    }
+    free(tests);
+    sim_free(&boot);
+    return failures || errors ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "lib/getopt/getopt.h"
+#include "m4asm.h"
+#include "sim.h"
+#include "simtrace.h"
+#include "srcmap.h"
+#include "insns.h"
+
+// Reads an m4sim -T trace. Without -c or -i it prints a summary; with
+// either it prints the instructions around that point, one per line, with
+// what each one changed and, given the image's listing, its label, line
+// number and source.
+
+void usage(char** argv) {
+    fprintf(stderr, "Usage: %s [-l listing] [-c cycle | -i insn] [-w window] trace\n", argv[0]);
+    exit(EXIT_FAILURE);
+}
+
+static void print_step(struct trc_step *st, struct srcmap *map, int target) {
+    char name[48];
+    printf("%c %10llu %12llu  %08X", target ? '>' : ' ', st->insn, st->cycles, st->pc);
+    if (map != NULL) {
+        int k = srcmap_line(map, st->pc);
+        printf("  %-24s", srcmap_name(map, st->pc, name));
+        if (k >= 0 && map->lines[k].addr == st->pc) printf(" %5d  %-32s", map->lines[k].lineno, map->lines[k].text);
+        else printf(" %5s  %-32s", "", "");
+    }
+    for (int i=0;i<16;i++) {
+        if (st->regs >> i & 1) printf(" r%d=%04X", i, st->r[i]);
+    }
+    if (st->misc & TRC_M_A) printf(" a=%04X", st->a);
+    if (st->misc & TRC_M_D) printf(" d=%04X", st->d);
+    if (st->misc & TRC_M_SP) printf(" sp=%08X", st->sp);
+    if (st->misc & TRC_M_FLAGS) printf(" flags=%02X", st->flags);
+    if (st->misc & TRC_M_DEPTH) printf(" depth=%d", st->depth);
+    for (int k=0;k<st->nstores;k++) printf(" [%08X]=%04X", st->stores[k].addr, st->stores[k].v);
+    if (st->jump) printf(" -> %08X", st->next);
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    const char* listing = NULL;
+    unsigned long long at = 0;
+    int mode = 0;   // 'c' or 'i' once given
+    unsigned long long window = 8;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:c:i:w:")) != -1) {
+        switch (opt) {
+        case 'l':
+            listing = optarg;
+            break;
+        case 'c':
+        case 'i': {
+            struct parsed_int_t iv = getintval(optarg);
+            if (iv.code != 0 || mode) usage(argv);
+            at = iv.value;
+            mode = opt;
+            break;
+        }
+        case 'w': {
+            struct parsed_int_t iv = getintval(optarg);
+            if (iv.code != 0) usage(argv);
+            window = iv.value;
+            break;
+        }
+        default:
+            usage(argv);
+        }
+    }
+    if (optind != argc - 1) usage(argv);
+
+    struct trc_reader *r = trc_open(argv[optind]);
+    if (r == NULL) {
+        perror("Loading trace");
+        exit(-errno);
+    }
+    struct srcmap map;
+    memset(&map, 0, sizeof(map));
+    if (listing != NULL && srcmap_load(&map, listing) != 0) {
+        perror("Loading listing");
+        exit(-errno);
+    }
+
+    struct trc_info info;
+    trc_get_info(r, &info);
+    if (!mode) {
+        printf("instructions %llu (from %llu)\n", info.steps, info.first);
+        printf("cycles %llu (from %llu)\n", info.end - info.start, info.start);
+        printf("stop %s at %08X\n", sim_stop_name(info.stop), info.pc);
+        printf("chunks %d\nbytes %llu (%.2f per instruction)\n", info.chunks, info.bytes,
+            info.steps ? (double)info.bytes / info.steps : 0.0);
+        trc_close(r);
+        srcmap_free(&map);
+        return 0;
+    }
+    if (info.steps == 0) {
+        fprintf(stderr, "Error: the trace is empty\n");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long long target = at;
+    if (mode == 'c') {
+        target = trc_find_cycle(r, at);
+    } else if (at < info.first || at >= info.first + info.steps) {
+        fprintf(stderr, "Error: instruction %llu is not in the trace (%llu to %llu)\n", at, info.first, info.first + info.steps - 1);
+        exit(EXIT_FAILURE);
+    }
+    unsigned long long from = target - info.first > window ? target - window : info.first;
+    trc_seek(r, from);
+    struct trc_step st;
+    while (trc_next(r, &st) && st.insn <= target + window) {
+        print_step(&st, listing != NULL ? &map : NULL, st.insn == target);
+    }
+
+    trc_close(r);
+    srcmap_free(&map);
+    return 0;
+}
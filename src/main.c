@@ -0,0 +1,487 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "lib/getopt/getopt.h"
+#include "label.h"
+#include "source.h"
+#include "stmt.h"
+#include "opt.h"
+#include "inline.h"
+#include "live.h"
+#include "superopt.h"
+#include "pgo.h"
+#include "data.h"
+#include "wcet.h"
+#include "mix.h"
+#include "listing.h"
+#include "stats.h"
+#include "trace.h"
+#include "cost.h"
+#include "m4asm.h"
+#include "insns.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+void usage(char** argv) {
+    fprintf(stderr, "Usage: %s [-i file|-] [-o file|-] [-f binary/logisim] [-l listing] [--stats[=text|json][:file]] [--trace file] [--no-relax] [-O] [--inline[=cycles]] [--superopt[=len]] [--superopt-patch file] [--opt-log file] [--profile file] [--layout-report file] [--place-data] [--align-loops[=bytes]] [--wcet[=file]] [--mix[=text|json][:file]] [--optimize=cycles|size|balanced] [--cost-profile file]\n", argv[0]);
+    exit(EXIT_FAILURE);
+}
+
+// A report option's argument: "text" or "json", optionally followed by
+// ":file", or just a file for text. No file (or "-") means stderr. Returns
+// 0 if the format is unknown.
+static int report_arg(const char* arg, int *format, char** file) {
+    *format = ST_FMT_TEXT;
+    *file = NULL;
+    if (arg == NULL) return 1;
+    const char* colon = strchr(arg, ':');
+    size_t n = colon != NULL ? (size_t)(colon - arg) : strlen(arg);
+    if (n == 4 && strncmp(arg, "text", 4) == 0) {
+        *format = ST_FMT_TEXT;
+    } else if (n == 4 && strncmp(arg, "json", 4) == 0) {
+        *format = ST_FMT_JSON;
+    } else if (colon != NULL) {
+        return 0;
+    } else {
+        *file = strdup(arg);
+        return 1;
+    }
+    if (colon != NULL) *file = strdup(colon + 1);
+    return 1;
+}
+
+static FILE* report_open(const char* file, const char* what) {
+    if (file == NULL || strcmp(file, "-") == 0) return stderr;
+    FILE* fp = fopen(file, "w");
+    if (fp == NULL) {
+        perror(what);
+        exit(-errno);
+    }
+    return fp;
+}
+
+int main(int argc, char** argv) {
+    char *infile = NULL;
+    char *outfile = NULL;
+    char *listfile = NULL;
+    int opt;
+    int outformat = OUTFMT_BINARY;
+    int stats = 0;
+    int statsformat = ST_FMT_TEXT;
+    char *statsfile = NULL;
+    char *tracefile = NULL;
+    int relax = 1;
+    int optimize = 0;
+    int inlinelimit = 0;
+    int superopt = 0;
+    char *sopatch = NULL;
+    char *profile = NULL;
+    char *layoutreport = NULL;
+    int placedata = 0;
+    int alignloops = 0;
+    int wcet = 0;
+    char *wcetfile = NULL;
+    int mix = 0;
+    int mixformat = ST_FMT_TEXT;
+    char *mixfile = NULL;
+    char *optlog = NULL;
+    int costmode = COST_CYCLES;
+    char *costprofile = NULL;
+
+    static struct option longopts[] = {
+        {"stats", optional_argument, NULL, 'S'},
+        {"trace", required_argument, NULL, 'T'},
+        {"no-relax", no_argument, NULL, 'R'},
+        {"opt-log", required_argument, NULL, 'L'},
+        {"inline", optional_argument, NULL, 'I'},
+        {"superopt", optional_argument, NULL, 'U'},
+        {"superopt-patch", required_argument, NULL, 'Q'},
+        {"profile", required_argument, NULL, 'G'},
+        {"layout-report", required_argument, NULL, 'Y'},
+        {"place-data", no_argument, NULL, 'D'},
+        {"align-loops", optional_argument, NULL, 'A'},
+        {"wcet", optional_argument, NULL, 'W'},
+        {"mix", optional_argument, NULL, 'X'},
+        {"optimize", required_argument, NULL, 'M'},
+        {"cost-profile", required_argument, NULL, 'P'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "i:o:f:l:O", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'i': 
+            infile = strdup(optarg);
+            break;
+        case 'o': 
+            outfile = strdup(optarg);
+            break;
+        case 'l':
+            listfile = strdup(optarg);
+            break;
+        case 'f':
+            if (strcmp(optarg,"logisim") == 0) {
+                outformat = OUTFMT_LOGISIM;
+            } else if (strcmp(optarg, "binary") == 0) {
+                outformat = OUTFMT_BINARY;
+            } else {
+                usage(argv);
+            }
+            break;
+        case 'S':
+            stats = 1;
+            if (!report_arg(optarg, &statsformat, &statsfile)) usage(argv);
+            break;
+        case 'T':
+            tracefile = strdup(optarg);
+            break;
+        case 'R':
+            relax = 0;
+            break;
+        case 'O':
+            optimize = 1;
+            break;
+        case 'L':
+            optlog = strdup(optarg);
+            break;
+        case 'I':
+            inlinelimit = INLINE_DEFAULT_LIMIT;
+            if (optarg != NULL) {
+                struct parsed_int_t iv = getintval(optarg);
+                if (iv.code != 0 || iv.value == 0) usage(argv);
+                inlinelimit = (int)iv.value;
+            }
+            break;
+        case 'U':
+            superopt = SUPEROPT_DEFAULT_LEN;
+            if (optarg != NULL) {
+                struct parsed_int_t iv = getintval(optarg);
+                if (iv.code != 0 || iv.value == 0 || iv.value > SO_MAXREGION) usage(argv);
+                superopt = (int)iv.value;
+            }
+            break;
+        case 'Q':
+            sopatch = strdup(optarg);
+            if (!superopt) superopt = SUPEROPT_DEFAULT_LEN;
+            break;
+        case 'G':
+            profile = strdup(optarg);
+            break;
+        case 'Y':
+            layoutreport = strdup(optarg);
+            break;
+        case 'D':
+            placedata = 1;
+            break;
+        case 'A':
+            alignloops = PGO_ALIGN_DEFAULT;
+            if (optarg != NULL) {
+                struct parsed_int_t iv = getintval(optarg);
+                if (iv.code != 0 || iv.value < 2 || iv.value > 0x10000 || (iv.value & (iv.value - 1))) usage(argv);
+                alignloops = (int)iv.value;
+            }
+            break;
+        case 'W':
+            wcet = 1;
+            if (optarg != NULL) wcetfile = strdup(optarg);
+            break;
+        case 'X':
+            mix = 1;
+            if (!report_arg(optarg, &mixformat, &mixfile)) usage(argv);
+            break;
+        case 'M':
+            costmode = cost_parse_mode(optarg);
+            if (costmode < 0) usage(argv);
+            break;
+        case 'P':
+            costprofile = strdup(optarg);
+            break;
+        default:
+            usage(argv);
+        }
+    }
+
+    if (infile == NULL || outfile == NULL) {
+        usage(argv);
+    }
+    if (alignloops && profile == NULL) {
+        fprintf(stderr, "Error: --align-loops needs --profile\n");
+        exit(EXIT_FAILURE);
+    }
+
+    st_init(stats);
+    cost_init(costmode);
+    if (costprofile != NULL && cost_load_profile(costprofile) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (tracefile != NULL && tr_open(tracefile) != 0) {
+        perror("Opening trace file");
+        exit(-errno);
+    }
+    tr_thread_name("m4asm");
+    tr_begin_arg("assemble", TR_CAT_FILE, "file", infile);
+
+    // Keep stdout clean for the image when writing to a pipe.
+    FILE* msg = strcmp(outfile, "-") == 0 ? stderr : stdout;
+    fprintf(msg, "m4asm (C) Charlie Camilleri 2023\n");
+    fprintf(msg, "Version 0.9\n\n");
+
+    FILE* fp;
+    if (strcmp(infile, "-") == 0) {
+        fprintf(msg, "Reading <stdin>\n");
+        fp = stdin;
+    } else {
+        fprintf(msg, "Reading %s\n", infile);
+        fp = fopen(infile, "r");
+        if (fp == NULL) {
+            perror("fopen()");
+            exit(-errno);
+        }
+    }
+
+    st_pass_begin(ST_PASS_READ);
+    tr_begin("read", TR_CAT_IO);
+    struct src_context sctx = src_init_context();
+    if (src_read(fp, &sctx) != 0) {
+        perror("Reading file");
+        exit(-errno);
+    }
+    if (fp != stdin) fclose(fp);
+    st_ctx.lines = sctx.nread;
+    tr_end("read", TR_CAT_IO);
+    st_pass_end(ST_PASS_READ);
+
+    struct le_context lctx = le_init_context();
+
+    struct stmt_list sl = stmt_init_list(relax);
+
+    st_pass_begin(ST_PASS_COUNT);
+    tr_begin("label_count", TR_CAT_PASS);
+    stmt_build(&sctx, &sl, &lctx);
+    tr_end("label_count", TR_CAT_PASS);
+    st_pass_end(ST_PASS_COUNT);
+
+    FILE* logfp = NULL;
+    if (optlog != NULL && (optimize || inlinelimit || superopt || placedata || alignloops)) {
+        logfp = strcmp(optlog, "-") == 0 ? stderr : fopen(optlog, "w");
+        if (logfp == NULL) {
+            perror("Opening optimizer log");
+            exit(-errno);
+        }
+    }
+
+    if (superopt) {
+        FILE* patchfp = NULL;
+        if (sopatch != NULL) {
+            patchfp = strcmp(sopatch, "-") == 0 ? stderr : fopen(sopatch, "w");
+            if (patchfp == NULL) {
+                perror("Opening superoptimizer patch");
+                exit(-errno);
+            }
+        }
+        st_pass_begin(ST_PASS_OPT);
+        tr_begin("superopt", TR_CAT_PASS);
+        int n = opt_superopt(&sl, &lctx, superopt, infile, patchfp, logfp);
+        tr_end("superopt", TR_CAT_PASS);
+        st_pass_end(ST_PASS_OPT);
+        fprintf(msg, "Superopt: %d regions improved%s\n", n, patchfp != NULL ? " (patch written)" : "");
+        if (patchfp != NULL && patchfp != stderr) fclose(patchfp);
+    }
+
+    // Inlining first, so the peephole pass sees the merged code.
+    if (inlinelimit) {
+        st_pass_begin(ST_PASS_OPT);
+        tr_begin("inline", TR_CAT_PASS);
+        int n = opt_inline(&sl, &lctx, inlinelimit, logfp);
+        tr_end("inline", TR_CAT_PASS);
+        st_pass_end(ST_PASS_OPT);
+        fprintf(msg, "Inlined: %d call sites\n", n);
+    }
+
+    if (optimize) {
+        st_pass_begin(ST_PASS_OPT);
+        tr_begin("peephole", TR_CAT_PASS);
+        int n = opt_peephole(&sl, &lctx, logfp);
+        tr_end("peephole", TR_CAT_PASS);
+        st_pass_end(ST_PASS_OPT);
+        fprintf(msg, "Peephole: %d rewrites\n", n);
+
+        int saves;
+        st_pass_begin(ST_PASS_OPT);
+        tr_begin("liveness", TR_CAT_PASS);
+        n = opt_liveness(&sl, &lctx, &saves, logfp);
+        tr_end("liveness", TR_CAT_PASS);
+        st_pass_end(ST_PASS_OPT);
+        fprintf(msg, "Liveness: %d dead stores, %d save/restore pairs removed\n", n, saves);
+    }
+    if (profile != NULL) {
+        FILE* reportfp = NULL;
+        if (layoutreport != NULL) {
+            reportfp = strcmp(layoutreport, "-") == 0 ? stderr : fopen(layoutreport, "w");
+            if (reportfp == NULL) {
+                perror("Opening layout report");
+                exit(-errno);
+            }
+        }
+        struct pgo_result pr;
+        st_pass_begin(ST_PASS_LAYOUT);
+        tr_begin("pgo_layout", TR_CAT_PASS);
+        if (opt_pgo_layout(&sl, &lctx, profile, reportfp, &pr) == 0) {
+            fprintf(msg, "Layout: %d chunks moved, %d jumps removed, predicted cycles %ld -> %ld\n", pr.moved, pr.jumps, pr.before, pr.after);
+        }
+        tr_end("pgo_layout", TR_CAT_PASS);
+        st_pass_end(ST_PASS_LAYOUT);
+        if (reportfp != NULL && reportfp != stderr) fclose(reportfp);
+    }
+
+    // After the code layout, so data goes in front of the final code order.
+    if (placedata) {
+        st_pass_begin(ST_PASS_LAYOUT);
+        tr_begin("place_data", TR_CAT_PASS);
+        int n = opt_place_data(&sl, &lctx, profile, logfp);
+        tr_end("place_data", TR_CAT_PASS);
+        st_pass_end(ST_PASS_LAYOUT);
+        fprintf(msg, "Data placement: %d blocks moved near\n", n);
+    }
+
+    if (alignloops) {
+        int words;
+        st_pass_begin(ST_PASS_LAYOUT);
+        tr_begin("align_loops", TR_CAT_PASS);
+        int n = opt_pgo_align(&sl, &lctx, profile, alignloops, logfp, &words);
+        tr_end("align_loops", TR_CAT_PASS);
+        st_pass_end(ST_PASS_LAYOUT);
+        fprintf(msg, "Loop alignment: %d loop heads padded, %d words\n", n, words);
+    }
+    if (logfp != NULL && logfp != stderr) fclose(logfp);
+
+    st_pass_begin(ST_PASS_LAYOUT);
+    tr_begin("layout", TR_CAT_PASS);
+    stmt_layout(&sl, &lctx);
+    lctx.stage = 1;
+    tr_end("layout", TR_CAT_PASS);
+    st_pass_end(ST_PASS_LAYOUT);
+
+    // Cycle bounds need the final encodings; a blown $assert_cycles budget
+    // stops the build before anything is written.
+    if (wcet || wcet_needed(&sl)) {
+        FILE* wcetfp = NULL;
+        if (wcet) {
+            wcetfp = wcetfile == NULL ? msg : strcmp(wcetfile, "-") == 0 ? stderr : fopen(wcetfile, "w");
+            if (wcetfp == NULL) {
+                perror("Opening cycle report");
+                exit(-errno);
+            }
+        }
+        st_pass_begin(ST_PASS_OPT);
+        tr_begin("wcet", TR_CAT_PASS);
+        int fails = wcet_analyze(&sl, &lctx, wcetfp);
+        tr_end("wcet", TR_CAT_PASS);
+        st_pass_end(ST_PASS_OPT);
+        if (wcetfp != NULL && wcetfp != msg && wcetfp != stderr) fclose(wcetfp);
+        if (fails) exit(EXIT_FAILURE);
+    }
+
+    const char* writer = outformat == OUTFMT_LOGISIM ? "writer:logisim" : "writer:binary";
+    st_pass_begin(ST_PASS_WRITE);
+    tr_begin("open_output", TR_CAT_IO);
+    if (strcmp(outfile, "-") == 0) {
+        fp = stdout;
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    } else {
+        fp = fopen(outfile, "wb");
+        if (fp == NULL) {
+            perror("Opening output file");
+            exit(-errno);
+        }
+    }
+
+    if (outformat == OUTFMT_LOGISIM) {
+        char* hdr = "v3.0 hex words addressed\n";
+        if (fwrite(hdr, 1, strlen(hdr), fp) != (strlen(hdr))) {
+            perror("fwrite");
+            exit(-errno);
+        }
+    }
+    if (listfile != NULL && lst_open(listfile, infile) != 0) {
+        perror("Opening listing file");
+        exit(-errno);
+    }
+    tr_end("open_output", TR_CAT_IO);
+    tr_begin_arg(writer, TR_CAT_WRITER, "file", outfile);
+    st_pass_end(ST_PASS_WRITE);
+
+    // Labels are final at this point, so each instruction is written out as
+    // soon as it is encoded rather than being collected first. The encode
+    // pass is timed as a whole, writes included; timing each statement would
+    // cost more than encoding it.
+    uint32_t a = 0;
+    tr_begin("encode", TR_CAT_PASS);
+    st_pass_begin(ST_PASS_ENCODE);
+    for (int i=0;i<sl.n;i++) {
+        if (sl.v[i].kind == STMT_ALIGN || sl.v[i].kind == STMT_FILL) {
+            write_fill(fp, outformat, sl.v[i].fill, sl.v[i].length, &a);
+            lst_stmt(&sl.v[i], NULL);
+            continue;
+        }
+        if (sl.v[i].kind != STMT_INSN) {
+            lst_stmt(&sl.v[i], NULL);
+            continue;
+        }
+        struct assembled_insn_t asi = stmt_assemble(&sl.v[i], &lctx);
+        if (asi.length > 0) {
+            st_ctx.insns++;
+            write_insn(fp, outformat, &asi, &a);
+            lst_stmt(&sl.v[i], &asi);
+        }
+    }
+    st_pass_end(ST_PASS_ENCODE);
+
+    tr_end("encode", TR_CAT_PASS);
+    lst_close();
+
+    st_pass_begin(ST_PASS_WRITE);
+    tr_begin("flush", TR_CAT_IO);
+    if (fp == stdout) {
+        fflush(fp);
+    } else {
+        fclose(fp);
+    }
+    tr_end("flush", TR_CAT_IO);
+    tr_end(writer, TR_CAT_WRITER);
+    st_pass_end(ST_PASS_WRITE);
+    tr_end("assemble", TR_CAT_FILE);
+    tr_close();
+
+    if (stats) {
+        FILE* statsfp = report_open(statsfile, "Opening stats report");
+        st_report(statsfp, statsformat, &lctx);
+        if (statsfp != stderr) fclose(statsfp);
+    }
+    if (mix) {
+        FILE* mixfp = report_open(mixfile, "Opening mix report");
+        mix_report(mixfp, mixformat, &sl, &lctx);
+        if (mixfp != stderr) fclose(mixfp);
+    }
+
+    free(infile);
+    free(outfile);
+    if (listfile != NULL) free(listfile);
+    if (tracefile != NULL) free(tracefile);
+    if (optlog != NULL) free(optlog);
+    if (costprofile != NULL) free(costprofile);
+    if (wcetfile != NULL) free(wcetfile);
+    if (statsfile != NULL) free(statsfile);
+    if (mixfile != NULL) free(mixfile);
+    if (sopatch != NULL) free(sopatch);
+    if (profile != NULL) free(profile);
+    if (layoutreport != NULL) free(layoutreport);
+    src_free(&sctx);
+    stmt_free(&sl);
+    le_free_labels(&lctx);
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m4asm.h"
+#include "label.h"
+#include "stmt.h"
+#include "stats.h"
+#include "cost.h"
+#include "mix.h"
+#include "insns.h"
+
+#define MIX_NONE 0
+#define MIX_REGISTER 1
+#define MIX_IMMEDIATE 2
+#define MIX_NEAR 3
+#define MIX_FAR 4
+#define MIX_RELATIVE 5
+#define MIX_RSA 6
+#define MIX_DATA 7
+#define MIX_NFORMS 8
+
+static const char* mix_form_names[MIX_NFORMS] = {
+    "none", "register", "immediate", "near", "far", "relative", "rsa", "data"
+};
+
+struct mix_count {
+    char name[16];
+    unsigned long count;
+    unsigned long words;
+    unsigned long cycles;
+};
+
+struct mix_routine {
+    char name[33];
+    unsigned long words;
+    unsigned long cycles;
+};
+
+static int mix_is_branch(const char* m) {
+    return strcmp(m, "jmp") == 0 || strcmp(m, "call") == 0 || strcmp(m, "brchf") == 0 || strcmp(m, "brchi") == 0;
+}
+
+// Addressing form of a variant, by its most telling operand.
+static int mix_form(int def) {
+    const char* p = insns[def].params;
+    if (strcmp(insns[def].mnemonic, "dw") == 0 || strcmp(insns[def].mnemonic, "ds") == 0) return MIX_DATA;
+    if (strchr(p, PTYPE_REGPAIR_PTR)) return MIX_RSA;
+    if (strchr(p, PTYPE_RELATIVE_POS) || strchr(p, PTYPE_RELATIVE_NEG)) return MIX_RELATIVE;
+    if (strchr(p, PTYPE_FAR_PTR) || strchr(p, PTYPE_DWORD_IMM)) return MIX_FAR;
+    if (strchr(p, PTYPE_NEAR_PTR)) return MIX_NEAR;
+    if (p[0] == PTYPE_WORD_IMM && mix_is_branch(insns[def].mnemonic)) return MIX_NEAR;
+    if (strchr(p, PTYPE_WORD_IMM)) return MIX_IMMEDIATE;
+    if (strchr(p, PTYPE_REGISTER)) return MIX_REGISTER;
+    return MIX_NONE;
+}
+
+// Returns 1 if the label operand of st could have used a variant with
+// fewer words at its final address.
+static int mix_shorter(struct stmt_t *st, struct le_context *lctx) {
+    struct parsed_insn_t pi;
+    parse_insn(st->text, lctx, &pi);
+    if (pi.symidx < 0) return 0;
+    int cur = st->cand[st->rank];
+    const char* alt = pi.ptypes[pi.symidx] == PTYPE_FAR_PTR ? "n" : "W+-";
+    for (int c=0;insns[c].mnemonic != NULL;c++) {
+        if (c == cur || strcmp(insns[c].mnemonic, insns[cur].mnemonic) != 0) continue;
+        if (strlen(insns[c].params) != strlen(insns[cur].params)) continue;
+        int ok = 1;
+        for (int i=0;insns[c].params[i] && ok;i++) {
+            if (i == pi.symidx) ok = insns[c].params[i] == pi.ptypes[i] || strchr(alt, insns[c].params[i]) != NULL;
+            else ok = insns[c].params[i] == insns[cur].params[i];
+        }
+        if (ok && cost_length(c) < st->length && stmt_operand_fits(st, c, pi.symidx, pi.pvs[pi.symidx].value)) return 1;
+    }
+    return 0;
+}
+
+static int mix_count_cmp(const void* a, const void* b) {
+    const struct mix_count *x = (const struct mix_count*)a;
+    const struct mix_count *y = (const struct mix_count*)b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+static int mix_words_cmp(const void* a, const void* b) {
+    const struct mix_routine *x = (const struct mix_routine*)a;
+    const struct mix_routine *y = (const struct mix_routine*)b;
+    if (x->words != y->words) return x->words < y->words ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+static int mix_cycles_cmp(const void* a, const void* b) {
+    const struct mix_routine *x = (const struct mix_routine*)a;
+    const struct mix_routine *y = (const struct mix_routine*)b;
+    if (x->cycles != y->cycles) return x->cycles < y->cycles ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+// Routines start at the program entry, at call targets and at labels that
+// cannot be fallen into. Collects the call targets.
+static void mix_calls(struct stmt_list *sl, struct stmt_names *calls) {
+    char op[33];
+    for (int i=0;i<sl->n;i++) {
+        struct stmt_t *st = &sl->v[i];
+        char m[16];
+        if (st->kind != STMT_INSN || st->special) continue;
+        stmt_mnemonic(st, m);
+        if (strcmp(m, "call") != 0) continue;
+        for (int k=0;stmt_operand(st, k, op) == 0;k++) stmt_names_add(calls, op);
+    }
+    stmt_names_sort(calls);
+}
+
+static void mix_routines_out(FILE* fp, int format, const char* key, struct mix_routine *r, int n) {
+    if (format == ST_FMT_JSON) {
+        fprintf(fp, ",\"%s\":[", key);
+        for (int k=0;k<n && k<MIX_TOP;k++) {
+            fprintf(fp, "%s{\"name\":\"%s\",\"words\":%lu,\"cycles\":%lu}", k ? "," : "", r[k].name, r[k].words, r[k].cycles);
+        }
+        fprintf(fp, "]");
+        return;
+    }
+    for (int k=0;k<n && k<MIX_TOP;k++) {
+        fprintf(fp, "  %-24s %8lu %10lu\n", r[k].name, r[k].words, r[k].cycles);
+    }
+}
+
+void mix_report(FILE* fp, int format, struct stmt_list *sl, struct le_context *lctx) {
+    struct mix_count mn[64];
+    int nmn = 0;
+    struct mix_count forms[MIX_NFORMS];
+    memset(forms, 0, sizeof(forms));
+    for (int f=0;f<MIX_NFORMS;f++) strcpy(forms[f].name, mix_form_names[f]);
+    struct mix_routine *rs = (struct mix_routine*)calloc(sl->n + 1, sizeof(struct mix_routine));
+    int nrs = 0;
+    struct stmt_names calls;
+    memset(&calls, 0, sizeof(calls));
+    mix_calls(sl, &calls);
+    unsigned long insns_total = 0, words = 0, cycles = 0, shorter = 0;
+
+    int closed = 1;
+    for (int i=0;i<sl->n;i++) {
+        struct stmt_t *st = &sl->v[i];
+        if (st->kind == STMT_LABEL) {
+            char name[33];
+            strncpy(name, st->text, 32);
+            name[32] = 0;
+            name[strlen(name)-1] = 0;
+            int head = nrs == 0 || (closed && sl->v[i-1].kind != STMT_LABEL) || stmt_names_find(&calls, name) >= 0;
+            if (head) strcpy(rs[nrs++].name, name);
+            continue;
+        }
+        if (st->kind != STMT_INSN) continue;
+        if (nrs == 0) strcpy(rs[nrs++].name, "(entry)");
+
+        const char* m = st->special ? "ds" : insns[st->cand[st->rank]].mnemonic;
+        int form = st->special ? MIX_DATA : mix_form(st->cand[st->rank]);
+        int cyc = st->special ? 0 : insns[st->cand[st->rank]].cycles;
+        int k;
+        for (k=0;k<nmn && strcmp(mn[k].name, m) != 0;k++);
+        if (k == nmn && nmn < 64) {
+            memset(&mn[nmn], 0, sizeof(mn[nmn]));
+            strncpy(mn[nmn++].name, m, 15);
+        }
+        if (k < nmn) {
+            mn[k].count++;
+            mn[k].words += st->length;
+            mn[k].cycles += cyc;
+        }
+        forms[form].count++;
+        forms[form].words += st->length;
+        forms[form].cycles += cyc;
+        rs[nrs-1].words += st->length;
+        rs[nrs-1].cycles += cyc;
+        insns_total++;
+        words += st->length;
+        cycles += cyc;
+        if (!st->special) shorter += mix_shorter(st, lctx);
+        closed = strcmp(m, "jmp") == 0 || strcmp(m, "ret") == 0;
+    }
+    qsort(mn, nmn, sizeof(struct mix_count), mix_count_cmp);
+
+    if (format == ST_FMT_JSON) {
+        fprintf(fp, "{\"insns\":%lu,\"words\":%lu,\"cycles\":%lu", insns_total, words, cycles);
+        fprintf(fp, ",\"mnemonics\":{");
+        for (int k=0;k<nmn;k++) {
+            fprintf(fp, "%s\"%s\":{\"count\":%lu,\"words\":%lu,\"cycles\":%lu}", k ? "," : "", mn[k].name, mn[k].count, mn[k].words, mn[k].cycles);
+        }
+        fprintf(fp, "},\"forms\":{");
+        for (int f=0;f<MIX_NFORMS;f++) {
+            fprintf(fp, "%s\"%s\":{\"count\":%lu,\"words\":%lu,\"cycles\":%lu}", f ? "," : "", forms[f].name, forms[f].count, forms[f].words, forms[f].cycles);
+        }
+        fprintf(fp, "},\"far_bytes\":%lu,\"near_bytes\":%lu,\"shorter_refs\":%lu", forms[MIX_FAR].words * 2, forms[MIX_NEAR].words * 2, shorter);
+    } else {
+        fprintf(fp, "\nInstruction mix: %lu instructions, %lu words, %lu cycles\n", insns_total, words, cycles);
+        fprintf(fp, "  %-14s %8s %8s %10s\n", "mnemonic", "count", "words", "cycles");
+        for (int k=0;k<nmn;k++) {
+            fprintf(fp, "  %-14s %8lu %8lu %10lu\n", mn[k].name, mn[k].count, mn[k].words, mn[k].cycles);
+        }
+        fprintf(fp, "  %-14s %8s %8s %10s\n", "form", "count", "words", "cycles");
+        for (int f=0;f<MIX_NFORMS;f++) {
+            if (forms[f].count == 0) continue;
+            fprintf(fp, "  %-14s %8lu %8lu %10lu\n", forms[f].name, forms[f].count, forms[f].words, forms[f].cycles);
+        }
+        fprintf(fp, "  far encodings %lu bytes, near encodings %lu bytes\n", forms[MIX_FAR].words * 2, forms[MIX_NEAR].words * 2);
+        fprintf(fp, "  label references with a shorter form in reach: %lu\n", shorter);
+        fprintf(fp, "Largest routines by size:\n  %-24s %8s %10s\n", "routine", "words", "cycles");
+    }
+
+    qsort(rs, nrs, sizeof(struct mix_routine), mix_words_cmp);
+    mix_routines_out(fp, format, "by_size", rs, nrs);
+    if (format != ST_FMT_JSON) fprintf(fp, "Largest routines by cycles:\n  %-24s %8s %10s\n", "routine", "words", "cycles");
+    qsort(rs, nrs, sizeof(struct mix_routine), mix_cycles_cmp);
+    mix_routines_out(fp, format, "by_cycles", rs, nrs);
+    if (format == ST_FMT_JSON) fprintf(fp, "}\n");
+    free(rs);
+    stmt_names_free(&calls);
+}
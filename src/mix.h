@@ -0,0 +1,16 @@
+#ifndef MIX_H
+#define MIX_H
+
+#include <stdio.h>
+#include "label.h"
+#include "stmt.h"
+
+// Static instruction-mix and code-density report (--mix[=json]) over the
+// final layout, from the insns[] variant each statement was encoded with.
+// format is ST_FMT_TEXT or ST_FMT_JSON.
+
+#define MIX_TOP 10    // routines listed by size and by cycles
+
+void mix_report(FILE* fp, int format, struct stmt_list *sl, struct le_context *lctx);
+
+#endif
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m4asm.h"
+#include "label.h"
+#include "stmt.h"
+#include "opt.h"
+#include "cost.h"
+#include "insns.h"
+
+static struct opt_rule opt_rules[] = {
+    {"tail-call", {"call %x", "ret", NULL},           {"jmp %x", NULL}},
+    {"jmp-next",  {"jmp %x", "%x:", NULL},            {"%x:", NULL}},
+    {"push-pop",  {"push %a", "pop %a", NULL},        {NULL}},
+    {"mov-back",  {"mov %a, %b", "mov %b, %a", NULL}, {"mov %a, %b", NULL}},
+    {"add-inc",   {"add %a, 1", NULL},                {"inc %a", NULL}},
+    {"add-inc2",  {"add %a, 2", NULL},                {"inc2 %a", NULL}},
+    {"sub-dec",   {"sub %a, 1", NULL},                {"dec %a", NULL}},
+    {"sub-dec2",  {"sub %a, 2", NULL},                {"dec2 %a", NULL}},
+    {NULL, {NULL}, {NULL}}
+};
+
+#define OPT_NVARS 3
+
+struct opt_binds {
+    char val[OPT_NVARS][34];
+    int bound[OPT_NVARS];
+};
+
+static int opt_var(char c) {
+    switch (c) {
+    case 'a': return 0;
+    case 'b': return 1;
+    case 'x': return 2;
+    default: return -1;
+    }
+}
+
+static int opt_tokenize(char* s, char** toks, int max) {
+    int n = 0;
+    char* tok;
+    while ((tok = strsep(&s, " ")) && n < max) {
+        if (tok[0] == 0) continue;
+        if (tok[strlen(tok)-1] == ',') tok[strlen(tok)-1] = 0;
+        toks[n++] = tok;
+    }
+    return n;
+}
+
+static int opt_match_operand(const char* pat, const char* op, struct opt_binds *b) {
+    if (pat[0] == '%') {
+        int v = opt_var(pat[1]);
+        char val[34];
+        if (v == 2) {
+            strncpy(val, op[0] == '@' ? op+1 : op, 33);
+            val[33] = 0;
+        } else {
+            struct parsed_int_t r = getintval((char*)op+1);
+            if (op[0] != 'r' || r.code != 0 || r.value > 15) return 0;
+            snprintf(val, 34, "r%lu", r.value);
+        }
+        if (b->bound[v]) return strcmp(b->val[v], val) == 0;
+        strcpy(b->val[v], val);
+        b->bound[v] = 1;
+        return 1;
+    }
+
+    struct parsed_int_t pv = getintval((char*)pat);
+    struct parsed_int_t ov = getintval((char*)op);
+    if (pv.code == 0 && ov.code == 0) return pv.value == ov.value;
+    return strcmp(pat, op) == 0;
+}
+
+static int opt_match_stmt(const char* pat, struct stmt_t *st, struct opt_binds *b) {
+    int plabel = pat[strlen(pat)-1] == ':';
+    if (plabel != (st->kind == STMT_LABEL)) return 0;
+    if (st->kind != STMT_LABEL && (st->kind != STMT_INSN || st->special)) return 0;
+
+    char* pcopy = strdup(pat);
+    char* scopy = strdup(st->text);
+    if (plabel) {
+        pcopy[strlen(pcopy)-1] = 0;
+        scopy[strlen(scopy)-1] = 0;
+    }
+    char* ptoks[16];
+    char* stoks[16];
+    int np = opt_tokenize(pcopy, ptoks, 16);
+    int ns = opt_tokenize(scopy, stoks, 16);
+
+    int ok = np == ns && np > 0;
+    if (ok && !plabel) {
+        STRTOLOWER(stoks[0]);
+        ok = strcmp(ptoks[0], stoks[0]) == 0;
+    }
+    for (int i=plabel ? 0 : 1;i<np && ok;i++) {
+        ok = opt_match_operand(ptoks[i], stoks[i], b);
+    }
+
+    free(pcopy);
+    free(scopy);
+    return ok;
+}
+
+static void opt_expand(const char* tmpl, struct opt_binds *b, char* out, int outlen) {
+    int o = 0;
+    for (int i=0;tmpl[i] && o < outlen-1;i++) {
+        int v;
+        if (tmpl[i] == '%' && (v = opt_var(tmpl[i+1])) >= 0) {
+            o += snprintf(out+o, outlen-o, "%s", b->val[v]);
+            i++;
+            continue;
+        }
+        out[o++] = tmpl[i];
+    }
+    out[o < outlen ? o : outlen-1] = 0;
+}
+
+// Static cost of one statement: the cheapest variant that encodes it.
+static void opt_cost(struct stmt_t *st, int *cycles, int *words) {
+    if (st->kind != STMT_INSN) return;
+    if (st->special) {
+        *cycles += st->length;
+        *words += st->length;
+        return;
+    }
+    *cycles += cost_cycles(st->cand[0]);
+    *words += cost_length(st->cand[0]);
+}
+
+static void opt_log_window(FILE* log, struct stmt_t **win, int n) {
+    for (int i=0;i<n;i++) fprintf(log, "%s%s", i ? "; " : "", win[i]->text);
+}
+
+// Tries rule r on the window of live statements starting at index i.
+// Returns 1 if the window was rewritten.
+static int opt_try(struct stmt_list *sl, int i, struct opt_rule *r, struct le_context *lctx, FILE* log) {
+    struct stmt_t *win[OPT_MAXPAT];
+    struct opt_binds b;
+    memset(&b, 0, sizeof(b));
+
+    int n = 0;
+    for (int j=i;j<sl->n && r->match[n] != NULL;j++) {
+        if (sl->v[j].kind == STMT_NONE) continue;
+        if (!opt_match_stmt(r->match[n], &sl->v[j], &b)) return 0;
+        win[n++] = &sl->v[j];
+    }
+    if (r->match[n] != NULL) return 0;
+
+    int ocycles = 0, owords = 0;
+    for (int k=0;k<n;k++) opt_cost(win[k], &ocycles, &owords);
+
+    int nrep = 0;
+    char rep[OPT_MAXPAT][128];
+    struct stmt_t tmp[OPT_MAXPAT];
+    int ncycles = 0, nwords = 0;
+    for (;r->replace[nrep] != NULL;nrep++) {
+        opt_expand(r->replace[nrep], &b, rep[nrep], 128);
+        memset(&tmp[nrep], 0, sizeof(struct stmt_t));
+        tmp[nrep].kind = rep[nrep][strlen(rep[nrep])-1] == ':' ? STMT_LABEL : STMT_INSN;
+        tmp[nrep].text = strdup(rep[nrep]);
+        if (tmp[nrep].kind == STMT_INSN) stmt_parse(sl, &tmp[nrep], lctx);
+        opt_cost(&tmp[nrep], &ncycles, &nwords);
+        free(tmp[nrep].text);
+    }
+
+    if (cost_value(ncycles, nwords) >= cost_value(ocycles, owords)) return 0;
+
+    if (log != NULL) {
+        fprintf(log, "line %d: %s: ", win[0]->lineno, r->name);
+        opt_log_window(log, win, n);
+        fprintf(log, " -> ");
+        for (int k=0;k<nrep;k++) fprintf(log, "%s%s", k ? "; " : "", rep[k]);
+        if (nrep == 0) fprintf(log, "(removed)");
+        fprintf(log, " (cycles %+d, words %+d)\n", ncycles - ocycles, nwords - owords);
+    }
+
+    for (int k=0;k<n;k++) {
+        if (k < nrep) {
+            win[k]->kind = tmp[k].kind;
+            stmt_set_text(sl, win[k], rep[k], lctx);
+        } else {
+            win[k]->kind = STMT_NONE;
+        }
+    }
+    return 1;
+}
+
+// Applies the rule table until no rule fires, keeping only rewrites that
+// lower the static cost under the current cost model. Returns the number of rewrites.
+int opt_peephole(struct stmt_list *sl, struct le_context *lctx, FILE* log) {
+    int total = 0;
+    int changed;
+    // Rewrites delete and shrink statements, which would move hand-computed
+    // branch targets.
+    if (!stmt_branches_all_labels(sl)) {
+        if (log != NULL) fprintf(log, "peephole: skipped, program branches to non-label addresses\n");
+        return 0;
+    }
+    do {
+        changed = 0;
+        for (int i=0;i<sl->n;i++) {
+            if (sl->v[i].kind == STMT_NONE) continue;
+            for (int r=0;opt_rules[r].name != NULL;r++) {
+                if (opt_try(sl, i, &opt_rules[r], lctx, log)) {
+                    changed = 1;
+                    total++;
+                    break;
+                }
+            }
+        }
+    } while (changed);
+
+    stmt_compact(sl);
+    return total;
+}
@@ -0,0 +1,22 @@
+#ifndef OPT_H
+#define OPT_H
+
+#include <stdio.h>
+#include "label.h"
+#include "stmt.h"
+
+#define OPT_MAXPAT 4
+
+// A peephole rule: a window of statement templates and its replacement.
+// Templates are ordinary source lines in which %a/%b match any register
+// and %x matches any operand (a leading '@' is ignored). A template ending
+// in ':' matches a label statement. Numeric operands compare by value.
+struct opt_rule {
+    const char* name;
+    const char* match[OPT_MAXPAT + 1];      // NULL-terminated
+    const char* replace[OPT_MAXPAT + 1];    // NULL-terminated, at most as long as match
+};
+
+int opt_peephole(struct stmt_list *sl, struct le_context *lctx, FILE* log);
+
+#endif
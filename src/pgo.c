@@ -0,0 +1,589 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m4asm.h"
+#include "label.h"
+#include "stmt.h"
+#include "cost.h"
+#include "pgo.h"
+#include "insns.h"
+
+// Profile-guided placement. The program is cut into chunks: a chunk starts
+// at a label that cannot be fallen into (the previous instruction is a jmp
+// or ret), or at the $align in front of it, and runs up to the next such
+// label. Chunks only reach each other through labels, so they can be put
+// in any order within their $org or $fill segment. Hot jmp edges are
+// chained so the jmp becomes a fall-through and is deleted; the remaining
+// chains are placed next to the chains they branch to and call most, which
+// keeps near and relative forms in reach.
+
+struct pgo_label {
+    char name[33];
+    unsigned long count;
+    int has_count;
+    int stmt;           // defining statement, -1 if not in the program
+};
+
+struct pgo_edge {
+    int from;           // chunk
+    int to;
+    unsigned long count;
+    int tail;           // the chunk's closing jmp to the head of 'to'
+};
+
+struct pgo_chunk {
+    int start;
+    int end;            // exclusive
+    int seg;
+    int pinned;         // first chunk of its segment
+    int next;           // chain links
+    int prev;
+    int placed;
+    unsigned long count;
+    long before;        // predicted cycles
+    long after;
+};
+
+struct pgo_ctx {
+    struct stmt_list *sl;
+    struct pgo_label *labels;
+    int nlabels;
+    int caplabels;
+    struct pgo_edge *edges;
+    int nedges;
+    int capedges;
+    int edge_rows;      // profile had from,to,count rows
+    struct pgo_chunk *chunks;
+    int nchunks;
+    int *chunk_of;      // statement -> chunk
+    unsigned long *stmt_count;
+};
+
+static int pgo_label_cmp(const void* a, const void* b) {
+    return strcmp(((const struct pgo_label*)a)->name, ((const struct pgo_label*)b)->name);
+}
+
+static struct pgo_label *pgo_find(struct pgo_ctx *pc, const char* name) {
+    struct pgo_label key;
+    strncpy(key.name, name, 32);
+    key.name[32] = 0;
+    return (struct pgo_label*)bsearch(&key, pc->labels, pc->nlabels, sizeof(struct pgo_label), pgo_label_cmp);
+}
+
+static struct pgo_label *pgo_add_label(struct pgo_ctx *pc, const char* name, int stmt) {
+    if (pc->nlabels == pc->caplabels) {
+        pc->caplabels = pc->caplabels ? pc->caplabels * 2 : 256;
+        pc->labels = (struct pgo_label*)realloc(pc->labels, sizeof(struct pgo_label) * pc->caplabels);
+    }
+    struct pgo_label *l = &pc->labels[pc->nlabels++];
+    memset(l, 0, sizeof(*l));
+    strncpy(l->name, name, 32);
+    l->stmt = stmt;
+    return l;
+}
+
+static void pgo_add_edge(struct pgo_ctx *pc, int from, int to, unsigned long count, int tail) {
+    if (pc->nedges == pc->capedges) {
+        pc->capedges = pc->capedges ? pc->capedges * 2 : 256;
+        pc->edges = (struct pgo_edge*)realloc(pc->edges, sizeof(struct pgo_edge) * pc->capedges);
+    }
+    struct pgo_edge *e = &pc->edges[pc->nedges++];
+    e->from = from;
+    e->to = to;
+    e->count = count;
+    e->tail = tail;
+}
+
+// Label name of the first operand of a branch, or NULL.
+static char* pgo_operand(struct stmt_t *st, char* out) {
+    const char* s = strchr(st->text, ' ');
+    if (s == NULL) return NULL;
+    s++;
+    if (*s == '@') s++;
+    int n = strcspn(s, ", ");
+    if (n == 0 || n > 32) return NULL;
+    memcpy(out, s, n);
+    out[n] = 0;
+    return out;
+}
+
+static int pgo_is(struct stmt_t *st, const char* mnemonic) {
+    char m[16];
+    if (st->kind != STMT_INSN || st->special) return 0;
+    stmt_mnemonic(st, m);
+    return strcmp(m, mnemonic) == 0;
+}
+
+static int pgo_branch(struct stmt_t *st) {
+    return pgo_is(st, "jmp") || pgo_is(st, "call") || pgo_is(st, "brchf") || pgo_is(st, "brchi");
+}
+
+// Profile rows, comma or space separated:
+//   label,count          executions of the code at label
+//   from,to,count        transfers from the chunk holding 'from' to 'to'
+// Blank lines, '#' and ';' comments and a non-numeric header are skipped.
+static int pgo_load(struct pgo_ctx *pc, const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror("Opening profile");
+        return 1;
+    }
+
+    char buf[512];
+    int lineno = 0;
+    while (fgets(buf, sizeof(buf), fp)) {
+        lineno++;
+        buf[strcspn(buf, "\r\n")] = 0;
+        char* s = buf;
+        char* f[3];
+        int nf = 0;
+        char* tok;
+        while ((tok = strsep(&s, ", \t")) && nf < 4) {
+            if (tok[0] == 0) continue;
+            if (nf == 3) {
+                nf++;
+                break;
+            }
+            f[nf++] = tok;
+        }
+        if (nf == 0 || f[0][0] == '#' || f[0][0] == ';') continue;
+
+        struct parsed_int_t cnt = nf >= 2 ? getintval(f[nf-1]) : (struct parsed_int_t){1, 0, 0};
+        if (nf < 2 || nf > 3 || cnt.code != 0) {
+            if (lineno == 1) continue;
+            fprintf(stderr, "Error: %s:%d: expected 'label,count' or 'from,to,count'\n", path, lineno);
+            fclose(fp);
+            return 1;
+        }
+
+        struct pgo_label *a = pgo_find(pc, f[0]);
+        struct pgo_label *b = nf == 3 ? pgo_find(pc, f[1]) : NULL;
+        if (a == NULL || (nf == 3 && b == NULL)) continue;   // stale profile entries are harmless
+        if (nf == 2) {
+            a->count += cnt.value;
+            a->has_count = 1;
+        } else {
+            pc->edge_rows = 1;
+            pgo_add_edge(pc, pc->chunk_of[a->stmt], pc->chunk_of[b->stmt], cnt.value, 0);
+            b->count += cnt.value;
+            b->has_count = 1;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void pgo_chunks(struct pgo_ctx *pc) {
+    struct stmt_list *sl = pc->sl;
+    pc->chunks = (struct pgo_chunk*)calloc(sl->n + 1, sizeof(struct pgo_chunk));
+    pc->chunk_of = (int*)calloc(sl->n + 1, sizeof(int));
+    pc->nchunks = 0;
+
+    int seg = 0;
+    int closed = 0;     // last instruction was a jmp or ret
+    for (int i=0;i<sl->n;i++) {
+        struct stmt_t *st = &sl->v[i];
+        int fixed = st->kind == STMT_ORG || st->kind == STMT_FILL;
+        int head = st->kind == STMT_LABEL || st->kind == STMT_ALIGN;
+        int start = i == 0 || fixed || (head && closed && sl->v[i-1].kind != STMT_LABEL && sl->v[i-1].kind != STMT_ALIGN);
+        if (fixed) seg++;
+        if (start) {
+            struct pgo_chunk *c = &pc->chunks[pc->nchunks++];
+            c->start = i;
+            c->seg = seg;
+            c->pinned = i == 0 || fixed;
+            c->next = c->prev = -1;
+        }
+        pc->chunk_of[i] = pc->nchunks - 1;
+        if (st->kind == STMT_INSN) closed = pgo_is(st, "jmp") || pgo_is(st, "ret");
+        if (fixed) closed = 0;
+    }
+    for (int c=0;c<pc->nchunks;c++) {
+        pc->chunks[c].end = c + 1 < pc->nchunks ? pc->chunks[c+1].start : sl->n;
+    }
+}
+
+// Labels at the head of a chunk, before its first instruction.
+static int pgo_head_label(struct pgo_ctx *pc, int chunk, const char* name) {
+    for (int i=pc->chunks[chunk].start;i<pc->chunks[chunk].end;i++) {
+        struct stmt_t *st = &pc->sl->v[i];
+        if (st->kind == STMT_INSN) return 0;
+        if (st->kind != STMT_LABEL) continue;
+        if (strlen(st->text) - 1 == strlen(name) && strncmp(st->text, name, strlen(name)) == 0) return 1;
+    }
+    return 0;
+}
+
+static int pgo_last_insn(struct pgo_ctx *pc, int chunk) {
+    for (int i=pc->chunks[chunk].end-1;i>=pc->chunks[chunk].start;i--) {
+        if (pc->sl->v[i].kind == STMT_INSN) return i;
+    }
+    return -1;
+}
+
+// Execution counts per statement: a label with a count sets it, other
+// labels inherit it from the code above within the same chunk.
+static void pgo_counts(struct pgo_ctx *pc) {
+    pc->stmt_count = (unsigned long*)calloc(pc->sl->n + 1, sizeof(unsigned long));
+    unsigned long cur = 0;
+    for (int i=0;i<pc->sl->n;i++) {
+        struct stmt_t *st = &pc->sl->v[i];
+        if (pc->chunks[pc->chunk_of[i]].start == i) cur = 0;
+        if (st->kind == STMT_LABEL) {
+            char name[33];
+            strncpy(name, st->text, 32);
+            name[32] = 0;
+            name[strlen(name)-1] = 0;
+            struct pgo_label *l = pgo_find(pc, name);
+            if (l != NULL && l->has_count) cur = l->count;
+        }
+        pc->stmt_count[i] = cur;
+        struct pgo_chunk *c = &pc->chunks[pc->chunk_of[i]];
+        if (cur > c->count) c->count = cur;
+    }
+}
+
+// Branch edges between chunks, weighted from the profile.
+static void pgo_edges(struct pgo_ctx *pc) {
+    char op[33];
+    for (int i=0;i<pc->sl->n;i++) {
+        struct stmt_t *st = &pc->sl->v[i];
+        if (!pgo_branch(st) || pgo_operand(st, op) == NULL) continue;
+        struct pgo_label *l = pgo_find(pc, op);
+        if (l == NULL || l->stmt < 0) continue;
+
+        int from = pc->chunk_of[i];
+        int to = pc->chunk_of[l->stmt];
+        if (from == to) continue;
+        int tail = pgo_is(st, "jmp") && i == pgo_last_insn(pc, from) && pgo_head_label(pc, to, op);
+        unsigned long w = pc->stmt_count[i] < pc->stmt_count[l->stmt] ? pc->stmt_count[i] : pc->stmt_count[l->stmt];
+        pgo_add_edge(pc, from, to, pc->edge_rows ? 0 : w, tail);
+    }
+}
+
+static int pgo_edge_cmp(const void* a, const void* b) {
+    const struct pgo_edge *x = (const struct pgo_edge*)a;
+    const struct pgo_edge *y = (const struct pgo_edge*)b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    if (x->from != y->from) return x->from - y->from;
+    return x->to - y->to;
+}
+
+static int pgo_chain_head(struct pgo_ctx *pc, int c) {
+    while (pc->chunks[c].prev >= 0) c = pc->chunks[c].prev;
+    return c;
+}
+
+// Places chunk k and credits every unplaced chain it branches to or from.
+static void pgo_place(struct pgo_ctx *pc, int k, int *adj, int *adjstart, unsigned long *conn, int *head) {
+    pc->chunks[k].placed = 1;
+    for (int a=adjstart[k];a<adjstart[k+1];a++) {
+        struct pgo_edge *ed = &pc->edges[adj[a]];
+        int other = ed->from == k ? ed->to : ed->from;
+        if (!pc->chunks[other].placed) conn[head[other]] += ed->count;
+    }
+}
+
+static long pgo_cycles(struct pgo_ctx *pc, struct stmt_list *sl, unsigned long *count, int *chunk_of) {
+    for (int c=0;c<pc->nchunks;c++) pc->chunks[c].after = 0;
+    long total = 0;
+    for (int i=0;i<sl->n;i++) {
+        struct stmt_t *st = &sl->v[i];
+        if (st->kind != STMT_INSN || st->special) continue;
+        long cyc = (long)count[i] * cost_cycles(st->cand[st->rank]);
+        pc->chunks[chunk_of[i]].after += cyc;
+        total += cyc;
+    }
+    return total;
+}
+
+static void pgo_relayout(struct stmt_list *sl, struct le_context *lctx) {
+    for (int i=0;i<sl->n;i++) sl->v[i].rank = 0;
+    stmt_layout(sl, lctx);
+}
+
+static void pgo_index(struct pgo_ctx *pc) {
+    pgo_chunks(pc);
+    for (int i=0;i<pc->sl->n;i++) {
+        if (pc->sl->v[i].kind != STMT_LABEL) continue;
+        char name[33];
+        strncpy(name, pc->sl->v[i].text, 32);
+        name[32] = 0;
+        name[strlen(name)-1] = 0;
+        pgo_add_label(pc, name, i);
+    }
+    qsort(pc->labels, pc->nlabels, sizeof(struct pgo_label), pgo_label_cmp);
+}
+
+// Per-statement execution counts from a profile, for passes that only need
+// weights. The caller frees the result.
+unsigned long *pgo_stmt_counts(struct stmt_list *sl, const char* profile) {
+    struct pgo_ctx pc;
+    memset(&pc, 0, sizeof(pc));
+    pc.sl = sl;
+    pgo_index(&pc);
+    if (pgo_load(&pc, profile) != 0) exit(EXIT_FAILURE);
+    pgo_counts(&pc);
+    free(pc.labels);
+    free(pc.edges);
+    free(pc.chunks);
+    free(pc.chunk_of);
+    return pc.stmt_count;
+}
+
+int opt_pgo_layout(struct stmt_list *sl, struct le_context *lctx, const char* profile, FILE* report, struct pgo_result *res) {
+    struct pgo_ctx pc;
+    memset(&pc, 0, sizeof(pc));
+    pc.sl = sl;
+    memset(res, 0, sizeof(*res));
+    stmt_compact(sl);
+
+    if (!stmt_branches_all_labels(sl)) {
+        fprintf(stderr, "Warning: profile-guided layout skipped, program branches to non-label addresses\n");
+        return 1;
+    }
+
+    pgo_index(&pc);
+
+    if (pgo_load(&pc, profile) != 0) exit(EXIT_FAILURE);
+    pgo_counts(&pc);
+    pgo_edges(&pc);
+
+    pgo_relayout(sl, lctx);
+    pgo_cycles(&pc, sl, pc.stmt_count, pc.chunk_of);
+    for (int c=0;c<pc.nchunks;c++) pc.chunks[c].before = pc.chunks[c].after;
+
+    // Chain hot tail jumps into fall-throughs.
+    qsort(pc.edges, pc.nedges, sizeof(struct pgo_edge), pgo_edge_cmp);
+    for (int e=0;e<pc.nedges;e++) {
+        struct pgo_edge *ed = &pc.edges[e];
+        struct pgo_chunk *a = &pc.chunks[ed->from];
+        struct pgo_chunk *b = &pc.chunks[ed->to];
+        if (!ed->tail || ed->count == 0) continue;
+        if (a->next >= 0 || b->prev >= 0 || b->pinned || a->seg != b->seg) continue;
+        if (pgo_chain_head(&pc, ed->from) == ed->to) continue;
+        a->next = ed->to;
+        b->prev = ed->from;
+    }
+
+    // Place chains: each segment starts with its pinned chunk, then the
+    // chain most connected to what is already placed, in source order on ties.
+    int *head = (int*)malloc(sizeof(int) * (pc.nchunks + 1));
+    unsigned long *conn = (unsigned long*)calloc(pc.nchunks + 1, sizeof(unsigned long));
+    int *adjstart = (int*)calloc(pc.nchunks + 2, sizeof(int));
+    int *adj = (int*)malloc(sizeof(int) * (2 * pc.nedges + 1));
+    for (int c=0;c<pc.nchunks;c++) head[c] = pgo_chain_head(&pc, c);
+    for (int e=0;e<pc.nedges;e++) {
+        adjstart[pc.edges[e].from + 2]++;
+        adjstart[pc.edges[e].to + 2]++;
+    }
+    for (int c=0;c<pc.nchunks;c++) adjstart[c+2] += adjstart[c+1];
+    for (int e=0;e<pc.nedges;e++) {
+        adj[adjstart[pc.edges[e].from + 1]++] = e;
+        adj[adjstart[pc.edges[e].to + 1]++] = e;
+    }
+
+    int *order = (int*)malloc(sizeof(int) * (pc.nchunks + 1));
+    int norder = 0;
+    for (int c=0;c<pc.nchunks;c++) {
+        if (!pc.chunks[c].pinned) continue;
+        int seg = pc.chunks[c].seg;
+        int h = head[c];
+        while (h >= 0) {
+            for (int k=h;k>=0;k=pc.chunks[k].next) {
+                pgo_place(&pc, k, adj, adjstart, conn, head);
+                order[norder++] = k;
+            }
+            h = -1;
+            for (int k=c;k<pc.nchunks && pc.chunks[k].seg == seg;k++) {
+                if (pc.chunks[k].placed || head[k] != k) continue;
+                if (h < 0 || conn[k] > conn[h]) h = k;
+            }
+        }
+    }
+    for (int k=0;k<norder;k++) {
+        if (order[k] != k) res->moved++;
+    }
+
+    // Rebuild the statement list in the new order and drop jumps that now
+    // fall through.
+    struct stmt_t *v = (struct stmt_t*)malloc(sizeof(struct stmt_t) * (sl->n + 1));
+    unsigned long *cnt = (unsigned long*)malloc(sizeof(unsigned long) * (sl->n + 1));
+    int *chunk_of = (int*)malloc(sizeof(int) * (sl->n + 1));
+    int n = 0;
+    for (int k=0;k<norder;k++) {
+        int c = order[k];
+        for (int i=pc.chunks[c].start;i<pc.chunks[c].end;i++) {
+            v[n] = sl->v[i];
+            cnt[n] = pc.stmt_count[i];
+            chunk_of[n] = c;
+            n++;
+        }
+        char op[33];
+        int last = pgo_last_insn(&pc, c);
+        if (k + 1 < norder && last >= 0 && pgo_is(&sl->v[last], "jmp") && pgo_operand(&sl->v[last], op) != NULL && pgo_head_label(&pc, order[k+1], op)) {
+            int j = n - (pc.chunks[c].end - last);
+            v[j].kind = STMT_NONE;
+            res->jumps++;
+        }
+    }
+    free(sl->v);
+    sl->v = v;
+    sl->cap = sl->n + 1;
+
+    pgo_relayout(sl, lctx);
+    res->before = 0;
+    res->after = pgo_cycles(&pc, sl, cnt, chunk_of);
+    for (int c=0;c<pc.nchunks;c++) res->before += pc.chunks[c].before;
+
+    if (report != NULL) {
+        fprintf(report, "%-24s %12s %14s %14s %14s\n", "function", "count", "cycles before", "cycles after", "saved");
+        for (int k=0;k<norder;k++) {
+            struct pgo_chunk *c = &pc.chunks[order[k]];
+            if (c->before == 0 && c->after == 0) continue;
+            const char* name = "(entry)";
+            char buf[33];
+            for (int i=0;i<n;i++) {
+                if (chunk_of[i] != order[k] || v[i].kind != STMT_LABEL) continue;
+                strncpy(buf, v[i].text, 32);
+                buf[32] = 0;
+                buf[strlen(buf)-1] = 0;
+                name = buf;
+                break;
+            }
+            fprintf(report, "%-24s %12lu %14ld %14ld %14ld\n", name, c->count, c->before, c->after, c->before - c->after);
+        }
+        fprintf(report, "%-24s %12s %14ld %14ld %14ld\n", "total", "", res->before, res->after, res->before - res->after);
+    }
+
+    stmt_compact(sl);
+    free(order);
+    free(head);
+    free(conn);
+    free(adjstart);
+    free(adj);
+    free(cnt);
+    free(chunk_of);
+    free(pc.labels);
+    free(pc.edges);
+    free(pc.chunks);
+    free(pc.chunk_of);
+    free(pc.stmt_count);
+    return 0;
+}
+
+static void pgo_insert_align(struct stmt_list *sl, int at, int line, unsigned long *count) {
+    if (sl->n + 1 >= sl->cap) {
+        sl->cap = sl->cap ? sl->cap * 2 : 256;
+        sl->v = (struct stmt_t*)realloc(sl->v, sizeof(struct stmt_t) * sl->cap);
+    }
+    memmove(&sl->v[at+1], &sl->v[at], sizeof(struct stmt_t) * (sl->n - at));
+    memmove(&count[at+1], &count[at], sizeof(unsigned long) * (sl->n - at));
+    sl->n++;
+
+    char text[24];
+    snprintf(text, sizeof(text), "$align %d", line);
+    struct stmt_t *st = &sl->v[at];
+    memset(st, 0, sizeof(*st));
+    st->kind = STMT_ALIGN;
+    st->lineno = sl->v[at+1].lineno;
+    st->text = strdup(text);
+    st->value = line;
+    st->symidx = -1;
+}
+
+// Pads hot loop heads to a fetch line boundary. A loop runs from a label to
+// the last branch back to it; aligning the head saves PGO_FETCH_CYCLES per
+// iteration for every line the body no longer straddles, and costs the
+// padding words plus the nops executed whenever the loop is entered by
+// falling into it. Returns the number of heads padded; *words gets the
+// padding added at the time of the decision.
+int opt_pgo_align(struct stmt_list *sl, struct le_context *lctx, const char* profile, int line, FILE* log, int *words) {
+    struct pgo_ctx pc;
+    memset(&pc, 0, sizeof(pc));
+    pc.sl = sl;
+    *words = 0;
+    stmt_compact(sl);
+
+    if (!stmt_branches_all_labels(sl)) {
+        fprintf(stderr, "Warning: loop alignment skipped, program branches to non-label addresses\n");
+        return 0;
+    }
+
+    pgo_index(&pc);
+    if (pgo_load(&pc, profile) != 0) exit(EXIT_FAILURE);
+    pgo_counts(&pc);
+
+    // back[h]: the last branch to a label of the run starting at h, if it
+    // comes after it.
+    unsigned long *count = (unsigned long*)realloc(pc.stmt_count, sizeof(unsigned long) * (2 * sl->n + 1));
+    int *back = (int*)malloc(sizeof(int) * (2 * sl->n + 1));
+    for (int i=0;i<sl->n;i++) back[i] = -1;
+    char op[33];
+    for (int i=0;i<sl->n;i++) {
+        struct stmt_t *st = &sl->v[i];
+        if (!pgo_branch(st) || pgo_is(st, "call") || pgo_operand(st, op) == NULL) continue;
+        struct pgo_label *l = pgo_find(&pc, op);
+        if (l == NULL || l->stmt < 0 || l->stmt > i) continue;
+        int h = l->stmt;
+        while (h > 0 && sl->v[h-1].kind == STMT_LABEL) h--;
+        if (pc.chunks[pc.chunk_of[h]].seg != pc.chunks[pc.chunk_of[i]].seg) continue;
+        if (i > back[h]) back[h] = i;
+    }
+
+    char nop[] = "nop", none[] = "";
+    int nopcycles = cost_cycles(find_insn(nop, none));
+    int padded = 0;
+    pgo_relayout(sl, lctx);
+    for (int h=0;h<sl->n;h++) {
+        int j = back[h];
+        if (j < 0 || count[j] == 0 || (h > 0 && sl->v[h-1].kind == STMT_ALIGN)) continue;
+        int first = h;
+        while (first < j && sl->v[first].kind != STMT_INSN) first++;
+
+        uint32_t a = sl->v[first].addr;
+        uint32_t e = sl->v[j].addr + sl->v[j].length*2;
+        uint32_t pad = (line - a % line) % line;
+        if (pad == 0) continue;
+        long before = (e - 1) / line - a / line + 1;
+        long after = (e - 1 + pad) / line - (a + pad) / line + 1;
+        if (after >= before) continue;
+
+        // Entries by falling in execute the padding.
+        unsigned long fallin = 0;
+        for (int p=h-1;p>=0;p--) {
+            struct stmt_t *st = &sl->v[p];
+            if (st->kind == STMT_ORG || st->kind == STMT_FILL) break;
+            if (st->kind != STMT_INSN) continue;
+            if (!pgo_is(st, "jmp") && !pgo_is(st, "ret")) fallin = count[p];
+            break;
+        }
+        long cycles = (long)fallin * (pad / 2) * nopcycles - (long)count[j] * (before - after) * PGO_FETCH_CYCLES;
+        if (cycles < -0x7FFFFFFFL) cycles = -0x7FFFFFFFL;
+        if (cycles > 0x7FFFFFFFL) cycles = 0x7FFFFFFFL;
+        if (cost_value((int)cycles, pad / 2) >= 0) continue;
+
+        if (log != NULL) {
+            fprintf(log, "line %d: align-loop: %.*s (%lu iterations, %ld -> %ld lines, %d padding words)\n", sl->v[h].lineno,
+                (int)strlen(sl->v[h].text) - 1, sl->v[h].text, count[j], before, after, pad / 2);
+        }
+        pgo_insert_align(sl, h, line, count);
+        memmove(&back[h+1], &back[h], sizeof(int) * (sl->n - 1 - h));
+        back[h] = -1;
+        for (int k=h+1;k<sl->n;k++) {
+            if (back[k] >= h) back[k]++;
+        }
+        *words += pad / 2;
+        padded++;
+        h++;
+        pgo_relayout(sl, lctx);
+    }
+
+    free(back);
+    free(count);
+    free(pc.labels);
+    free(pc.edges);
+    free(pc.chunks);
+    free(pc.chunk_of);
+    return padded;
+}
@@ -0,0 +1,22 @@
+#ifndef PGO_H
+#define PGO_H
+
+#include <stdio.h>
+#include "label.h"
+#include "stmt.h"
+
+#define PGO_ALIGN_DEFAULT 16   // fetch line, bytes
+#define PGO_FETCH_CYCLES 1     // stall per extra line fetched
+
+struct pgo_result {
+    int moved;          // chunks not at their source position
+    int jumps;          // jmp statements turned into fall-throughs
+    long before;        // predicted cycles, weighted by the profile
+    long after;
+};
+
+unsigned long *pgo_stmt_counts(struct stmt_list *sl, const char* profile);
+int opt_pgo_layout(struct stmt_list *sl, struct le_context *lctx, const char* profile, FILE* report, struct pgo_result *res);
+int opt_pgo_align(struct stmt_list *sl, struct le_context *lctx, const char* profile, int line, FILE* log, int *words);
+
+#endif
@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "m4asm.h"
+#include "sim.h"
+#include "srcmap.h"
+#include "prof.h"
+
+#define PROF_TOP 20             // source lines in the report
+#define PROF_PAGE_WORDS (SIM_PAGE_SIZE / 2)
+
+struct prof_count {
+    unsigned long long insns;
+    unsigned long long cycles;
+};
+
+// Calling-context tree node: one per distinct call path.
+struct prof_node {
+    uint32_t fn;        // call target, the entry point for the root
+    int parent;
+    int child;
+    int sibling;
+    unsigned long long calls;
+    unsigned long long insns;
+    unsigned long long cycles;
+};
+
+struct prof {
+    unsigned long long period;  // 0 = exact
+    struct prof_count **pages;  // SIM_NPAGES entries, per word
+    struct srcmap map;
+    int has_listing;
+    struct prof_count *linec;   // per map line, filled by prof_fold()
+    struct prof_count *labelc;  // per map label
+    struct prof_node *nodes;
+    int nnodes;
+    int capnodes;
+    int cur;
+    unsigned long long insns;
+    unsigned long long cycles;
+};
+
+static void* prof_grow(void* v, int *cap, size_t size) {
+    *cap = *cap ? *cap * 2 : 256;
+    v = realloc(v, size * *cap);
+    if (v == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return v;
+}
+
+struct prof *prof_new(unsigned long long period) {
+    struct prof *p = (struct prof*)calloc(1, sizeof(struct prof));
+    if (p != NULL) p->pages = (struct prof_count**)calloc(SIM_NPAGES, sizeof(struct prof_count*));
+    if (p == NULL || p->pages == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    p->period = period;
+    return p;
+}
+
+void prof_free(struct prof *p) {
+    if (p == NULL) return;
+    for (unsigned long k=0;k<SIM_NPAGES;k++) free(p->pages[k]);
+    free(p->pages);
+    srcmap_free(&p->map);
+    free(p->linec);
+    free(p->labelc);
+    free(p->nodes);
+    free(p);
+}
+
+int prof_has_listing(struct prof *p) {
+    return p->has_listing;
+}
+
+int prof_exact(struct prof *p) {
+    return p->period == 0;
+}
+
+int prof_listing(struct prof *p, const char* path) {
+    if (srcmap_load(&p->map, path) != 0) return 1;
+    p->has_listing = 1;
+    return 0;
+}
+
+static void prof_charge(struct prof *p, uint32_t pc, unsigned long long insns, unsigned long long cycles) {
+    struct prof_count **pp = &p->pages[pc >> SIM_PAGE_BITS];
+    if (*pp == NULL) {
+        *pp = (struct prof_count*)calloc(PROF_PAGE_WORDS, sizeof(struct prof_count));
+        if (*pp == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct prof_count *c = &(*pp)[(pc & (SIM_PAGE_SIZE - 1)) >> 1];
+    c->insns += insns;
+    c->cycles += cycles;
+    p->insns += insns;
+    p->cycles += cycles;
+}
+
+static struct prof_count prof_count_at(struct prof *p, uint32_t addr) {
+    struct prof_count *pg = p->pages[addr >> SIM_PAGE_BITS];
+    struct prof_count zero = {0, 0};
+    return pg == NULL ? zero : pg[(addr & (SIM_PAGE_SIZE - 1)) >> 1];
+}
+
+static int prof_node(struct prof *p, int parent, uint32_t fn) {
+    if (p->nnodes == p->capnodes) p->nodes = (struct prof_node*)prof_grow(p->nodes, &p->capnodes, sizeof(struct prof_node));
+    struct prof_node *n = &p->nodes[p->nnodes];
+    memset(n, 0, sizeof(*n));
+    n->fn = fn;
+    n->parent = parent;
+    n->child = -1;
+    n->sibling = -1;
+    if (parent >= 0) {
+        n->sibling = p->nodes[parent].child;
+        p->nodes[parent].child = p->nnodes;
+    }
+    return p->nnodes++;
+}
+
+static int prof_child(struct prof *p, int parent, uint32_t fn) {
+    for (int c=p->nodes[parent].child;c>=0;c=p->nodes[c].sibling) {
+        if (p->nodes[c].fn == fn) return c;
+    }
+    return prof_node(p, parent, fn);
+}
+
+int prof_run(struct prof *p, struct sim *s, unsigned long long maxinsns, int (*run)(struct sim*, unsigned long long)) {
+    unsigned long long limit = maxinsns ? maxinsns : ~0ULL;
+    unsigned long long done = 0;
+    int stop = SIM_STOP_LIMIT;
+
+    if (p->period == 0) {
+        if (p->nnodes == 0) p->cur = prof_node(p, -1, s->pc);
+        while (done < limit) {
+            uint32_t pc = s->pc;
+            int depth = s->depth;
+            unsigned long long i0 = s->insns;
+            unsigned long long c0 = s->cycles;
+            stop = sim_run(s, 1);
+            unsigned long long di = s->insns - i0;
+            if (di) {
+                prof_charge(p, pc, di, s->cycles - c0);
+                p->nodes[p->cur].insns += di;
+                p->nodes[p->cur].cycles += s->cycles - c0;
+            }
+            done += di;
+            if (s->depth > depth) {
+                p->cur = prof_child(p, p->cur, s->pc);
+                p->nodes[p->cur].calls++;
+            } else if (s->depth < depth && p->nodes[p->cur].parent >= 0) {
+                p->cur = p->nodes[p->cur].parent;
+            }
+            if (stop != SIM_STOP_LIMIT) return stop;
+        }
+    } else {
+        while (done < limit) {
+            unsigned long long slice = p->period < limit - done ? p->period : limit - done;
+            unsigned long long i0 = s->insns;
+            unsigned long long c0 = s->cycles;
+            stop = run(s, slice);
+            if (s->insns > i0) prof_charge(p, s->pc, s->insns - i0, s->cycles - c0);
+            done += s->insns - i0;
+            if (stop != SIM_STOP_LIMIT) return stop;
+        }
+    }
+    s->stop = SIM_STOP_LIMIT;
+    return s->stop;
+}
+
+static const char* prof_name(struct prof *p, uint32_t addr, char* out) {
+    return srcmap_name(&p->map, addr, out);
+}
+
+static double prof_pct(unsigned long long v, unsigned long long total) {
+    return total ? 100.0 * v / total : 0.0;
+}
+
+// Folds the per-word counts onto lines and labels.
+static void prof_fold(struct prof *p, struct prof_count *loose) {
+    struct srcmap *m = &p->map;
+    memset(loose, 0, sizeof(*loose));
+    free(p->linec);
+    free(p->labelc);
+    p->linec = (struct prof_count*)calloc(m->nlines + 1, sizeof(struct prof_count));
+    p->labelc = (struct prof_count*)calloc(m->nlabels + 1, sizeof(struct prof_count));
+    for (unsigned long pg=0;pg<SIM_NPAGES;pg++) {
+        if (p->pages[pg] == NULL) continue;
+        for (uint32_t w=0;w<PROF_PAGE_WORDS;w++) {
+            struct prof_count *c = &p->pages[pg][w];
+            if (c->insns == 0) continue;
+            uint32_t addr = (uint32_t)(pg << SIM_PAGE_BITS) | w << 1;
+            int k = srcmap_line(m, addr);
+            struct prof_count *to = k < 0 || m->lines[k].label < 0 ? loose : &p->labelc[m->lines[k].label];
+            if (k >= 0) {
+                p->linec[k].insns += c->insns;
+                p->linec[k].cycles += c->cycles;
+            }
+            to->insns += c->insns;
+            to->cycles += c->cycles;
+        }
+    }
+}
+
+static struct prof *prof_sort_ctx;
+
+static int prof_by_cycles_line(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    struct prof_count *c = prof_sort_ctx->linec;
+    if (c[x].cycles != c[y].cycles) return c[x].cycles < c[y].cycles ? 1 : -1;
+    return prof_sort_ctx->map.lines[x].lineno - prof_sort_ctx->map.lines[y].lineno;
+}
+
+static int prof_by_cycles_label(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    struct prof_count *c = prof_sort_ctx->labelc;
+    if (c[x].cycles != c[y].cycles) return c[x].cycles < c[y].cycles ? 1 : -1;
+    return prof_sort_ctx->map.labels[x].order - prof_sort_ctx->map.labels[y].order;
+}
+
+// Per-routine totals over the calling-context tree.
+struct prof_fn {
+    uint32_t fn;
+    unsigned long long calls;
+    unsigned long long self;
+    unsigned long long total;   // cycles under the routine, recursion counted once
+    int onstack;
+};
+
+struct prof_edge {
+    int caller;
+    int callee;
+    unsigned long long calls;
+    unsigned long long cycles;
+};
+
+static int prof_fn_cmp(const void* a, const void* b) {
+    const struct prof_fn *x = (const struct prof_fn*)a;
+    const struct prof_fn *y = (const struct prof_fn*)b;
+    return x->fn < y->fn ? -1 : x->fn > y->fn;
+}
+
+static int prof_fn_total_cmp(const void* a, const void* b) {
+    const struct prof_fn *x = (const struct prof_fn*)a;
+    const struct prof_fn *y = (const struct prof_fn*)b;
+    if (x->total != y->total) return x->total < y->total ? 1 : -1;
+    return x->fn < y->fn ? -1 : x->fn > y->fn;
+}
+
+static int prof_edge_cmp(const void* a, const void* b) {
+    const struct prof_edge *x = (const struct prof_edge*)a;
+    const struct prof_edge *y = (const struct prof_edge*)b;
+    if (x->caller != y->caller) return x->caller - y->caller;
+    return x->callee - y->callee;
+}
+
+static int prof_edge_cycles_cmp(const void* a, const void* b) {
+    const struct prof_edge *x = (const struct prof_edge*)a;
+    const struct prof_edge *y = (const struct prof_edge*)b;
+    if (x->cycles != y->cycles) return x->cycles < y->cycles ? 1 : -1;
+    return prof_edge_cmp(a, b);
+}
+
+static int prof_fn_index(struct prof_fn *fns, int nfns, uint32_t fn) {
+    struct prof_fn key;
+    key.fn = fn;
+    return (struct prof_fn*)bsearch(&key, fns, nfns, sizeof(struct prof_fn), prof_fn_cmp) - fns;
+}
+
+static void prof_callgraph(struct prof *p, FILE* fp) {
+    int n = p->nnodes;
+    unsigned long long *incl = (unsigned long long*)malloc(sizeof(unsigned long long) * (n + 1));
+    int *fidx = (int*)malloc(sizeof(int) * (n + 1));
+    struct prof_fn *fns = (struct prof_fn*)calloc(n + 1, sizeof(struct prof_fn));
+    struct prof_edge *edges = (struct prof_edge*)calloc(n + 1, sizeof(struct prof_edge));
+    char na[48], nb[48];
+
+    // Children are always created after their parent.
+    for (int i=0;i<n;i++) incl[i] = p->nodes[i].cycles;
+    for (int i=n-1;i>0;i--) incl[p->nodes[i].parent] += incl[i];
+
+    int nfns = 0;
+    for (int i=0;i<n;i++) fns[nfns++].fn = p->nodes[i].fn;
+    qsort(fns, nfns, sizeof(struct prof_fn), prof_fn_cmp);
+    int u = 0;
+    for (int i=0;i<nfns;i++) {
+        if (u == 0 || fns[u-1].fn != fns[i].fn) fns[u++] = fns[i];
+    }
+    nfns = u;
+    for (int i=0;i<n;i++) {
+        fidx[i] = prof_fn_index(fns, nfns, p->nodes[i].fn);
+        fns[fidx[i]].calls += p->nodes[i].calls;
+        fns[fidx[i]].self += p->nodes[i].cycles;
+    }
+
+    // Depth-first walk; a node only adds to its routine's total when the
+    // routine is not already further up the path.
+    int v = 0;
+    for (;;) {
+        if (fns[fidx[v]].onstack++ == 0) fns[fidx[v]].total += incl[v];
+        if (p->nodes[v].child >= 0) {
+            v = p->nodes[v].child;
+            continue;
+        }
+        for (;;) {
+            fns[fidx[v]].onstack--;
+            if (v == 0) break;
+            if (p->nodes[v].sibling >= 0) {
+                v = p->nodes[v].sibling;
+                break;
+            }
+            v = p->nodes[v].parent;
+        }
+        if (v == 0) break;
+    }
+
+    int nedges = 0;
+    for (int i=1;i<n;i++) {
+        struct prof_edge *e = &edges[nedges++];
+        e->caller = fidx[p->nodes[i].parent];
+        e->callee = fidx[i];
+        e->calls = p->nodes[i].calls;
+        e->cycles = incl[i];
+    }
+    qsort(edges, nedges, sizeof(struct prof_edge), prof_edge_cmp);
+    u = 0;
+    for (int i=0;i<nedges;i++) {
+        if (u > 0 && edges[u-1].caller == edges[i].caller && edges[u-1].callee == edges[i].callee) {
+            edges[u-1].calls += edges[i].calls;
+            edges[u-1].cycles += edges[i].cycles;
+        } else {
+            edges[u++] = edges[i];
+        }
+    }
+    nedges = u;
+    qsort(edges, nedges, sizeof(struct prof_edge), prof_edge_cycles_cmp);
+
+    fprintf(fp, ";\n; routines (call targets), cycles\n");
+    fprintf(fp, "; %12s %6s  %12s %6s  %10s  %s\n", "self", "%", "total", "%", "calls", "routine");
+    struct prof_fn *order = (struct prof_fn*)malloc(sizeof(struct prof_fn) * (nfns + 1));
+    memcpy(order, fns, sizeof(struct prof_fn) * nfns);
+    qsort(order, nfns, sizeof(struct prof_fn), prof_fn_total_cmp);
+    for (int i=0;i<nfns;i++) {
+        struct prof_fn *f = &order[i];
+        fprintf(fp, "  %12llu %5.1f%%  %12llu %5.1f%%  %10llu  %s\n", f->self, prof_pct(f->self, p->cycles),
+            f->total, prof_pct(f->total, p->cycles), f->calls, prof_name(p, f->fn, na));
+    }
+
+    fprintf(fp, ";\n; calls, cycles spent in the callee on behalf of the caller\n");
+    fprintf(fp, "; %10s  %12s %6s  %s\n", "calls", "cycles", "%", "caller -> callee");
+    for (int i=0;i<nedges;i++) {
+        struct prof_edge *e = &edges[i];
+        fprintf(fp, "  %10llu  %12llu %5.1f%%  %s -> %s\n", e->calls, e->cycles, prof_pct(e->cycles, p->cycles),
+            prof_name(p, fns[e->caller].fn, na), prof_name(p, fns[e->callee].fn, nb));
+    }
+
+    free(order);
+    free(edges);
+    free(fns);
+    free(fidx);
+    free(incl);
+}
+
+void prof_report(struct prof *p, FILE* fp) {
+    struct prof_count loose;
+    prof_fold(p, &loose);
+    prof_sort_ctx = p;
+
+    if (p->period) fprintf(fp, "; m4sim profile, sampled every %llu instructions\n", p->period);
+    else fprintf(fp, "; m4sim profile, exact\n");
+    fprintf(fp, "; %llu instructions, %llu cycles\n", p->insns, p->cycles);
+
+    struct srcmap *m = &p->map;
+    int *idx = (int*)malloc(sizeof(int) * (m->nlabels + m->nlines + 1));
+    fprintf(fp, ";\n; by label\n");
+    fprintf(fp, "; %12s %6s  %12s  %s\n", "cycles", "%", "insns", "label");
+    int n = 0;
+    for (int i=0;i<m->nlabels;i++) {
+        if (p->labelc[i].insns) idx[n++] = i;
+    }
+    qsort(idx, n, sizeof(int), prof_by_cycles_label);
+    for (int i=0;i<n;i++) {
+        struct prof_count *c = &p->labelc[idx[i]];
+        fprintf(fp, "  %12llu %5.1f%%  %12llu  %s\n", c->cycles, prof_pct(c->cycles, p->cycles), c->insns, m->labels[idx[i]].name);
+    }
+    if (loose.insns) {
+        fprintf(fp, "  %12llu %5.1f%%  %12llu  %s\n", loose.cycles, prof_pct(loose.cycles, p->cycles), loose.insns,
+            p->has_listing ? "(no label)" : "(no listing)");
+    }
+
+    if (m->nlines) {
+        fprintf(fp, ";\n; by source line, top %d\n", PROF_TOP);
+        fprintf(fp, "; %12s %6s  %12s  %7s  %s\n", "cycles", "%", "insns", "line", "source");
+        n = 0;
+        for (int i=0;i<m->nlines;i++) {
+            if (p->linec[i].insns) idx[n++] = i;
+        }
+        qsort(idx, n, sizeof(int), prof_by_cycles_line);
+        for (int i=0;i<n && i<PROF_TOP;i++) {
+            struct prof_count *c = &p->linec[idx[i]];
+            struct srcmap_line *l = &m->lines[idx[i]];
+            fprintf(fp, "  %12llu %5.1f%%  %12llu  %7d  %s\n", c->cycles, prof_pct(c->cycles, p->cycles), c->insns, l->lineno, l->text);
+        }
+    }
+    free(idx);
+
+    if (p->period == 0 && p->nnodes > 0) prof_callgraph(p, fp);
+}
+
+void prof_collapsed(struct prof *p, FILE* fp) {
+    int *path = (int*)malloc(sizeof(int) * (p->nnodes + 1));
+    char name[48];
+    for (int i=0;i<p->nnodes;i++) {
+        if (p->nodes[i].cycles == 0) continue;
+        int depth = 0;
+        for (int v=i;v>=0;v=p->nodes[v].parent) path[depth++] = v;
+        for (int k=depth-1;k>=0;k--) {
+            fprintf(fp, "%s%s", prof_name(p, p->nodes[path[k]].fn, name), k ? ";" : "");
+        }
+        fprintf(fp, " %llu\n", p->nodes[i].cycles);
+    }
+    free(path);
+}
+
+void prof_pgo(struct prof *p, FILE* fp) {
+    fprintf(fp, "# label,count: executions of the code at label (m4sim");
+    if (p->period) fprintf(fp, ", estimated from samples every %llu instructions", p->period);
+    fprintf(fp, ")\n");
+    for (int i=0;i<p->map.nlabels;i++) {
+        if (!p->map.labels[i].code) continue;
+        fprintf(fp, "%s,%llu\n", p->map.labels[i].name, prof_count_at(p, p->map.labels[i].addr).insns);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdio.h>
+#include "sim.h"
+
+// Profiler for simulated programs (m4sim -p/-F/-G). Executed instructions
+// and cycles are counted per address and folded onto source lines and
+// labels through an m4asm listing (-l), which is the assembler's
+// address -> line mapping.
+//
+// Exact mode steps the interpreter and keeps a calling-context tree from
+// call/ret, which gives cumulative per-routine totals, a caller/callee
+// graph and collapsed stacks for flamegraph tools. Sampling mode runs
+// whole slices of period instructions (through the JIT if asked) and
+// charges each slice to the pc it stops at; it only has flat totals.
+//
+// prof_pgo() writes the label,count profile that m4asm --profile reads:
+// the number of times the instruction at each code label ran.
+
+struct prof;
+
+struct prof *prof_new(unsigned long long period);
+void prof_free(struct prof *p);
+// Reads an m4asm listing. Returns 0, or 1 with errno set.
+int prof_listing(struct prof *p, const char* path);
+int prof_has_listing(struct prof *p);
+int prof_exact(struct prof *p);
+
+// Like sim_run(), profiling as it goes. run executes sampling slices.
+int prof_run(struct prof *p, struct sim *s, unsigned long long maxinsns, int (*run)(struct sim*, unsigned long long));
+
+// Flat report by label and by source line, and in exact mode the
+// per-routine cumulative totals and call graph.
+void prof_report(struct prof *p, FILE* fp);
+// "root;caller;callee cycles" lines. Exact mode only.
+void prof_collapsed(struct prof *p, FILE* fp);
+// Needs a listing.
+void prof_pgo(struct prof *p, FILE* fp);
+
+#endif
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m4asm.h"
+#include "label.h"
+#include "cost.h"
+#include "pseudo.h"
+#include "insns.h"
+
+// Pseudo-instructions. Each is expanded into real instructions when the
+// statement list is built; where several sequences do the same job, the
+// one that is cheapest under the cost model is used.
+//
+//   clr rA              rA = 0
+//   neg rA              rA = -rA
+//   swap rA, rB         exchange rA and rB
+//   mul rA, c [, rT]    rA = rA * c (mod 2^16); rT is scratch, needed
+//                       unless c is 0 or +-2^k
+//   div rA, 2^k         rA = rA / 2^k, unsigned
+//   add32 rA:rB, rC:rD  rA:rB += rC:rD (high:low)
+//   sub32 rA:rB, rC:rD  rA:rB -= rC:rD
+
+struct pseudo_seq {
+    int n;
+    char v[PSEUDO_MAXEXP][PSEUDO_MAXLINE];
+};
+
+static void ps_emit(struct pseudo_seq *s, const char* fmt, int a, int b) {
+    if (s->n == PSEUDO_MAXEXP) {
+        fprintf(stderr, "Error: pseudo-instruction expands to more than %d instructions\n", PSEUDO_MAXEXP);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(s->v[s->n++], PSEUDO_MAXLINE, fmt, a, b);
+}
+
+static long ps_cost(struct pseudo_seq *s, struct le_context *lctx) {
+    int cycles = 0, words = 0;
+    for (int i=0;i<s->n;i++) {
+        struct parsed_insn_t pi;
+        parse_insn(s->v[i], lctx, &pi);
+        int def = find_insn(pi.mnemonic, pi.ptypes);
+        if (def < 0) return -1;
+        cycles += cost_cycles(def);
+        words += cost_length(def);
+    }
+    return cost_value(cycles, words);
+}
+
+// Keeps the cheaper of *best and *alt in *best.
+static void ps_pick(struct pseudo_seq *best, struct pseudo_seq *alt, struct le_context *lctx) {
+    long a = ps_cost(alt, lctx);
+    long b = ps_cost(best, lctx);
+    if (a >= 0 && (b < 0 || a < b)) *best = *alt;
+}
+
+static int ps_reg(char* tok) {
+    struct parsed_int_t iv;
+    if (tok == NULL || tok[0] != 'r') return -1;
+    iv = getintval(tok+1);
+    return iv.code == 0 && iv.value <= 15 ? (int)iv.value : -1;
+}
+
+// "rA:rB" -> hi, lo
+static int ps_pair(char* tok, int *hi, int *lo) {
+    if (tok == NULL) return 0;
+    char* colon = strchr(tok, ':');
+    if (colon == NULL) return 0;
+    *colon = 0;
+    *hi = ps_reg(tok);
+    *lo = ps_reg(colon+1);
+    *colon = ':';
+    return *hi >= 0 && *lo >= 0 && *hi != *lo;
+}
+
+static void ps_clr(struct pseudo_seq *s, int r, struct le_context *lctx) {
+    struct pseudo_seq alt;
+    s->n = 0;
+    ps_emit(s, "xor r%d, r%d", r, r);
+    alt.n = 0;
+    ps_emit(&alt, "sub r%d, r%d", r, r);
+    ps_pick(s, &alt, lctx);
+    alt.n = 0;
+    ps_emit(&alt, "mov r%d, %d", r, 0);
+    ps_pick(s, &alt, lctx);
+}
+
+static void ps_neg(struct pseudo_seq *s, int r, struct le_context *lctx) {
+    struct pseudo_seq alt;
+    s->n = 0;
+    ps_emit(s, "not r%d", r, 0);
+    ps_emit(s, "inc r%d", r, 0);
+    alt.n = 0;
+    ps_emit(&alt, "not r%d", r, 0);
+    ps_emit(&alt, "add r%d, %d", r, 1);
+    ps_pick(s, &alt, lctx);
+}
+
+// Horner evaluation of rA * sum(sign[i] << pos[i]), digits most significant
+// first, with rT holding the original value.
+static int ps_horner(struct pseudo_seq *s, int a, int t, int n, int *pos, int *sign, struct le_context *lctx) {
+    s->n = 0;
+    if (n == 0) {
+        ps_clr(s, a, lctx);
+        return 1;
+    }
+    if (n > 1) {
+        if (t < 0) return 0;
+        ps_emit(s, "mov r%d, r%d", t, a);
+    }
+    if (sign[0] < 0) {
+        struct pseudo_seq neg;
+        ps_neg(&neg, a, lctx);
+        for (int i=0;i<neg.n;i++) strcpy(s->v[s->n++], neg.v[i]);
+    }
+    for (int i=1;i<n;i++) {
+        ps_emit(s, "shl r%d, %d", a, pos[i-1] - pos[i]);
+        ps_emit(s, sign[i] > 0 ? "add r%d, r%d" : "sub r%d, r%d", a, t);
+    }
+    if (pos[n-1] > 0) ps_emit(s, "shl r%d, %d", a, pos[n-1]);
+    return 1;
+}
+
+// Plain binary and canonical signed-digit decompositions of c, both
+// evaluated by ps_horner; the cheaper one wins.
+static void ps_mul(struct pseudo_seq *s, int a, int t, unsigned c, struct le_context *lctx, const char* line) {
+    int pos[17], sign[17], n;
+    struct pseudo_seq alt;
+    int ok = 0;
+    c &= 0xFFFF;
+
+    if (c == 1) {
+        s->n = 0;
+        return;
+    }
+
+    n = 0;
+    for (int k=15;k>=0;k--) {
+        if (!(c >> k & 1)) continue;
+        pos[n] = k;
+        sign[n++] = 1;
+    }
+    ok = ps_horner(s, a, t, n, pos, sign, lctx);
+
+    // CSD digits, least significant first, then reversed. A digit at 2^16
+    // vanishes modulo the word size.
+    int cpos[17], csign[17], m = 0;
+    unsigned long x = c;
+    for (int k=0;x && k<=16;k++) {
+        if (!(x & 1)) {
+            x >>= 1;
+            continue;
+        }
+        int d = (x & 3) == 3 ? -1 : 1;
+        if (k < 16) {
+            cpos[m] = k;
+            csign[m++] = d;
+        }
+        x = (x - d) >> 1;
+    }
+    n = 0;
+    for (int i=m-1;i>=0;i--) {
+        pos[n] = cpos[i];
+        sign[n++] = csign[i];
+    }
+    if (ps_horner(&alt, a, t, n, pos, sign, lctx)) {
+        if (!ok) *s = alt;
+        else ps_pick(s, &alt, lctx);
+        ok = 1;
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Error: %s needs a scratch register: mul rA, const, rT\n", line);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Returns 1 and fills out/n if line is a pseudo-instruction.
+int pseudo_expand(char* line, struct le_context *lctx, char out[][PSEUDO_MAXLINE], int *n) {
+    char* dup = strdup(line);
+    char* s = dup;
+    char* tok[5] = {NULL, NULL, NULL, NULL, NULL};
+    int ntok = 0;
+    char* t;
+    while ((t = strsep(&s, " ")) && ntok < 5) {
+        if (t[0] == 0) continue;
+        if (t[strlen(t)-1] == ',') t[strlen(t)-1] = 0;
+        tok[ntok++] = t;
+    }
+    if (ntok == 0) {
+        free(dup);
+        return 0;
+    }
+    STRTOLOWER(tok[0]);
+
+    struct pseudo_seq seq;
+    seq.n = 0;
+    int ra = ps_reg(tok[1]);
+    int rb = ps_reg(tok[2]);
+    int ah, al, bh, bl;
+    int bad = 0;
+
+    if (strcmp(tok[0], "clr") == 0) {
+        bad = ntok != 2 || ra < 0;
+        if (!bad) ps_clr(&seq, ra, lctx);
+    } else if (strcmp(tok[0], "neg") == 0) {
+        bad = ntok != 2 || ra < 0;
+        if (!bad) ps_neg(&seq, ra, lctx);
+    } else if (strcmp(tok[0], "swap") == 0) {
+        bad = ntok != 3 || ra < 0 || rb < 0;
+        if (!bad && ra != rb) {
+            struct pseudo_seq alt;
+            ps_emit(&seq, "xor r%d, r%d", ra, rb);
+            ps_emit(&seq, "xor r%d, r%d", rb, ra);
+            ps_emit(&seq, "xor r%d, r%d", ra, rb);
+            alt.n = 0;
+            ps_emit(&alt, "push r%d", ra, 0);
+            ps_emit(&alt, "mov r%d, r%d", ra, rb);
+            ps_emit(&alt, "pop r%d", rb, 0);
+            ps_pick(&seq, &alt, lctx);
+        }
+    } else if (strcmp(tok[0], "mul") == 0) {
+        struct parsed_int_t c = tok[2] != NULL ? getintval(tok[2]) : (struct parsed_int_t){1, 0, 0};
+        int rt = ntok == 4 ? ps_reg(tok[3]) : -1;
+        bad = (ntok != 3 && ntok != 4) || ra < 0 || c.code != 0 || c.value > 0xFFFF || (ntok == 4 && (rt < 0 || rt == ra));
+        if (!bad) ps_mul(&seq, ra, rt, c.value, lctx, line);
+    } else if (strcmp(tok[0], "div") == 0) {
+        struct parsed_int_t c = tok[2] != NULL ? getintval(tok[2]) : (struct parsed_int_t){1, 0, 0};
+        bad = ntok != 3 || ra < 0 || c.code != 0 || c.value == 0 || c.value > 0x8000 || (c.value & (c.value - 1));
+        if (bad && ra >= 0 && c.code == 0) {
+            fprintf(stderr, "Error: %s: only division by a power of two is supported\n", line);
+            exit(EXIT_FAILURE);
+        }
+        int k = 0;
+        while (!bad && (1ul << k) < c.value) k++;
+        if (!bad && k > 0) ps_emit(&seq, "shr r%d, %d", ra, k);
+    } else if (strcmp(tok[0], "add32") == 0 || strcmp(tok[0], "sub32") == 0) {
+        int add = tok[0][0] == 'a';
+        bad = ntok != 3 || !ps_pair(tok[1], &ah, &al) || !ps_pair(tok[2], &bh, &bl) || al == bh;
+        if (!bad) {
+            ps_emit(&seq, add ? "add r%d, r%d" : "sub r%d, r%d", al, bl);
+            ps_emit(&seq, add ? "adc r%d, r%d" : "suc r%d, r%d", ah, bh);
+        }
+    } else {
+        free(dup);
+        return 0;
+    }
+
+    if (bad) {
+        fprintf(stderr, "Error: Invalid operands for pseudo-instruction: %s\n", line);
+        exit(EXIT_FAILURE);
+    }
+    for (int i=0;i<seq.n;i++) strcpy(out[i], seq.v[i]);
+    *n = seq.n;
+    free(dup);
+    return 1;
+}
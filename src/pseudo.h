@@ -0,0 +1,11 @@
+#ifndef PSEUDO_H
+#define PSEUDO_H
+
+#include "label.h"
+
+#define PSEUDO_MAXEXP 40
+#define PSEUDO_MAXLINE 32
+
+int pseudo_expand(char* line, struct le_context *lctx, char out[][PSEUDO_MAXLINE], int *n);
+
+#endif
@@ -0,0 +1,692 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "m4asm.h"
+#include "sim.h"
+#include "insns.h"
+
+static struct sim_form sim_forms[256];
+static int sim_ready = 0;
+
+static uint16_t sim_word(struct assembled_insn_t *in, int i) {
+    return hton16(in->data[i]);
+}
+
+// Finds param k of an opcode by encoding it with probe values and looking
+// at what changed.
+static void sim_probe(int opcode, int k, struct sim_field *f) {
+    uint32_t p[4] = {0, 0, 0, 0};
+    struct assembled_insn_t base = assemble_insn(opcode, 0, 0, 0, 0);
+    p[k] = 0xFFFFFFFF;
+    struct assembled_insn_t ones = assemble_insn(opcode, p[0], p[1], p[2], p[3]);
+    p[k] = 0x12345678;
+    struct assembled_insn_t mix = assemble_insn(opcode, p[0], p[1], p[2], p[3]);
+
+    f->word = -1;
+    f->hi = -1;
+    f->shift = 0;
+    f->mask = 0xFFFF;
+    uint16_t d0 = sim_word(&ones, 0) ^ sim_word(&base, 0);
+    if (d0 != 0) {
+        f->word = 0;
+        while (!((d0 >> f->shift) & 1)) f->shift++;
+        f->mask = d0 >> f->shift;
+        return;
+    }
+    for (int i=1;i<base.length;i++) {
+        if (sim_word(&ones, i) == sim_word(&base, i)) continue;
+        if (sim_word(&mix, i) == 0x1234) f->hi = i;
+        else f->word = i;
+    }
+}
+
+void sim_tables() {
+    if (sim_ready) return;
+    for (int o=0;o<256;o++) sim_forms[o].def = -1;
+    for (int c=0;insns[c].mnemonic != NULL;c++) {
+        if (insns[c].opcode > 0xFF) continue;    // dw, ds
+        struct sim_form *fm = &sim_forms[insns[c].opcode];
+        struct assembled_insn_t base = assemble_insn(insns[c].opcode, 0, 0, 0, 0);
+        fm->def = c;
+        fm->length = base.length;
+        fm->nparams = strlen(insns[c].params);
+        uint16_t used = 0;
+        for (int k=0;k<fm->nparams && k<2;k++) {
+            sim_probe(insns[c].opcode, k, &fm->f[k]);
+            if (fm->f[k].word == 0) used |= fm->f[k].mask << fm->f[k].shift;
+        }
+        fm->fixedmask = ~used;
+        fm->fixed = sim_word(&base, 0) & fm->fixedmask;
+    }
+    sim_ready = 1;
+}
+
+const struct sim_form *sim_form(int opcode) {
+    sim_tables();
+    return &sim_forms[opcode & 0xFF];
+}
+
+int sim_def(int opcode) {
+    sim_tables();
+    return opcode >= 0 && opcode <= 0xFF ? sim_forms[opcode].def : -1;
+}
+
+void sim_init(struct sim *s) {
+    sim_tables();
+    memset(s, 0, sizeof(*s));
+    s->mem.pages = (unsigned char**)calloc(SIM_NPAGES, sizeof(unsigned char*));
+    s->io.pages = (unsigned char**)calloc(SIM_NPAGES, sizeof(unsigned char*));
+    s->mgmt.pages = (unsigned char**)calloc(SIM_NPAGES, sizeof(unsigned char*));
+    s->code = (struct sim_op**)calloc(SIM_NPAGES, sizeof(struct sim_op*));
+    if (s->mem.pages == NULL || s->io.pages == NULL || s->mgmt.pages == NULL || s->code == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void sim_note_page(uint32_t **list, unsigned long n, unsigned long *cap, uint32_t page) {
+    if (n == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        *list = (uint32_t*)realloc(*list, sizeof(uint32_t) * *cap);
+        if (*list == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*list)[n] = page;
+}
+
+static void sim_mem_reset(struct sim_mem *m) {
+    for (unsigned long k=0;k<m->npages;k++) {
+        uint32_t p = m->used[k];
+        if (m->shared == NULL || !m->shared[p]) free(m->pages[p]);
+        else m->shared[p] = 0;
+        m->pages[p] = NULL;
+    }
+    m->npages = 0;
+}
+
+static void sim_mem_free(struct sim_mem *m) {
+    if (m->pages == NULL) return;
+    for (unsigned long k=0;k<m->npages;k++) {
+        uint32_t p = m->used[k];
+        if (m->shared == NULL || !m->shared[p]) free(m->pages[p]);
+    }
+    free(m->pages);
+    free(m->shared);
+    free(m->used);
+    m->pages = NULL;
+    m->shared = NULL;
+    m->used = NULL;
+}
+
+void sim_free(struct sim *s) {
+    sim_mem_free(&s->mem);
+    sim_mem_free(&s->io);
+    sim_mem_free(&s->mgmt);
+    if (s->code != NULL) {
+        for (unsigned long k=0;k<s->ncode;k++) free(s->code[s->codeused[k]]);
+        free(s->code);
+        free(s->codeused);
+        s->code = NULL;
+        s->codeused = NULL;
+    }
+    if (s->watch != NULL) {
+        for (unsigned long p=0;p<SIM_NPAGES;p++) free(s->watch[p]);
+        free(s->watch);
+        s->watch = NULL;
+    }
+}
+
+void sim_reset(struct sim *s) {
+    sim_mem_reset(&s->mem);
+    sim_mem_reset(&s->io);
+    sim_mem_reset(&s->mgmt);
+    for (unsigned long k=0;k<s->ncode;k++) {
+        free(s->code[s->codeused[k]]);
+        s->code[s->codeused[k]] = NULL;
+    }
+    s->ncode = 0;
+    if (s->watch != NULL) {
+        for (unsigned long p=0;p<SIM_NPAGES;p++) free(s->watch[p]);
+        free(s->watch);
+        s->watch = NULL;
+    }
+    memset(s->r, 0, sizeof(s->r));
+    s->a = s->d = 0;
+    s->pc = s->sp = 0;
+    s->flags = s->iv = s->ien = 0;
+    s->depth = 0;
+    s->stop = SIM_RUNNING;
+    s->insns = s->cycles = 0;
+    s->watch_hit = 0;
+    s->log = NULL;
+    s->nlog = 0;
+}
+
+static unsigned char* sim_page(struct sim_mem *m, uint32_t addr) {
+    unsigned char **pp = &m->pages[addr >> SIM_PAGE_BITS];
+    if (*pp == NULL) {
+        *pp = (unsigned char*)calloc(SIM_PAGE_SIZE, 1);
+        if (*pp == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        sim_note_page(&m->used, m->npages, &m->capused, addr >> SIM_PAGE_BITS);
+        m->npages++;
+    } else if (m->shared != NULL && m->shared[addr >> SIM_PAGE_BITS]) {
+        unsigned char *copy = (unsigned char*)malloc(SIM_PAGE_SIZE);
+        if (copy == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(copy, *pp, SIM_PAGE_SIZE);
+        *pp = copy;
+        m->shared[addr >> SIM_PAGE_BITS] = 0;
+    }
+    return *pp;
+}
+
+static unsigned char sim_read8(struct sim_mem *m, uint32_t addr) {
+    unsigned char *p = m->pages[addr >> SIM_PAGE_BITS];
+    return p == NULL ? 0 : p[addr & (SIM_PAGE_SIZE - 1)];
+}
+
+static void sim_write8(struct sim_mem *m, uint32_t addr, unsigned char v) {
+    sim_page(m, addr)[addr & (SIM_PAGE_SIZE - 1)] = v;
+}
+
+uint16_t sim_read16(struct sim_mem *m, uint32_t addr) {
+    if (addr & 1) return sim_read8(m, addr) << 8 | sim_read8(m, addr + 1);
+    unsigned char *p = m->pages[addr >> SIM_PAGE_BITS];
+    if (p == NULL) return 0;
+    p += addr & (SIM_PAGE_SIZE - 1);
+    return p[0] << 8 | p[1];
+}
+
+void sim_write16(struct sim_mem *m, uint32_t addr, uint16_t v) {
+    if (addr & 1) {
+        sim_write8(m, addr, v >> 8);
+        sim_write8(m, addr + 1, v & 0xFF);
+        return;
+    }
+    unsigned char *p = sim_page(m, addr) + (addr & (SIM_PAGE_SIZE - 1));
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+// Drops the cached decodes of every instruction that could overlap the
+// word at addr (the longest encoding is 4 words).
+void sim_store16(struct sim *s, uint32_t addr, uint16_t v) {
+    sim_write16(&s->mem, addr, v);
+    if (s->log != NULL && s->nlog < SIM_LOG_MAX) {
+        s->log[s->nlog].addr = addr;
+        s->log[s->nlog].v = v;
+        s->nlog++;
+    }
+    uint32_t from = (addr & ~1u) - 6;
+    for (int k=0;k<5;k++) {
+        uint32_t x = from + 2*k;
+        struct sim_op *ops = s->code[x >> SIM_PAGE_BITS];
+        if (ops != NULL) ops[(x & (SIM_PAGE_SIZE - 1)) >> 1].valid = 0;
+    }
+    if (s->watch != NULL) {
+        for (uint32_t x=addr & ~1u;x<addr+2;x+=2) {
+            unsigned char *w = s->watch[x >> SIM_PAGE_BITS];
+            uint32_t i = (x & (SIM_PAGE_SIZE - 1)) >> 1;
+            if (w != NULL && (w[i >> 3] >> (i & 7)) & 1) s->watch_hit = 1;
+        }
+    }
+}
+
+static struct sim_op* sim_code_page(struct sim *s, uint32_t pc) {
+    struct sim_op **pp = &s->code[pc >> SIM_PAGE_BITS];
+    *pp = (struct sim_op*)calloc(SIM_PAGE_SIZE / 2, sizeof(struct sim_op));
+    if (*pp == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    sim_note_page(&s->codeused, s->ncode, &s->capcode, pc >> SIM_PAGE_BITS);
+    s->ncode++;
+    return *pp;
+}
+
+int sim_decode(struct sim *s, uint32_t addr, struct sim_op *op) {
+    uint16_t w[4];
+    w[0] = sim_read16(&s->mem, addr);
+    struct sim_form *fm = &sim_forms[w[0] & 0xFF];
+    op->valid = 0;
+    if (fm->def < 0) return 1;
+    for (int i=1;i<fm->length;i++) w[i] = sim_read16(&s->mem, addr + 2*i);
+
+    uint32_t p[2] = {0, 0};
+    for (int k=0;k<fm->nparams && k<2;k++) {
+        struct sim_field *f = &fm->f[k];
+        if (f->word == 0) p[k] = (w[0] >> f->shift) & f->mask;
+        else if (f->word > 0) p[k] = w[f->word];
+        if (f->hi > 0) p[k] |= (uint32_t)w[f->hi] << 16;
+    }
+    if (insns[fm->def].params[0] == PTYPE_RELATIVE_POS) p[0] = addr + (p[0] + 2) * 2;
+    if (insns[fm->def].params[0] == PTYPE_RELATIVE_NEG) p[0] = addr - (p[0] - 2) * 2;
+
+    op->opcode = w[0] & 0xFF;
+    op->length = fm->length;
+    op->cycles = insns[fm->def].cycles;
+    op->p0 = p[0];
+    op->p1 = p[1];
+    op->valid = 1;
+    return 0;
+}
+
+#define SIM_LOGISIM_HDR "v3.0 hex words addressed"
+
+long sim_load(struct sim *s, const char* path, uint32_t base) {
+    FILE* fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (fp == NULL) return -1;
+    size_t n = 0, cap = 65536;
+    char* buf = (char*)malloc(cap + 1);
+    for (;;) {
+        n += fread(buf + n, 1, cap - n, fp);
+        if (n < cap) break;
+        cap *= 2;
+        buf = (char*)realloc(buf, cap + 1);
+    }
+    if (fp != stdin) fclose(fp);
+    buf[n] = 0;
+
+    long words = 0;
+    if (n >= strlen(SIM_LOGISIM_HDR) && strncmp(buf, SIM_LOGISIM_HDR, strlen(SIM_LOGISIM_HDR)) == 0) {
+        // "AAAAAAAA: wwww wwww ..." lines, AAAAAAAA a word address.
+        char* line = strchr(buf, '\n');
+        while (line != NULL) {
+            line++;
+            char* end;
+            uint32_t a = strtoul(line, &end, 16);
+            if (isxdigit((unsigned char)*line) && *end == ':') {
+                char* p = end + 1;
+                for (;;) {
+                    while (*p == ' ' || *p == '\t') p++;
+                    if (!isxdigit((unsigned char)*p)) break;
+                    unsigned long v = strtoul(p, &end, 16);
+                    sim_write16(&s->mem, base + a*2, v);
+                    a++;
+                    words++;
+                    p = end;
+                }
+            }
+            line = strchr(line, '\n');
+        }
+    } else {
+        for (size_t i=0;i<n;i++) sim_write8(&s->mem, base + i, buf[i]);
+        words = (n + 1) / 2;
+    }
+    free(buf);
+    return words;
+}
+
+void sim_clone(struct sim *dst, struct sim *src) {
+    struct sim_mem *from[3] = {&src->mem, &src->io, &src->mgmt};
+    struct sim_mem *to[3] = {&dst->mem, &dst->io, &dst->mgmt};
+
+    memcpy(dst->r, src->r, sizeof(dst->r));
+    dst->a = src->a;
+    dst->d = src->d;
+    dst->pc = src->pc;
+    dst->sp = src->sp;
+    dst->flags = src->flags;
+    dst->iv = src->iv;
+    dst->ien = src->ien;
+    dst->depth = src->depth;
+    dst->stop = src->stop;
+    dst->insns = src->insns;
+    dst->cycles = src->cycles;
+    for (int k=0;k<3;k++) {
+        if (to[k]->shared == NULL) to[k]->shared = (unsigned char*)calloc(SIM_NPAGES, 1);
+        if (to[k]->shared == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        for (unsigned long i=0;i<from[k]->npages;i++) {
+            uint32_t p = from[k]->used[i];
+            to[k]->pages[p] = from[k]->pages[p];
+            to[k]->shared[p] = 1;
+            sim_note_page(&to[k]->used, i, &to[k]->capused, p);
+        }
+        to[k]->npages = from[k]->npages;
+    }
+}
+
+// Snapshot file: SIM_SNAP_MAGIC, the machine state, then one record per
+// nonzero page of each space: space, page number, a bitmap of the
+// nonzero SIM_SNAP_BLOCK-byte blocks and those blocks. Numbers are big
+// endian, like the image.
+#define SIM_SNAP_MAGIC "m4snap1\n"
+#define SIM_SNAP_BLOCK 256
+#define SIM_SNAP_BLOCKS ((int)(SIM_PAGE_SIZE / SIM_SNAP_BLOCK))
+#define SIM_SNAP_END 0xFF
+
+static void sim_put(FILE* fp, unsigned long long v, int bytes) {
+    for (int k=bytes-1;k>=0;k--) fputc((v >> (8*k)) & 0xFF, fp);
+}
+
+static int sim_get(FILE* fp, unsigned long long *v, int bytes) {
+    *v = 0;
+    for (int k=0;k<bytes;k++) {
+        int c = fgetc(fp);
+        if (c == EOF) return 1;
+        *v = *v << 8 | c;
+    }
+    return 0;
+}
+
+int sim_save(struct sim *s, const char* path) {
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) return -1;
+    struct sim_mem *spaces[3] = {&s->mem, &s->io, &s->mgmt};
+
+    fwrite(SIM_SNAP_MAGIC, 1, strlen(SIM_SNAP_MAGIC), fp);
+    for (int i=0;i<16;i++) sim_put(fp, s->r[i], 2);
+    sim_put(fp, s->a, 2);
+    sim_put(fp, s->d, 2);
+    sim_put(fp, s->pc, 4);
+    sim_put(fp, s->sp, 4);
+    sim_put(fp, s->flags, 1);
+    sim_put(fp, s->iv, 1);
+    sim_put(fp, s->ien, 1);
+    sim_put(fp, (uint32_t)s->depth, 4);
+    sim_put(fp, s->insns, 8);
+    sim_put(fp, s->cycles, 8);
+
+    for (int k=0;k<3;k++) {
+        for (unsigned long p=0;p<SIM_NPAGES;p++) {
+            unsigned char *pg = spaces[k]->pages[p];
+            if (pg == NULL) continue;
+            unsigned char map[SIM_SNAP_BLOCKS / 8];
+            memset(map, 0, sizeof(map));
+            for (int b=0;b<SIM_SNAP_BLOCKS;b++) {
+                for (int i=0;i<SIM_SNAP_BLOCK;i++) {
+                    if (pg[b*SIM_SNAP_BLOCK + i]) {
+                        map[b >> 3] |= 1 << (b & 7);
+                        break;
+                    }
+                }
+            }
+            int used = 0;
+            for (size_t i=0;i<sizeof(map);i++) used |= map[i];
+            if (!used) continue;
+            sim_put(fp, k, 1);
+            sim_put(fp, p, 2);
+            fwrite(map, 1, sizeof(map), fp);
+            for (int b=0;b<SIM_SNAP_BLOCKS;b++) {
+                if ((map[b >> 3] >> (b & 7)) & 1) fwrite(pg + b*SIM_SNAP_BLOCK, 1, SIM_SNAP_BLOCK, fp);
+            }
+        }
+    }
+    sim_put(fp, SIM_SNAP_END, 1);
+    int err = ferror(fp);
+    if (fclose(fp) != 0 || err) return -1;
+    return 0;
+}
+
+int sim_restore(struct sim *s, const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) return -1;
+    struct sim_mem *spaces[3] = {&s->mem, &s->io, &s->mgmt};
+    char magic[sizeof(SIM_SNAP_MAGIC)];
+    unsigned long long v[26];
+    int bad = fread(magic, 1, strlen(SIM_SNAP_MAGIC), fp) != strlen(SIM_SNAP_MAGIC) || memcmp(magic, SIM_SNAP_MAGIC, strlen(SIM_SNAP_MAGIC)) != 0;
+
+    static const int widths[] = {2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2, 2,2,4,4,1,1,1,4,8,8};
+    int nv = sizeof(widths) / sizeof(widths[0]);
+    for (int i=0;i<nv && !bad;i++) bad = sim_get(fp, &v[i], widths[i]);
+    if (!bad) {
+        for (int i=0;i<16;i++) s->r[i] = v[i];
+        s->a = v[16];
+        s->d = v[17];
+        s->pc = v[18];
+        s->sp = v[19];
+        s->flags = v[20];
+        s->iv = v[21];
+        s->ien = v[22];
+        s->depth = (int)(uint32_t)v[23];
+        s->insns = v[24];
+        s->cycles = v[25];
+        s->stop = SIM_RUNNING;
+    }
+
+    while (!bad) {
+        unsigned long long k, p;
+        unsigned char map[SIM_SNAP_BLOCKS / 8];
+        if (sim_get(fp, &k, 1) || k == SIM_SNAP_END) {
+            bad = k != SIM_SNAP_END;
+            break;
+        }
+        if (k > 2 || sim_get(fp, &p, 2) || fread(map, 1, sizeof(map), fp) != sizeof(map)) {
+            bad = 1;
+            break;
+        }
+        unsigned char *pg = sim_page(spaces[k], p << SIM_PAGE_BITS);
+        for (int b=0;b<SIM_SNAP_BLOCKS && !bad;b++) {
+            if ((map[b >> 3] >> (b & 7)) & 1) bad = fread(pg + b*SIM_SNAP_BLOCK, 1, SIM_SNAP_BLOCK, fp) != SIM_SNAP_BLOCK;
+        }
+    }
+    fclose(fp);
+    if (bad) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+const char* sim_stop_name(int stop) {
+    switch (stop) {
+    case SIM_RUNNING: return "running";
+    case SIM_STOP_SINT: return "sint";
+    case SIM_STOP_RET: return "ret";
+    case SIM_STOP_HALT: return "halt";
+    case SIM_STOP_LIMIT: return "limit";
+    case SIM_STOP_ILLEGAL: return "illegal";
+    case SIM_STOP_ALIGN: return "align";
+    default: return "?";
+    }
+}
+
+// ALU. Each returns the result and replaces the flags.
+
+static uint16_t sim_add(unsigned *f, uint16_t a, uint16_t b, unsigned c) {
+    uint32_t t = (uint32_t)a + b + c;
+    uint16_t r = t;
+    *f = (r == 0 ? SIM_F_Z : 0) | (t >> 16 ? SIM_F_C : 0) | (r & 0x8000 ? SIM_F_N : 0)
+       | ((~(a ^ b) & (a ^ r)) & 0x8000 ? SIM_F_V : 0);
+    return r;
+}
+
+static uint16_t sim_sub(unsigned *f, uint16_t a, uint16_t b, unsigned c) {
+    uint32_t t = (uint32_t)a - b - c;
+    uint16_t r = t;
+    *f = (r == 0 ? SIM_F_Z : 0) | (t >> 16 ? SIM_F_C : 0) | (r & 0x8000 ? SIM_F_N : 0)
+       | (((a ^ b) & (a ^ r)) & 0x8000 ? SIM_F_V : 0);
+    return r;
+}
+
+static uint16_t sim_logic(unsigned *f, uint16_t r) {
+    *f = (r == 0 ? SIM_F_Z : 0) | (r & 0x8000 ? SIM_F_N : 0);
+    return r;
+}
+
+static uint16_t sim_shift(unsigned *f, int opcode, uint16_t a, unsigned n) {
+    uint16_t r = a;
+    unsigned c = 0;
+    if (n != 0) {
+        switch (opcode) {
+        case OPC_SHL_RI: c = (a >> (16 - n)) & 1; r = a << n; break;
+        case OPC_SHR_RI: c = (a >> (n - 1)) & 1; r = a >> n; break;
+        case OPC_ROL_RI: r = a << n | a >> (16 - n); c = r & 1; break;
+        case OPC_ROR_RI: r = a >> n | a << (16 - n); c = r >> 15; break;
+        }
+    }
+    *f = (r == 0 ? SIM_F_Z : 0) | (c ? SIM_F_C : 0) | (r & 0x8000 ? SIM_F_N : 0);
+    return r;
+}
+
+#define SIM_PUSH(v) do { sp -= 2; sim_store16(s, sp, (v)); } while (0)
+#define SIM_POP(v) do { (v) = sim_read16(&s->mem, sp); sp += 2; } while (0)
+#define SIM_PAIR(t) ((uint32_t)r[(t) & 15] << 16 | r[((t) + 1) & 15])
+
+int sim_run(struct sim *s, unsigned long long maxinsns) {
+    uint16_t *r = s->r;
+    uint32_t pc = s->pc;
+    uint32_t sp = s->sp;
+    unsigned f = s->flags;
+    unsigned long long n = 0;
+    unsigned long long cycles = s->cycles;
+    unsigned long long limit = maxinsns ? maxinsns : ~0ULL;
+    int stop = SIM_RUNNING;
+    uint16_t v;
+
+    while (stop == SIM_RUNNING) {
+        if (n >= limit) {
+            stop = SIM_STOP_LIMIT;
+            break;
+        }
+        if (pc & 1) {
+            stop = SIM_STOP_ALIGN;
+            break;
+        }
+        struct sim_op *ops = s->code[pc >> SIM_PAGE_BITS];
+        if (ops == NULL) ops = sim_code_page(s, pc);
+        struct sim_op *op = &ops[(pc & (SIM_PAGE_SIZE - 1)) >> 1];
+        if (!op->valid && sim_decode(s, pc, op)) {
+            stop = SIM_STOP_ILLEGAL;
+            break;
+        }
+        uint32_t next = pc + op->length * 2;
+        uint32_t p0 = op->p0;
+        uint32_t p1 = op->p1;
+        n++;
+        cycles += op->cycles;
+
+        switch (op->opcode) {
+        case OPC_NOP:
+            break;
+
+        case OPC_JMP_FAR:
+        case OPC_JMP_NEAR:
+        case OPC_JMP_REL_POS:
+        case OPC_JMP_REL_NEG:
+            if (p0 == pc) stop = SIM_STOP_HALT;
+            next = p0;
+            break;
+
+        case OPC_MOV_I2R_NEAR:
+        case OPC_MOV_I2R_FAR: r[p0] = sim_read16(&s->mem, p1); break;
+        case OPC_MOV_R2M_FAR:
+        case OPC_MOV_R2M_NEAR: sim_store16(s, p0, r[p1]); break;
+        case OPC_MOV_R2R: r[p0] = r[p1]; break;
+        case OPC_MOV_R2A: s->a = r[p0]; break;
+        case OPC_MOV_V2R: r[p0] = p1; break;
+        case OPC_MOV_V2A: s->a = p0; break;
+        case OPC_MOV_D2R: r[p0] = sim_read16(&s->mem, (uint32_t)s->d << 16 | s->a); break;
+        case OPC_MOV_R2D: sim_store16(s, (uint32_t)s->d << 16 | s->a, r[p0]); break;
+
+        case OPC_ADD_RR: r[p0] = sim_add(&f, r[p0], r[p1], 0); break;
+        case OPC_ADD_RI: r[p0] = sim_add(&f, r[p0], p1, 0); break;
+        case OPC_ADC_RR: r[p0] = sim_add(&f, r[p0], r[p1], (f & SIM_F_C) != 0); break;
+        case OPC_SUB_RR: r[p0] = sim_sub(&f, r[p0], r[p1], 0); break;
+        case OPC_SUB_RI: r[p0] = sim_sub(&f, r[p0], p1, 0); break;
+        case OPC_SUC_RR: r[p0] = sim_sub(&f, r[p0], r[p1], (f & SIM_F_C) != 0); break;
+        case OPC_CMP_RR: sim_sub(&f, r[p0], r[p1], 0); break;
+
+        case OPC_SHR_RI:
+        case OPC_SHL_RI:
+        case OPC_ROR_RI:
+        case OPC_ROL_RI: r[p0] = sim_shift(&f, op->opcode, r[p0], p1); break;
+
+        case OPC_NOT_R: r[p0] = sim_logic(&f, ~r[p0]); break;
+        case OPC_INC_R: r[p0] = sim_add(&f, r[p0], 1, 0); break;
+        case OPC_DEC_R: r[p0] = sim_sub(&f, r[p0], 1, 0); break;
+        case OPC_INC2_R: r[p0] = sim_add(&f, r[p0], 2, 0); break;
+        case OPC_DEC2_R: r[p0] = sim_sub(&f, r[p0], 2, 0); break;
+
+        case OPC_AND_RR: r[p0] = sim_logic(&f, r[p0] & r[p1]); break;
+        case OPC_OR_RR: r[p0] = sim_logic(&f, r[p0] | r[p1]); break;
+        case OPC_NOR_RR: r[p0] = sim_logic(&f, ~(r[p0] | r[p1])); break;
+        case OPC_XOR_RR: r[p0] = sim_logic(&f, r[p0] ^ r[p1]); break;
+        case OPC_NAND_RR: r[p0] = sim_logic(&f, ~(r[p0] & r[p1])); break;
+        case OPC_XNOR_RR: r[p0] = sim_logic(&f, ~(r[p0] ^ r[p1])); break;
+        case OPC_AND_RI: r[p0] = sim_logic(&f, r[p0] & p1); break;
+        case OPC_OR_RI: r[p0] = sim_logic(&f, r[p0] | p1); break;
+        case OPC_NOR_RI: r[p0] = sim_logic(&f, ~(r[p0] | p1)); break;
+        case OPC_XOR_RI: r[p0] = sim_logic(&f, r[p0] ^ p1); break;
+        case OPC_NAND_RI: r[p0] = sim_logic(&f, ~(r[p0] & p1)); break;
+        case OPC_XNOR_RI: r[p0] = sim_logic(&f, ~(r[p0] ^ p1)); break;
+
+        case OPC_PUSHB_FAR: SIM_PUSH(sim_read8(&s->mem, p0)); break;
+        case OPC_PUSHW_FAR:
+        case OPC_PUSHW_NEAR: SIM_PUSH(sim_read16(&s->mem, p0)); break;
+        case OPC_PUSH_REG: SIM_PUSH(r[p0]); break;
+        case OPC_SSP: sp = p0; break;
+        case OPC_POP_REG: SIM_POP(r[p0]); break;
+        case OPC_POP_FAR:
+        case OPC_POP_NEAR: SIM_POP(v); sim_store16(s, p0, v); break;
+        case OPC_POP_AD: SIM_POP(s->a); SIM_POP(s->d); break;
+
+        case OPC_CALL_FAR:
+        case OPC_CALL_NEAR:
+            SIM_PUSH(next >> 16);
+            SIM_PUSH(next & 0xFFFF);
+            s->depth++;
+            next = p0;
+            break;
+        case OPC_RET:
+            if (s->depth == 0) {
+                stop = SIM_STOP_RET;
+                next = pc;
+                break;
+            }
+            SIM_POP(v);
+            next = v;
+            SIM_POP(v);
+            next |= (uint32_t)v << 16;
+            s->depth--;
+            break;
+
+        case OPC_IEN: s->ien = 1; break;
+        case OPC_SINT: stop = SIM_STOP_SINT; break;
+
+        case OPC_MMOV_ST: sim_write16(&s->mgmt, p0, r[p1]); break;
+        case OPC_MMOV_LD: r[p0] = sim_read16(&s->mgmt, p1); break;
+        case OPC_IMOV_LD: r[p0] = sim_read16(&s->io, p1); break;
+        case OPC_IMOV_ST: sim_write16(&s->io, p0, r[p1]); break;
+        case OPC_IMOV_ST_IMM: sim_write16(&s->io, p0, p1); break;
+
+        case OPC_BRCH_FLG_FAR:
+        case OPC_BRCH_FLG_NEAR: if (f & p1) next = p0; break;
+        case OPC_BRCH_IV_FAR:
+        case OPC_BRCH_IV_NEAR: if (s->iv == p1) next = p0; break;
+
+        case OPC_MOV_RSA: sim_store16(s, SIM_PAIR(p0), r[p1]); break;
+        case OPC_IMOV_RSA: sim_write16(&s->io, SIM_PAIR(p0), r[p1]); break;
+        case OPC_MMOV_RSA: sim_write16(&s->mgmt, SIM_PAIR(p0), r[p1]); break;
+        case OPC_MOV_RSA_LOAD: r[p0] = sim_read16(&s->mem, SIM_PAIR(p1)); break;
+        case OPC_MMOV_RSA_LOAD: r[p0] = sim_read16(&s->mgmt, SIM_PAIR(p1)); break;
+
+        default:
+            stop = SIM_STOP_ILLEGAL;
+            n--;
+            cycles -= op->cycles;
+            next = pc;
+            break;
+        }
+        pc = next;
+    }
+
+    s->pc = pc;
+    s->sp = sp;
+    s->flags = f;
+    s->insns += n;
+    s->cycles = cycles;
+    s->stop = stop;
+    return stop;
+}
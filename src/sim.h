@@ -0,0 +1,167 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "m4asm.h"
+
+// Cycle-counting M4 simulator (m4sim). Opcodes are decoded through a
+// reverse table built from insns[] and the encoder, so the simulator and
+// the assembler cannot disagree on lengths or field positions. Cycles are
+// the insns[] cycles column. Decoded instructions are cached per code page
+// and dispatched from there; stores into a cached page drop the entries
+// they overlap, so self-modifying code still works.
+//
+// Memory is a sparse 32-bit byte address space of SIM_PAGE_SIZE pages,
+// allocated on first write (unwritten memory reads as 0). Words are big
+// endian, as in the image. imov and mmov go to two further spaces of the
+// same shape.
+//
+// What the assembler does not pin down, the simulator defines as follows:
+//   flags: SIM_F_* bits, set by the ALU ops; brchf branches if any of the
+//          operand's bits are set. Logic ops clear C and V; shifts and
+//          rotates leave the last bit shifted out in C.
+//   stack: grows down, one word per push; call/ret push and pop the 32-bit
+//          return address high word first.
+//   A/D:   mova and mov rX load A; ldfa/stfa access the word at D:A;
+//          popad pops A, then D.
+//   [rT:rT+1] addresses are rT << 16 | rT+1.
+//   brchi branches if the operand equals iv, which nothing in the simulator
+//          sets (there are no interrupt sources); ien only sets ien.
+// A run stops at sint, at a ret with no call outstanding, at a jmp to
+// itself, at an undecodable opcode or odd pc, or after the given number
+// of instructions.
+
+#define SIM_PAGE_BITS 16
+#define SIM_PAGE_SIZE (1u << SIM_PAGE_BITS)
+#define SIM_NPAGES (1u << (32 - SIM_PAGE_BITS))
+
+#define SIM_F_Z 0x01
+#define SIM_F_C 0x02
+#define SIM_F_N 0x04
+#define SIM_F_V 0x08
+
+#define SIM_RUNNING 0
+#define SIM_STOP_SINT 1
+#define SIM_STOP_RET 2
+#define SIM_STOP_HALT 3     // jmp to itself
+#define SIM_STOP_LIMIT 4
+#define SIM_STOP_ILLEGAL 5
+#define SIM_STOP_ALIGN 6    // odd pc
+
+struct sim_mem {
+    unsigned char **pages;  // SIM_NPAGES entries, NULL = all zero
+    unsigned long npages;   // pages allocated
+    unsigned char *shared;  // NULL, or per page: owned by a sim_clone() source
+    uint32_t *used;         // the npages page numbers in use, so that
+    unsigned long capused;  // freeing does not scan the whole table
+};
+
+// A decoded instruction. p0/p1 are the operand values in insns[].params
+// order; branch targets are resolved to absolute addresses.
+struct sim_op {
+    unsigned char opcode;
+    unsigned char valid;
+    unsigned char length;   // words
+    unsigned char cycles;
+    uint32_t p0;
+    uint32_t p1;
+};
+
+// Where an operand sits in an encoded instruction: a bit field of the
+// opcode word, a whole word, or two words for a 32-bit value.
+struct sim_field {
+    int word;           // word holding the value (the low half if hi >= 0)
+    int hi;             // word holding the high half, -1 if none
+    int shift;          // word 0 fields only
+    uint32_t mask;
+};
+
+// How an opcode is encoded, found by probing assemble_insn().
+struct sim_form {
+    int def;            // insns[] index, -1 = not an opcode
+    int length;         // encoded words
+    int nparams;
+    struct sim_field f[2];
+    uint16_t fixed;     // word 0 outside the fields, as the encoder
+    uint16_t fixedmask; // writes it
+};
+
+#define SIM_LOG_MAX 4        // stores one instruction can make, with room
+
+struct sim_store {
+    uint32_t addr;
+    uint16_t v;
+};
+
+struct sim {
+    uint16_t r[16];
+    uint16_t a;
+    uint16_t d;
+    uint32_t pc;
+    uint32_t sp;
+    unsigned char flags;
+    unsigned char iv;
+    unsigned char ien;
+    int depth;              // calls outstanding
+    int stop;               // SIM_RUNNING or SIM_STOP_*
+    unsigned long long insns;
+    unsigned long long cycles;
+    struct sim_mem mem;
+    struct sim_mem io;      // imov
+    struct sim_mem mgmt;    // mmov
+    struct sim_op **code;   // decode cache, SIM_NPAGES entries
+    uint32_t *codeused;     // page numbers of the decode cache in use
+    unsigned long ncode;
+    unsigned long capcode;
+    unsigned char **watch;  // optional per-page bitmaps, one bit per word
+    int watch_hit;          // set by sim_store16 on a store to a watched word
+    struct sim_store *log;  // optional, SIM_LOG_MAX entries: sim_store16
+    int nlog;               // appends here; the caller empties it
+};
+
+void sim_init(struct sim *s);
+void sim_free(struct sim *s);
+// Back to the state after sim_init(), keeping the page tables, which is
+// much cheaper than sim_free() and sim_init() for many short runs.
+void sim_reset(struct sim *s);
+// Loads a binary or Logisim (-f logisim) image at byte address base.
+// Returns the number of words loaded, -1 on error with errno set.
+long sim_load(struct sim *s, const char* path, uint32_t base);
+
+// Snapshots of the whole machine: registers, flags, sp, pc, depth, the
+// instruction and cycle counters and the three memory spaces. Decode
+// caches and watches are not part of it.
+//
+// sim_save writes a file holding only the nonzero parts of each page;
+// sim_restore reads one into a freshly sim_init()ed machine. Both return
+// 0, or -1 with errno set (EINVAL for a damaged file).
+int sim_save(struct sim *s, const char* path);
+int sim_restore(struct sim *s, const char* path);
+// Makes dst, which must be freshly sim_init()ed or sim_reset(), a copy of
+// src that shares src's pages until it writes to them. src must outlive dst and must not change while dst is
+// in use; any number of clones can run from one src, also in parallel.
+void sim_clone(struct sim *dst, struct sim *src);
+
+uint16_t sim_read16(struct sim_mem *m, uint32_t addr);
+void sim_write16(struct sim_mem *m, uint32_t addr, uint16_t v);
+// Main-memory store that keeps the decode cache coherent, reports stores
+// to watched words and logs the store if s->log is set.
+void sim_store16(struct sim *s, uint32_t addr, uint16_t v);
+
+// Decodes the instruction at addr. Returns 0, or 1 if the opcode is not in
+// insns[].
+int sim_decode(struct sim *s, uint32_t addr, struct sim_op *op);
+// Index into insns[] of an opcode, -1 if none.
+int sim_def(int opcode);
+// The form of an opcode byte; def is -1 if it is not one.
+const struct sim_form *sim_form(int opcode);
+// Builds the decode tables. sim_init(), sim_def() and sim_form() do this on
+// first use without locking, so a program that simulates from several
+// threads calls it before starting them.
+void sim_tables();
+
+// Runs until a stop condition or until maxinsns more instructions have
+// been executed (0 = no limit). Returns s->stop.
+int sim_run(struct sim *s, unsigned long long maxinsns);
+const char* sim_stop_name(int stop);
+
+#endif
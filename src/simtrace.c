@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "m4asm.h"
+#include "sim.h"
+#include "simtrace.h"
+
+// File layout, numbers big endian:
+//   TRC_MAGIC
+//   chunks: keyframe (pc, sp, a, d, flags, depth, r0..r15, insns,
+//           cycles), steps, TRC_PC_END
+//   index:  per chunk its offset, first instruction and cycles
+//   footer: index offset, chunks, steps, end cycles, stop, pc, TRC_TAIL
+//
+// A step is a header byte and the fields it announces, in this order:
+//   bits 0-2  pc: 0-3 fell through an instruction of 1-4 words,
+//             TRC_PC_DELTA jumped, a zigzag varint delta follows,
+//             TRC_PC_END closes the chunk
+//   bits 6-7  cycles 1-3, or 0: a varint follows
+//   TRC_H_REGS    varint mask, then each written register as a word
+//   TRC_H_MISC    TRC_M_* byte, then a, d (words), sp delta (zigzag
+//                 varint), flags (byte), depth delta (zigzag varint)
+//   TRC_H_STORES  count byte, then per store the zigzag varint delta from
+//                 the previous store address in the chunk and the word
+
+#define TRC_MAGIC "m4trace1"
+#define TRC_TAIL "m4trend1"
+#define TRC_FOOTER (8 + 4 + 8 + 8 + 1 + 4 + 8)
+
+#define TRC_PC_DELTA 4
+#define TRC_PC_END 7
+#define TRC_H_REGS 0x08
+#define TRC_H_MISC 0x10
+#define TRC_H_STORES 0x20
+
+struct trc_chunk {
+    unsigned long long offset;
+    unsigned long long insn;
+    unsigned long long cycles;
+};
+
+struct trc_writer {
+    FILE* fp;
+    unsigned long long pos;
+    struct trc_chunk *chunks;
+    int nchunks;
+    int capchunks;
+    unsigned long long steps;
+    int inchunk;
+    uint32_t laststore;
+    struct sim_store log[SIM_LOG_MAX];
+};
+
+struct trc_reader {
+    FILE* fp;
+    struct trc_chunk *chunks;
+    struct trc_info info;
+    int chunk;                  // being decoded, -1 = none
+    struct trc_step cur;        // state before the next step
+    uint32_t laststore;
+};
+
+static void trc_put(struct trc_writer *w, unsigned long long v, int bytes) {
+    for (int k=bytes-1;k>=0;k--) fputc((v >> (8*k)) & 0xFF, w->fp);
+    w->pos += bytes;
+}
+
+static int trc_varint(unsigned char* out, unsigned long long v) {
+    int n = 0;
+    while (v >= 0x80) {
+        out[n++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    out[n++] = v;
+    return n;
+}
+
+static int trc_svarint(unsigned char* out, int32_t v) {
+    return trc_varint(out, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+struct trc_writer *trc_create(const char* path) {
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) return NULL;
+    struct trc_writer *w = (struct trc_writer*)calloc(1, sizeof(struct trc_writer));
+    if (w == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    w->fp = fp;
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+    fwrite(TRC_MAGIC, 1, strlen(TRC_MAGIC), fp);
+    w->pos = strlen(TRC_MAGIC);
+    return w;
+}
+
+static void trc_keyframe(struct trc_writer *w, struct sim *s) {
+    if (w->nchunks > 0) trc_put(w, TRC_PC_END, 1);
+    if (w->nchunks == w->capchunks) {
+        w->capchunks = w->capchunks ? w->capchunks * 2 : 64;
+        w->chunks = (struct trc_chunk*)realloc(w->chunks, sizeof(struct trc_chunk) * w->capchunks);
+        if (w->chunks == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct trc_chunk *c = &w->chunks[w->nchunks++];
+    c->offset = w->pos;
+    c->insn = s->insns;
+    c->cycles = s->cycles;
+    trc_put(w, s->pc, 4);
+    trc_put(w, s->sp, 4);
+    trc_put(w, s->a, 2);
+    trc_put(w, s->d, 2);
+    trc_put(w, s->flags, 1);
+    trc_put(w, (uint32_t)s->depth, 4);
+    for (int i=0;i<16;i++) trc_put(w, s->r[i], 2);
+    trc_put(w, s->insns, 8);
+    trc_put(w, s->cycles, 8);
+    w->inchunk = 0;
+    w->laststore = 0;
+}
+
+// b is the machine before the step, len the instruction's words.
+static void trc_step(struct trc_writer *w, struct sim *b, struct sim *s, int len) {
+    unsigned char buf[128];
+    int n = 1;
+    unsigned h;
+
+    uint32_t d = s->pc - b->pc;
+    if (len > 0 && d == 2u * len) {
+        h = len - 1;
+    } else {
+        h = TRC_PC_DELTA;
+        n += trc_svarint(buf + n, (int32_t)d);
+    }
+    unsigned long long cost = s->cycles - b->cycles;
+    if (cost >= 1 && cost <= 3) h |= cost << 6;
+    else n += trc_varint(buf + n, cost);
+
+    unsigned mask = 0;
+    for (int i=0;i<16;i++) {
+        if (s->r[i] != b->r[i]) mask |= 1u << i;
+    }
+    if (mask) {
+        h |= TRC_H_REGS;
+        n += trc_varint(buf + n, mask);
+        for (int i=0;i<16;i++) {
+            if (!(mask >> i & 1)) continue;
+            buf[n++] = s->r[i] >> 8;
+            buf[n++] = s->r[i] & 0xFF;
+        }
+    }
+
+    unsigned misc = (s->a != b->a ? TRC_M_A : 0) | (s->d != b->d ? TRC_M_D : 0) | (s->sp != b->sp ? TRC_M_SP : 0) |
+        (s->flags != b->flags ? TRC_M_FLAGS : 0) | (s->depth != b->depth ? TRC_M_DEPTH : 0);
+    if (misc) {
+        h |= TRC_H_MISC;
+        buf[n++] = misc;
+        if (misc & TRC_M_A) {
+            buf[n++] = s->a >> 8;
+            buf[n++] = s->a & 0xFF;
+        }
+        if (misc & TRC_M_D) {
+            buf[n++] = s->d >> 8;
+            buf[n++] = s->d & 0xFF;
+        }
+        if (misc & TRC_M_SP) n += trc_svarint(buf + n, (int32_t)(s->sp - b->sp));
+        if (misc & TRC_M_FLAGS) buf[n++] = s->flags;
+        if (misc & TRC_M_DEPTH) n += trc_svarint(buf + n, s->depth - b->depth);
+    }
+
+    if (s->nlog) {
+        h |= TRC_H_STORES;
+        buf[n++] = s->nlog;
+        for (int k=0;k<s->nlog;k++) {
+            n += trc_svarint(buf + n, (int32_t)(s->log[k].addr - w->laststore));
+            w->laststore = s->log[k].addr;
+            buf[n++] = s->log[k].v >> 8;
+            buf[n++] = s->log[k].v & 0xFF;
+        }
+    }
+
+    buf[0] = h;
+    fwrite(buf, 1, n, w->fp);
+    w->pos += n;
+    w->steps++;
+    w->inchunk++;
+}
+
+int trc_run(struct trc_writer *w, struct sim *s, unsigned long long maxinsns) {
+    unsigned long long limit = maxinsns ? maxinsns : ~0ULL;
+    unsigned long long done = 0;
+    struct sim b;
+
+    s->log = w->log;
+    while (done < limit) {
+        if (w->nchunks == 0 || w->inchunk == TRC_CHUNK) trc_keyframe(w, s);
+        memcpy(b.r, s->r, sizeof(b.r));
+        b.a = s->a;
+        b.d = s->d;
+        b.pc = s->pc;
+        b.sp = s->sp;
+        b.flags = s->flags;
+        b.depth = s->depth;
+        b.cycles = s->cycles;
+        unsigned long long i0 = s->insns;
+        struct sim_op op;
+        int len = sim_decode(s, s->pc, &op) ? 0 : op.length;
+        s->nlog = 0;
+        int stop = sim_run(s, 1);
+        if (s->insns == i0) break;
+        trc_step(w, &b, s, len);
+        done++;
+        if (stop != SIM_STOP_LIMIT) break;
+    }
+    s->log = NULL;
+    return s->stop;
+}
+
+int trc_finish(struct trc_writer *w, struct sim *s) {
+    if (w->nchunks == 0) trc_keyframe(w, s);
+    trc_put(w, TRC_PC_END, 1);
+    unsigned long long index = w->pos;
+    for (int k=0;k<w->nchunks;k++) {
+        trc_put(w, w->chunks[k].offset, 8);
+        trc_put(w, w->chunks[k].insn, 8);
+        trc_put(w, w->chunks[k].cycles, 8);
+    }
+    trc_put(w, index, 8);
+    trc_put(w, w->nchunks, 4);
+    trc_put(w, w->steps, 8);
+    trc_put(w, s->cycles, 8);
+    trc_put(w, s->stop, 1);
+    trc_put(w, s->pc, 4);
+    fwrite(TRC_TAIL, 1, strlen(TRC_TAIL), w->fp);
+    int err = ferror(w->fp);
+    int rc = fclose(w->fp);
+    free(w->chunks);
+    free(w);
+    return rc != 0 || err ? -1 : 0;
+}
+
+// Reading
+
+static int trc_get(FILE* fp, unsigned long long *v, int bytes) {
+    *v = 0;
+    for (int k=0;k<bytes;k++) {
+        int c = fgetc(fp);
+        if (c == EOF) return 1;
+        *v = *v << 8 | c;
+    }
+    return 0;
+}
+
+static unsigned long long trc_get_varint(FILE* fp) {
+    unsigned long long v = 0;
+    int shift = 0;
+    int c;
+    while ((c = fgetc(fp)) != EOF) {
+        v |= (unsigned long long)(c & 0x7F) << shift;
+        if (!(c & 0x80)) break;
+        shift += 7;
+    }
+    return v;
+}
+
+static int32_t trc_get_svarint(FILE* fp) {
+    uint32_t v = trc_get_varint(fp);
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static uint16_t trc_get16(FILE* fp) {
+    int hi = fgetc(fp);
+    int lo = fgetc(fp);
+    return (hi & 0xFF) << 8 | (lo & 0xFF);
+}
+
+struct trc_reader *trc_open(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) return NULL;
+    struct trc_reader *r = (struct trc_reader*)calloc(1, sizeof(struct trc_reader));
+    char magic[8];
+    unsigned long long v[6];
+    int bad = fread(magic, 1, 8, fp) != 8 || memcmp(magic, TRC_MAGIC, 8) != 0;
+    if (!bad) bad = fseek(fp, -TRC_FOOTER, SEEK_END) != 0;
+    if (!bad) {
+        r->info.bytes = ftell(fp) + TRC_FOOTER;
+        static const int widths[] = {8, 4, 8, 8, 1, 4};
+        for (int i=0;i<6 && !bad;i++) bad = trc_get(fp, &v[i], widths[i]);
+        bad = bad || fread(magic, 1, 8, fp) != 8 || memcmp(magic, TRC_TAIL, 8) != 0 || v[1] == 0;
+    }
+    if (!bad) {
+        r->info.chunks = v[1];
+        r->info.steps = v[2];
+        r->info.end = v[3];
+        r->info.stop = v[4];
+        r->info.pc = v[5];
+        r->chunks = (struct trc_chunk*)malloc(sizeof(struct trc_chunk) * r->info.chunks);
+        bad = fseek(fp, v[0], SEEK_SET) != 0;
+        for (int k=0;k<r->info.chunks && !bad;k++) {
+            bad = trc_get(fp, &r->chunks[k].offset, 8) || trc_get(fp, &r->chunks[k].insn, 8) || trc_get(fp, &r->chunks[k].cycles, 8);
+        }
+    }
+    if (bad) {
+        fclose(fp);
+        free(r->chunks);
+        free(r);
+        errno = EINVAL;
+        return NULL;
+    }
+    r->fp = fp;
+    r->chunk = -1;
+    r->info.first = r->chunks[0].insn;
+    r->info.start = r->chunks[0].cycles;
+    return r;
+}
+
+void trc_close(struct trc_reader *r) {
+    if (r == NULL) return;
+    fclose(r->fp);
+    free(r->chunks);
+    free(r);
+}
+
+void trc_get_info(struct trc_reader *r, struct trc_info *info) {
+    *info = r->info;
+}
+
+static void trc_load(struct trc_reader *r, int k) {
+    unsigned long long v;
+    struct trc_step *c = &r->cur;
+    memset(c, 0, sizeof(*c));
+    fseek(r->fp, r->chunks[k].offset, SEEK_SET);
+    trc_get(r->fp, &v, 4);
+    c->pc = v;
+    trc_get(r->fp, &v, 4);
+    c->sp = v;
+    c->a = trc_get16(r->fp);
+    c->d = trc_get16(r->fp);
+    c->flags = fgetc(r->fp);
+    trc_get(r->fp, &v, 4);
+    c->depth = (int)(uint32_t)v;
+    for (int i=0;i<16;i++) c->r[i] = trc_get16(r->fp);
+    trc_get(r->fp, &c->insn, 8);
+    trc_get(r->fp, &c->cycles, 8);
+    r->chunk = k;
+    r->laststore = 0;
+}
+
+int trc_next(struct trc_reader *r, struct trc_step *st) {
+    if (r->chunk < 0) trc_load(r, 0);
+    int h;
+    for (;;) {
+        h = fgetc(r->fp);
+        if (h == EOF) return 0;
+        if ((h & 7) != TRC_PC_END) break;
+        if (r->chunk + 1 >= r->info.chunks) {
+            ungetc(h, r->fp);
+            return 0;
+        }
+        trc_load(r, r->chunk + 1);
+    }
+
+    *st = r->cur;
+    FILE* fp = r->fp;
+    st->jump = (h & 7) == TRC_PC_DELTA;
+    if (st->jump) st->next = st->pc + trc_get_svarint(fp);
+    else st->next = st->pc + 2 * ((h & 7) + 1);
+    st->cost = h >> 6 ? (unsigned)(h >> 6) : (unsigned)trc_get_varint(fp);
+    st->regs = 0;
+    st->misc = 0;
+    st->nstores = 0;
+    if (h & TRC_H_REGS) {
+        st->regs = trc_get_varint(fp);
+        for (int i=0;i<16;i++) {
+            if (st->regs >> i & 1) st->r[i] = trc_get16(fp);
+        }
+    }
+    if (h & TRC_H_MISC) {
+        st->misc = fgetc(fp);
+        if (st->misc & TRC_M_A) st->a = trc_get16(fp);
+        if (st->misc & TRC_M_D) st->d = trc_get16(fp);
+        if (st->misc & TRC_M_SP) st->sp += trc_get_svarint(fp);
+        if (st->misc & TRC_M_FLAGS) st->flags = fgetc(fp);
+        if (st->misc & TRC_M_DEPTH) st->depth += trc_get_svarint(fp);
+    }
+    if (h & TRC_H_STORES) {
+        int n = fgetc(fp);
+        for (int k=0;k<n;k++) {
+            uint32_t addr = r->laststore + trc_get_svarint(fp);
+            uint16_t v = trc_get16(fp);
+            r->laststore = addr;
+            if (k < SIM_LOG_MAX) {
+                st->stores[k].addr = addr;
+                st->stores[k].v = v;
+                st->nstores++;
+            }
+        }
+    }
+
+    r->cur = *st;
+    r->cur.pc = st->next;
+    r->cur.insn++;
+    r->cur.cycles += st->cost;
+    return 1;
+}
+
+int trc_seek(struct trc_reader *r, unsigned long long insn) {
+    if (insn < r->info.first || insn >= r->info.first + r->info.steps) return 1;
+    int lo = 0, hi = r->info.chunks - 1, k = 0;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (r->chunks[mid].insn <= insn) {
+            k = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    trc_load(r, k);
+    struct trc_step st;
+    while (r->cur.insn < insn && trc_next(r, &st)) {}
+    return 0;
+}
+
+unsigned long long trc_find_cycle(struct trc_reader *r, unsigned long long cycle) {
+    int lo = 0, hi = r->info.chunks - 1, k = 0;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (r->chunks[mid].cycles <= cycle) {
+            k = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    trc_load(r, k);
+    struct trc_step st;
+    unsigned long long last = r->cur.insn;
+    while (trc_next(r, &st)) {
+        last = st.insn;
+        if (st.cycles + st.cost > cycle) break;
+    }
+    if (r->info.steps && last >= r->info.first + r->info.steps) last = r->info.first + r->info.steps - 1;
+    return last;
+}
@@ -0,0 +1,80 @@
+#ifndef SIMTRACE_H
+#define SIMTRACE_H
+
+#include "sim.h"
+
+// Execution traces (m4sim -T, read back by m4trace). Every instruction is
+// recorded as a one-byte header plus what changed: the pc when it does not
+// simply move to the next instruction, the registers, a/d/sp/flags/depth
+// and main-memory stores, each as a delta or a raw word. A straight-line
+// step with one register write takes 4 bytes.
+//
+// Steps are grouped into chunks of TRC_CHUNK, each starting with a full
+// copy of the registers, and an index of the chunks at the end of the
+// file lets a reader start decoding at any chunk. imov/mmov stores are
+// not recorded.
+
+#define TRC_CHUNK 4096
+
+struct trc_writer;
+struct trc_reader;
+
+// One executed instruction, with the machine state after it.
+struct trc_step {
+    unsigned long long insn;    // instructions before this one
+    unsigned long long cycles;  // cycles before this one
+    unsigned cost;              // its cycles
+    uint32_t pc;                // where it was
+    uint32_t next;              // pc after it
+    int jump;                   // next is not the instruction after it
+    unsigned regs;              // mask of r0..r15 written
+    unsigned misc;              // TRC_M_* written
+    uint16_t r[16];
+    uint16_t a;
+    uint16_t d;
+    uint32_t sp;
+    unsigned char flags;
+    int depth;
+    int nstores;
+    struct sim_store stores[SIM_LOG_MAX];
+};
+
+struct trc_info {
+    unsigned long long first;   // first instruction
+    unsigned long long steps;
+    unsigned long long start;   // cycles at the first instruction
+    unsigned long long end;     // and after the last
+    unsigned long long bytes;
+    int chunks;
+    int stop;                   // SIM_STOP_* the run ended with
+    uint32_t pc;                // final pc
+};
+
+#define TRC_M_A 0x01
+#define TRC_M_D 0x02
+#define TRC_M_SP 0x04
+#define TRC_M_FLAGS 0x08
+#define TRC_M_DEPTH 0x10
+
+// Returns NULL with errno set if path cannot be created.
+struct trc_writer *trc_create(const char* path);
+// sim_run() that records every instruction.
+int trc_run(struct trc_writer *w, struct sim *s, unsigned long long maxinsns);
+// Writes the index and closes the file. Returns 0, or -1 with errno set.
+int trc_finish(struct trc_writer *w, struct sim *s);
+
+// Returns NULL with errno set (EINVAL if the file is not a trace).
+struct trc_reader *trc_open(const char* path);
+void trc_close(struct trc_reader *r);
+void trc_get_info(struct trc_reader *r, struct trc_info *info);
+// Positions the reader so that trc_next() returns instruction insn (as
+// counted by the simulator, so a run restored from a snapshot does not
+// start at 0). Returns 0, or 1 if insn is not in the trace.
+int trc_seek(struct trc_reader *r, unsigned long long insn);
+// Returns 1 and fills st, or 0 at the end of the trace.
+int trc_next(struct trc_reader *r, struct trc_step *st);
+// The instruction running at the given cycle; the last one if the trace
+// ends earlier.
+unsigned long long trc_find_cycle(struct trc_reader *r, unsigned long long cycle);
+
+#endif
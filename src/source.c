@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m4asm.h"
+#include "source.h"
+
+struct src_context src_init_context() {
+    struct src_context ret;
+    ret.nlines = 0;
+    ret.nread = 0;
+    ret.cap = 0;
+    ret.lines = NULL;
+    return ret;
+}
+
+// Reads the whole input in a single forward pass so that non-seekable
+// streams (pipes, stdin) can be assembled. Blank lines and comments are
+// dropped here; nothing in the later passes needs them.
+int src_read(FILE* fp, struct src_context *ctx) {
+    char *line_ = (char*)malloc(32768);
+    int lineno = 0;
+
+    while (fgets(line_, 32768, fp)) {
+        lineno++;
+        char* line = collapse_spaces(line_);
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == 0 || line[0] == ';') {
+            free(line);
+            continue;
+        }
+
+        if (ctx->nlines == ctx->cap) {
+            ctx->cap = ctx->cap ? ctx->cap * 2 : 256;
+            ctx->lines = (struct src_line*)realloc(ctx->lines, sizeof(struct src_line) * ctx->cap);
+        }
+        ctx->lines[ctx->nlines].text = line;
+        ctx->lines[ctx->nlines].lineno = lineno;
+        ctx->nlines++;
+    }
+
+    ctx->nread = lineno;
+    free(line_);
+    return ferror(fp) ? 1 : 0;
+}
+
+void src_free(struct src_context *ctx) {
+    for (int i=0;i<ctx->nlines;i++) free(ctx->lines[i].text);
+    if (ctx->lines != NULL) free(ctx->lines);
+    ctx->lines = NULL;
+    ctx->nlines = ctx->cap = 0;
+}
@@ -0,0 +1,22 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdio.h>
+
+struct src_line {
+    char* text;     // collapsed, CR/LF stripped
+    int lineno;     // 1-based line number in the input
+};
+
+struct src_context {
+    int nlines;
+    int nread;      // lines read, including dropped blanks/comments
+    int cap;
+    struct src_line *lines;
+};
+
+struct src_context src_init_context();
+int src_read(FILE* fp, struct src_context *ctx);
+void src_free(struct src_context *ctx);
+
+#endif
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m4asm.h"
+#include "srcmap.h"
+
+#define SRCMAP_SRC_COL 69       // where listing.c puts the source text
+
+static void* srcmap_grow(void* v, int *cap, size_t size) {
+    *cap = *cap ? *cap * 2 : 256;
+    v = realloc(v, size * *cap);
+    if (v == NULL) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return v;
+}
+
+static int srcmap_line_cmp(const void* a, const void* b) {
+    const struct srcmap_line *x = (const struct srcmap_line*)a;
+    const struct srcmap_line *y = (const struct srcmap_line*)b;
+    if (x->addr != y->addr) return x->addr < y->addr ? -1 : 1;
+    return x->lineno - y->lineno;
+}
+
+static int srcmap_label_cmp(const void* a, const void* b) {
+    const struct srcmap_label *x = (const struct srcmap_label*)a;
+    const struct srcmap_label *y = (const struct srcmap_label*)b;
+    if (x->addr != y->addr) return x->addr < y->addr ? -1 : 1;
+    return x->order - y->order;
+}
+
+// Last entry of a sorted array whose address is <= addr, -1 if none.
+#define SRCMAP_FLOOR(v, n, key, out) do { \
+        int lo_ = 0, hi_ = (n) - 1; \
+        (out) = -1; \
+        while (lo_ <= hi_) { \
+            int mid_ = (lo_ + hi_) / 2; \
+            if ((v)[mid_].addr <= (key)) { (out) = mid_; lo_ = mid_ + 1; } \
+            else hi_ = mid_ - 1; \
+        } \
+    } while (0)
+
+int srcmap_line(struct srcmap *m, uint32_t addr) {
+    int k;
+    SRCMAP_FLOOR(m->lines, m->nlines, addr, k);
+    return k;
+}
+
+int srcmap_label_at(struct srcmap *m, uint32_t addr) {
+    int k;
+    SRCMAP_FLOOR(m->labels, m->nlabels, addr, k);
+    if (k < 0 || m->labels[k].addr != addr) return -1;
+    while (k > 0 && m->labels[k-1].addr == addr) k--;
+    return k;
+}
+
+const char* srcmap_name(struct srcmap *m, uint32_t addr, char* out) {
+    int k;
+    SRCMAP_FLOOR(m->labels, m->nlabels, addr, k);
+    if (k < 0) {
+        sprintf(out, "%08X", addr);
+        return out;
+    }
+    while (k > 0 && m->labels[k-1].addr == m->labels[k].addr) k--;
+    if (m->labels[k].addr == addr) return m->labels[k].name;
+    sprintf(out, "%s+0x%X", m->labels[k].name, addr - m->labels[k].addr);
+    return out;
+}
+
+// Listing lines look like
+//   "   line  address   words  variant  len  cyc  source"
+// with the line number right-aligned in 7 columns (blank on the lines that
+// continue a long instruction) and empty columns for labels and
+// directives.
+int srcmap_load(struct srcmap *m, const char* path) {
+    memset(m, 0, sizeof(*m));
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) return 1;
+
+    char buf[1024];
+    while (fgets(buf, sizeof(buf), fp)) {
+        buf[strcspn(buf, "\r\n")] = 0;
+        size_t len = strlen(buf);
+        if (buf[0] == ';' || len < 17 || buf[6] == ' ') continue;
+        int lineno = atoi(buf);
+        uint32_t addr = strtoul(buf + 9, NULL, 16);
+        const char* src = len > SRCMAP_SRC_COL ? buf + SRCMAP_SRC_COL : "";
+
+        if (len > 19 && buf[19] != ' ') {
+            if (m->nlines == m->caplines) m->lines = (struct srcmap_line*)srcmap_grow(m->lines, &m->caplines, sizeof(struct srcmap_line));
+            struct srcmap_line *l = &m->lines[m->nlines++];
+            memset(l, 0, sizeof(*l));
+            l->addr = addr;
+            l->lineno = lineno;
+            l->insn = strstr(buf, "(0x") != NULL && strstr(buf, "(0x") < src;
+            l->text = strdup(src);
+        } else if (strchr(src, ':') != NULL) {
+            int n = strchr(src, ':') - src;
+            if (n == 0 || n > 32) continue;
+            if (m->nlabels == m->caplabels) m->labels = (struct srcmap_label*)srcmap_grow(m->labels, &m->caplabels, sizeof(struct srcmap_label));
+            struct srcmap_label *l = &m->labels[m->nlabels];
+            memset(l, 0, sizeof(*l));
+            memcpy(l->name, src, n);
+            l->addr = addr;
+            l->order = m->nlabels++;
+        }
+    }
+    fclose(fp);
+
+    qsort(m->lines, m->nlines, sizeof(struct srcmap_line), srcmap_line_cmp);
+    qsort(m->labels, m->nlabels, sizeof(struct srcmap_label), srcmap_label_cmp);
+    for (int i=0;i<m->nlines;i++) {
+        struct srcmap_line *l = &m->lines[i];
+        SRCMAP_FLOOR(m->labels, m->nlabels, l->addr, l->label);
+        if (l->label >= 0) {
+            uint32_t a = m->labels[l->label].addr;
+            while (l->label > 0 && m->labels[l->label-1].addr == a) l->label--;
+        }
+        int k = srcmap_label_at(m, l->addr);
+        for (;k >= 0 && k < m->nlabels && m->labels[k].addr == l->addr;k++) m->labels[k].code |= l->insn;
+    }
+    return 0;
+}
+
+void srcmap_free(struct srcmap *m) {
+    for (int i=0;i<m->nlines;i++) free(m->lines[i].text);
+    free(m->lines);
+    free(m->labels);
+    memset(m, 0, sizeof(*m));
+}
@@ -0,0 +1,46 @@
+#ifndef SRCMAP_H
+#define SRCMAP_H
+
+#include "m4asm.h"
+
+// Address -> source mapping read back from an m4asm listing (-l): every
+// statement that emits words with its address, line number and text, and
+// every label with its address. Used by the profiler, the trace viewer
+// and the disassembler.
+
+struct srcmap_line {
+    uint32_t addr;
+    int lineno;
+    int insn;           // an instruction, not data
+    int label;          // label the line sits under, -1 if none
+    char* text;
+};
+
+struct srcmap_label {
+    char name[33];
+    uint32_t addr;
+    int order;          // position in the listing
+    int code;           // an instruction starts at addr
+};
+
+struct srcmap {
+    struct srcmap_line *lines;      // by address
+    int nlines;
+    int caplines;
+    struct srcmap_label *labels;    // by address, then listing order
+    int nlabels;
+    int caplabels;
+};
+
+// Returns 0, or 1 with errno set.
+int srcmap_load(struct srcmap *m, const char* path);
+void srcmap_free(struct srcmap *m);
+// Last line at or before addr, -1 if none.
+int srcmap_line(struct srcmap *m, uint32_t addr);
+// First label at exactly addr, -1 if none.
+int srcmap_label_at(struct srcmap *m, uint32_t addr);
+// The label at addr, else "label+0xN" for the one before it, else the
+// address in hex. out needs 48 bytes.
+const char* srcmap_name(struct srcmap *m, uint32_t addr, char* out);
+
+#endif
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+struct st_context st_ctx;
+
+static const char* st_pass_names[ST_NPASSES] = {"read", "label_count", "layout", "encode", "write", "optimize"};
+static const char* st_hw_names[ST_NHW] = {"cycles", "cache_misses", "branch_misses"};
+
+double st_wall_time() {
+#ifdef _WIN32
+    LARGE_INTEGER f, c;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&c);
+    return (double)c.QuadPart / (double)f.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+double st_cpu_time() {
+#ifdef _WIN32
+    FILETIME c, e, k, u;
+    GetProcessTimes(GetCurrentProcess(), &c, &e, &k, &u);
+    unsigned long long t = ((unsigned long long)k.dwHighDateTime << 32 | k.dwLowDateTime)
+                         + ((unsigned long long)u.dwHighDateTime << 32 | u.dwLowDateTime);
+    return t / 1e7;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+long st_peak_rss_kb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+    return (long)(pmc.PeakWorkingSetSize / 1024);
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;
+#else
+    return ru.ru_maxrss;
+#endif
+#endif
+}
+
+#ifdef __linux__
+static int st_hw_open(unsigned long long config) {
+    struct perf_event_attr pe;
+    memset(&pe, 0, sizeof(pe));
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.size = sizeof(pe);
+    pe.config = config;
+    pe.disabled = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+}
+#endif
+
+void st_init(int enabled) {
+    memset(&st_ctx, 0, sizeof(st_ctx));
+    st_ctx.enabled = enabled;
+    for (int i=0;i<ST_NHW;i++) st_ctx.hw_fds[i] = -1;
+
+#ifdef __linux__
+    if (!enabled) return;
+    // Hardware counters are best effort: perf_event_paranoid or a VM without
+    // a PMU will make these fail, in which case they are left out of the report.
+    unsigned long long configs[ST_NHW] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    for (int i=0;i<ST_NHW;i++) {
+        st_ctx.hw_fds[i] = st_hw_open(configs[i]);
+        if (st_ctx.hw_fds[i] < 0) continue;
+        ioctl(st_ctx.hw_fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(st_ctx.hw_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+void st_pass_begin(int pass) {
+    if (!st_ctx.enabled) return;
+    st_ctx.passes[pass].wall_start = st_wall_time();
+    st_ctx.passes[pass].cpu_start = st_cpu_time();
+}
+
+void st_pass_end(int pass) {
+    if (!st_ctx.enabled) return;
+    st_ctx.passes[pass].wall += st_wall_time() - st_ctx.passes[pass].wall_start;
+    st_ctx.passes[pass].cpu += st_cpu_time() - st_ctx.passes[pass].cpu_start;
+}
+
+static double st_rate(unsigned long n, double t) {
+    return t > 0 ? n / t : 0;
+}
+
+void st_report(FILE* fp, int format, struct le_context *lctx) {
+    double wall = 0, cpu = 0;
+    for (int i=0;i<ST_NPASSES;i++) {
+        wall += st_ctx.passes[i].wall;
+        cpu += st_ctx.passes[i].cpu;
+    }
+
+    long long hw[ST_NHW];
+    for (int i=0;i<ST_NHW;i++) {
+        hw[i] = -1;
+#ifdef __linux__
+        if (st_ctx.hw_fds[i] < 0) continue;
+        ioctl(st_ctx.hw_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(st_ctx.hw_fds[i], &hw[i], sizeof(hw[i])) != sizeof(hw[i])) hw[i] = -1;
+        close(st_ctx.hw_fds[i]);
+        st_ctx.hw_fds[i] = -1;
+#endif
+    }
+
+    unsigned long label_bytes = sizeof(struct label) * lctx->nlabels;
+
+    if (format == ST_FMT_JSON) {
+        fprintf(fp, "{\"passes\":{");
+        for (int i=0;i<ST_NPASSES;i++) {
+            fprintf(fp, "%s\"%s\":{\"wall\":%.9f,\"cpu\":%.9f}", i ? "," : "", st_pass_names[i], st_ctx.passes[i].wall, st_ctx.passes[i].cpu);
+        }
+        fprintf(fp, "},\"wall\":%.9f,\"cpu\":%.9f", wall, cpu);
+        fprintf(fp, ",\"lines\":%lu,\"insns\":%lu,\"lines_per_sec\":%.1f,\"insns_per_sec\":%.1f",
+            st_ctx.lines, st_ctx.insns, st_rate(st_ctx.lines, wall), st_rate(st_ctx.insns, wall));
+        fprintf(fp, ",\"mallocs\":%lu,\"malloc_bytes\":%lu,\"regex_compiles\":%lu",
+            st_ctx.mallocs, st_ctx.malloc_bytes, st_ctx.regex_compiles);
+        fprintf(fp, ",\"labels\":%d,\"label_bytes\":%lu,\"label_lookups\":%lu,\"label_probes\":%lu",
+            lctx->nlabels, label_bytes, lctx->lookups, lctx->probes);
+        fprintf(fp, ",\"peak_rss_kb\":%ld", st_peak_rss_kb());
+        for (int i=0;i<ST_NHW;i++) {
+            if (hw[i] >= 0) fprintf(fp, ",\"%s\":%lld", st_hw_names[i], hw[i]);
+        }
+        fprintf(fp, "}\n");
+        return;
+    }
+
+    fprintf(fp, "\nStatistics:\n");
+    fprintf(fp, "  %-14s %12s %12s\n", "pass", "wall (ms)", "cpu (ms)");
+    for (int i=0;i<ST_NPASSES;i++) {
+        fprintf(fp, "  %-14s %12.3f %12.3f\n", st_pass_names[i], st_ctx.passes[i].wall * 1e3, st_ctx.passes[i].cpu * 1e3);
+    }
+    fprintf(fp, "  %-14s %12.3f %12.3f\n", "total", wall * 1e3, cpu * 1e3);
+    fprintf(fp, "  lines          %lu (%.0f/s)\n", st_ctx.lines, st_rate(st_ctx.lines, wall));
+    fprintf(fp, "  instructions   %lu (%.0f/s)\n", st_ctx.insns, st_rate(st_ctx.insns, wall));
+    fprintf(fp, "  allocations    %lu (%lu bytes)\n", st_ctx.mallocs, st_ctx.malloc_bytes);
+    fprintf(fp, "  regex compiles %lu\n", st_ctx.regex_compiles);
+    fprintf(fp, "  labels         %d (%lu bytes), %lu lookups, %lu probes\n", lctx->nlabels, label_bytes, lctx->lookups, lctx->probes);
+    fprintf(fp, "  peak RSS       %ld KiB\n", st_peak_rss_kb());
+    for (int i=0;i<ST_NHW;i++) {
+        if (hw[i] >= 0) fprintf(fp, "  %-14s %lld\n", st_hw_names[i], hw[i]);
+    }
+}
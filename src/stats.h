@@ -0,0 +1,51 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "label.h"
+
+#define ST_PASS_READ 0
+#define ST_PASS_COUNT 1
+#define ST_PASS_LAYOUT 2
+#define ST_PASS_ENCODE 3
+#define ST_PASS_WRITE 4
+#define ST_PASS_OPT 5
+#define ST_NPASSES 6
+
+#define ST_FMT_TEXT 0
+#define ST_FMT_JSON 1
+
+#define ST_HW_CYCLES 0
+#define ST_HW_CACHE_MISSES 1
+#define ST_HW_BRANCH_MISSES 2
+#define ST_NHW 3
+
+struct st_pass {
+    double wall;        // seconds, accumulated over every begin/end pair
+    double cpu;
+    double wall_start;
+    double cpu_start;
+};
+
+struct st_context {
+    int enabled;
+    struct st_pass passes[ST_NPASSES];
+    unsigned long lines;            // source lines read, including blanks/comments
+    unsigned long insns;            // instructions encoded
+    unsigned long regex_compiles;
+    unsigned long mallocs;          // malloc/calloc/realloc calls
+    unsigned long malloc_bytes;
+    int hw_fds[ST_NHW];             // perf_event_open fds, -1 if unavailable
+};
+
+extern struct st_context st_ctx;
+
+void st_init(int enabled);
+void st_pass_begin(int pass);
+void st_pass_end(int pass);
+double st_wall_time();
+double st_cpu_time();
+long st_peak_rss_kb();
+void st_report(FILE* fp, int format, struct le_context *lctx);
+
+#endif
@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include "stats.h"
+
+#ifdef __GLIBC__
+// Allocation counting for --stats. glibc lets the executable interpose the
+// allocator as long as malloc, calloc, realloc and free are all provided,
+// and internal calls (strdup, pcre, stdio) go through these too. This file
+// is linked into m4asm and m4asm_bench only, not into m4asm_core, so other
+// programs keep the plain allocator. Counting is off without --stats, and atomic since
+// trace.c may be called from more than one thread.
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static void st_count(size_t size) {
+    if (!st_ctx.enabled) return;
+    __atomic_fetch_add(&st_ctx.mallocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st_ctx.malloc_bytes, size, __ATOMIC_RELAXED);
+}
+
+void* malloc(size_t size) {
+    st_count(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    st_count(n * size);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    st_count(size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+    __libc_free(ptr);
+}
+#endif
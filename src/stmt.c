@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m4asm.h"
+#include "label.h"
+#include "source.h"
+#include "stmt.h"
+#include "cost.h"
+#include "pseudo.h"
+#include "insns.h"
+
+struct stmt_list stmt_init_list(int relax) {
+    struct stmt_list ret;
+    ret.n = 0;
+    ret.cap = 0;
+    ret.v = NULL;
+    ret.relax = relax;
+    ret.passes = 0;
+    return ret;
+}
+
+static struct stmt_t *stmt_append(struct stmt_list *sl, int kind, struct src_line *line) {
+    if (sl->n == sl->cap) {
+        sl->cap = sl->cap ? sl->cap * 2 : 256;
+        sl->v = (struct stmt_t*)realloc(sl->v, sizeof(struct stmt_t) * sl->cap);
+    }
+    struct stmt_t *st = &sl->v[sl->n++];
+    memset(st, 0, sizeof(struct stmt_t));
+    st->kind = kind;
+    st->lineno = line->lineno;
+    st->text = strdup(line->text);
+    st->symidx = -1;
+    return st;
+}
+
+static int insn_length(int def) {
+    return assemble_insn(insns[def].opcode, 0, 0, 0, 0).length;
+}
+
+// Fills st->cand with every variant that can encode pi. A bare label
+// operand may also use a near (W) or relative (+/-) form, and a [label]
+// memory operand a (near) one, but only when the far form exists too, so
+// there is always a legal fallback.
+static void stmt_candidates(struct stmt_t *st, struct parsed_insn_t *pi, int relax) {
+    int exact = find_insn(pi->mnemonic, pi->ptypes);
+    if (exact < 0) {
+        fprintf(stderr, "Error: Cannot find instruction with mnemonic %s and ptypes [%s]\n", pi->mnemonic, pi->ptypes);
+        exit(EXIT_FAILURE);
+    }
+
+    st->ncand = 0;
+    st->cand[st->ncand++] = exact;
+    if (!relax || pi->symidx < 0) return;
+
+    st->symidx = pi->symidx;
+    strcpy(st->sym, pi->sym);
+    for (int c=0;insns[c].mnemonic != NULL && st->ncand < STMT_MAXCAND;c++) {
+        if (c == exact) continue;
+        if (strcmp(pi->mnemonic, insns[c].mnemonic) != 0) continue;
+        if ((int)strlen(insns[c].params) != pi->nparams) continue;
+
+        int ok = 1;
+        for (int i=0;i<pi->nparams && ok;i++) {
+            if (insns[c].params[i] == pi->ptypes[i]) continue;
+            if (i == pi->symidx && strchr(pi->ptypes[i] == PTYPE_FAR_PTR ? "n" : "W+-", insns[c].params[i]) != NULL) continue;
+            ok = 0;
+        }
+        if (ok) st->cand[st->ncand++] = c;
+    }
+
+    for (int i=1;i<st->ncand;i++) {
+        for (int j=i;j>0 && cost_less(st->cand[j], st->cand[j-1]);j--) {
+            short t = st->cand[j];
+            st->cand[j] = st->cand[j-1];
+            st->cand[j-1] = t;
+        }
+    }
+}
+
+// Returns 1 if operand idx of variant def can reach target from st's
+// address. Relative offsets count words from the start of the
+// instruction, as written by hand with jmp +N / jmp -N.
+int stmt_operand_fits(struct stmt_t *st, int def, int idx, uint32_t target) {
+    uint32_t d;
+    switch (insns[def].params[idx]) {
+    case PTYPE_WORD_IMM:
+    case PTYPE_NEAR_PTR:
+        return target <= 0xFFFF;
+    case PTYPE_RELATIVE_POS:
+        if (target <= st->addr || (target - st->addr) % 2) return 0;
+        d = (target - st->addr) / 2;
+        return d >= 2 && d - 2 <= 0xFFFF;
+    case PTYPE_RELATIVE_NEG:
+        if (target > st->addr || (st->addr - target) % 2) return 0;
+        d = (st->addr - target) / 2;
+        return d + 2 <= 0xFFFF;
+    default:
+        return 1;
+    }
+}
+
+static int stmt_fits(struct stmt_t *st, int def, uint32_t target) {
+    return stmt_operand_fits(st, def, st->symidx, target);
+}
+
+static uint32_t stmt_symvalue(struct stmt_t *st, int def, uint32_t target) {
+    switch (insns[def].params[st->symidx]) {
+    case PTYPE_WORD_IMM:
+    case PTYPE_NEAR_PTR:
+        return target & 0xFFFF;
+    case PTYPE_RELATIVE_POS:
+        return (target - st->addr) / 2 - 2;
+    case PTYPE_RELATIVE_NEG:
+        return (st->addr - target) / 2 + 2;
+    default:
+        return target;
+    }
+}
+
+// Annotation directives. They take no space and are read by the passes
+// that use them.
+static const char* stmt_annots[] = {
+    "$loop_bound ", "$LOOP_BOUND ", "$interrupt ", "$INTERRUPT ", "$assert_cycles ", "$ASSERT_CYCLES ", NULL
+};
+
+static int stmt_is_annot(const char* line) {
+    for (int i=0;stmt_annots[i] != NULL;i++) {
+        if (strncmp(line, stmt_annots[i], strlen(stmt_annots[i])) == 0) return 1;
+    }
+    return 0;
+}
+
+void stmt_build(struct src_context *sctx, struct stmt_list *sl, struct le_context *lctx) {
+    for (int l=0;l<sctx->nlines;l++) {
+        char* line = sctx->lines[l].text;
+        if ((strncmp(line, "$ORG ", 5) == 0 || strncmp(line, "$org ", 5) == 0) && strlen(line)>5) {
+            struct parsed_int_t pp = getintval(line + 5);
+            if (pp.code != 0) {
+                fprintf(stderr, "Error: Invalid origin specified: %s\n", line);
+                exit(EXIT_FAILURE);
+            }
+            stmt_append(sl, STMT_ORG, &sctx->lines[l])->value = pp.value&0xFFFFFFFF;
+        } else if ((strncmp(line, "$ALIGN ", 7) == 0 || strncmp(line, "$align ", 7) == 0) && strlen(line)>7) {
+            struct parsed_int_t pp = getintval(line + 7);
+            if (pp.code != 0 || pp.value < 2 || pp.value > 0x10000 || (pp.value & (pp.value - 1))) {
+                fprintf(stderr, "Error: Invalid alignment specified (expected a power of two from 2 to 0x10000): %s\n", line);
+                exit(EXIT_FAILURE);
+            }
+            stmt_append(sl, STMT_ALIGN, &sctx->lines[l])->value = pp.value;
+        } else if ((strncmp(line, "$FILL ", 6) == 0 || strncmp(line, "$fill ", 6) == 0) && strlen(line)>6) {
+            char* dup = strdup(line + 6);
+            char* s = dup;
+            char* a = strsep(&s, ",");
+            while (s != NULL && *s == ' ') s++;
+            struct parsed_int_t addr = getintval(a);
+            struct parsed_int_t val = s != NULL ? getintval(s) : (struct parsed_int_t){1, 0, 0};
+            if (addr.code != 0 || val.code != 0 || addr.value % 2 || addr.value > 0xFFFFFFFF || val.value > 0xFFFF) {
+                fprintf(stderr, "Error: Invalid fill specified (expected $fill even-address, word): %s\n", line);
+                exit(EXIT_FAILURE);
+            }
+            struct stmt_t *st = stmt_append(sl, STMT_FILL, &sctx->lines[l]);
+            st->value = addr.value;
+            st->fill = val.value;
+            free(dup);
+        } else if (stmt_is_annot(line)) {
+            stmt_append(sl, STMT_ANNOT, &sctx->lines[l]);
+        } else if (strcmp(line, "$superopt") == 0 || strcmp(line, "$SUPEROPT") == 0) {
+            stmt_append(sl, STMT_MARK, &sctx->lines[l])->value = 1;
+        } else if (strcmp(line, "$end") == 0 || strcmp(line, "$END") == 0) {
+            stmt_append(sl, STMT_MARK, &sctx->lines[l])->value = 0;
+        } else if (strlen(line) > 2 && le_valid_label(line)) {
+            stmt_append(sl, STMT_LABEL, &sctx->lines[l]);
+            le_initial_count(line, lctx);
+        } else if (strlen(line) > 2) {
+            char exp[PSEUDO_MAXEXP][PSEUDO_MAXLINE];
+            int n;
+            if (!pseudo_expand(line, lctx, exp, &n)) {
+                stmt_append(sl, STMT_INSN, &sctx->lines[l]);
+                continue;
+            }
+            for (int k=0;k<n;k++) {
+                struct src_line sub = {exp[k], sctx->lines[l].lineno};
+                stmt_append(sl, STMT_INSN, &sub);
+            }
+        }
+    }
+    le_allocate_labels(lctx);
+
+    for (int i=0;i<sl->n;i++) {
+        if (sl->v[i].kind == STMT_INSN) stmt_parse(sl, &sl->v[i], lctx);
+    }
+}
+
+// (Re)computes the encoding candidates of an instruction statement from
+// its text. Used by stmt_build and by passes that rewrite statements.
+void stmt_parse(struct stmt_list *sl, struct stmt_t *st, struct le_context *lctx) {
+    st->special = 0;
+    st->rank = 0;
+    st->symidx = -1;
+    st->sym[0] = 0;
+
+    struct assembled_insn_t asi = handle_special_cases(st->text);
+    if (asi.length > 0) {
+        st->special = 1;
+        st->ncand = 0;
+        st->length = asi.length;
+        return;
+    }
+
+    struct parsed_insn_t pi;
+    parse_insn(st->text, lctx, &pi);
+    stmt_candidates(st, &pi, sl->relax);
+}
+
+void stmt_set_text(struct stmt_list *sl, struct stmt_t *st, const char* text, struct le_context *lctx) {
+    free(st->text);
+    st->text = strdup(text);
+    if (st->kind == STMT_INSN) stmt_parse(sl, st, lctx);
+}
+
+// Copies the lowercased mnemonic of an instruction statement to out.
+void stmt_mnemonic(struct stmt_t *st, char* out) {
+    int n = 0;
+    while (st->text[n] && st->text[n] != ' ' && n < 15) {
+        out[n] = tolower(st->text[n]);
+        n++;
+    }
+    out[n] = 0;
+}
+
+// Copies operand k of an instruction statement to out (33 bytes), without
+// the @, [] or () around a label in the forms parse_param accepts (label,
+// @label, [label], (label)). Returns 0, or 1 if there is no operand k.
+int stmt_operand(struct stmt_t *st, int k, char* out) {
+    if (st->kind != STMT_INSN || st->special) return 1;
+    const char* s = strchr(st->text, ' ');
+    for (;s != NULL && k > 0;k--) s = strchr(s + 1, ' ');
+    if (s == NULL) return 1;
+    s++;
+    int n = strcspn(s, " ");
+    if (n > 0 && s[n-1] == ',') n--;
+    if (n > 1 && ((s[0] == '[' && s[n-1] == ']') || (s[0] == '(' && s[n-1] == ')'))) {
+        s++;
+        n -= 2;
+    }
+    if (n > 0 && s[0] == '@') {
+        s++;
+        n--;
+    }
+    if (n > 32) n = 0;          // longer than any label
+    memcpy(out, s, n);
+    out[n] = 0;
+    return 0;
+}
+
+// Returns 1 if any operand of st names label.
+int stmt_refs_label(struct stmt_t *st, const char* label) {
+    char op[33];
+    for (int k=0;stmt_operand(st, k, op) == 0;k++) {
+        if (strcmp(op, label) == 0) return 1;
+    }
+    return 0;
+}
+
+void stmt_names_add(struct stmt_names *ns, const char* name) {
+    if (ns->n == ns->cap) {
+        ns->cap = ns->cap ? ns->cap * 2 : 64;
+        ns->v = (char**)realloc(ns->v, sizeof(char*) * ns->cap);
+        if (ns->v == NULL) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ns->v[ns->n++] = strdup(name);
+}
+
+static int stmt_name_cmp(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+void stmt_names_sort(struct stmt_names *ns) {
+    qsort(ns->v, ns->n, sizeof(char*), stmt_name_cmp);
+}
+
+int stmt_names_find(struct stmt_names *ns, const char* name) {
+    int lo = 0, hi = ns->n - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int c = strcmp(ns->v[mid], name);
+        if (c == 0) return mid;
+        if (c < 0) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+void stmt_names_free(struct stmt_names *ns) {
+    for (int i=0;i<ns->n;i++) free(ns->v[i]);
+    free(ns->v);
+    memset(ns, 0, sizeof(*ns));
+}
+
+int stmt_branches_all_labels(struct stmt_list *sl) {
+    static const char* branches[] = {"jmp", "call", "brchf", "brchi", NULL};
+    struct stmt_names labels;
+    memset(&labels, 0, sizeof(labels));
+    for (int i=0;i<sl->n;i++) {
+        if (sl->v[i].kind != STMT_LABEL) continue;
+        char name[33];
+        snprintf(name, sizeof(name), "%.*s", (int)strlen(sl->v[i].text) - 1, sl->v[i].text);
+        stmt_names_add(&labels, name);
+    }
+    stmt_names_sort(&labels);
+
+    int ok = 1;
+    for (int i=0;i<sl->n && ok;i++) {
+        struct stmt_t *st = &sl->v[i];
+        char m[16], op[33];
+        if (st->kind != STMT_INSN || st->special) continue;
+        stmt_mnemonic(st, m);
+        for (int b=0;branches[b] != NULL;b++) {
+            if (strcmp(m, branches[b]) != 0) continue;
+            ok = stmt_operand(st, 0, op) == 0 && stmt_names_find(&labels, op) >= 0;
+            break;
+        }
+    }
+    stmt_names_free(&labels);
+    return ok;
+}
+
+// Drops statements marked STMT_NONE.
+void stmt_compact(struct stmt_list *sl) {
+    int o = 0;
+    for (int i=0;i<sl->n;i++) {
+        if (sl->v[i].kind == STMT_NONE) {
+            free(sl->v[i].text);
+            continue;
+        }
+        sl->v[o++] = sl->v[i];
+    }
+    sl->n = o;
+}
+
+// Assigns addresses, iterating to a fixed point: every relaxable statement
+// starts at its cheapest form and is only ever moved to a later candidate
+// when its label is out of reach, so the loop always terminates. Addresses
+// only grow from one iteration to the next, so a $fill that is already
+// overrun in the first one is an error.
+void stmt_layout(struct stmt_list *sl, struct le_context *lctx) {
+    int changed;
+    sl->passes = 0;
+    do {
+        uint32_t addr = 0;
+        lctx->idx = 0;
+        for (int i=0;i<sl->n;i++) {
+            struct stmt_t *st = &sl->v[i];
+            switch (st->kind) {
+            case STMT_ORG:
+                addr = st->value;
+                break;
+            case STMT_LABEL:
+                le_parse_label(st->text, addr, lctx, 1);
+                break;
+            case STMT_ALIGN:
+                st->addr = addr;
+                st->length = (st->value - addr % st->value) % st->value / 2;
+                addr += st->length*2;
+                break;
+            case STMT_FILL:
+                if (addr > st->value) {
+                    fprintf(stderr, "Error: line %d: $fill to 0x%X, but the code already reaches 0x%X\n", st->lineno, st->value, addr);
+                    exit(EXIT_FAILURE);
+                }
+                st->addr = addr;
+                st->length = (st->value - addr) / 2;
+                addr += st->length*2;
+                break;
+            case STMT_INSN:
+                st->addr = addr;
+                if (!st->special) st->length = insn_length(st->cand[st->rank]);
+                addr += st->length*2;
+                break;
+            }
+        }
+        sl->passes++;
+
+        changed = 0;
+        for (int i=0;i<sl->n;i++) {
+            struct stmt_t *st = &sl->v[i];
+            if (st->kind != STMT_INSN || st->ncand < 2) continue;
+
+            uint32_t target = le_get_label_addr(st->sym, lctx);
+            while (!stmt_fits(st, st->cand[st->rank], target)) {
+                st->rank++;
+                changed = 1;
+            }
+        }
+    } while (changed);
+}
+
+struct assembled_insn_t stmt_assemble(struct stmt_t *st, struct le_context *lctx) {
+    if (st->special) return handle_special_cases(st->text);
+
+    struct parsed_insn_t pi;
+    parse_insn(st->text, lctx, &pi);
+
+    int def = st->cand[st->rank];
+    if (st->symidx >= 0) {
+        pi.pvs[st->symidx].value = stmt_symvalue(st, def, pi.pvs[st->symidx].value);
+    }
+    return assemble_insn(insns[def].opcode, pi.pvs[0].value, pi.pvs[1].value, pi.pvs[2].value, pi.pvs[3].value);
+}
+
+int stmt_encode(struct stmt_t *st, struct le_context *lctx, uint16_t *out) {
+    struct assembled_insn_t asi = stmt_assemble(st, lctx);
+    for (int k=0;k<asi.length;k++) out[k] = hton16(asi.data[k]);
+    return asi.length;
+}
+
+void stmt_free(struct stmt_list *sl) {
+    for (int i=0;i<sl->n;i++) free(sl->v[i].text);
+    if (sl->v != NULL) free(sl->v);
+    sl->v = NULL;
+    sl->n = sl->cap = 0;
+}
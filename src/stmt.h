@@ -0,0 +1,80 @@
+#ifndef STMT_H
+#define STMT_H
+
+#include "label.h"
+#include "source.h"
+#include "m4asm.h"
+
+#define STMT_INSN 0
+#define STMT_LABEL 1
+#define STMT_ORG 2
+#define STMT_NONE 3   // deleted by a pass, dropped by stmt_compact
+#define STMT_MARK 4   // $superopt / $end region marker, value 1 / 0
+#define STMT_ALIGN 5  // $align: nop padding up to a multiple of value
+#define STMT_FILL 6   // $fill: fill words up to address value
+#define STMT_ANNOT 7  // $loop_bound / $interrupt / $assert_cycles, for wcet.c
+
+#define STMT_MAXCAND 8
+#define STMT_MAXWORDS 64    // longest encoding (ds)
+
+struct stmt_t {
+    int kind;
+    int lineno;
+    char* text;                 // collapsed source text (owned)
+    uint32_t value;             // STMT_ORG: origin, STMT_ALIGN: boundary,
+                                // STMT_FILL: target address
+    uint16_t fill;              // STMT_ALIGN / STMT_FILL: padding word
+    uint32_t addr;              // byte address from the last layout
+    int length;                 // words
+    int special;                // 1 if emitted by handle_special_cases (ds)
+    int ncand;                  // insns[] variants that can encode this statement,
+    short cand[STMT_MAXCAND];   // cheapest first
+    int rank;                   // index into cand[] of the selected variant
+    int symidx;                 // relaxable label operand, -1 if none
+    char sym[33];
+};
+
+struct stmt_list {
+    int n;
+    int cap;
+    struct stmt_t *v;
+    int relax;                  // allow label operands to use shorter forms
+    int passes;                 // layout iterations taken by the last stmt_layout
+};
+
+// Sorted label names, for passes that would otherwise compare every
+// statement against every label. Fill with stmt_names_add, then
+// stmt_names_sort before the first stmt_names_find.
+struct stmt_names {
+    char** v;
+    int n;
+    int cap;
+};
+
+struct stmt_list stmt_init_list(int relax);
+void stmt_build(struct src_context *sctx, struct stmt_list *sl, struct le_context *lctx);
+void stmt_parse(struct stmt_list *sl, struct stmt_t *st, struct le_context *lctx);
+void stmt_set_text(struct stmt_list *sl, struct stmt_t *st, const char* text, struct le_context *lctx);
+void stmt_mnemonic(struct stmt_t *st, char* out);
+int stmt_operand(struct stmt_t *st, int k, char* out);
+int stmt_refs_label(struct stmt_t *st, const char* label);
+void stmt_names_add(struct stmt_names *ns, const char* name);
+void stmt_names_sort(struct stmt_names *ns);
+// Index of name, -1 if absent.
+int stmt_names_find(struct stmt_names *ns, const char* name);
+void stmt_names_free(struct stmt_names *ns);
+int stmt_operand_fits(struct stmt_t *st, int def, int idx, uint32_t target);
+// Returns 1 if every jmp, call, brchf and brchi names a label of the
+// program. Passes that insert, delete or move code check this first: a
+// relative or numeric target (jmp +4, jmp @0x100, call d0x100) would
+// silently land somewhere else.
+int stmt_branches_all_labels(struct stmt_list *sl);
+void stmt_compact(struct stmt_list *sl);
+void stmt_layout(struct stmt_list *sl, struct le_context *lctx);
+struct assembled_insn_t stmt_assemble(struct stmt_t *st, struct le_context *lctx);
+// stmt_assemble() into out (STMT_MAXWORDS words, host order). Returns the
+// number of words.
+int stmt_encode(struct stmt_t *st, struct le_context *lctx, uint16_t *out);
+void stmt_free(struct stmt_list *sl);
+
+#endif
@@ -0,0 +1,521 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m4asm.h"
+#include "label.h"
+#include "stmt.h"
+#include "cost.h"
+#include "superopt.h"
+#include "insns.h"
+
+// Search space: register-only and immediate ALU forms. Equivalence is over
+// the registers the region names; flags are not modelled, so a region is
+// refused unless the code after $end overwrites the flags before reading
+// them or leaving straight-line code. Only single-register regions are
+// verified on every input; a replacement for a wider region is checked on
+// samples, so it is only offered through --superopt-patch, never applied.
+#define SO_RR 0     // op rA, rB
+#define SO_RW 1     // op rA, imm
+#define SO_R 2      // op rA
+#define SO_SH 3     // op rA, 1..15
+
+#define SO_MOV 0
+#define SO_ADD 1
+#define SO_SUB 2
+#define SO_AND 3
+#define SO_OR 4
+#define SO_NOR 5
+#define SO_XOR 6
+#define SO_NAND 7
+#define SO_XNOR 8
+#define SO_NOT 9
+#define SO_INC 10
+#define SO_DEC 11
+#define SO_INC2 12
+#define SO_DEC2 13
+#define SO_SHL 14
+#define SO_SHR 15
+#define SO_ROL 16
+#define SO_ROR 17
+
+struct so_op {
+    const char* mnemonic;
+    int form;
+    int fn;
+};
+
+static struct so_op so_ops[] = {
+    {"mov",  SO_RR, SO_MOV},  {"mov",  SO_RW, SO_MOV},
+    {"add",  SO_RR, SO_ADD},  {"add",  SO_RW, SO_ADD},
+    {"sub",  SO_RR, SO_SUB},  {"sub",  SO_RW, SO_SUB},
+    {"and",  SO_RR, SO_AND},  {"and",  SO_RW, SO_AND},
+    {"or",   SO_RR, SO_OR},   {"or",   SO_RW, SO_OR},
+    {"nor",  SO_RR, SO_NOR},  {"nor",  SO_RW, SO_NOR},
+    {"xor",  SO_RR, SO_XOR},  {"xor",  SO_RW, SO_XOR},
+    {"nand", SO_RR, SO_NAND}, {"nand", SO_RW, SO_NAND},
+    {"xnor", SO_RR, SO_XNOR}, {"xnor", SO_RW, SO_XNOR},
+    {"not",  SO_R,  SO_NOT},
+    {"inc",  SO_R,  SO_INC},
+    {"dec",  SO_R,  SO_DEC},
+    {"inc2", SO_R,  SO_INC2},
+    {"dec2", SO_R,  SO_DEC2},
+    {"shl",  SO_SH, SO_SHL},
+    {"shr",  SO_SH, SO_SHR},
+    {"rol",  SO_SH, SO_ROL},
+    {"ror",  SO_SH, SO_ROR},
+    {NULL, 0, 0}
+};
+
+static const char* so_ptypes[] = {"RR", "RW", "R", "RW"};
+
+#define SO_MAXREGS 4
+#define SO_MAXCONST 12
+#define SO_NQUICK 16
+#define SO_NRANDOM 8192
+
+struct so_insn {
+    int op;             // index into so_ops
+    int dst;            // register slot
+    int src;            // register slot (SO_RR)
+    uint16_t imm;       // SO_RW, SO_SH
+    int cycles;
+    int words;
+    long cost;
+};
+
+struct so_search {
+    int nregs;
+    int regs[SO_MAXREGS];           // slot -> register number
+    int nconst;
+    uint16_t consts[SO_MAXCONST];
+    struct so_insn orig[SO_MAXREGION];
+    int norig;
+    struct so_insn *cands;
+    int ncands;
+    int maxlen;
+    uint16_t quick[SO_NQUICK][SO_MAXREGS];
+    uint16_t want[SO_NQUICK][SO_MAXREGS];
+    uint16_t state[SO_MAXREGION + 1][SO_NQUICK][SO_MAXREGS];
+    struct so_insn seq[SO_MAXREGION];
+    struct so_insn best[SO_MAXREGION];
+    int nbest;
+    long bestcost;
+    unsigned long nodes;
+    uint32_t rng;
+};
+
+static uint32_t so_rand(struct so_search *s) {
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 17;
+    s->rng ^= s->rng << 5;
+    return s->rng;
+}
+
+static uint16_t so_alu(int fn, uint16_t a, uint16_t b) {
+    switch (fn) {
+    case SO_MOV: return b;
+    case SO_ADD: return a + b;
+    case SO_SUB: return a - b;
+    case SO_AND: return a & b;
+    case SO_OR: return a | b;
+    case SO_NOR: return ~(a | b);
+    case SO_XOR: return a ^ b;
+    case SO_NAND: return ~(a & b);
+    case SO_XNOR: return ~(a ^ b);
+    case SO_NOT: return ~a;
+    case SO_INC: return a + 1;
+    case SO_DEC: return a - 1;
+    case SO_INC2: return a + 2;
+    case SO_DEC2: return a - 2;
+    case SO_SHL: return b > 15 ? 0 : a << b;
+    case SO_SHR: return b > 15 ? 0 : a >> b;
+    case SO_ROL: b &= 15; return b ? (uint16_t)(a << b | a >> (16 - b)) : a;
+    case SO_ROR: b &= 15; return b ? (uint16_t)(a >> b | a << (16 - b)) : a;
+    default: return a;
+    }
+}
+
+static void so_exec(struct so_insn *in, uint16_t *r) {
+    struct so_op *op = &so_ops[in->op];
+    uint16_t b = op->form == SO_RR ? r[in->src] : in->imm;
+    r[in->dst] = so_alu(op->fn, r[in->dst], b);
+}
+
+static int so_fill_cost(struct so_insn *in) {
+    int def = find_insn((char*)so_ops[in->op].mnemonic, (char*)so_ptypes[so_ops[in->op].form]);
+    if (def < 0) return 0;
+    in->cycles = cost_cycles(def);
+    in->words = cost_length(def);
+    in->cost = cost_value(in->cycles, in->words);
+    return 1;
+}
+
+static void so_format(struct so_search *s, struct so_insn *in, char* out, int outlen) {
+    struct so_op *op = &so_ops[in->op];
+    switch (op->form) {
+    case SO_RR:
+        snprintf(out, outlen, "%s r%d, r%d", op->mnemonic, s->regs[in->dst], s->regs[in->src]);
+        break;
+    case SO_R:
+        snprintf(out, outlen, "%s r%d", op->mnemonic, s->regs[in->dst]);
+        break;
+    default:
+        snprintf(out, outlen, "%s r%d, 0x%X", op->mnemonic, s->regs[in->dst], in->imm);
+        break;
+    }
+}
+
+static int so_slot(struct so_search *s, int reg) {
+    for (int i=0;i<s->nregs;i++) {
+        if (s->regs[i] == reg) return i;
+    }
+    if (s->nregs == SO_MAXREGS) return -1;
+    s->regs[s->nregs] = reg;
+    return s->nregs++;
+}
+
+static void so_const(struct so_search *s, uint16_t v) {
+    for (int i=0;i<s->nconst;i++) {
+        if (s->consts[i] == v) return;
+    }
+    if (s->nconst < SO_MAXCONST) s->consts[s->nconst++] = v;
+}
+
+// Translates one region statement. Returns 0 if it is outside the search space.
+static int so_translate(struct so_search *s, struct stmt_t *st, struct le_context *lctx, struct so_insn *in) {
+    if (st->kind != STMT_INSN || st->special) return 0;
+
+    struct parsed_insn_t pi;
+    parse_insn(st->text, lctx, &pi);
+    for (int o=0;so_ops[o].mnemonic != NULL;o++) {
+        if (strcmp(so_ops[o].mnemonic, pi.mnemonic) != 0) continue;
+        if (strcmp(so_ptypes[so_ops[o].form], pi.ptypes) != 0) continue;
+
+        memset(in, 0, sizeof(*in));
+        in->op = o;
+        if ((in->dst = so_slot(s, pi.pvs[0].value)) < 0) return 0;
+        if (so_ops[o].form == SO_RR && (in->src = so_slot(s, pi.pvs[1].value)) < 0) return 0;
+        if (so_ops[o].form == SO_RW || so_ops[o].form == SO_SH) {
+            in->imm = pi.pvs[1].value & 0xFFFF;
+            if (so_ops[o].form == SO_RW) so_const(s, in->imm);
+        }
+        return so_fill_cost(in);
+    }
+    return 0;
+}
+
+static void so_add_cand(struct so_search *s, struct so_insn *in) {
+    if (!so_fill_cost(in)) return;
+    s->cands[s->ncands++] = *in;
+}
+
+static int so_cand_cmp(const void* a, const void* b) {
+    long x = ((const struct so_insn*)a)->cost;
+    long y = ((const struct so_insn*)b)->cost;
+    return x < y ? -1 : x > y;
+}
+
+static void so_build_cands(struct so_search *s) {
+    int max = 0;
+    for (int o=0;so_ops[o].mnemonic != NULL;o++) max += s->nregs * (s->nregs + s->nconst + 15 + 1);
+    s->cands = (struct so_insn*)malloc(sizeof(struct so_insn) * max);
+    s->ncands = 0;
+
+    struct so_insn in;
+    for (int o=0;so_ops[o].mnemonic != NULL;o++) {
+        for (int d=0;d<s->nregs;d++) {
+            memset(&in, 0, sizeof(in));
+            in.op = o;
+            in.dst = d;
+            switch (so_ops[o].form) {
+            case SO_RR:
+                for (int r=0;r<s->nregs;r++) {
+                    if (r == d && so_ops[o].fn == SO_MOV) continue;
+                    in.src = r;
+                    so_add_cand(s, &in);
+                }
+                break;
+            case SO_RW:
+                for (int c=0;c<s->nconst;c++) {
+                    in.imm = s->consts[c];
+                    so_add_cand(s, &in);
+                }
+                break;
+            case SO_SH:
+                for (int c=1;c<16;c++) {
+                    in.imm = c;
+                    so_add_cand(s, &in);
+                }
+                break;
+            default:
+                so_add_cand(s, &in);
+                break;
+            }
+        }
+    }
+    qsort(s->cands, s->ncands, sizeof(struct so_insn), so_cand_cmp);
+}
+
+static void so_run(struct so_insn *seq, int n, uint16_t *r) {
+    for (int i=0;i<n;i++) so_exec(&seq[i], r);
+}
+
+static int so_same(struct so_search *s, struct so_insn *seq, int n, uint16_t *in) {
+    uint16_t a[SO_MAXREGS], b[SO_MAXREGS];
+    memcpy(a, in, sizeof(a));
+    memcpy(b, in, sizeof(b));
+    so_run(s->orig, s->norig, a);
+    so_run(seq, n, b);
+    return memcmp(a, b, sizeof(uint16_t) * s->nregs) == 0;
+}
+
+// Full check of a candidate that passed the quick vectors: every input for a
+// single-register region, otherwise boundary patterns and random vectors,
+// which is why wider regions only go to the patch.
+static int so_verify(struct so_search *s, struct so_insn *seq, int n) {
+    uint16_t in[SO_MAXREGS];
+    memset(in, 0, sizeof(in));
+    if (s->nregs == 1) {
+        for (uint32_t v=0;v<=0xFFFF;v++) {
+            in[0] = v;
+            if (!so_same(s, seq, n, in)) return 0;
+        }
+        return 1;
+    }
+
+    static const uint16_t edge[] = {0, 1, 2, 0x7FFF, 0x8000, 0xFFFE, 0xFFFF, 0x5555};
+    int nedge = sizeof(edge) / sizeof(edge[0]);
+    int combos = 1;
+    for (int i=0;i<s->nregs;i++) combos *= nedge;
+    for (int c=0;c<combos;c++) {
+        int x = c;
+        for (int i=0;i<s->nregs;i++) {
+            in[i] = edge[x % nedge];
+            x /= nedge;
+        }
+        if (!so_same(s, seq, n, in)) return 0;
+    }
+    for (int t=0;t<SO_NRANDOM;t++) {
+        for (int i=0;i<s->nregs;i++) in[i] = so_rand(s);
+        if (!so_same(s, seq, n, in)) return 0;
+    }
+    return 1;
+}
+
+static void so_dfs(struct so_search *s, int depth, long cost) {
+    s->nodes++;
+    if (depth > 0 && memcmp(s->state[depth], s->want, sizeof(s->want)) == 0 && so_verify(s, s->seq, depth)) {
+        memcpy(s->best, s->seq, sizeof(struct so_insn) * depth);
+        s->nbest = depth;
+        s->bestcost = cost;
+        return;
+    }
+    if (depth == s->maxlen) return;
+
+    // Every instruction writes one register, so each register that is still
+    // wrong needs at least one more instruction.
+    int wrong = 0;
+    for (int i=0;i<s->nregs;i++) {
+        for (int v=0;v<SO_NQUICK;v++) {
+            if (s->state[depth][v][i] == s->want[v][i]) continue;
+            wrong++;
+            break;
+        }
+    }
+    if (wrong > s->maxlen - depth) return;
+    if (wrong > 0 && cost + wrong * s->cands[0].cost >= s->bestcost) return;
+
+    for (int c=0;c<s->ncands;c++) {
+        struct so_insn *in = &s->cands[c];
+        if (cost + in->cost >= s->bestcost) break;
+        for (int v=0;v<SO_NQUICK;v++) {
+            memcpy(s->state[depth+1][v], s->state[depth][v], sizeof(s->state[0][0]));
+            so_exec(in, s->state[depth+1][v]);
+        }
+        s->seq[depth] = *in;
+        so_dfs(s, depth+1, cost + in->cost);
+    }
+}
+
+// Searches for the cheapest sequence equivalent to the region [first, last).
+// Returns the number of instructions found, 0 if the region cannot be
+// improved, -1 if it is outside the search space.
+static int so_region(struct stmt_list *sl, int first, int last, int maxlen, struct le_context *lctx, struct so_search *s) {
+    memset(s, 0, sizeof(*s));
+    s->rng = 0x9E3779B9u;
+    for (int i=first;i<last;i++) {
+        if (sl->v[i].kind == STMT_NONE) continue;
+        if (s->norig == SO_MAXREGION) return -1;
+        if (!so_translate(s, &sl->v[i], lctx, &s->orig[s->norig])) return -1;
+        s->bestcost += s->orig[s->norig].cost;
+        s->norig++;
+    }
+    if (s->norig == 0) return -1;
+    so_const(s, 0);
+    so_const(s, 1);
+    so_const(s, 2);
+    so_const(s, 0xFFFF);
+
+    for (int v=0;v<SO_NQUICK;v++) {
+        for (int i=0;i<s->nregs;i++) {
+            s->quick[v][i] = v < 2 ? (v ? 0xFFFF : 0) : so_rand(s);
+            s->state[0][v][i] = s->want[v][i] = s->quick[v][i];
+        }
+        so_run(s->orig, s->norig, s->want[v]);
+    }
+
+    s->maxlen = maxlen < s->norig ? maxlen : s->norig;
+    so_build_cands(s);
+    so_dfs(s, 0, 0);
+    free(s->cands);
+    return s->nbest;
+}
+
+// Whether the flags left at statement i may be read before anything
+// overwrites them. Only straight-line code is followed: leaving it (a jump,
+// call, return, interrupt, data or the end of the program) counts as a
+// read, since the flags can be tested wherever control goes.
+static int so_flags_read(struct stmt_list *sl, int i) {
+    static const char* const readers[] = {"brchf", "brchi", "adc", "suc", NULL};
+    static const char* const writers[] = {"add", "sub", "and", "or", "nor", "xor", "nand", "xnor",
+        "not", "inc", "dec", "inc2", "dec2", "cmp", "shr", "shl", "ror", "rol", NULL};
+    static const char* const leaves[] = {"jmp", "call", "ret", "sint", "ssp", "dw", "ds", NULL};
+    char m[16];
+    for (;i<sl->n;i++) {
+        if (sl->v[i].kind != STMT_INSN) continue;
+        stmt_mnemonic(&sl->v[i], m);
+        for (int k=0;readers[k];k++) if (strcmp(m, readers[k]) == 0) return 1;
+        for (int k=0;writers[k];k++) if (strcmp(m, writers[k]) == 0) return 0;
+        for (int k=0;leaves[k];k++) if (strcmp(m, leaves[k]) == 0) return 1;
+    }
+    return 1;
+}
+
+static void so_patch_hunk(FILE* patch, char** src, int nsrc, int from, int to, char rep[][64], int nrep, int *delta) {
+    fprintf(patch, "@@ -%d,%d +%d,%d @@\n", from, to - from + 1, from + *delta, nrep);
+    for (int l=from;l<=to && l<=nsrc;l++) fprintf(patch, "-%s", src[l-1]);
+    for (int k=0;k<nrep;k++) fprintf(patch, "+%s\n", rep[k]);
+    *delta += nrep - (to - from + 1);
+}
+
+static char** so_read_lines(const char* path, int *n) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) return NULL;
+    char buf[32768];
+    int cap = 256;
+    char** lines = (char**)malloc(sizeof(char*) * cap);
+    *n = 0;
+    while (fgets(buf, sizeof(buf), fp)) {
+        if (*n == cap) {
+            cap *= 2;
+            lines = (char**)realloc(lines, sizeof(char*) * cap);
+        }
+        if (buf[strlen(buf)-1] != '\n' && strlen(buf) < sizeof(buf)-1) strcat(buf, "\n");
+        lines[(*n)++] = strdup(buf);
+    }
+    fclose(fp);
+    return lines;
+}
+
+// Superoptimizes every $superopt ... $end region. With patch == NULL the
+// replacements are applied in place; otherwise they are written to patch as
+// a unified diff against srcpath and the statement list is left alone.
+// Returns the number of regions improved.
+int opt_superopt(struct stmt_list *sl, struct le_context *lctx, int maxlen, const char* srcpath, FILE* patch, FILE* log) {
+    struct so_search *s = (struct so_search*)malloc(sizeof(struct so_search));
+    char** src = NULL;
+    int nsrc = 0;
+    int delta = 0;
+    int total = 0;
+
+    if (patch != NULL) {
+        src = so_read_lines(srcpath, &nsrc);
+        if (src == NULL) {
+            fprintf(stderr, "Error: --superopt-patch needs the input file, cannot read %s\n", srcpath);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(patch, "--- a/%s\n+++ b/%s\n", srcpath, srcpath);
+    }
+
+    for (int i=0;i<sl->n;i++) {
+        if (sl->v[i].kind != STMT_MARK || sl->v[i].value != 1) continue;
+        int open = i;
+        int end = i+1;
+        while (end < sl->n && sl->v[end].kind != STMT_MARK) end++;
+        if (end == sl->n || sl->v[end].value != 0) {
+            fprintf(stderr, "Error: line %d: $superopt without matching $end\n", sl->v[open].lineno);
+            exit(EXIT_FAILURE);
+        }
+        i = end;
+
+        if (so_flags_read(sl, end+1)) {
+            fprintf(stderr, "Warning: line %d: $superopt region's flags may be read after $end, skipped\n", sl->v[open].lineno);
+            continue;
+        }
+        int n = so_region(sl, open+1, end, maxlen, lctx, s);
+        if (n < 0) {
+            fprintf(stderr, "Warning: line %d: $superopt region has labels, more than %d instructions or non-ALU forms, skipped\n", sl->v[open].lineno, SO_MAXREGION);
+            continue;
+        }
+        if (n == 0) {
+            if (log != NULL) fprintf(log, "line %d: superopt: no cheaper sequence of up to %d instructions (%lu nodes)\n", sl->v[open].lineno, s->maxlen, s->nodes);
+            continue;
+        }
+
+        char rep[SO_MAXREGION][64];
+        int ocycles = 0, owords = 0, ncycles = 0, nwords = 0;
+        for (int k=0;k<s->norig;k++) {
+            ocycles += s->orig[k].cycles;
+            owords += s->orig[k].words;
+        }
+        for (int k=0;k<n;k++) {
+            so_format(s, &s->best[k], rep[k], 64);
+            ncycles += s->best[k].cycles;
+            nwords += s->best[k].words;
+        }
+        if (log != NULL) {
+            fprintf(log, "line %d: superopt: ", sl->v[open].lineno);
+            int first = 1;
+            for (int j=open+1;j<end;j++) {
+                if (sl->v[j].kind == STMT_NONE) continue;
+                fprintf(log, "%s%s", first ? "" : "; ", sl->v[j].text);
+                first = 0;
+            }
+            fprintf(log, " ->");
+            for (int k=0;k<n;k++) fprintf(log, "%s %s", k ? ";" : "", rep[k]);
+            fprintf(log, " (cycles %+d, words %+d, %lu nodes)\n", ncycles - ocycles, nwords - owords, s->nodes);
+        }
+        if (patch == NULL && s->nregs > 1) {
+            fprintf(stderr, "Warning: line %d: $superopt replacement over %d registers is only checked on samples, not applied; review it with --superopt-patch\n", sl->v[open].lineno, s->nregs);
+            continue;
+        }
+        total++;
+
+        if (patch != NULL) {
+            int from = -1, to = -1;
+            for (int j=open+1;j<end;j++) {
+                if (sl->v[j].kind == STMT_NONE) continue;
+                if (from < 0) from = sl->v[j].lineno;
+                to = sl->v[j].lineno;
+            }
+            so_patch_hunk(patch, src, nsrc, from, to, rep, n, &delta);
+            continue;
+        }
+
+        int k = 0;
+        for (int j=open+1;j<end;j++) {
+            if (sl->v[j].kind == STMT_NONE) continue;
+            if (k < n) stmt_set_text(sl, &sl->v[j], rep[k], lctx);
+            else sl->v[j].kind = STMT_NONE;
+            k++;
+        }
+    }
+
+    if (src != NULL) {
+        for (int l=0;l<nsrc;l++) free(src[l]);
+        free(src);
+    }
+    free(s);
+    stmt_compact(sl);
+    return total;
+}
@@ -0,0 +1,13 @@
+#ifndef SUPEROPT_H
+#define SUPEROPT_H
+
+#include <stdio.h>
+#include "label.h"
+#include "stmt.h"
+
+#define SO_MAXREGION 6          // instructions in a $superopt region
+#define SUPEROPT_DEFAULT_LEN 3  // longest replacement searched by default
+
+int opt_superopt(struct stmt_list *sl, struct le_context *lctx, int maxlen, const char* srcpath, FILE* patch, FILE* log);
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+#include "trace.h"
+
+#ifdef _WIN32
+#include <windows.h>
+static CRITICAL_SECTION tr_lock;
+#define TR_LOCK() EnterCriticalSection(&tr_lock)
+#define TR_UNLOCK() LeaveCriticalSection(&tr_lock)
+#else
+#include <pthread.h>
+#include <unistd.h>
+static pthread_mutex_t tr_lock = PTHREAD_MUTEX_INITIALIZER;
+#define TR_LOCK() pthread_mutex_lock(&tr_lock)
+#define TR_UNLOCK() pthread_mutex_unlock(&tr_lock)
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+static FILE* tr_fp = NULL;
+static double tr_t0 = 0;
+static int tr_nevents = 0;
+
+static long tr_tid() {
+#ifdef _WIN32
+    return (long)GetCurrentThreadId();
+#elif defined(__linux__)
+    return (long)syscall(SYS_gettid);
+#else
+    return (long)(size_t)pthread_self();
+#endif
+}
+
+static long tr_pid() {
+#ifdef _WIN32
+    return (long)GetCurrentProcessId();
+#else
+    return (long)getpid();
+#endif
+}
+
+static void tr_write_string(const char* s) {
+    fputc('"', tr_fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', tr_fp);
+        if ((unsigned char)*s < 0x20) {
+            fprintf(tr_fp, "\\u%04x", *s);
+            continue;
+        }
+        fputc(*s, tr_fp);
+    }
+    fputc('"', tr_fp);
+}
+
+// Writes one event. Caller holds tr_lock.
+static void tr_event(const char* name, const char* cat, char ph, const char* argname, const char* argval) {
+    double ts = (st_wall_time() - tr_t0) * 1e6;
+    fprintf(tr_fp, "%s\n{\"name\":", tr_nevents ? "," : "");
+    tr_write_string(name);
+    fprintf(tr_fp, ",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%ld", cat, ph, ts, tr_pid(), tr_tid());
+    if (argname != NULL) {
+        fprintf(tr_fp, ",\"args\":{\"%s\":", argname);
+        tr_write_string(argval);
+        fputc('}', tr_fp);
+    }
+    fputc('}', tr_fp);
+    tr_nevents++;
+}
+
+int tr_open(const char* path) {
+    tr_fp = fopen(path, "w");
+    if (tr_fp == NULL) return 1;
+#ifdef _WIN32
+    InitializeCriticalSection(&tr_lock);
+#endif
+    tr_t0 = st_wall_time();
+    tr_nevents = 0;
+    fprintf(tr_fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    return 0;
+}
+
+void tr_close() {
+    if (tr_fp == NULL) return;
+    TR_LOCK();
+    fprintf(tr_fp, "\n]}\n");
+    fclose(tr_fp);
+    tr_fp = NULL;
+    TR_UNLOCK();
+}
+
+int tr_enabled() {
+    return tr_fp != NULL;
+}
+
+void tr_thread_name(const char* name) {
+    if (tr_fp == NULL) return;
+    TR_LOCK();
+    tr_event("thread_name", "__metadata", 'M', "name", name);
+    TR_UNLOCK();
+}
+
+void tr_begin(const char* name, const char* cat) {
+    if (tr_fp == NULL) return;
+    TR_LOCK();
+    tr_event(name, cat, 'B', NULL, NULL);
+    TR_UNLOCK();
+}
+
+void tr_begin_arg(const char* name, const char* cat, const char* argname, const char* argval) {
+    if (tr_fp == NULL) return;
+    TR_LOCK();
+    tr_event(name, cat, 'B', argname, argval);
+    TR_UNLOCK();
+}
+
+void tr_end(const char* name, const char* cat) {
+    if (tr_fp == NULL) return;
+    TR_LOCK();
+    tr_event(name, cat, 'E', NULL, NULL);
+    TR_UNLOCK();
+}
@@ -0,0 +1,21 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Chrome/Perfetto trace-event export (chrome://tracing, ui.perfetto.dev).
+// Events are Begin/End pairs, so they must nest properly per thread.
+// Every call is a no-op unless tr_open() succeeded.
+
+#define TR_CAT_FILE "file"
+#define TR_CAT_PASS "pass"
+#define TR_CAT_IO "io"
+#define TR_CAT_WRITER "writer"
+
+int tr_open(const char* path);
+void tr_close();
+int tr_enabled();
+void tr_thread_name(const char* name);
+void tr_begin(const char* name, const char* cat);
+void tr_begin_arg(const char* name, const char* cat, const char* argname, const char* argval);
+void tr_end(const char* name, const char* cat);
+
+#endif
@@ -0,0 +1,701 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "m4asm.h"
+#include "label.h"
+#include "stmt.h"
+#include "cost.h"
+#include "wcet.h"
+#include "insns.h"
+
+// Cycle bounds over the control-flow graph of the laid-out program. Every
+// instruction (and $align padding) is a node; jmp, brchf/brchi and falling
+// through give the edges, call adds the callee's bound to the call, and
+// ret or the end of a segment leaves the routine. Natural loops are found
+// from the DFS back edges and collapsed innermost first: with a bound of
+// min..max runs of the head, a loop costs (max-1) iterations plus its
+// longest way out (best case: min-1 and the shortest). What is left is
+// acyclic and is solved for the longest and shortest path to an exit.
+
+#define WCET_NONE (-1L)
+
+#define WCET_ENTRY 1
+#define WCET_CALLED 2
+#define WCET_INTERRUPT 4
+
+struct wcet_node {          // per routine, possibly a collapsed loop
+    int stmt;
+    int *succ;              // local ids, resolved through rep
+    int nsucc;
+    int capsucc;
+    int *pred;
+    int npred;
+    int cappred;
+    int exits;
+    long worst;
+    long best;
+    int rep;
+    // scratch for the path and DFS walks
+    int mark;
+    int color;
+    long bw, bb, ew, eb;
+};
+
+struct wcet_entry {
+    int stmt;
+    int kind;
+    char name[33];
+    long budget;            // -1 if no $assert_cycles
+    int budget_line;
+};
+
+struct wcet_ctx {
+    struct stmt_list *sl;
+    struct le_context *lctx;
+    int *succ;              // 2 per statement, -1 if unused
+    int *exits;
+    int *call;              // callee statement, -1 if none
+    int *bad;               // branch target is not an instruction
+    long *cycles;
+    int *bound_min;         // per head statement, 0 if none
+    int *bound_max;
+    int *lid;               // statement -> local id, -1 outside the routine
+    int *state;             // 0 not analysed, 1 in progress, 2 done
+    long *worst;
+    long *best;
+    char **why;             // reason a routine is unbounded
+    int *addrs;             // executable statements sorted by address
+    int naddrs;
+    struct wcet_entry *entries;
+    int nentries;
+    int stamp;
+};
+
+static int wcet_node_kind(struct stmt_t *st) {
+    return st->kind == STMT_INSN || st->kind == STMT_ALIGN;
+}
+
+static int wcet_is(struct stmt_t *st, const char* mnemonic) {
+    char m[16];
+    if (st->kind != STMT_INSN || st->special) return 0;
+    stmt_mnemonic(st, m);
+    return strcmp(m, mnemonic) == 0;
+}
+
+static struct wcet_ctx *wcet_sort_ctx;
+
+static int wcet_addr_cmp(const void* a, const void* b) {
+    uint32_t x = wcet_sort_ctx->sl->v[*(const int*)a].addr;
+    uint32_t y = wcet_sort_ctx->sl->v[*(const int*)b].addr;
+    if (x != y) return x < y ? -1 : 1;
+    return *(const int*)a - *(const int*)b;
+}
+
+static int wcet_at(struct wcet_ctx *wc, uint32_t addr) {
+    int lo = 0, hi = wc->naddrs - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        uint32_t a = wc->sl->v[wc->addrs[mid]].addr;
+        if (a == addr) {
+            // The first statement there; an empty $align in front of an
+            // instruction just falls through to it.
+            while (mid > 0 && wc->sl->v[wc->addrs[mid-1]].addr == addr) mid--;
+            return wc->addrs[mid];
+        }
+        if (a < addr) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+// Next statement executed after i by falling through, -1 at the end of the
+// segment.
+static int wcet_next(struct stmt_list *sl, int i) {
+    for (int j=i+1;j<sl->n;j++) {
+        if (sl->v[j].kind == STMT_ORG || sl->v[j].kind == STMT_FILL) return -1;
+        if (wcet_node_kind(&sl->v[j])) return j;
+    }
+    return -1;
+}
+
+// Statement a branch or call at i transfers to, -1 (and bad[i] set) if
+// the target is not the start of an instruction.
+static int wcet_target(struct wcet_ctx *wc, int i) {
+    struct stmt_t *st = &wc->sl->v[i];
+    struct parsed_insn_t pi;
+    parse_insn(st->text, wc->lctx, &pi);
+    uint32_t target = pi.pvs[0].value;
+    if (pi.ptypes[0] == PTYPE_RELATIVE_POS) target = st->addr + (pi.pvs[0].value + 2) * 2;
+    if (pi.ptypes[0] == PTYPE_RELATIVE_NEG) target = st->addr - (pi.pvs[0].value - 2) * 2;
+    int t = wcet_at(wc, target);
+    if (t < 0) wc->bad[i] = 1;
+    return t;
+}
+
+// First executable statement after the label named name.
+static int wcet_label(struct wcet_ctx *wc, const char* name, int lineno) {
+    struct stmt_list *sl = wc->sl;
+    for (int i=0;i<sl->n;i++) {
+        if (sl->v[i].kind != STMT_LABEL) continue;
+        if (strlen(sl->v[i].text) - 1 != strlen(name) || strncmp(sl->v[i].text, name, strlen(name)) != 0) continue;
+        for (int j=i+1;j<sl->n;j++) {
+            if (sl->v[j].kind == STMT_ORG || sl->v[j].kind == STMT_FILL) break;
+            if (wcet_node_kind(&sl->v[j])) return j;
+        }
+        fprintf(stderr, "Error: line %d: label %s has no code after it\n", lineno, name);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "Error: line %d: label %s not found\n", lineno, name);
+    exit(EXIT_FAILURE);
+}
+
+static struct wcet_entry *wcet_add_entry(struct wcet_ctx *wc, int stmt, const char* name) {
+    for (int e=0;e<wc->nentries;e++) {
+        if (wc->entries[e].stmt == stmt) return &wc->entries[e];
+    }
+    struct wcet_entry *en = &wc->entries[wc->nentries++];
+    memset(en, 0, sizeof(*en));
+    en->stmt = stmt;
+    en->budget = -1;
+    strncpy(en->name, name, 32);
+    return en;
+}
+
+// Splits an annotation into its directive and operands; more than 4
+// fields give 5.
+static int wcet_split(char* text, char** f) {
+    int n = 0;
+    char* s = text;
+    char* tok;
+    while ((tok = strsep(&s, ", "))) {
+        if (tok[0] == 0) continue;
+        if (n == 4) return 5;
+        f[n++] = tok;
+    }
+    return n;
+}
+
+static void wcet_annotations(struct wcet_ctx *wc) {
+    struct stmt_list *sl = wc->sl;
+    for (int i=0;i<sl->n;i++) {
+        struct stmt_t *st = &sl->v[i];
+        if (st->kind != STMT_ANNOT) continue;
+        char* dup = strdup(st->text);
+        char* f[4];
+        int n = wcet_split(dup, f);
+        STRTOLOWER(f[0]);
+        struct parsed_int_t a = n > 2 ? getintval(f[2]) : (struct parsed_int_t){1, 0, 0};
+        struct parsed_int_t b = n > 3 ? getintval(f[3]) : (struct parsed_int_t){0, 0, 0};
+
+        if (strcmp(f[0], "$loop_bound") == 0) {
+            unsigned long lo = n == 4 ? a.value : 1;
+            unsigned long hi = n == 4 ? b.value : a.value;
+            if ((n != 3 && n != 4) || a.code != 0 || b.code != 0 || lo < 1 || lo > hi || hi > 0x7FFFFFFF) {
+                fprintf(stderr, "Error: line %d: expected $loop_bound label, [min,] max with 1 <= min <= max: %s\n", st->lineno, st->text);
+                exit(EXIT_FAILURE);
+            }
+            int h = wcet_label(wc, f[1], st->lineno);
+            wc->bound_min[h] = (int)lo;
+            wc->bound_max[h] = (int)hi;
+        } else if (strcmp(f[0], "$interrupt") == 0) {
+            if (n != 2) {
+                fprintf(stderr, "Error: line %d: expected $interrupt label: %s\n", st->lineno, st->text);
+                exit(EXIT_FAILURE);
+            }
+            wcet_add_entry(wc, wcet_label(wc, f[1], st->lineno), f[1])->kind |= WCET_INTERRUPT;
+        } else {
+            if (n != 3 || a.code != 0) {
+                fprintf(stderr, "Error: line %d: expected $assert_cycles label, cycles: %s\n", st->lineno, st->text);
+                exit(EXIT_FAILURE);
+            }
+            struct wcet_entry *en = wcet_add_entry(wc, wcet_label(wc, f[1], st->lineno), f[1]);
+            en->budget = a.value;
+            en->budget_line = st->lineno;
+        }
+        free(dup);
+    }
+}
+
+static void wcet_edge(int **v, int *n, int *cap, int x) {
+    for (int k=0;k<*n;k++) {
+        if ((*v)[k] == x) return;
+    }
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 4;
+        *v = (int*)realloc(*v, sizeof(int) * *cap);
+    }
+    (*v)[(*n)++] = x;
+}
+
+static int wcet_find(struct wcet_node *nd, int x) {
+    while (nd[x].rep != x) x = nd[x].rep;
+    return x;
+}
+
+static int wcet_routine(struct wcet_ctx *wc, int entry);
+
+// Topological walk of the nodes marked with stamp, from head, and longest
+// and shortest paths to the head's back edges (bw/bb) and out of the set
+// (ew/eb). Edges to head are back edges; head < 0 means there are none.
+// Returns 0 if the marked nodes are not acyclic apart from those edges.
+static int wcet_paths(struct wcet_ctx *wc, struct wcet_node *nd, int nn, int start, int head) {
+    int *stack = (int*)malloc(sizeof(int) * (nn + 1));
+    int *pos = (int*)calloc(nn + 1, sizeof(int));
+    int sp = 0;
+    for (int x=0;x<nn;x++) nd[x].color = 0;
+    stack[sp++] = start;
+    nd[start].color = 1;
+    while (sp > 0) {
+        int x = stack[sp-1];
+        if (pos[x] < nd[x].nsucc) {
+            int y = wcet_find(nd, nd[x].succ[pos[x]++]);
+            if (y == head || nd[y].mark != wc->stamp) continue;
+            if (nd[y].color == 1) {
+                free(stack);
+                free(pos);
+                return 0;
+            }
+            if (nd[y].color == 0) {
+                nd[y].color = 1;
+                stack[sp++] = y;
+            }
+            continue;
+        }
+
+        // All successors are done: x in postorder.
+        long bw = WCET_NONE, bb = WCET_NONE, ew = WCET_NONE, eb = WCET_NONE;
+        if (nd[x].exits) ew = eb = 0;
+        for (int k=0;k<nd[x].nsucc;k++) {
+            int y = wcet_find(nd, nd[x].succ[k]);
+            long cbw = WCET_NONE, cbb = WCET_NONE, cew = WCET_NONE, ceb = WCET_NONE;
+            if (y == head) {
+                cbw = cbb = 0;
+            } else if (nd[y].mark != wc->stamp) {
+                cew = ceb = 0;
+            } else {
+                cbw = nd[y].bw;
+                cbb = nd[y].bb;
+                cew = nd[y].ew;
+                ceb = nd[y].eb;
+            }
+            if (cbw != WCET_NONE && (bw == WCET_NONE || cbw > bw)) bw = cbw;
+            if (cbb != WCET_NONE && (bb == WCET_NONE || cbb < bb)) bb = cbb;
+            if (cew != WCET_NONE && (ew == WCET_NONE || cew > ew)) ew = cew;
+            if (ceb != WCET_NONE && (eb == WCET_NONE || ceb < eb)) eb = ceb;
+        }
+        nd[x].bw = bw == WCET_NONE ? WCET_NONE : bw + nd[x].worst;
+        nd[x].bb = bb == WCET_NONE ? WCET_NONE : bb + nd[x].best;
+        nd[x].ew = ew == WCET_NONE ? WCET_NONE : ew + nd[x].worst;
+        nd[x].eb = eb == WCET_NONE ? WCET_NONE : eb + nd[x].best;
+        nd[x].color = 2;
+        sp--;
+    }
+    free(stack);
+    free(pos);
+    return 1;
+}
+
+static int wcet_fail(struct wcet_ctx *wc, int entry, const char* why) {
+    wc->why[entry] = strdup(why);
+    return 0;
+}
+
+// Analyses the routine starting at statement entry. Returns 1 and sets
+// worst/best, or 0 with a reason in why.
+static int wcet_solve(struct wcet_ctx *wc, int entry) {
+    struct stmt_list *sl = wc->sl;
+    char why[128];
+
+    // Nodes reachable without entering calls.
+    int nn = 0, cap = 64;
+    struct wcet_node *nd = (struct wcet_node*)malloc(sizeof(struct wcet_node) * cap);
+    int ok = 1;
+    wc->lid[entry] = nn;
+    memset(&nd[nn], 0, sizeof(struct wcet_node));
+    nd[nn].stmt = entry;
+    nn++;
+    for (int q=0;q<nn;q++) {
+        int i = nd[q].stmt;
+        nd[q].rep = q;
+        nd[q].exits = wc->exits[i];
+        nd[q].worst = nd[q].best = wc->cycles[i];
+        for (int k=0;k<2;k++) {
+            int j = wc->succ[2*i + k];
+            if (j < 0) continue;
+            if (wc->lid[j] < 0) {
+                if (nn == cap) {
+                    cap *= 2;
+                    nd = (struct wcet_node*)realloc(nd, sizeof(struct wcet_node) * cap);
+                }
+                wc->lid[j] = nn;
+                memset(&nd[nn], 0, sizeof(struct wcet_node));
+                nd[nn].stmt = j;
+                nn++;
+            }
+            wcet_edge(&nd[q].succ, &nd[q].nsucc, &nd[q].capsucc, wc->lid[j]);
+            wcet_edge(&nd[wc->lid[j]].pred, &nd[wc->lid[j]].npred, &nd[wc->lid[j]].cappred, q);
+        }
+    }
+
+    for (int x=0;x<nn;x++) wc->lid[nd[x].stmt] = -1;
+    for (int x=0;x<nn && ok;x++) {
+        if (!wc->bad[nd[x].stmt]) continue;
+        snprintf(why, sizeof(why), "line %d: %s: target is not an instruction", sl->v[nd[x].stmt].lineno, sl->v[nd[x].stmt].text);
+        ok = wcet_fail(wc, entry, why);
+    }
+
+    // Callees, now that lid[] is free for them.
+    for (int x=0;x<nn && ok;x++) {
+        int c = wc->call[nd[x].stmt];
+        if (c < 0) continue;
+        if (!wcet_routine(wc, c)) {
+            snprintf(why, sizeof(why), "line %d: %s: %s", sl->v[nd[x].stmt].lineno, sl->v[nd[x].stmt].text,
+                wc->state[c] == 1 ? "recursive call" : "callee is unbounded");
+            ok = wcet_fail(wc, entry, why);
+            break;
+        }
+        nd[x].worst += wc->worst[c];
+        nd[x].best += wc->best[c];
+    }
+
+    // Back edges from an iterative DFS.
+    int *bsrc = (int*)malloc(sizeof(int) * (2 * nn + 1));
+    int *bdst = (int*)malloc(sizeof(int) * (2 * nn + 1));
+    int nback = 0;
+    if (ok) {
+        int *stack = (int*)malloc(sizeof(int) * (nn + 1));
+        int *pos = (int*)calloc(nn + 1, sizeof(int));
+        int sp = 0;
+        stack[sp++] = 0;
+        nd[0].color = 1;
+        while (sp > 0) {
+            int x = stack[sp-1];
+            if (pos[x] < nd[x].nsucc) {
+                int y = nd[x].succ[pos[x]++];
+                if (nd[y].color == 1) {
+                    bsrc[nback] = x;
+                    bdst[nback++] = y;
+                } else if (nd[y].color == 0) {
+                    nd[y].color = 1;
+                    stack[sp++] = y;
+                }
+                continue;
+            }
+            nd[x].color = 2;
+            sp--;
+        }
+        free(stack);
+        free(pos);
+    }
+
+    // Natural loops: the head plus everything that reaches one of its back
+    // edges without passing it. Flow entering a body anywhere but the head
+    // is irreducible and has no bound here.
+    int *heads = (int*)malloc(sizeof(int) * (nn + 1));
+    int **body = (int**)calloc(nn + 1, sizeof(int*));
+    int *nbody = (int*)calloc(nn + 1, sizeof(int));
+    int nheads = 0;
+    for (int b=0;b<nback && ok;b++) {
+        int h = bdst[b];
+        int seen = 0;
+        for (int l=0;l<nheads;l++) seen |= heads[l] == h;
+        if (seen) continue;
+        int l = nheads++;
+        heads[l] = h;
+        body[l] = (int*)malloc(sizeof(int) * (nn + 1));
+        wc->stamp++;
+        nd[h].mark = wc->stamp;
+        body[l][nbody[l]++] = h;
+        for (int c=b;c<nback;c++) {
+            if (bdst[c] != h || nd[bsrc[c]].mark == wc->stamp) continue;
+            nd[bsrc[c]].mark = wc->stamp;
+            body[l][nbody[l]++] = bsrc[c];
+        }
+        for (int q=1;q<nbody[l];q++) {
+            int x = body[l][q];
+            for (int k=0;k<nd[x].npred;k++) {
+                int p = nd[x].pred[k];
+                if (nd[p].mark == wc->stamp) continue;
+                nd[p].mark = wc->stamp;
+                body[l][nbody[l]++] = p;
+            }
+        }
+        // In reducible flow the head reaches the whole body; whatever it
+        // does not reach was pulled in through a second entry.
+        int in = wc->stamp++;
+        int *queue = (int*)malloc(sizeof(int) * (nbody[l] + 1));
+        int nq = 0;
+        queue[nq++] = h;
+        nd[h].mark = wc->stamp;
+        for (int q=0;q<nq;q++) {
+            int x = queue[q];
+            for (int k=0;k<nd[x].nsucc;k++) {
+                int y = nd[x].succ[k];
+                if (nd[y].mark != in) continue;
+                nd[y].mark = wc->stamp;
+                queue[nq++] = y;
+            }
+        }
+        free(queue);
+        if (nq != nbody[l]) {
+            snprintf(why, sizeof(why), "line %d: loop entered other than through its head", sl->v[nd[h].stmt].lineno);
+            ok = wcet_fail(wc, entry, why);
+        }
+    }
+
+    // Innermost first: a nested body is strictly smaller.
+    for (int a=1;a<nheads;a++) {
+        for (int b=a;b>0 && nbody[b] < nbody[b-1];b--) {
+            int t = heads[b]; heads[b] = heads[b-1]; heads[b-1] = t;
+            int *tb = body[b]; body[b] = body[b-1]; body[b-1] = tb;
+            t = nbody[b]; nbody[b] = nbody[b-1]; nbody[b-1] = t;
+        }
+    }
+
+    for (int l=0;l<nheads && ok;l++) {
+        int h = heads[l];
+        int hs = nd[h].stmt;
+        if (wc->bound_max[hs] == 0) {
+            const char* name = NULL;
+            for (int j=hs-1;j>=0 && !wcet_node_kind(&sl->v[j]) && name == NULL;j--) {
+                if (sl->v[j].kind == STMT_LABEL) name = sl->v[j].text;
+            }
+            if (name != NULL) snprintf(why, sizeof(why), "line %d: loop at %.*s has no $loop_bound", sl->v[hs].lineno, (int)strlen(name) - 1, name);
+            else snprintf(why, sizeof(why), "line %d: loop has no $loop_bound", sl->v[hs].lineno);
+            ok = wcet_fail(wc, entry, why);
+            break;
+        }
+
+        // The body as it is now, with inner loops already collapsed.
+        wc->stamp++;
+        for (int q=0;q<nbody[l];q++) nd[wcet_find(nd, body[l][q])].mark = wc->stamp;
+        if (!wcet_paths(wc, nd, nn, h, h)) {
+            snprintf(why, sizeof(why), "line %d: loop entered other than through its head", sl->v[hs].lineno);
+            ok = wcet_fail(wc, entry, why);
+            break;
+        }
+        long max = wc->bound_max[hs], min = wc->bound_min[hs];
+        long worst = (max - 1) * nd[h].bw;
+        long best = (min - 1) * nd[h].bb;
+        if (nd[h].ew != WCET_NONE) {
+            worst += nd[h].ew;
+            best += nd[h].eb;
+        } else {
+            // Never left: the bound covers every run of the head.
+            worst += nd[h].bw;
+            best += nd[h].bb;
+        }
+
+        // Collapse into the head: it takes the body's exits.
+        int *succ = NULL, nsucc = 0, capsucc = 0;
+        int exits = 0;
+        for (int q=0;q<nbody[l];q++) {
+            int x = wcet_find(nd, body[l][q]);
+            exits |= nd[x].exits;
+            for (int k=0;k<nd[x].nsucc;k++) {
+                int y = wcet_find(nd, nd[x].succ[k]);
+                if (nd[y].mark != wc->stamp) wcet_edge(&succ, &nsucc, &capsucc, y);
+            }
+        }
+        for (int q=0;q<nbody[l];q++) {
+            int x = wcet_find(nd, body[l][q]);
+            if (x != h) nd[x].rep = h;
+        }
+        free(nd[h].succ);
+        nd[h].succ = succ;
+        nd[h].nsucc = nsucc;
+        nd[h].capsucc = capsucc;
+        nd[h].exits = exits && nd[h].ew != WCET_NONE;
+        nd[h].worst = worst;
+        nd[h].best = best;
+    }
+
+    // What is left is acyclic.
+    if (ok) {
+        int e = wcet_find(nd, 0);
+        wc->stamp++;
+        for (int x=0;x<nn;x++) nd[x].mark = wc->stamp;
+        if (!wcet_paths(wc, nd, nn, e, -1)) {
+            ok = wcet_fail(wc, entry, "irreducible control flow");
+        } else if (nd[e].ew == WCET_NONE) {
+            ok = wcet_fail(wc, entry, "never returns");
+        } else {
+            wc->worst[entry] = nd[e].ew;
+            wc->best[entry] = nd[e].eb;
+        }
+    }
+
+    for (int l=0;l<nheads;l++) free(body[l]);
+    free(body);
+    free(nbody);
+    free(heads);
+    free(bsrc);
+    free(bdst);
+    for (int x=0;x<nn;x++) {
+        free(nd[x].succ);
+        free(nd[x].pred);
+    }
+    free(nd);
+    return ok;
+}
+
+static int wcet_routine(struct wcet_ctx *wc, int entry) {
+    if (wc->state[entry] == 2) return wc->why[entry] == NULL;
+    if (wc->state[entry] == 1) return 0;
+    wc->state[entry] = 1;
+    int ok = wcet_solve(wc, entry);
+    wc->state[entry] = 2;
+    return ok;
+}
+
+int wcet_needed(struct stmt_list *sl) {
+    for (int i=0;i<sl->n;i++) {
+        if (sl->v[i].kind != STMT_ANNOT) continue;
+        if (strncmp(sl->v[i].text, "$assert_cycles", 14) == 0 || strncmp(sl->v[i].text, "$ASSERT_CYCLES", 14) == 0) return 1;
+    }
+    return 0;
+}
+
+static const char* wcet_kind(int kind) {
+    if (kind & WCET_INTERRUPT) return "interrupt";
+    if (kind & WCET_ENTRY) return "entry";
+    if (kind & WCET_CALLED) return "routine";
+    return "label";
+}
+
+static int wcet_entry_cmp(const void* a, const void* b) {
+    return ((const struct wcet_entry*)a)->stmt - ((const struct wcet_entry*)b)->stmt;
+}
+
+int wcet_analyze(struct stmt_list *sl, struct le_context *lctx, FILE* fp) {
+    struct wcet_ctx wc;
+    memset(&wc, 0, sizeof(wc));
+    wc.sl = sl;
+    wc.lctx = lctx;
+    int n = sl->n;
+    wc.succ = (int*)malloc(sizeof(int) * (2 * n + 1));
+    wc.exits = (int*)calloc(n + 1, sizeof(int));
+    wc.call = (int*)malloc(sizeof(int) * (n + 1));
+    wc.bad = (int*)calloc(n + 1, sizeof(int));
+    wc.cycles = (long*)calloc(n + 1, sizeof(long));
+    wc.bound_min = (int*)calloc(n + 1, sizeof(int));
+    wc.bound_max = (int*)calloc(n + 1, sizeof(int));
+    wc.lid = (int*)malloc(sizeof(int) * (n + 1));
+    wc.state = (int*)calloc(n + 1, sizeof(int));
+    wc.worst = (long*)calloc(n + 1, sizeof(long));
+    wc.best = (long*)calloc(n + 1, sizeof(long));
+    wc.why = (char**)calloc(n + 1, sizeof(char*));
+    wc.addrs = (int*)malloc(sizeof(int) * (n + 1));
+    wc.entries = (struct wcet_entry*)malloc(sizeof(struct wcet_entry) * (n + 1));
+
+    char nop[] = "nop", none[] = "";
+    int nopcycles = cost_cycles(find_insn(nop, none));
+    for (int i=0;i<n;i++) {
+        wc.lid[i] = wc.call[i] = -1;
+        wc.succ[2*i] = wc.succ[2*i+1] = -1;
+        if (wcet_node_kind(&sl->v[i])) wc.addrs[wc.naddrs++] = i;
+    }
+    wcet_sort_ctx = &wc;
+    qsort(wc.addrs, wc.naddrs, sizeof(int), wcet_addr_cmp);
+
+    // Per-statement edges and costs.
+    for (int i=0;i<n;i++) {
+        struct stmt_t *st = &sl->v[i];
+        if (!wcet_node_kind(st)) continue;
+        int next = wcet_next(sl, i);
+        if (st->kind == STMT_ALIGN) {
+            wc.cycles[i] = (long)st->length * nopcycles;
+        } else if (st->special) {
+            wc.cycles[i] = st->length;
+        } else {
+            wc.cycles[i] = cost_cycles(st->cand[st->rank]);
+        }
+
+        if (wcet_is(st, "ret")) {
+            wc.exits[i] = 1;
+            continue;
+        }
+        if (wcet_is(st, "jmp")) {
+            wc.succ[2*i] = wcet_target(&wc, i);
+            continue;
+        }
+        if (wcet_is(st, "brchf") || wcet_is(st, "brchi")) wc.succ[2*i+1] = wcet_target(&wc, i);
+        if (wcet_is(st, "call")) wc.call[i] = wcet_target(&wc, i);
+        wc.succ[2*i] = next;
+        if (next < 0) wc.exits[i] = 1;
+    }
+
+    // Entry points: the start of the program, call targets, annotations.
+    for (int i=0;i<n;i++) {
+        if (!wcet_node_kind(&sl->v[i])) continue;
+        const char* name = "(entry)";
+        char buf[33];
+        for (int j=i-1;j>=0 && sl->v[j].kind != STMT_ORG;j--) {
+            if (sl->v[j].kind != STMT_LABEL) continue;
+            strncpy(buf, sl->v[j].text, 32);
+            buf[32] = 0;
+            buf[strlen(buf)-1] = 0;
+            name = buf;
+            break;
+        }
+        wcet_add_entry(&wc, i, name)->kind |= WCET_ENTRY;
+        break;
+    }
+    for (int i=0;i<n;i++) {
+        if (wc.call[i] < 0) continue;
+        char name[33];
+        const char* op = strchr(sl->v[i].text, ' ');
+        op = op == NULL ? "" : op + strspn(op, " @");
+        int len = strcspn(op, ", ");
+        snprintf(name, sizeof(name), "%.*s", len > 32 ? 32 : len, op);
+        wcet_add_entry(&wc, wc.call[i], name)->kind |= WCET_CALLED;
+    }
+    wcet_annotations(&wc);
+    qsort(wc.entries, wc.nentries, sizeof(struct wcet_entry), wcet_entry_cmp);
+
+    for (int e=0;e<wc.nentries;e++) wcet_routine(&wc, wc.entries[e].stmt);
+
+    if (fp != NULL) {
+        fprintf(fp, "%-24s %-10s %12s %12s %10s\n", "routine", "kind", "best", "worst", "budget");
+        for (int e=0;e<wc.nentries;e++) {
+            struct wcet_entry *en = &wc.entries[e];
+            char budget[24] = "-";
+            if (en->budget >= 0) snprintf(budget, sizeof(budget), "%ld", en->budget);
+            if (wc.why[en->stmt] != NULL) {
+                fprintf(fp, "%-24s %-10s %12s %12s %10s  %s\n", en->name, wcet_kind(en->kind), "-", "unbounded", budget, wc.why[en->stmt]);
+            } else {
+                fprintf(fp, "%-24s %-10s %12ld %12ld %10s\n", en->name, wcet_kind(en->kind), wc.best[en->stmt], wc.worst[en->stmt], budget);
+            }
+        }
+    }
+
+    int fails = 0;
+    for (int e=0;e<wc.nentries;e++) {
+        struct wcet_entry *en = &wc.entries[e];
+        if (en->budget < 0) continue;
+        if (wc.why[en->stmt] != NULL) {
+            fprintf(stderr, "Error: line %d: $assert_cycles %s: worst case cannot be bounded (%s)\n", en->budget_line, en->name, wc.why[en->stmt]);
+            fails++;
+        } else if (wc.worst[en->stmt] > en->budget) {
+            fprintf(stderr, "Error: line %d: $assert_cycles %s, %ld: worst case is %ld cycles\n", en->budget_line, en->name, en->budget, wc.worst[en->stmt]);
+            fails++;
+        }
+    }
+
+    for (int i=0;i<n;i++) free(wc.why[i]);
+    free(wc.why);
+    free(wc.succ);
+    free(wc.exits);
+    free(wc.call);
+    free(wc.bad);
+    free(wc.cycles);
+    free(wc.bound_min);
+    free(wc.bound_max);
+    free(wc.lid);
+    free(wc.state);
+    free(wc.worst);
+    free(wc.best);
+    free(wc.addrs);
+    free(wc.entries);
+    return fails;
+}
@@ -0,0 +1,20 @@
+#ifndef WCET_H
+#define WCET_H
+
+#include <stdio.h>
+#include "label.h"
+#include "stmt.h"
+
+// Static best/worst-case cycle bounds per routine, from the final layout.
+// Loops need a bound:
+//   $loop_bound label, max           label heads a loop run at most max times
+//   $loop_bound label, min, max
+//   $interrupt label                 report label as an interrupt entry
+//   $assert_cycles label, N          fail if label can take more than N cycles
+
+int wcet_needed(struct stmt_list *sl);
+// Writes the report to fp (may be NULL) and returns the number of failed
+// $assert_cycles budgets.
+int wcet_analyze(struct stmt_list *sl, struct le_context *lctx, FILE* fp);
+
+#endif
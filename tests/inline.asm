@@ -0,0 +1,26 @@
+; Small leaf routines --inline copies into their callers.
+; options --inline
+; expect r1 = 6
+; expect r2 = 3
+; expect depth = 0
+; expect stop = sint
+start:
+ssp d0x10000
+mov r1, 0
+mov r2, 0
+mov r5, 3
+loop:
+call step
+call count
+dec r5
+brchf finish, 1
+jmp loop
+finish:
+sint
+step:
+inc r1
+inc r1
+ret
+count:
+inc r2
+ret
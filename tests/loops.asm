@@ -0,0 +1,27 @@
+; Nested loop with calls: sums 1..10 into r2 and counts the inner
+; iterations in r3.
+; expect r2 = 55
+; expect r3 = 30
+; expect stop = sint
+start:
+ssp d0x10000
+mov r1, 10
+mov r2, 0
+mov r3, 0
+outer:
+add r2, r1
+call inner
+dec r1
+brchf finish, 1
+jmp outer
+finish:
+sint
+inner:
+mov r4, 3
+again:
+inc r3
+dec r4
+brchf back, 1
+jmp again
+back:
+ret
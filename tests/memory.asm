@@ -0,0 +1,13 @@
+; Loads and stores through far and near labels and a register pair.
+; expect r1 = 0x1234
+; expect r2 = 0x1235
+; expect [0x2000] = 0x1235
+; expect stop = sint
+start:
+mov r1, [val]
+mov r2, r1
+inc r2
+mov [0x2000], r2
+sint
+val:
+dw 0x1234
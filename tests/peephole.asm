@@ -0,0 +1,32 @@
+; Code the -O rules rewrite: jmp to the next line, push/pop of the same
+; register, add/sub of 1, a call followed by ret and dead stores.
+; options -O
+; expect r1 = 11
+; expect r2 = 4
+; expect r3 = 2
+; expect r4 = 2
+; expect stop = sint
+start:
+ssp d0x10000
+mov r1, 10
+add r1, 1
+jmp next
+next:
+push r1
+pop r1
+mov r2, 5
+sub r2, 1
+mov r3, 99
+mov r4, 1
+mov r4, 2
+call twice
+sint
+twice:
+mov r3, 1
+jmp bump
+bump:
+call one
+ret
+one:
+inc r3
+ret
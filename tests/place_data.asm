@@ -0,0 +1,22 @@
+; Data behind padding up to 0x10000; --place-data moves it into the near
+; window in front of the padding.
+; options --place-data
+; expect r1 = 0x0102
+; expect r2 = 0x0304
+; expect r3 = 0x0406
+; expect stop = sint
+start:
+jmp main
+main:
+mov r1, [first]
+mov r2, [second]
+mov r3, r1
+add r3, r2
+jmp finish
+$align 0x10000
+finish:
+sint
+first:
+dw 0x0102
+second:
+dw 0x0304
@@ -0,0 +1,39 @@
+; Pseudo-instructions against hand-computed results.
+; expect r1 = 0
+; expect r2 = 0xFFFB
+; expect r3 = 9
+; expect r4 = 7
+; expect r5 = 210
+; expect r7 = 0x20
+; expect r8 = 0x0002
+; expect r9 = 0x0001
+; expect r10 = 0x0000
+; expect r11 = 0xFFFF
+; expect stop = sint
+start:
+mov r1, 0x55
+clr r1
+mov r2, 5
+neg r2
+mov r3, 7
+mov r4, 9
+swap r3, r4
+mov r5, 21
+mul r5, 10, r6
+mov r7, 0x100
+div r7, 8
+; r8:r9 = 0x0001:0xFFFF + 0x0000:0x0002 = 0x0002:0x0001
+mov r8, 1
+mov r9, 0xFFFF
+mov r10, 0
+mov r11, 2
+add32 r8:r9, r10:r11
+; r10:r11 = 0x0000:0x0002 - 0x0000:0x0003 = 0xFFFF:0xFFFF, then + 1:0
+mov r11, 3
+mov r12, 0
+mov r13, 2
+sub32 r12:r13, r10:r11
+mov r10, r12
+mov r11, r13
+inc r10
+sint
@@ -0,0 +1,37 @@
+# m4dis round trip: every source assembled, disassembled with its listing
+# and reassembled with --no-relax must give the same image.
+#   cmake -DM4ASM=... -DM4DIS=... -DWORK=dir -DSOURCES="a.asm;b.asm" -P roundtrip.cmake
+
+file(MAKE_DIRECTORY ${WORK})
+set(failed 0)
+foreach(src ${SOURCES})
+  get_filename_component(name ${src} NAME_WE)
+  set(base ${WORK}/${name})
+  execute_process(COMMAND ${M4ASM} -i ${src} -o ${base}.bin -l ${base}.lst
+    RESULT_VARIABLE rc OUTPUT_QUIET)
+  if(NOT rc EQUAL 0)
+    message(SEND_ERROR "${name}: m4asm failed")
+    set(failed 1)
+    continue()
+  endif()
+  execute_process(COMMAND ${M4DIS} -l ${base}.lst -o ${base}.dis.asm ${base}.bin
+    RESULT_VARIABLE rc)
+  if(NOT rc EQUAL 0)
+    message(SEND_ERROR "${name}: m4dis failed")
+    set(failed 1)
+    continue()
+  endif()
+  execute_process(COMMAND ${M4ASM} --no-relax -i ${base}.dis.asm -o ${base}.re.bin
+    RESULT_VARIABLE rc OUTPUT_QUIET)
+  if(rc EQUAL 0)
+    execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${base}.bin ${base}.re.bin
+      RESULT_VARIABLE rc)
+  endif()
+  if(NOT rc EQUAL 0)
+    message(SEND_ERROR "${name}: ${base}.dis.asm does not reassemble to ${base}.bin")
+    set(failed 1)
+  endif()
+endforeach()
+if(failed)
+  message(FATAL_ERROR "m4dis round trip failed")
+endif()